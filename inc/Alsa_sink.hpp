@@ -0,0 +1,42 @@
+#pragma once
+
+#include <alsa/asoundlib.h>
+#include <string>
+
+#include "Audio_sink.hpp"
+
+// An ALSA PCM device, opened non-blocking. open() takes the first sample format of
+// preferred_formats() the device accepts, asks for the stream's rate and channels,
+// and settles for stereo when the device has fewer channels than the stream and
+// the stream can be mixed down. The buffer holds a second in PERIODS periods.
+class Alsa_sink : public Audio_sink
+{
+private:
+    std::string m_device;
+    snd_pcm_t *m_handle = nullptr;
+    bool m_draining = false;
+
+    // closes the device and throws when error is negative
+    void check(int error, const std::string &message);
+
+public:
+    explicit Alsa_sink(std::string device) : m_device(std::move(device)) {}
+    ~Alsa_sink() override { close(); }
+
+    Alsa_sink(const Alsa_sink &) = delete;
+    Alsa_sink &operator=(const Alsa_sink &) = delete;
+
+    Sink_format open(const Pcm_format &format) override;
+    void close() override;
+    bool is_open() const override { return m_handle != nullptr; }
+    std::string name() const override { return "alsa " + m_device; }
+
+    Sink_write write(const char *data, size_t frames) override;
+    std::vector<pollfd> poll_descriptors() override;
+    bool writable(const pollfd *fds, size_t count) override;
+    long available() override;
+
+    void pause(bool paused) override;
+    void drop() override;
+    bool drain() override;
+};
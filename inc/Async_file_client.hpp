@@ -0,0 +1,172 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Event_loop.hpp"
+#include "Transfer_stats.hpp"
+
+struct Transfer_result
+{
+    bool success = false;
+    std::string error;
+    uint64_t bytes{};       // payload bytes moved, excluding protocol overhead
+    std::vector<char> data; // response body for listings
+};
+
+using Transfer_callback = std::function<void(Transfer_result)>;
+
+enum class Protocol_mode : uint8_t
+{
+    // Try the framed protocol, fall back to legacy if the server doesn't answer. A legacy
+    // server costs the handshake timeout once; the answer is remembered per server for
+    // the rest of the process, so later connections to it go straight to legacy.
+    AUTO,
+    LEGACY, // one bare command per round trip
+    FRAMED  // pipelined, length-prefixed frames with request ids
+};
+
+// A request body that another thread writes while it is being uploaded, see
+// Async_file_client::upload_stream(). The writer blocks once buffer_limit bytes are
+// waiting to be sent, so a fast producer doesn't outrun the connection.
+class Upload_stream
+{
+private:
+    mutable std::mutex m_mutex;
+    std::condition_variable m_space;
+    std::deque<std::vector<char>> m_chunks;
+    size_t m_front_offset{};
+    size_t m_buffered{};
+    size_t m_buffer_limit;
+    bool m_closed = false;
+    bool m_failed = false;    // by the writer, the body is incomplete
+    bool m_cancelled = false; // by the upload
+    std::function<void()> m_wake;
+
+public:
+    static constexpr size_t DEFAULT_BUFFER_LIMIT = 4 * 1024 * 1024;
+
+    explicit Upload_stream(size_t buffer_limit = DEFAULT_BUFFER_LIMIT) : m_buffer_limit(buffer_limit) {}
+
+    // Writer side. write() returns false once the upload has failed; close() ends the
+    // body, and the upload completes when everything buffered has been sent. fail()
+    // gives up on the body, and the upload fails without storing anything.
+    bool write(const char *data, size_t size);
+    void close();
+    void fail();
+
+    // Upload side, on the connection's loop thread. wake is called, from the writer's
+    // thread, whenever data or the end arrives after read() found nothing.
+    void set_wake(std::function<void()> wake);
+    size_t read(char *data, size_t size);
+    bool readable() const;
+    bool finished() const;
+    bool failed() const;
+    void cancel();
+};
+
+// Non-blocking client core: transfers are multiplexed over a small pool of
+// connections, each owned by one of a few epoll loop threads. With the framed
+// protocol many requests are pipelined on each connection. Completion
+// callbacks run on a loop thread and must not block.
+class Async_file_client
+{
+public:
+    class Transfer;
+
+private:
+    class Connection;
+
+    std::string m_server_ip;
+    int m_server_port;
+    mutable std::mutex m_server_mutex;
+    std::function<bool()> m_connect_failure_handler;
+    size_t m_max_connections;
+
+    std::vector<std::unique_ptr<Event_loop>> m_loops;
+    std::vector<std::shared_ptr<Connection>> m_connections;
+    std::deque<std::unique_ptr<Transfer>> m_pending;
+    std::mutex m_mutex;
+    bool m_shutting_down = false;
+
+    // bytes per second for each connection, 0 means unlimited
+    std::atomic<size_t> m_rate_limit{0};
+    std::atomic<size_t> m_buffer_size{BUFFER_SIZE};
+    const std::atomic<bool> *m_cancel_flag = nullptr;
+
+    Transfer_stats m_stats;
+
+    std::atomic<Protocol_mode> m_protocol_mode{Protocol_mode::AUTO};
+
+    void submit(std::unique_ptr<Transfer> transfer);
+    bool on_connect_failure();
+    std::unique_ptr<Transfer> take_pending(Connection &connection);
+
+public:
+    static constexpr size_t BUFFER_SIZE = 8192;
+
+    Async_file_client(const std::string &server_ip, int server_port,
+                      size_t thread_count = 1, size_t max_connections = 1);
+    ~Async_file_client();
+
+    Async_file_client(const Async_file_client &) = delete;
+    Async_file_client &operator=(const Async_file_client &) = delete;
+
+    // With a catalog version, framed servers that keep history only send the changes
+    // since then (see Protocol.hpp); everyone else gets the full listing
+
+    // callback interface
+    void list_files(Transfer_callback on_complete, const std::string &since_version = {});
+    void download_file(const std::string &filename, const std::string &save_path, Transfer_callback on_complete);
+    // Reads [offset, offset + length) of a remote file into Transfer_result::data;
+    // the result is shorter when the file ends first
+    void download_range(const std::string &filename, uint64_t offset, uint64_t length, Transfer_callback on_complete);
+    void upload_file(const std::string &filepath, Transfer_callback on_complete);
+    // Uploads a body of unknown size as it is written, framed protocol only
+    void upload_stream(const std::string &filename, std::shared_ptr<Upload_stream> stream, Transfer_callback on_complete);
+
+    // future interface
+    std::future<Transfer_result> list_files(const std::string &since_version = {});
+    std::future<Transfer_result> download_file(const std::string &filename, const std::string &save_path);
+    std::future<Transfer_result> download_range(const std::string &filename, uint64_t offset, uint64_t length);
+    std::future<Transfer_result> upload_file(const std::string &filepath);
+    std::future<Transfer_result> upload_stream(const std::string &filename, std::shared_ptr<Upload_stream> stream);
+    // Submits all downloads at once so they share round trips on pipelined connections
+    std::vector<std::future<Transfer_result>> download_files(const std::vector<std::string> &filenames,
+                                                             const std::string &save_path);
+
+    void set_rate_limit(size_t bytes_per_second) { m_rate_limit = bytes_per_second; }
+    size_t get_rate_limit() const { return m_rate_limit.load(std::memory_order_relaxed); }
+    // Upload chunk size; connections opened afterwards also receive into buffers at least this big
+    void set_buffer_size(size_t bytes) { m_buffer_size = std::max<size_t>(bytes, 1); }
+    size_t get_buffer_size() const { return m_buffer_size.load(std::memory_order_relaxed); }
+    // Transfers poll this flag whenever their socket becomes ready and abort when it is set
+    void set_cancel_flag(const std::atomic<bool> *flag) { m_cancel_flag = flag; }
+    bool cancelled() const { return m_cancel_flag != nullptr && m_cancel_flag->load(std::memory_order_relaxed); }
+
+    void set_protocol_mode(Protocol_mode mode) { m_protocol_mode = mode; }
+    Protocol_mode get_protocol_mode() const { return m_protocol_mode.load(std::memory_order_relaxed); }
+    // Whether the current server is known to speak the framed protocol
+    bool is_framed() const;
+
+    // Per-operation and socket level counters, safe to read from any thread
+    const Transfer_stats &get_stats() const { return m_stats; }
+
+    // New connections go to this server; open ones finish their transfers first
+    void set_server(const std::string &server_ip, int server_port);
+    std::string get_server_ip() const;
+    int get_server_port() const;
+    // Called on a loop thread when a connection attempt fails; returning true means
+    // another server was selected and the waiting transfers should retry there
+    void set_connect_failure_handler(std::function<bool()> handler);
+};
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <poll.h>
+#include <string>
+#include <vector>
+
+#include "Output_stage.hpp"
+#include "Wav_writer.hpp"
+
+struct Pcm_format
+{
+    uint32_t sample_rate{};
+    uint8_t channels{};
+    uint8_t bits_per_sample{};
+
+    bool operator==(const Pcm_format &) const = default;
+};
+
+// What a sink settled on for a stream; the engine mixes, resamples and packs to it
+struct Sink_format
+{
+    unsigned int sample_rate{};
+    uint8_t channels{};
+    Sample_format sample_format = Sample_format::S32;
+    size_t period_frames{}; // a full sink wants samples again once this many have played
+};
+
+struct Sink_write
+{
+    size_t frames{};     // taken; 0 when the sink is full, wait on its descriptors
+    bool xrun = false;   // the sink had run dry and was restarted
+    bool failed = false; // for good, playback can't go on
+};
+
+// Where Playback_engine sends its samples: the sound card, or nothing or a file so
+// the whole pipeline runs on machines without one. Writes never block; a full sink
+// says through its poll descriptors when it takes samples again, so the engine
+// sleeps in one poll() next to its controls.
+class Audio_sink
+{
+public:
+    // sinks buffer about a second in this many periods
+    static constexpr unsigned int PERIODS = 8;
+
+    virtual ~Audio_sink() = default;
+
+    // Sets the sink up for format, or as close to it as the sink gets. Throws
+    // std::runtime_error.
+    virtual Sink_format open(const Pcm_format &format) = 0;
+    virtual void close() = 0;
+    virtual bool is_open() const = 0;
+    // for the log
+    virtual std::string name() const = 0;
+
+    // Takes what fits of frames packed in the sample format open() returned
+    virtual Sink_write write(const char *data, size_t frames) = 0;
+    // Valid until close(); empty for sinks that are never full
+    virtual std::vector<pollfd> poll_descriptors() = 0;
+    // Whether the revents of the descriptors mean the sink wants samples, or has an
+    // error for the next write() to report
+    virtual bool writable(const pollfd *fds, size_t count) = 0;
+    // Frames the sink would take right now, negative if it can't tell
+    virtual long available() = 0;
+
+    virtual void pause(bool paused) = 0;
+    // Drops everything queued and gets ready for new samples
+    virtual void drop() = 0;
+    // Plays out everything queued without blocking: true once that is done, and the
+    // sink is ready for new samples. Until then call again after waiting on the
+    // descriptors or a period.
+    virtual bool drain() = 0;
+};
+
+// Stands in for a sound card. Fast mode takes everything at once, for measuring
+// how quickly the pipeline produces samples; paced mode plays them out in real
+// time with a one-second buffer, so waits, wakeups and xruns behave like a device's.
+// With a rate the sink runs at that rate instead of the stream's, and the
+// resampler becomes part of the run.
+class Null_sink : public Audio_sink
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+private:
+    bool m_paced;
+    unsigned int m_rate;
+    Sink_format m_format{};
+    bool m_open = false;
+    int m_timer_fd = -1;
+    size_t m_buffer_frames{};
+    // the clock starts with the first write after open, drop() or an xrun
+    bool m_started = false;
+    Clock::time_point m_start;
+    uint64_t m_written{}; // frames since m_start
+    bool m_paused = false;
+    Clock::time_point m_paused_at;
+
+    uint64_t played(Clock::time_point now) const;
+    void wake_at(Clock::time_point time);
+
+public:
+    explicit Null_sink(bool paced = false, unsigned int rate = 0);
+    ~Null_sink() override;
+
+    Null_sink(const Null_sink &) = delete;
+    Null_sink &operator=(const Null_sink &) = delete;
+
+    Sink_format open(const Pcm_format &format) override;
+    void close() override { m_open = false; }
+    bool is_open() const override { return m_open; }
+    std::string name() const override;
+
+    Sink_write write(const char *data, size_t frames) override;
+    std::vector<pollfd> poll_descriptors() override;
+    bool writable(const pollfd *fds, size_t count) override;
+    long available() override;
+
+    void pause(bool paused) override;
+    void drop() override;
+    bool drain() override;
+};
+
+// Writes what would have been played into a WAV file, or a headerless PCM file.
+// The first stream fixes the file's format; later ones are resampled and mixed to
+// it, as they would be for a device that runs at one rate. The header is kept up to
+// date whenever playback ends, so the file can be read between sessions.
+class File_sink : public Audio_sink
+{
+private:
+    std::filesystem::path m_path;
+    bool m_raw;
+    Wav_writer m_writer;
+    Sink_format m_format{};
+    bool m_open = false;
+
+public:
+    explicit File_sink(std::filesystem::path path, bool raw = false) : m_path(std::move(path)), m_raw(raw) {}
+
+    Sink_format open(const Pcm_format &format) override;
+    void close() override;
+    bool is_open() const override { return m_open; }
+    std::string name() const override;
+
+    Sink_write write(const char *data, size_t frames) override;
+    std::vector<pollfd> poll_descriptors() override { return {}; }
+    bool writable(const pollfd *, size_t) override { return false; }
+    long available() override { return -1; }
+
+    void pause(bool) override {}
+    void drop() override {}
+    bool drain() override;
+};
+
+// The sinks that need no sound card, from a spec: "null" or "paced", each with an
+// optional "@RATE", or "file:PATH", raw for .raw and .pcm and WAV otherwise.
+// nullptr for anything else.
+std::unique_ptr<Audio_sink> make_headless_sink(const std::string &spec);
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "Flac_types.hpp"
+#include "Work_stealing_pool.hpp"
+
+struct Batch_file_result
+{
+    std::filesystem::path path;
+    bool ok = false;
+    std::string error; // the first one, when ok is false
+    uint64_t bytes{};   // file size
+    uint64_t samples{}; // per channel, decoded
+    uint32_t sample_rate{};
+    uint8_t channels{};
+    size_t ranges{};         // tasks the file was split into
+    double decode_seconds{}; // summed over its tasks
+    double wall_seconds{};   // from its first task starting to its last one finishing
+};
+
+struct Batch_report
+{
+    std::vector<Batch_file_result> files; // in the order they were given
+    size_t failed{};
+    size_t tasks{};
+    uint64_t bytes{};
+    uint64_t samples{};
+    double audio_seconds{};
+    double seconds{};
+    std::vector<Work_stealing_pool::Worker_stats> workers;
+
+    double realtime_factor() const { return seconds > 0 ? audio_seconds / seconds : 0; }
+    double mib_per_second() const { return seconds > 0 ? bytes / seconds / (1024 * 1024) : 0; }
+    // Share of the workers' wall time spent running tasks
+    double utilization() const;
+
+    std::string to_json() const;
+};
+
+struct Batch_options
+{
+    static constexpr uint64_t DEFAULT_SPLIT_BYTES = 16 * 1024 * 1024;
+
+    size_t threads = 0;                         // 0 for one per hardware thread
+    uint64_t split_bytes = DEFAULT_SPLIT_BYTES; // 0 never splits
+};
+
+// One decoded frame, handed to the block handler on the worker that decoded it
+struct Decoded_block
+{
+    size_t file; // index into the list given to run()
+    const Stream_info &stream_info;
+    uint64_t first_sample;
+    const std::vector<buffer_sample_type> &samples; // interleaved
+    size_t worker;
+};
+
+// Decodes a list of FLAC files on a Work_stealing_pool, for integrity checks, loudness
+// scans and transcodes over a whole library. Files are queued smallest first; workers
+// run their newest task first, so each starts on the largest of its share. Files
+// above split_bytes are cut into frame ranges at their seek points, or at frames
+// Frame_scanner finds when they have no seek table, each range a task of its own,
+// so one long track doesn't keep a single core busy while the rest are done. Read
+// and sample buffers belong to the workers and are reused from task to task.
+//
+// A file fails when it can't be read, doesn't decode, or decodes to another length
+// than STREAMINFO gives; the other files carry on.
+class Batch_decoder
+{
+public:
+    // Called for every frame, from several workers at once. Frames of a split file
+    // arrive out of order; first_sample tells where each one goes.
+    using Block_handler = std::function<void(const Decoded_block &)>;
+
+    static constexpr size_t READ_BUFFER_SIZE = 256 * 1024;
+
+private:
+    Batch_options m_options;
+    Block_handler m_handler;
+
+public:
+    explicit Batch_decoder(Batch_options options = {}, Block_handler handler = {})
+        : m_options(options), m_handler(std::move(handler)) {}
+
+    Batch_report run(const std::vector<std::filesystem::path> &paths) const;
+};
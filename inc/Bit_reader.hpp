@@ -3,6 +3,8 @@
 #include <cstdint>
 #include <stdexcept>
 
+#include "Flac_crc.hpp"
+
 template <typename Input_stream>
 class Bit_reader
 {
@@ -10,6 +12,12 @@ private:
     Input_stream *m_stream{};
     uint64_t m_bit_buffer{};
     uint8_t m_bits_in_buffer{};
+    // of the bytes taken since reset_crc(), for checking frames
+    uint8_t m_crc8{};
+    uint16_t m_crc16{};
+#ifdef FLAC_PROFILE
+    uint64_t m_bytes_read{};
+#endif
 
 public:
     explicit Bit_reader(Input_stream &stream)
@@ -36,7 +44,13 @@ public:
         {
             throw std::runtime_error("Failed to read byte from stream.");
         }
-        return static_cast<uint8_t>(byte);
+#ifdef FLAC_PROFILE
+        m_bytes_read++;
+#endif
+        uint8_t value = static_cast<uint8_t>(byte);
+        m_crc8 = Flac_crc::crc8_table[m_crc8 ^ value];
+        m_crc16 = static_cast<uint16_t>((m_crc16 << 8) ^ Flac_crc::crc16_table[(m_crc16 >> 8) ^ value]);
+        return value;
     }
 
     uint64_t read_bits_unsigned(uint8_t num_bits)
@@ -79,4 +93,26 @@ public:
     {
         m_bits_in_buffer -= m_bits_in_buffer % 8;
     }
+
+    // Starts both checksums over; at a frame boundary no bits are buffered, so they
+    // cover exactly the bytes read from here on
+    void reset_crc()
+    {
+        m_crc8 = 0;
+        m_crc16 = 0;
+    }
+    uint8_t crc8() const { return m_crc8; }
+    uint16_t crc16() const { return m_crc16; }
+
+#ifdef FLAC_PROFILE
+    // Bytes taken from the stream since construction, for the decoder profile
+    uint64_t bytes_read() const { return m_bytes_read; }
+#endif
+
+    // Drops buffered bits, after the stream has been repositioned
+    void reset()
+    {
+        m_bit_buffer = 0;
+        m_bits_in_buffer = 0;
+    }
 };
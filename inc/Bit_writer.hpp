@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// The counterpart of Bit_reader: packs values most significant bit first into a
+// byte buffer that is reused from one frame to the next
+class Bit_writer
+{
+private:
+    std::vector<uint8_t> m_bytes;
+    uint64_t m_bit_buffer{};
+    uint8_t m_bits_in_buffer{};
+
+    void flush_bytes()
+    {
+        while (m_bits_in_buffer >= 8)
+        {
+            m_bits_in_buffer -= 8;
+            m_bytes.push_back(static_cast<uint8_t>(m_bit_buffer >> m_bits_in_buffer));
+        }
+    }
+
+public:
+    // Drops everything written, keeping the allocation
+    void clear()
+    {
+        m_bytes.clear();
+        m_bit_buffer = 0;
+        m_bits_in_buffer = 0;
+    }
+
+    void reserve(size_t bytes) { m_bytes.reserve(bytes); }
+
+    // num_bits up to 32
+    void write_bits_unsigned(uint32_t value, uint8_t num_bits)
+    {
+        if (num_bits == 0)
+        {
+            return;
+        }
+        m_bit_buffer = (m_bit_buffer << num_bits) | (value & (0xFFFFFFFFULL >> (32 - num_bits)));
+        m_bits_in_buffer += num_bits;
+        flush_bytes();
+    }
+
+    void write_bits_signed(int64_t value, uint8_t num_bits)
+    {
+        write_bits_unsigned(static_cast<uint32_t>(value), num_bits);
+    }
+
+    // count zeros, then a one
+    void write_unary(uint32_t count)
+    {
+        while (count >= 32)
+        {
+            write_bits_unsigned(0, 32);
+            count -= 32;
+        }
+        write_bits_unsigned(1, count + 1);
+    }
+
+    // Zig-zag folds value and writes it Rice coded, as decode_and_unfold_rice reads it
+    void write_rice_signed(int64_t value, uint8_t rice_parameter)
+    {
+        uint64_t folded = value >= 0 ? static_cast<uint64_t>(value) << 1 : (static_cast<uint64_t>(~value) << 1) | 1;
+        write_unary(static_cast<uint32_t>(folded >> rice_parameter));
+        write_bits_unsigned(static_cast<uint32_t>(folded), rice_parameter);
+    }
+
+    // Writes everything other holds, partial last byte included
+    void append(const Bit_writer &other)
+    {
+        if (is_aligned())
+        {
+            m_bytes.insert(m_bytes.end(), other.m_bytes.begin(), other.m_bytes.end());
+        }
+        else
+        {
+            for (uint8_t byte : other.m_bytes)
+            {
+                write_bits_unsigned(byte, 8);
+            }
+        }
+        write_bits_unsigned(static_cast<uint32_t>(other.m_bit_buffer), other.m_bits_in_buffer);
+    }
+
+    // Pads with zero bits to the next byte boundary
+    void align_to_byte()
+    {
+        if (m_bits_in_buffer > 0)
+        {
+            write_bits_unsigned(0, 8 - m_bits_in_buffer);
+        }
+    }
+
+    bool is_aligned() const { return m_bits_in_buffer == 0; }
+    // Complete bytes written so far; call align_to_byte() first to get all of them
+    const std::vector<uint8_t> &bytes() const { return m_bytes; }
+    uint64_t bit_count() const { return m_bytes.size() * 8 + m_bits_in_buffer; }
+};
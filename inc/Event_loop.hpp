@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Single-threaded epoll reactor. Everything registered with a loop is only touched
+// from its own thread; other threads hand work over with post().
+class Event_loop
+{
+public:
+    using Handler = std::function<void(uint32_t events)>;
+    using Task = std::function<void()>;
+    using Clock = std::chrono::steady_clock;
+
+private:
+    struct Timer
+    {
+        Clock::time_point deadline;
+        uint64_t sequence; // keeps timers with equal deadlines in FIFO order
+        Task task;
+
+        bool operator>(const Timer &other) const
+        {
+            return deadline != other.deadline ? deadline > other.deadline : sequence > other.sequence;
+        }
+    };
+
+    int m_epoll_fd = -1;
+    int m_wake_fd = -1;
+    // Events carry a token per registration rather than the fd: a descriptor closed by
+    // an earlier handler in the same batch may already be reused by a new registration,
+    // and its stale events must not reach the new handler
+    std::unordered_map<int, uint64_t> m_tokens;
+    std::unordered_map<uint64_t, std::shared_ptr<Handler>> m_handlers;
+    uint64_t m_next_token = 1; // 0 is the wake fd
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> m_timers;
+    uint64_t m_timer_sequence{};
+
+    std::mutex m_task_mutex;
+    std::vector<Task> m_tasks;
+
+    std::atomic<bool> m_stop{false};
+    std::thread m_thread;
+
+    void run();
+    void run_tasks();
+    void run_timers();
+    int next_timeout_ms();
+
+public:
+    Event_loop();
+    ~Event_loop();
+
+    Event_loop(const Event_loop &) = delete;
+    Event_loop &operator=(const Event_loop &) = delete;
+
+    // fd registration, loop thread only
+    void add_fd(int fd, uint32_t events, Handler handler);
+    void modify_fd(int fd, uint32_t events);
+    void remove_fd(int fd);
+
+    // Runs the task on the loop thread, callable from any thread
+    void post(Task task);
+    // Runs the task on the loop thread after the delay, loop thread only
+    void run_after(Clock::duration delay, Task task);
+
+    bool in_loop_thread() const { return std::this_thread::get_id() == m_thread.get_id(); }
+};
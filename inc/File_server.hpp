@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Stand-in for the real file server, speaking the same legacy and framed protocols
+// and multicast announcement that File_client expects. Serves a single directory,
+// one thread per connection. Meant for benchmarks and offline testing.
+class File_server
+{
+private:
+    std::filesystem::path m_root;
+    int m_port;
+    bool m_announce;
+
+    int m_listen_sock = -1;
+    std::atomic<bool> m_stop{false};
+    std::atomic<int> m_active_connections{0};
+    std::thread m_accept_thread;
+    std::thread m_announce_thread;
+
+    // workers are detached, stop() waits on m_workers_cv until the last one has left
+    std::mutex m_workers_mutex;
+    std::condition_variable m_workers_cv;
+    std::vector<int> m_client_socks;
+
+    // Catalog state for versioned listings. Every LIST rescans the directory and
+    // records what changed, so clients holding a recent version get only the delta.
+    struct Catalog_entry
+    {
+        uint64_t size;
+        int64_t mtime;
+
+        bool operator==(const Catalog_entry &other) const = default;
+    };
+    std::mutex m_catalog_mutex;
+    std::map<std::string, Catalog_entry> m_catalog;
+    std::string m_catalog_epoch; // differs between runs so old tokens are never trusted
+    uint64_t m_catalog_version = 0;
+    std::deque<std::pair<uint64_t, std::string>> m_catalog_changes; // (version, name), oldest first
+    uint64_t m_oldest_delta_version = 0; // deltas can be served from this version on
+
+    void accept_loop();
+    void announce_loop();
+    void serve(int sock);
+    void serve_framed(int sock);
+
+    void rescan_locked();
+    std::string format_entry(const std::string &name, const Catalog_entry &entry) const;
+    // Full listing, or only the changes when since is a version we still have history for
+    std::string list_catalog(std::string_view since);
+    bool valid_name(const std::string &name) const;
+
+public:
+    static constexpr int MAX_CONNECTIONS = 64; // only used to compute the announced load
+    static constexpr size_t MAX_CATALOG_CHANGES = 16384;
+
+    // port 0 picks a free ephemeral port
+    explicit File_server(const std::filesystem::path &root, int port = 0, bool announce = false);
+    ~File_server();
+
+    File_server(const File_server &) = delete;
+    File_server &operator=(const File_server &) = delete;
+
+    void start();
+    void stop();
+
+    int get_port() const { return m_port; }
+    const std::filesystem::path &get_root() const { return m_root; }
+};
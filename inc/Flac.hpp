@@ -1,26 +1,43 @@
 #pragma once
 
-#include <fstream>
-#include <unordered_map>
+#include <istream>
+#include <optional>
 #include <vector>
 
 #include "Bit_reader.hpp"
 #include "Flac_constants.hpp"
+#include "Flac_profile.hpp"
 #include "Flac_types.hpp"
 #include "decoders.hpp"
 
 class Flac
 {
 private:
+    // resync() reads this much at a time, or four of the largest frames
+    static constexpr size_t RESYNC_WINDOW = 64 * 1024;
+
     uint8_t m_channel_index{};
     uint64_t m_sample_count{};
     uint64_t m_frame_count{};
     Stream_info m_stream_info{};
     Frame_info m_frame_info{};
     Vorbis_comment m_vorbis_comment;
-    std::ifstream &m_flac_stream;
-    Bit_reader<std::ifstream> m_reader;
+    // large blocks are described, their payloads stay in the file
+    std::vector<Picture_info> m_pictures;
+    std::vector<Application_info> m_applications;
+    std::optional<Cuesheet_info> m_cuesheet;
+    std::vector<Seek_point> m_seek_table;
+    uint64_t m_audio_offset{}; // stream position of the first frame
+    std::istream &m_flac_stream;
+    Bit_reader<std::istream> m_reader;
     std::vector<buffer_sample_type> m_audio_buffer;
+#ifdef FLAC_PROFILE
+    Flac_profile m_profile;
+#endif
+
+    // The part of a frame after its header, picked by initialize() for the stream's layout
+    using Audio_decoder = void (Flac::*)();
+    Audio_decoder m_decode_audio;
 
     // internal functions
     // decoding values from bit codes
@@ -32,29 +49,81 @@ private:
     void read_metadata();
     void read_metadata_block_STREAMINFO();
     void read_metadata_block_PADDING();
-    void read_metadata_block_APPLICATION();
-    void read_metadata_block_SEEKTABLE();
-    void read_metadata_block_VORBIS_COMMENT();
-    void read_metadata_block_CUESHEET();
-    void read_metadata_block_PICTURE();
+    void read_metadata_block_APPLICATION(uint32_t block_length);
+    void read_metadata_block_SEEKTABLE(uint32_t block_length);
+    void read_metadata_block_VORBIS_COMMENT(uint32_t block_length);
+    void read_metadata_block_CUESHEET(uint32_t block_length);
+    void read_metadata_block_PICTURE(uint32_t block_length);
+    void select_decode_path();
+
+    // The audio decoding is specialized for the layouts most files use: with the
+    // channel count, sample size and block size as template arguments, strides, shifts
+    // and loop bounds are constants. 0 takes the value from the stream at run time, and
+    // frames that don't match the layout fall back to the generic <0, 0, 0> path.
+    template <uint8_t Channels>
+    uint32_t channels() const { return Channels != 0 ? Channels : m_stream_info.channels; }
+    template <uint16_t Block_size>
+    uint32_t block_size() const { return Block_size != 0 ? Block_size : m_frame_info.block_size; }
+
+    template <uint8_t Channels, uint8_t Bits_per_sample, uint16_t Block_size>
+    void decode_audio();
+    template <uint8_t Channels, uint16_t Block_size>
     void decode_subframe(uint8_t bits_per_sample);
+    template <uint8_t Channels, uint16_t Block_size>
     void decode_subframe_fixed(uint8_t predictor_order, uint8_t bits_per_sample);
+    template <uint8_t Channels, uint16_t Block_size>
     void decode_subframe_lpc(uint8_t predictor_order, uint8_t bits_per_sample);
+    template <uint8_t Channels, uint16_t Block_size>
     void linear_prediction(uint8_t predictor_order, const int16_t *predictor_coefficients, int8_t qlp_shift);
+    template <uint8_t Channels, uint16_t Block_size>
     void decode_residuals(uint8_t predictor_order);
 
 public:
-    explicit Flac(std::ifstream &flac_stream) : m_flac_stream(flac_stream), m_reader(m_flac_stream) {};
-    ~Flac();
+    // The stream can be a file or just the header bytes of one, e.g. from a ranged download
+    explicit Flac(std::istream &flac_stream);
 
     // Getter functions
-    const Stream_info &get_stream_info() { return m_stream_info; }
-    const Frame_info &get_frame_info() { return m_frame_info; }
-    const Vorbis_comment &get_vorbis_comment() { return m_vorbis_comment; }
-    const Bit_reader<std::ifstream> &get_reader() const { return m_reader; }
+    const Stream_info &get_stream_info() const { return m_stream_info; }
+    const Frame_info &get_frame_info() const { return m_frame_info; }
+    const Vorbis_comment &get_vorbis_comment() const { return m_vorbis_comment; }
+    // Offsets are positions in the stream; read the payloads with Mapped_file::range
+    const std::vector<Picture_info> &get_pictures() const { return m_pictures; }
+    const std::vector<Application_info> &get_applications() const { return m_applications; }
+    const std::optional<Cuesheet_info> &get_cuesheet() const { return m_cuesheet; }
+    const std::vector<Seek_point> &get_seek_table() const { return m_seek_table; }
+    // Stream position of the first frame, which seek point offsets count from
+    uint64_t get_audio_offset() const { return m_audio_offset; }
+    // Samples per channel decoded so far, or the position set by seek()
+    uint64_t get_sample_count() const { return m_sample_count; }
+    const Bit_reader<std::istream> &get_reader() const { return m_reader; }
     const std::vector<buffer_sample_type> &get_audio_buffer() const { return m_audio_buffer; }
+#ifdef FLAC_PROFILE
+    // What the frames decoded so far cost, see Flac_profile
+    const Flac_profile &get_profile() const { return m_profile; }
+#endif
 
     // decoder interface
     void initialize();
     void decode_frame();
+    // Allocates the sample buffer for the largest block the stream declares, so that
+    // decode_frame() doesn't allocate. Call after initialize().
+    void reserve_buffers();
+    // Hand the sample buffer from one decoder to the next, so a batch of files
+    // decodes into the same allocation
+    std::vector<buffer_sample_type> release_buffer() { return std::move(m_audio_buffer); }
+    void reuse_buffer(std::vector<buffer_sample_type> buffer) { m_audio_buffer = std::move(buffer); }
+    // Positions the stream on the frame that holds target_sample, starting from the
+    // closest seek point, and returns the first sample of that frame. The caller drops
+    // the difference from the next decoded frame. Needs a seekable stream.
+    uint64_t seek(uint64_t target_sample);
+    // Positions the stream on the frame stream_offset bytes after the first one, whose
+    // first sample is first_sample, as a seek point gives them. Nothing is decoded on
+    // the way, so a stream can be split between decoders at its seek points.
+    void seek_to_frame(uint64_t stream_offset, uint64_t first_sample);
+    // After decode_frame() threw on damaged data: positions the stream on the next
+    // intact frame, found with Frame_scanner, and returns the bytes skipped to get
+    // there. At the end of the stream if there is none. Needs a seekable stream.
+    uint64_t resync();
+    // The tracks of the cue sheet, read from the stream on demand; empty without one
+    std::vector<Virtual_track> read_virtual_tracks();
 };
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// The two checksums of a FLAC frame: CRC-8 (polynomial x^8 + x^2 + x + 1) over the
+// frame header and CRC-16 (x^16 + x^15 + x^2 + 1) over the whole frame, both with a
+// zero initial value and no reflection
+namespace Flac_crc
+{
+    constexpr std::array<uint8_t, 256> make_crc8_table()
+    {
+        std::array<uint8_t, 256> table{};
+        for (int i = 0; i < 256; i++)
+        {
+            uint8_t crc = static_cast<uint8_t>(i);
+            for (int bit = 0; bit < 8; bit++)
+            {
+                crc = static_cast<uint8_t>((crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1);
+            }
+            table[i] = crc;
+        }
+        return table;
+    }
+
+    constexpr std::array<uint16_t, 256> make_crc16_table()
+    {
+        std::array<uint16_t, 256> table{};
+        for (int i = 0; i < 256; i++)
+        {
+            uint16_t crc = static_cast<uint16_t>(i << 8);
+            for (int bit = 0; bit < 8; bit++)
+            {
+                crc = static_cast<uint16_t>((crc & 0x8000) ? (crc << 1) ^ 0x8005 : crc << 1);
+            }
+            table[i] = crc;
+        }
+        return table;
+    }
+
+    inline constexpr std::array<uint8_t, 256> crc8_table = make_crc8_table();
+    inline constexpr std::array<uint16_t, 256> crc16_table = make_crc16_table();
+
+    inline uint8_t crc8(const uint8_t *data, size_t size, uint8_t crc = 0)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            crc = crc8_table[crc ^ data[i]];
+        }
+        return crc;
+    }
+
+    inline uint16_t crc16(const uint8_t *data, size_t size, uint16_t crc = 0)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            crc = static_cast<uint16_t>((crc << 8) ^ crc16_table[(crc >> 8) ^ data[i]]);
+        }
+        return crc;
+    }
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "Bit_writer.hpp"
+#include "Flac_types.hpp"
+#include "Wav_reader.hpp"
+
+// How hard the encoder looks for a good model; for_level() gives the presets
+struct Encoder_settings
+{
+    static constexpr int MAX_LEVEL = 8;
+    static constexpr int DEFAULT_LEVEL = 5;
+
+    uint16_t block_size = 4096;
+    uint8_t max_lpc_order = 8;        // 0 uses the fixed predictors only
+    uint8_t max_partition_order = 5;  // up to 8
+    bool stereo_decorrelation = true; // tries left/side, side/right and mid/side
+    bool exhaustive_lpc_order = false; // encodes every LPC order instead of the estimated best
+
+    // The levels of the reference encoder, 0 fastest to 8 smallest
+    static Encoder_settings for_level(int level);
+};
+
+// Encodes one block at a time. Keeps its scratch buffers across blocks, so one
+// per thread encodes a stream without allocating once it has seen the largest block.
+class Frame_encoder
+{
+public:
+    static constexpr uint8_t MAX_FIXED_ORDER = 4;
+    static constexpr uint8_t MAX_LPC_ORDER = 32;
+
+private:
+    Encoder_settings m_settings;
+    Stream_info m_stream_info;
+
+    std::array<std::vector<int64_t>, 8> m_channels; // channel n, or left, right, mid, side
+    std::array<Bit_writer, 8> m_subframes;
+    std::vector<int64_t> m_residual;
+    std::vector<int64_t> m_best_residual;
+    std::vector<double> m_window;
+    std::vector<double> m_windowed;
+    std::vector<uint64_t> m_partition_sums;
+    Bit_writer m_frame;
+
+    struct Rice_plan
+    {
+        uint8_t partition_order{};
+        bool wide_parameters{}; // 5-bit parameters, for parameters above 14
+        std::array<uint8_t, 256> parameters{};
+        uint64_t bits{};
+    };
+
+    struct Subframe_plan
+    {
+        enum Kind : uint8_t
+        {
+            CONSTANT,
+            VERBATIM,
+            FIXED,
+            LPC
+        } kind{};
+        uint8_t order{};
+        uint8_t precision{};
+        int8_t shift{};
+        std::array<int32_t, MAX_LPC_ORDER> coefficients{};
+        Rice_plan rice;
+        uint64_t bits{};
+    };
+
+    Rice_plan plan_rice(const int64_t *residual, uint32_t count, uint8_t order);
+    bool lpc_residual(const int64_t *samples, uint32_t count, const Subframe_plan &plan, int64_t *residual) const;
+    void plan_lpc(const int64_t *samples, uint32_t count, uint8_t bits_per_sample, Subframe_plan &best);
+    void encode_subframe(int64_t *samples, uint32_t count, uint8_t bits_per_sample, Bit_writer &out);
+    void write_residual(const int64_t *residual, uint32_t count, uint8_t order, const Rice_plan &plan, Bit_writer &out) const;
+    void write_header(uint32_t count, uint8_t channel_assignment, uint64_t frame_number);
+
+public:
+    Frame_encoder(const Encoder_settings &settings, const Stream_info &stream_info)
+        : m_settings(settings), m_stream_info(stream_info) {}
+
+    // Codes count frames of interleaved, right-justified samples as frame number
+    // frame_number of a fixed block size stream, into out
+    void encode(const int32_t *samples, uint32_t count, uint64_t frame_number, std::vector<uint8_t> &out);
+};
+
+struct Encode_report
+{
+    Stream_info stream_info; // with the frame sizes filled in
+    uint64_t frames{};
+    uint64_t input_bytes{}; // of PCM
+    uint64_t output_bytes{};
+    double seconds{};
+
+    double ratio() const { return input_bytes == 0 ? 0 : static_cast<double>(output_bytes) / input_bytes; }
+};
+
+// Encodes a WAV file into a FLAC stream on a Work_stealing_pool. Blocks are read
+// ahead and encoded several at a time, and the finished frames are handed to the
+// output in order as soon as they are ready, so a consumer such as an upload runs
+// alongside the encoding.
+//
+// The stream starts with STREAMINFO before any frame is encoded, so its frame sizes
+// are unknown (0) there and its MD5 is left unset. Writers that can seek put
+// stream_header(report.stream_info) over the start of the stream afterwards.
+class Flac_encoder
+{
+public:
+    // Takes the next piece of the stream; returning false stops the encoding
+    using Output = std::function<bool(const uint8_t *data, size_t size)>;
+
+    // frames queued or being encoded, per thread
+    static constexpr size_t BLOCKS_PER_THREAD = 4;
+
+private:
+    Encoder_settings m_settings;
+    size_t m_threads;
+
+public:
+    // threads = 0 uses one per hardware thread
+    explicit Flac_encoder(const Encoder_settings &settings, size_t threads = 0)
+        : m_settings(settings), m_threads(threads) {}
+
+    // Throws std::runtime_error when the input can't be read or the output stops it
+    Encode_report encode(Wav_reader &input, const Output &output) const;
+
+    // The "fLaC" marker and STREAMINFO as the only metadata block
+    static std::vector<uint8_t> stream_header(const Stream_info &stream_info);
+};
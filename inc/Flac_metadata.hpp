@@ -0,0 +1,273 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#include "Flac_types.hpp"
+
+// Byte-level parsers for metadata blocks that are already in memory, for callers
+// that read the blocks themselves (ranged downloads, pread) instead of streaming
+// them through Flac.
+namespace Flac_metadata
+{
+    static constexpr size_t block_header_size = 4;
+    static constexpr size_t stream_info_size = 34;
+    static constexpr size_t cuesheet_header_size = 396; // catalog number to track count
+    static constexpr size_t picture_fixed_size = 32;    // the eight 32-bit fields
+    static constexpr size_t seek_point_size = 18;
+    static constexpr size_t cue_track_size = 36;        // without its indices
+    static constexpr size_t cue_index_size = 12;
+    static constexpr uint64_t placeholder_seek_point = ~uint64_t{0};
+
+    struct Block_header
+    {
+        bool is_last{};
+        block_type type{};
+        uint32_t length{};
+    };
+
+    inline uint32_t read_be32(const char *data)
+    {
+        const auto *bytes = reinterpret_cast<const uint8_t *>(data);
+        return (uint32_t(bytes[0]) << 24) | (uint32_t(bytes[1]) << 16) | (uint32_t(bytes[2]) << 8) | bytes[3];
+    }
+
+    inline uint64_t read_be64(const char *data)
+    {
+        return (uint64_t(read_be32(data)) << 32) | read_be32(data + 4);
+    }
+
+    inline uint32_t read_be24(const char *data)
+    {
+        const auto *bytes = reinterpret_cast<const uint8_t *>(data);
+        return (uint32_t(bytes[0]) << 16) | (uint32_t(bytes[1]) << 8) | bytes[2];
+    }
+
+    // Vorbis comment lengths are little-endian, unlike the rest of FLAC
+    inline uint32_t read_le32(const char *data)
+    {
+        const auto *bytes = reinterpret_cast<const uint8_t *>(data);
+        return uint32_t(bytes[0]) | (uint32_t(bytes[1]) << 8) | (uint32_t(bytes[2]) << 16) | (uint32_t(bytes[3]) << 24);
+    }
+
+    inline Block_header parse_block_header(const char *data)
+    {
+        uint8_t flags = static_cast<uint8_t>(data[0]);
+        return {(flags & 0x80) != 0, static_cast<block_type>(flags & 0x7F), read_be24(data + 1)};
+    }
+
+    inline bool has_flac_marker(const char *data, size_t size)
+    {
+        return size >= 4 && std::memcmp(data, "fLaC", 4) == 0;
+    }
+
+    // data points at the 34 bytes of a STREAMINFO block body
+    inline Stream_info parse_stream_info(const char *data)
+    {
+        const auto *bytes = reinterpret_cast<const uint8_t *>(data);
+        Stream_info info;
+        info.min_block_size = (uint16_t(bytes[0]) << 8) | bytes[1];
+        info.max_block_size = (uint16_t(bytes[2]) << 8) | bytes[3];
+        info.min_frame_size = read_be24(data + 4);
+        info.max_frame_size = read_be24(data + 7);
+        // 20 bits sample rate, 3 bits channels - 1, 5 bits bits per sample - 1, 36 bits total samples
+        uint64_t packed = 0;
+        for (int i = 10; i < 18; i++)
+        {
+            packed = (packed << 8) | bytes[i];
+        }
+        info.sample_rate = static_cast<uint32_t>(packed >> 44);
+        info.channels = static_cast<uint8_t>(((packed >> 41) & 0x07) + 1);
+        info.bits_per_sample = static_cast<uint8_t>(((packed >> 36) & 0x1F) + 1);
+        info.total_samples = packed & 0xFFFFFFFFFULL;
+        return info;
+    }
+
+    // Calls on_comment(name, value) for every "NAME=value" entry of a VORBIS_COMMENT
+    // block body. Returns false if a length runs past the end of the block.
+    template <typename Callback>
+    bool parse_vorbis_comment(const char *data, size_t size, Callback on_comment)
+    {
+        std::string_view block(data, size);
+        if (block.size() < 4)
+        {
+            return false;
+        }
+        uint32_t vendor_length = read_le32(block.data());
+        if (block.size() - 4 < vendor_length)
+        {
+            return false;
+        }
+        block.remove_prefix(4 + vendor_length);
+
+        if (block.size() < 4)
+        {
+            return false;
+        }
+        uint32_t comment_count = read_le32(block.data());
+        block.remove_prefix(4);
+
+        for (uint32_t i = 0; i < comment_count; i++)
+        {
+            if (block.size() < 4 || block.size() - 4 < read_le32(block.data()))
+            {
+                return false;
+            }
+            std::string_view comment = block.substr(4, read_le32(block.data()));
+            block.remove_prefix(4 + comment.size());
+
+            size_t delimiter_pos = comment.find('=');
+            if (delimiter_pos != std::string_view::npos)
+            {
+                on_comment(comment.substr(0, delimiter_pos), comment.substr(delimiter_pos + 1));
+            }
+        }
+        return true;
+    }
+
+    // data points at the first 396 bytes of a CUESHEET block body
+    inline void parse_cuesheet_header(const char *data, Cuesheet_info &cuesheet)
+    {
+        const auto *bytes = reinterpret_cast<const uint8_t *>(data);
+        cuesheet.media_catalog_number.assign(data, strnlen(data, 128));
+        cuesheet.lead_in_samples = read_be64(data + 128);
+        cuesheet.is_cd = (bytes[136] & 0x80) != 0;
+        cuesheet.track_count = bytes[395];
+    }
+
+    // Parses the fields of a PICTURE block body that starts at body_offset in the
+    // file. Returns false if a length runs past the end of the block.
+    inline bool parse_picture(const char *data, size_t size, uint64_t body_offset, Picture_info &picture)
+    {
+        std::string_view block(data, size);
+        auto read_string = [&](std::string &out)
+        {
+            if (block.size() < 4 || block.size() - 4 < read_be32(block.data()))
+            {
+                return false;
+            }
+            out.assign(block.substr(4, read_be32(block.data())));
+            block.remove_prefix(4 + out.size());
+            return true;
+        };
+
+        if (block.size() < 4)
+        {
+            return false;
+        }
+        picture.picture_type = read_be32(block.data());
+        block.remove_prefix(4);
+        if (!read_string(picture.mime_type) || !read_string(picture.description) || block.size() < 20)
+        {
+            return false;
+        }
+        picture.width = read_be32(block.data());
+        picture.height = read_be32(block.data() + 4);
+        picture.color_depth = read_be32(block.data() + 8);
+        picture.indexed_colors = read_be32(block.data() + 12);
+        picture.data_length = read_be32(block.data() + 16);
+        block.remove_prefix(20);
+        picture.data_offset = body_offset + (size - block.size());
+        return picture.data_length <= block.size();
+    }
+
+    // Parses a SEEKTABLE block body, dropping placeholder points
+    inline std::vector<Seek_point> parse_seek_table(const char *data, size_t size)
+    {
+        std::vector<Seek_point> points;
+        points.reserve(size / seek_point_size);
+        for (size_t offset = 0; offset + seek_point_size <= size; offset += seek_point_size)
+        {
+            uint64_t sample_number = read_be64(data + offset);
+            if (sample_number != placeholder_seek_point)
+            {
+                points.push_back({sample_number, read_be64(data + offset + 8),
+                                  static_cast<uint16_t>((uint8_t(data[offset + 16]) << 8) | uint8_t(data[offset + 17]))});
+            }
+        }
+        return points;
+    }
+
+    // Parses the track list of a CUESHEET block, i.e. the body after its 396-byte
+    // header. Returns false if the tracks run past the end of the block.
+    inline bool parse_cue_tracks(const char *data, size_t size, uint8_t track_count, std::vector<Cue_track> &tracks)
+    {
+        size_t offset = 0;
+        for (uint8_t i = 0; i < track_count; i++)
+        {
+            if (size - offset < cue_track_size)
+            {
+                return false;
+            }
+            const char *track_data = data + offset;
+            Cue_track track;
+            track.offset = read_be64(track_data);
+            track.number = static_cast<uint8_t>(track_data[8]);
+            track.isrc.assign(track_data + 9, strnlen(track_data + 9, 12));
+            track.is_audio = (static_cast<uint8_t>(track_data[21]) & 0x80) == 0;
+            track.pre_emphasis = (static_cast<uint8_t>(track_data[21]) & 0x40) != 0;
+            uint8_t index_count = static_cast<uint8_t>(track_data[35]);
+            offset += cue_track_size;
+
+            if ((size - offset) / cue_index_size < index_count)
+            {
+                return false;
+            }
+            for (uint8_t j = 0; j < index_count; j++)
+            {
+                track.indices.push_back({read_be64(data + offset), static_cast<uint8_t>(data[offset + 8])});
+                offset += cue_index_size;
+            }
+            tracks.push_back(std::move(track));
+        }
+        return true;
+    }
+
+    // The audio tracks with their sample ranges. Each track starts at its INDEX 01 and
+    // runs up to the next track's, so the pregap of a track is played at the end of the
+    // one before it and the tracks cover the album without gaps.
+    inline std::vector<Virtual_track> virtual_tracks(const std::vector<Cue_track> &tracks, uint64_t total_samples)
+    {
+        auto track_start = [](const Cue_track &track)
+        {
+            for (const auto &index : track.indices)
+            {
+                if (index.number == 1)
+                {
+                    return track.offset + index.offset;
+                }
+            }
+            return track.indices.empty() ? track.offset : track.offset + track.indices.front().offset;
+        };
+
+        std::vector<Virtual_track> result;
+        for (size_t i = 0; i < tracks.size(); i++)
+        {
+            const Cue_track &track = tracks[i];
+            bool is_lead_out = track.number == 170 || track.number == 255;
+            if (is_lead_out || !track.is_audio)
+            {
+                continue;
+            }
+            uint64_t end = total_samples;
+            if (i + 1 < tracks.size())
+            {
+                const Cue_track &next = tracks[i + 1];
+                end = (next.number == 170 || next.number == 255) ? next.offset : track_start(next);
+            }
+            uint64_t start = track_start(track);
+            if (total_samples != 0)
+            {
+                end = std::min(end, total_samples);
+            }
+            if (start < end)
+            {
+                result.push_back({track.number, start, end, track.isrc});
+            }
+        }
+        return result;
+    }
+}
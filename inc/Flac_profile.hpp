@@ -0,0 +1,83 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include "Transfer_stats.hpp"
+
+// Decoder instrumentation, compiled in with -DFLAC_PROFILE=ON. Without it the
+// FLAC_PROFILE_ONLY() hooks in Flac and Bit_reader expand to nothing.
+#ifdef FLAC_PROFILE
+#define FLAC_PROFILE_ONLY(...) __VA_ARGS__
+#else
+#define FLAC_PROFILE_ONLY(...)
+#endif
+
+// What one decoder spent its time on and which encoder choices it met. Plain
+// counters: a Flac is used from one thread at a time.
+struct Flac_profile
+{
+    using Clock = std::chrono::steady_clock;
+
+    enum Subframe_kind : uint8_t
+    {
+        CONSTANT,
+        VERBATIM,
+        FIXED,
+        LPC
+    };
+    static constexpr size_t SUBFRAME_KINDS = 4;
+
+    struct Subframe_stats
+    {
+        uint64_t count{};
+        uint64_t samples{};
+        uint64_t ns{}; // whole subframe, residuals and prediction included
+    };
+
+    // Adds the time from its construction to target when it goes out of scope
+    class Timer
+    {
+    private:
+        uint64_t &m_target;
+        Clock::time_point m_start = Clock::now();
+
+    public:
+        explicit Timer(uint64_t &target) : m_target(target) {}
+        ~Timer() { m_target += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - m_start).count(); }
+
+        Timer(const Timer &) = delete;
+        Timer &operator=(const Timer &) = delete;
+    };
+
+    uint64_t frames{};
+    uint64_t samples{};    // per channel
+    uint64_t bytes_read{}; // frame bytes, headers and footers included
+    uint64_t frame_ns{};
+    uint64_t residual_ns{};
+    uint64_t prediction_ns{};
+    uint64_t decorrelation_ns{};
+    Histogram frame_time_ns;
+    Histogram frame_bytes;
+
+    std::array<Subframe_stats, SUBFRAME_KINDS> subframes{};
+    uint64_t wasted_bits_subframes{};
+    // independent, left/side, side/right, mid/side
+    std::array<uint64_t, 4> channel_assignments{};
+    std::array<uint64_t, 5> fixed_orders{};
+    std::array<uint64_t, 33> lpc_orders{}; // indexed by order, 1 to 32
+    std::array<uint64_t, 16> lpc_precisions{}; // indexed by coefficient bits - 1
+    std::array<uint64_t, 16> partition_orders{};
+    std::array<uint64_t, 31> rice_parameters{}; // per partition
+    uint64_t escaped_partitions{};
+
+    void record_frame(uint8_t channel_assignment, uint16_t block_size, uint64_t bytes, uint64_t ns);
+    void record_subframe(Subframe_kind kind, uint16_t block_size, uint64_t ns);
+
+    // adds up the profiles of several decoders
+    void merge(const Flac_profile &other);
+
+    std::string to_json() const;
+};
@@ -1,7 +1,10 @@
 #pragma once
 
 #include <cstdint>
-#include <unordered_map>
+#include <string>
+#include <vector>
+
+#include "Vorbis_comment.hpp"
 
 using buffer_sample_type = int64_t;
 
@@ -29,12 +32,6 @@ struct Frame_info
     uint16_t crc_16{};
 };
 
-struct Vorbis_comment
-{
-    std::string vendor_string;
-    std::unordered_map<std::string, std::string> user_comments;
-};
-
 enum class block_type : uint8_t
 {
     STREAMINFO = 0,
@@ -45,3 +42,74 @@ enum class block_type : uint8_t
     CUESHEET = 5,
     PICTURE = 6
 };
+
+// Where the body of a metadata block sits in the file. Large blocks are described by
+// their location and read only when asked for, see Mapped_file and
+// Async_file_client::download_range.
+struct Block_location
+{
+    block_type type{};
+    uint64_t offset{}; // of the body, after the 4-byte block header
+    uint32_t length{};
+};
+
+struct Picture_info
+{
+    uint32_t picture_type{}; // 3 is the front cover
+    std::string mime_type;
+    std::string description;
+    uint32_t width{};
+    uint32_t height{};
+    uint32_t color_depth{};
+    uint32_t indexed_colors{};
+    uint64_t data_offset{}; // the image itself, in the file
+    uint32_t data_length{};
+};
+
+struct Application_info
+{
+    uint32_t id{}; // registered application id
+    uint64_t data_offset{};
+    uint32_t data_length{};
+};
+
+struct Seek_point
+{
+    uint64_t sample_number{};
+    uint64_t stream_offset{}; // bytes from the first frame
+    uint16_t frame_samples{};
+};
+
+struct Cue_index
+{
+    uint64_t offset{}; // samples, relative to the track
+    uint8_t number{};  // 0 is the pregap, 1 the start of the track proper
+};
+
+struct Cue_track
+{
+    uint64_t offset{}; // samples from the start of the stream
+    uint8_t number{};  // 170 (CD) or 255 marks the lead-out
+    std::string isrc;
+    bool is_audio{};
+    bool pre_emphasis{};
+    std::vector<Cue_index> indices;
+};
+
+// One track of a single-file album, as the cue sheet splits it
+struct Virtual_track
+{
+    uint8_t number{};
+    uint64_t start_sample{}; // INDEX 01
+    uint64_t end_sample{};   // start of the next track, or the lead-out
+    std::string isrc;
+};
+
+struct Cuesheet_info
+{
+    std::string media_catalog_number;
+    uint64_t lead_in_samples{};
+    bool is_cd{};
+    uint8_t track_count{};
+    Block_location location; // the track list
+};
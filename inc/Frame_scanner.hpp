@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "Flac_types.hpp"
+
+// A frame header found in a buffer
+struct Frame_location
+{
+    uint64_t offset{};       // of the sync code, from the start of the buffer
+    uint64_t first_sample{}; // per channel, from the start of the stream
+    uint32_t block_size{};
+    uint8_t header_size{}; // up to and including the CRC-8
+};
+
+// Finds FLAC frames in raw bytes without decoding them, for resynchronizing after
+// damaged data and for cutting streams that have no seek table into pieces.
+//
+// The sync pattern is searched 16 or 32 bytes at a time. A candidate counts as a
+// frame header when its reserved bits are clear, its CRC-8 matches and it agrees
+// with STREAMINFO; about one in a few thousand sync patterns in random audio data
+// still passes. find_confirmed_frame() also requires the next header to continue
+// the sample numbering, which rules those out.
+class Frame_scanner
+{
+private:
+    Stream_info m_stream_info;
+
+public:
+    // sync code, coded fields, a 7-byte frame number, 2-byte block size and rate, CRC-8
+    static constexpr size_t MAX_HEADER_SIZE = 16;
+
+    explicit Frame_scanner(const Stream_info &stream_info) : m_stream_info(stream_info) {}
+
+    // Offset of the first 0xFFF8 or 0xFFF9 at or after from, size if there is none
+    static size_t find_sync(const uint8_t *data, size_t size, size_t from = 0);
+
+    // The frame header at the start of data, if it is one
+    std::optional<Frame_location> parse_header(const uint8_t *data, size_t size) const;
+    // The first frame header at or after from
+    std::optional<Frame_location> find_frame(const uint8_t *data, size_t size, size_t from = 0) const;
+    // The first frame header at or after from that is followed in data by the header
+    // of the next frame
+    std::optional<Frame_location> find_confirmed_frame(const uint8_t *data, size_t size, size_t from = 0) const;
+    // Every frame header in data, in order
+    std::vector<Frame_location> scan(const uint8_t *data, size_t size) const;
+    // The last frame header in data that continues an earlier one; from the tail of a
+    // stream it gives the stream's length
+    std::optional<Frame_location> find_last_frame(const uint8_t *data, size_t size) const;
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Tag_index.hpp"
+
+struct Scan_report
+{
+    size_t files{};
+    size_t parsed{};
+    size_t reused{}; // unchanged since the previous index
+    size_t failed{};
+    uint64_t bytes_read{};
+    double seconds{};
+    std::vector<std::pair<std::string, std::string>> errors; // path, reason
+};
+
+// Indexes the FLAC files under a directory. Only the metadata blocks are read, with
+// a few pread calls per file instead of a stream, and files are parsed in parallel.
+class Library_scanner
+{
+private:
+    std::filesystem::path m_root;
+    size_t m_threads;
+
+public:
+    // first read per file; covers STREAMINFO and the tags of most files in one call
+    static constexpr size_t READ_SIZE = 64 * 1024;
+
+    // threads = 0 uses one per hardware thread
+    explicit Library_scanner(std::filesystem::path root, size_t threads = 0);
+
+    // Tracks whose size and mtime match an entry of previous are copied from it
+    // instead of being read again
+    std::vector<Indexed_track> scan(Scan_report &report, const Tag_index *previous = nullptr) const;
+
+    // Reads STREAMINFO and VORBIS_COMMENT of one file. On failure returns false and
+    // sets error; bytes_read is updated either way.
+    static bool read_track(const std::filesystem::path &path, Indexed_track &track, std::string &error, uint64_t &bytes_read);
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "Transfer_stats.hpp"
+
+struct Load_options
+{
+    std::string ip = "127.0.0.1";
+    int port = 0;
+    size_t sessions = 4;
+    std::chrono::milliseconds duration{10000}; // how long to run when operations is 0
+    uint64_t operations = 0;                   // over all sessions, 0 runs for duration instead
+    std::array<unsigned int, 3> mix{1, 8, 1};  // relative weights of LIST, GET and PUT
+    size_t file_size = 256 * 1024;             // of the files that are fetched and sent
+    size_t file_count = 16;                    // put on the server up front for GET
+    uint32_t seed = 1;
+};
+
+struct Load_report
+{
+    struct Command
+    {
+        uint64_t succeeded{};
+        uint64_t failed{};
+        uint64_t bytes{};
+        std::vector<uint32_t> latency_us; // of every operation that succeeded, sorted
+
+        // Exact, from the samples: the latency the given fraction of the operations stayed under
+        uint32_t percentile(double fraction) const;
+    };
+
+    std::array<Command, 3> commands; // by Transfer_kind
+    size_t sessions{};
+    double seconds{};
+
+    uint64_t operations() const;
+    double operations_per_second() const { return seconds > 0 ? operations() / seconds : 0; }
+
+    std::string to_json() const;
+};
+
+// Closed-loop load against a file server for capacity tests: sessions File_client
+// connections, each on a thread of its own with one request in flight, pick LIST,
+// GET and PUT at random by the weights of the mix and send the next request as soon
+// as the last one has finished. GETs fetch the load_get_* files uploaded before the
+// clock starts, PUTs overwrite one load_put_* file per session, so the server's
+// directory doesn't grow with the run. Latency is measured from sending a request
+// to its last byte, per command, with every sample kept so tail percentiles are exact.
+class Load_generator
+{
+private:
+    Load_options m_options;
+    std::filesystem::path m_work_dir; // payloads and downloads, removed afterwards
+
+    void seed_server(const std::filesystem::path &payload);
+
+public:
+    explicit Load_generator(Load_options options);
+    ~Load_generator();
+
+    Load_generator(const Load_generator &) = delete;
+    Load_generator &operator=(const Load_generator &) = delete;
+
+    // Throws std::runtime_error when the server can't be reached or seeded; failures
+    // during the run are counted per command instead
+    Load_report run();
+};
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string_view>
+
+// A whole file mapped read-only. Pages are only read from disk when they are touched,
+// so taking a slice of a large file (cover art at the start of a FLAC, say) costs the
+// pages of that slice only.
+class Mapped_file
+{
+private:
+    const char *m_data = nullptr;
+    size_t m_size{};
+    bool m_open = false;
+
+public:
+    Mapped_file() = default;
+    explicit Mapped_file(const std::filesystem::path &path) { open(path); }
+    ~Mapped_file() { close(); }
+
+    Mapped_file(const Mapped_file &) = delete;
+    Mapped_file &operator=(const Mapped_file &) = delete;
+    Mapped_file(Mapped_file &&other) noexcept;
+    Mapped_file &operator=(Mapped_file &&other) noexcept;
+
+    // Throws std::runtime_error if the file can't be opened or mapped
+    void open(const std::filesystem::path &path);
+    void close();
+
+    bool is_open() const { return m_open; }
+    const char *data() const { return m_data; }
+    size_t size() const { return m_size; }
+    // Throws std::out_of_range if the range isn't inside the file
+    std::string_view range(uint64_t offset, uint64_t length) const;
+};
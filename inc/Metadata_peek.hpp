@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <string>
+#include <vector>
+
+#include "Async_file_client.hpp"
+#include "Flac_types.hpp"
+
+struct Track_metadata
+{
+    Stream_info stream_info{};
+    Vorbis_comment vorbis_comment;
+    // "fLaC" followed by the STREAMINFO, SEEKTABLE and VORBIS_COMMENT blocks, enough
+    // for Flac::initialize()
+    std::vector<char> header;
+    // PICTURE, CUESHEET and APPLICATION blocks, when the peeker locates blocks
+    std::vector<Block_location> blocks;
+    uint64_t bytes_fetched{};
+
+    double duration() const
+    {
+        return stream_info.sample_rate == 0 ? 0.0 : static_cast<double>(stream_info.total_samples) / stream_info.sample_rate;
+    }
+};
+
+struct Peek_result
+{
+    std::string filename;
+    bool success = false;
+    std::string error;
+    Track_metadata metadata;
+};
+
+using Peek_callback = std::function<void(Peek_result)>;
+
+// Reads the metadata of remote FLAC files with ranged downloads instead of fetching
+// whole files. The metadata blocks are walked header by header; blocks that aren't
+// needed (pictures, padding) are skipped over without being downloaded. Peeks run
+// concurrently on the client's connections.
+class Metadata_peeker
+{
+private:
+    struct Peek;
+
+    Async_file_client &m_client;
+    size_t m_initial_range;
+    bool m_locate_blocks = false;
+
+    void fetch(std::shared_ptr<Peek> peek, uint64_t offset, uint64_t length);
+    void advance(std::shared_ptr<Peek> peek);
+    void finish(std::shared_ptr<Peek> peek);
+
+public:
+    // enough for STREAMINFO, a typical seek table and tags, and the start of the padding
+    static constexpr size_t DEFAULT_INITIAL_RANGE = 16 * 1024;
+    static constexpr size_t MAX_FETCHES = 16; // per file, guards against corrupt block lengths
+
+    explicit Metadata_peeker(Async_file_client &client, size_t initial_range = DEFAULT_INITIAL_RANGE)
+        : m_client(client), m_initial_range(initial_range) {}
+
+    // The callback runs on a loop thread of the client and must not block
+    void peek(const std::string &filename, Peek_callback on_complete);
+    std::future<Peek_result> peek(const std::string &filename);
+    // Starts every peek at once and waits for all of them
+    std::vector<Peek_result> peek_all(const std::vector<std::string> &filenames);
+
+    // Also walk past the tags to the last block and record where the large blocks are.
+    // Costs a small extra fetch per file when art sits beyond the first range.
+    void set_locate_blocks(bool locate) { m_locate_blocks = locate; }
+    // Downloads the body of a located block, e.g. cover art for Flac_metadata::parse_picture
+    std::future<Transfer_result> fetch_block(const std::string &filename, const Block_location &block);
+};
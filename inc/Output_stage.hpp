@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Sample formats the output can negotiate with the device, in the device's byte order
+// (little-endian)
+enum class Sample_format : uint8_t
+{
+    S16,
+    S24_3LE, // packed 3 bytes per sample
+    S32,
+    FLOAT
+};
+
+size_t bytes_per_sample(Sample_format format);
+const char *format_name(Sample_format format);
+// Formats worth trying for a stream of this bit depth, best first
+std::vector<Sample_format> preferred_formats(uint8_t bits_per_sample);
+
+// Linear gain in Q3.29 fixed point: unity is 1 << 29 and the largest gain is just
+// under 4 (+12 dB), enough for the boost ReplayGain asks for on quiet tracks
+using Fixed_gain = int32_t;
+constexpr Fixed_gain UNITY_GAIN = Fixed_gain{1} << 29;
+// Clamps to the representable range
+Fixed_gain to_fixed_gain(double linear);
+
+// Packs interleaved samples that are left-justified in 32 bits (as the decoder and
+// resampler produce them) into format, scaled by gain on the way. S16 and S24 drop
+// the low bits; a gain that would push a sample past full scale saturates it. Uses
+// SSE2 / SSSE3 / SSE4.1 / NEON where the CPU has them.
+void pack_samples(const int32_t *in, size_t count, Sample_format format, char *out, Fixed_gain gain = UNITY_GAIN);
+// Plain C++ version of pack_samples, the reference for tests and benchmarks
+void pack_samples_reference(const int32_t *in, size_t count, Sample_format format, char *out, Fixed_gain gain = UNITY_GAIN);
+const char *pack_kernel_name(Sample_format format, bool with_gain = false);
+
+// The gain of the output, applied while packing. A new target is reached over the
+// frames of the next pack() call, i.e. one period, in RAMP_STEPS even steps so the
+// change doesn't click.
+class Gain_stage
+{
+private:
+    Fixed_gain m_current = UNITY_GAIN;
+    Fixed_gain m_target = UNITY_GAIN;
+
+public:
+    static constexpr size_t RAMP_STEPS = 64;
+
+    void set_target(Fixed_gain gain) { m_target = gain; }
+    // Takes the target without a ramp, for when the stream restarts anyway
+    void settle() { m_current = m_target; }
+    Fixed_gain current() const { return m_current; }
+    Fixed_gain target() const { return m_target; }
+    bool is_unity() const { return m_current == UNITY_GAIN && m_target == UNITY_GAIN; }
+
+    // Packs frames of channels samples into out, sized for them by the caller
+    void pack(const int32_t *in, size_t frames, uint8_t channels, Sample_format format, char *out);
+};
+
+// Maps the stream's channels onto what the device offers. Multichannel FLAC
+// (3.0 to 7.1, in FLAC channel order) folds down to stereo with the ITU-R BS.775
+// coefficients: centre and surrounds at -3 dB, LFE dropped, and the result scaled
+// so a full-scale input can't clip. Mono is copied to both sides.
+class Channel_mixer
+{
+private:
+    uint8_t m_in_channels;
+    uint8_t m_out_channels;
+    std::vector<float> m_matrix; // m_out_channels rows of m_in_channels
+
+public:
+    Channel_mixer(uint8_t in_channels, uint8_t out_channels);
+
+    // true when the channels pass through unchanged and process() need not be called
+    bool passthrough() const { return m_in_channels == m_out_channels; }
+    uint8_t in_channels() const { return m_in_channels; }
+    uint8_t out_channels() const { return m_out_channels; }
+    float coefficient(uint8_t out_channel, uint8_t in_channel) const { return m_matrix[out_channel * m_in_channels + in_channel]; }
+
+    // Replaces out with frames mixed frames
+    void process(const int32_t *in, size_t frames, std::vector<int32_t> &out) const;
+
+    // Whether a stream with in_channels can be mixed for a device with out_channels
+    static bool can_mix(uint8_t in_channels, uint8_t out_channels);
+};
@@ -0,0 +1,201 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <iosfwd>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Audio_sink.hpp"
+#include "Output_stage.hpp"
+#include "Playback_stats.hpp"
+#include "Replay_gain.hpp"
+#include "Resampler.hpp"
+
+struct Playback_item
+{
+    std::string name;            // as the user knows it
+    std::filesystem::path path;  // local file to decode
+    int start_track = 0;         // track of an embedded cue sheet, 0 for the start
+    std::chrono::steady_clock::duration fetch_time{}; // spent getting the file local, for the stats
+};
+
+// Acted on by the playback loop, which sleeps in poll() until the sink wants
+// samples, input_fd is readable or notify() is called
+struct Playback_controls
+{
+    std::atomic<bool> paused{false};
+    std::atomic<bool> stop{false};
+    std::atomic<int> track_step{0}; // cue sheet tracks to move by
+    std::atomic<int> volume_step{0}; // VOLUME_STEP_DB steps to move the volume by
+
+    // Optional: called on the playback thread whenever input_fd is readable, to
+    // turn the input into changes of the fields above
+    int input_fd = -1;
+    std::function<void()> on_input;
+
+    Playback_controls();
+    ~Playback_controls();
+
+    Playback_controls(const Playback_controls &) = delete;
+    Playback_controls &operator=(const Playback_controls &) = delete;
+
+    // Wakes the playback loop after a field was changed from another thread
+    void notify();
+    int event_fd() const { return m_event_fd; }
+    // reads the pending wake-ups off the eventfd
+    void clear_events();
+
+private:
+    int m_event_fd = -1;
+};
+
+// Owns the audio sink (the PCM device, or a stand-in, see Audio_sink) across tracks.
+// Consecutive tracks of the same rate and channel count are written into one
+// running stream, the next decoder being opened ahead of time so no silence ends up
+// between them. The sink is only set up again when the format changes, or when a
+// track has more bits than the sink's format holds.
+//
+// On the way out samples are mixed down to the channels the sink has, resampled
+// to its rate and packed into the sample format it settled on. ReplayGain and the
+// volume are applied in that same packing pass. How long each stage takes goes
+// into the stats, whichever sink plays.
+//
+// In real-time mode play() runs under SCHED_FIFO with memory locked. Every buffer is
+// sized and touched before the first write, and whatever may block is left to two
+// helper threads started beforehand: one opens the upcoming track and hands it over
+// through a single lock-free slot, the other prints the status lines the loop queues
+// without locking and closes finished tracks. So while a track plays, and across a
+// gapless change to a track of the same format, the loop neither allocates nor locks.
+// Outside that are setting the sink up again for another format, recovering from a
+// damaged frame and whatever controls.on_input does.
+class Playback_engine
+{
+public:
+    // Hands out the next item to play, nullopt when there is none. Runs on a helper
+    // thread while the current track is still playing. cancel is set once playback
+    // is stopped; one that waits for a download should give up then.
+    using Next_item = std::function<std::optional<Playback_item>(const std::atomic<bool> *cancel)>;
+    // Called once an item is no longer needed, played to the end or not; on a helper
+    // thread while playback goes on
+    using Item_finished = std::function<void(const Playback_item &)>;
+    using Clock = std::chrono::steady_clock;
+
+    // open the next track this long before the current one ends
+    static constexpr auto PRIME_AHEAD = std::chrono::seconds(5);
+    static constexpr double VOLUME_STEP_DB = 2;
+    static constexpr int DEFAULT_REALTIME_PRIORITY = 70;
+    static constexpr double MIN_VOLUME_DB = -60;
+
+private:
+    struct Open_track;
+    class Helper;
+
+    std::unique_ptr<Audio_sink> m_sink;
+    Resampler_quality m_quality;
+    Pcm_format m_format{};
+    unsigned int m_device_rate{};
+    uint8_t m_device_channels{};
+    Sample_format m_sample_format = Sample_format::S32;
+    // set when the device has fewer channels than the stream
+    std::unique_ptr<Channel_mixer> m_mixer;
+    std::vector<int32_t> m_mixed;
+    // set when the device settled on another rate than the stream's
+    std::unique_ptr<Resampler> m_resampler;
+    std::vector<int32_t> m_resampled;
+    std::vector<char> m_packed;
+    Gain_stage m_gain;
+    Replay_gain_mode m_replay_gain_mode = Replay_gain_mode::TRACK;
+    double m_preamp_db = 0;
+    double m_track_gain = 1; // ReplayGain of the playing track, linear
+    double m_volume_db = 0;
+    bool m_device_paused = false;
+    size_t m_negotiations{};
+    unsigned int m_period_ms = 100;
+    size_t m_period_frames{};
+    std::vector<pollfd> m_poll_fds; // controls event fd, input fd, then the sink's
+    Playback_controls *m_controls = nullptr; // during play()
+    Helper *m_helper = nullptr;              // during play()
+    std::thread::id m_playback_thread;       // the one that runs play()
+    bool m_can_step = false;                 // whether the playing track has a cue sheet
+    bool m_realtime = false;
+    int m_realtime_priority = DEFAULT_REALTIME_PRIORITY;
+    Playback_stats m_stats;
+    Clock::duration m_waited{}; // spent in poll(), told apart from the time spent working
+
+    enum class Write_status
+    {
+        DONE,
+        INTERRUPTED, // stopped or skipped, what is left of the samples is dropped
+        FAILED       // the device failed for good
+    };
+
+    // Prints a status line to out; from the playback loop during play() it is queued
+    // for the helper instead, and dropped when the queue is full
+    void post(std::ostream &out, const char *format, ...) __attribute__((format(printf, 3, 4)));
+    // moves the output gain towards ReplayGain times volume over the next period
+    void update_gain();
+    // takes the ReplayGain of a track that starts playing
+    void start_gain(const Open_track &track);
+    void close_device();
+    Write_status write(const std::vector<int32_t> &samples);
+    // frames of m_device_channels samples each; sits out a pause on the way
+    Write_status write_frames(const int32_t *samples, size_t frames);
+    void flush();
+    // Plays out everything queued, including what is still inside the resampler.
+    // false if playback was stopped meanwhile.
+    bool drain();
+    // Sleeps until a control event arrives or, with device set, the sink wants
+    // samples. Handles input and volume changes. Returns true when the sink woke us.
+    bool wait(bool device, int timeout_ms = -1);
+    // how late the last wakeup for the device came, into the stats
+    void record_wakeup();
+    // whether the controls ask for the current write to be abandoned
+    bool interrupted();
+    // holds the device paused until the controls resume or stop playback
+    void pause();
+    // sizes and touches the output buffers for blocks of up to max_frames
+    void reserve_buffers(size_t max_frames);
+
+public:
+    explicit Playback_engine(std::unique_ptr<Audio_sink> sink, Resampler_quality quality = Resampler_quality::BALANCED)
+        : m_sink(std::move(sink)), m_quality(quality) {}
+    ~Playback_engine();
+
+    Playback_engine(const Playback_engine &) = delete;
+    Playback_engine &operator=(const Playback_engine &) = delete;
+
+    // Opens or re-opens the sink for format. Keeps the running stream, and returns
+    // false, when the sink already plays format without loss. Throws std::runtime_error.
+    bool configure(const Pcm_format &format);
+
+    // Plays first, then every item next_item hands out, back to back.
+    // Returns false when playback was stopped through controls.
+    bool play(Playback_item first, const Next_item &next_item, const Item_finished &on_finished, Playback_controls &controls);
+
+    void set_replay_gain(Replay_gain_mode mode, double preamp_db = 0);
+    // Opt-in; falls back to normal scheduling where the process isn't permitted
+    void set_realtime(bool enabled, int priority = DEFAULT_REALTIME_PRIORITY);
+    // Clamped to MIN_VOLUME_DB..0 dB, where MIN_VOLUME_DB mutes; on top of ReplayGain
+    void set_volume_db(double volume_db);
+    double volume_db() const { return m_volume_db; }
+
+    const Audio_sink &sink() const { return *m_sink; }
+    const Pcm_format &format() const { return m_format; }
+    // The rate the sink actually runs at; the stream is resampled when it differs
+    // from format().sample_rate
+    unsigned int device_rate() const { return m_device_rate; }
+    uint8_t device_channels() const { return m_device_channels; }
+    Sample_format sample_format() const { return m_sample_format; }
+    // How often the sink has been set up, for checking that tracks were spliced
+    size_t negotiations() const { return m_negotiations; }
+    // xruns, wakeup lateness, the decode headroom per block and the time per pipeline
+    // stage, over the engine's life
+    const Playback_stats &stats() const { return m_stats; }
+};
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include "Transfer_stats.hpp"
+
+// The pipeline from file to sink. FETCH and OPEN are timed per track, the others
+// per block: the decode of a frame, mixing, resampling and packing it, handing it
+// to the sink, and waiting for the sink to take more.
+enum class Playback_stage : uint8_t
+{
+    FETCH,
+    OPEN,
+    DECODE,
+    CONVERT,
+    OUTPUT,
+    WAIT
+};
+
+// Counters of the playback loop. Recorded with relaxed atomics like Transfer_stats,
+// so the audio thread never takes a lock for them.
+class Playback_stats
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+private:
+    static constexpr size_t STAGES = 6;
+
+    std::atomic<uint64_t> m_xruns{0};
+    std::atomic<uint64_t> m_played_us{0}; // play time of the blocks written
+    Histogram m_wakeup_late_us; // how long after its period boundary poll() returned
+    Histogram m_load_permille;  // time spent producing a block against its play time
+    std::array<Histogram, STAGES> m_stage_us;
+
+public:
+    void record_xrun();
+    void record_wakeup(uint64_t late_us);
+    void record_block(Clock::duration busy, Clock::duration play_time);
+    void record_stage(Playback_stage stage, Clock::duration time);
+
+    uint64_t xruns() const { return m_xruns.load(std::memory_order_relaxed); }
+    uint64_t worst_wakeup_us() const { return m_wakeup_late_us.max(); }
+    // The share of a block's play time left over in the tightest block, 1 before any
+    double min_headroom() const;
+    double played_seconds() const { return m_played_us.load(std::memory_order_relaxed) / 1e6; }
+    const Histogram &stage_us(Playback_stage stage) const { return m_stage_us[static_cast<size_t>(stage)]; }
+
+    // One line with the audio played and the total time of every stage, for benchmarks
+    std::string summary() const;
+
+    std::string to_json() const;
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "File_client.hpp"
+
+// Play queue that downloads the next few queued tracks in the background,
+// on its own connection, so that they are already on disk when their turn comes.
+class Prefetcher
+{
+private:
+    enum class Track_state : uint8_t
+    {
+        QUEUED,
+        DOWNLOADING,
+        READY,
+        FAILED
+    };
+
+    File_client m_client;
+    fs::path m_save_dir;
+    size_t m_depth;
+    size_t m_rate_limit;
+
+    std::deque<std::string> m_queue;
+    std::unordered_map<std::string, Track_state> m_tracks;
+    bool m_foreground_busy = false;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::atomic<bool> m_stop{false};
+    std::thread m_worker;
+
+    void worker_loop();
+    std::optional<std::string> pick_next_download();
+
+public:
+    // how often a waiting acquire() looks at its cancel flag
+    static constexpr auto CANCEL_CHECK_INTERVAL = std::chrono::milliseconds(50);
+
+    Prefetcher(const std::string &server_ip, int server_port, const fs::path &save_dir,
+               size_t depth, size_t rate_limit);
+    ~Prefetcher();
+
+    Prefetcher(const Prefetcher &) = delete;
+    Prefetcher &operator=(const Prefetcher &) = delete;
+
+    // play queue
+    void enqueue(const std::string &filename);
+    std::optional<std::string> pop_next();
+    // Puts a popped track back at the head of the queue, for a play that was cancelled
+    // before it started; whatever acquire() left of it on disk is removed
+    void requeue_front(const std::string &filename);
+    size_t queue_size();
+    std::deque<std::string> queued_tracks();
+
+    // Returns the local path once the track is on disk, downloading it first if needed.
+    // Tracks that aren't known to the prefetcher are fetched over foreground_client.
+    // Gives up, returning nullopt, once cancel is set.
+    std::optional<fs::path> acquire(const std::string &filename, File_client &foreground_client,
+                                    const std::atomic<bool> *cancel = nullptr);
+    // Deletes the local copy after the track has been played
+    void release(const std::string &filename);
+
+    fs::path local_path(const std::string &filename) const { return m_save_dir / filename; }
+    File_client &get_client() { return m_client; }
+};
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Wire format shared by the client and the server.
+//
+// Legacy mode: bare commands ("LIST", "GET <name>", "PUT <name>") with one request
+// in flight per connection and 4-byte big-endian sizes in front of response bodies.
+//
+// Framed mode: after the client sends framed_hello and the server answers "OK",
+// every message is a 9-byte header (payload length, request id, frame type) followed
+// by the payload. Requests can be pipelined and responses arrive in any order,
+// matched by request id; large bodies are split into DATA frames.
+//
+// Listings are text, one file per line. Servers may add tab-separated fields after
+// the name (size, unix mtime, duration in seconds, then key=value tags; any may be
+// empty) and a first line "#version <token>". A framed LIST whose payload is such a
+// token asks only for the changes since then; the answer starts "#version <new> delta"
+// and every line is "+<entry>" (added or changed) or "-<name>" (removed). Servers
+// that don't keep history simply answer with the full listing.
+namespace Protocol
+{
+    static constexpr const char *framed_hello = "FRAMED 1";
+    static constexpr const char *framed_accept = "OK";
+
+    static constexpr size_t frame_header_size = 9;
+    static constexpr uint32_t max_frame_payload = 1 << 20;
+    static constexpr uint32_t data_chunk_size = 64 * 1024;
+    static constexpr uint64_t unknown_size = UINT64_MAX;
+
+    static constexpr const char *catalog_version_prefix = "#version ";
+    static constexpr const char *catalog_delta_suffix = " delta";
+
+    enum class Frame_type : uint8_t
+    {
+        // client to server
+        LIST = 0x01,      // empty, or the catalog version to list changes since
+        GET = 0x02,       // file name
+        PUT_BEGIN = 0x03, // u64 file size (or unknown_size), then the file name
+        PUT_DATA = 0x04,  // chunk of the file body
+        PUT_END = 0x05,   // empty payload
+        GET_RANGE = 0x06, // u64 offset, u64 length, then the file name; answered like GET
+
+        // server to client
+        BEGIN = 0x81, // u64 body size, precedes the DATA frames of a GET
+        DATA = 0x82,  // chunk of a response body
+        END = 0x83,   // response body complete
+        OK = 0x84,    // request completed without a body
+        ERROR = 0x85  // request failed, payload is the error message
+    };
+
+    struct Frame_header
+    {
+        uint32_t length{};
+        uint32_t request_id{};
+        Frame_type type{};
+    };
+
+    inline void append_u32(std::vector<char> &out, uint32_t value)
+    {
+        for (int shift = 24; shift >= 0; shift -= 8)
+        {
+            out.push_back(static_cast<char>((value >> shift) & 0xFF));
+        }
+    }
+
+    inline void append_u64(std::vector<char> &out, uint64_t value)
+    {
+        append_u32(out, static_cast<uint32_t>(value >> 32));
+        append_u32(out, static_cast<uint32_t>(value));
+    }
+
+    inline uint32_t read_u32(const char *data)
+    {
+        const auto *bytes = reinterpret_cast<const uint8_t *>(data);
+        return (uint32_t(bytes[0]) << 24) | (uint32_t(bytes[1]) << 16) | (uint32_t(bytes[2]) << 8) | bytes[3];
+    }
+
+    inline uint64_t read_u64(const char *data)
+    {
+        return (uint64_t(read_u32(data)) << 32) | read_u32(data + 4);
+    }
+
+    inline Frame_header decode_header(const char *data)
+    {
+        return {read_u32(data), read_u32(data + 4), static_cast<Frame_type>(data[8])};
+    }
+
+    // Builds a complete frame; the payload is copied after the header
+    inline std::vector<char> make_frame(Frame_type type, uint32_t request_id, const char *payload = nullptr, size_t length = 0)
+    {
+        std::vector<char> frame;
+        frame.reserve(frame_header_size + length);
+        append_u32(frame, static_cast<uint32_t>(length));
+        append_u32(frame, request_id);
+        frame.push_back(static_cast<char>(type));
+        frame.insert(frame.end(), payload, payload + length);
+        return frame;
+    }
+
+    inline std::vector<char> make_frame(Frame_type type, uint32_t request_id, const std::string &payload)
+    {
+        return make_frame(type, request_id, payload.data(), payload.size());
+    }
+}
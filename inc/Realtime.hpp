@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <sched.h>
+#include <vector>
+
+// Puts the calling thread in real-time shape for as long as the object lives: a
+// SCHED_FIFO priority (SCHED_RR if FIFO is refused) and all memory locked, so the
+// scheduler and page faults can't stall it. Each step is skipped when the process
+// lacks the permission (CAP_SYS_NICE or RLIMIT_RTPRIO, RLIMIT_MEMLOCK); the
+// accessors say what was granted.
+class Realtime_scope
+{
+private:
+    int m_old_policy = SCHED_OTHER;
+    sched_param m_old_param{};
+    int m_policy = SCHED_OTHER;
+    int m_priority = 0;
+    bool m_memory_locked = false;
+
+public:
+    static constexpr size_t STACK_PREFAULT = 256 * 1024;
+
+    explicit Realtime_scope(int priority);
+    ~Realtime_scope();
+
+    Realtime_scope(const Realtime_scope &) = delete;
+    Realtime_scope &operator=(const Realtime_scope &) = delete;
+
+    bool scheduled() const { return m_policy != SCHED_OTHER; }
+    bool memory_locked() const { return m_memory_locked; }
+    int priority() const { return m_priority; }
+    const char *policy_name() const;
+
+    // Threads inherit the policy of the thread that starts them; helpers started
+    // from a real-time thread call this to go back to normal scheduling
+    static void demote_current_thread();
+    // Maps STACK_PREFAULT bytes of the calling thread's stack ahead of use
+    static void prefault_stack();
+};
+
+// Grows the allocation of buffer to count elements and touches every page of it,
+// leaving its size as it was
+template <typename T>
+void prefault(std::vector<T> &buffer, size_t count)
+{
+    size_t size = buffer.size();
+    if (size < count)
+    {
+        buffer.resize(count);
+        buffer.resize(size);
+    }
+}
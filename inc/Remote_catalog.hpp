@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+struct Catalog_entry
+{
+    std::string name;
+    std::optional<uint64_t> size;
+    std::optional<int64_t> mtime;    // unix seconds
+    std::optional<double> duration;  // seconds
+    std::vector<std::pair<std::string, std::string>> tags;
+};
+
+// The server's file listing, parsed. Entries are kept sorted by name for prefix
+// search, with a hash index on top for exact lookups. Listings with a version token
+// can later be refreshed with just the changes, see Protocol.hpp for the format.
+class Remote_catalog
+{
+private:
+    // lets the index be queried with a string_view without building a string
+    struct Name_hash
+    {
+        using is_transparent = void;
+        size_t operator()(std::string_view name) const { return std::hash<std::string_view>{}(name); }
+    };
+
+    std::vector<Catalog_entry> m_entries; // sorted by name
+    std::unordered_map<std::string, size_t, Name_hash, std::equal_to<>> m_index; // name -> position in m_entries
+    std::string m_version;
+
+    void rebuild_index();
+
+public:
+    // Applies a full listing or a delta. Returns false if a delta arrives for a
+    // catalog that has no version yet, in which case nothing changes.
+    bool apply(std::string_view listing);
+    void clear();
+    // Fills in what the listing didn't say, e.g. from a metadata peek. The details stay
+    // until the next listing or delta replaces the entry.
+    bool set_details(std::string_view name, double duration, std::vector<std::pair<std::string, std::string>> tags);
+
+    const Catalog_entry *find(std::string_view name) const;
+    bool contains(std::string_view name) const { return find(name) != nullptr; }
+    // All entries whose name starts with prefix, in name order
+    std::span<const Catalog_entry> find_prefix(std::string_view prefix) const;
+
+    const std::vector<Catalog_entry> &entries() const { return m_entries; }
+    size_t size() const { return m_entries.size(); }
+    bool empty() const { return m_entries.empty(); }
+    // Token to send with the next refresh, empty if the server doesn't version its listing
+    const std::string &version() const { return m_version; }
+
+    // Parses one listing line (without the +/- marker); false for empty names
+    static bool parse_entry(std::string_view line, Catalog_entry &entry);
+};
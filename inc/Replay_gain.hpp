@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+#include "Vorbis_comment.hpp"
+
+enum class Replay_gain_mode : uint8_t
+{
+    OFF,
+    TRACK,
+    ALBUM
+};
+
+// The REPLAYGAIN_* fields of a track. Gains are in dB ("-6.54 dB"), peaks are linear
+// with 1.0 at full scale.
+struct Replay_gain
+{
+    std::optional<double> track_gain;
+    std::optional<double> track_peak;
+    std::optional<double> album_gain;
+    std::optional<double> album_peak;
+
+    // Fields that are missing or don't parse stay unset
+    static Replay_gain from_comments(const Vorbis_comment &comments);
+
+    // The linear factor for mode plus preamp_db, lowered where needed so the tagged
+    // peak stays below full scale. Album mode falls back to the track values and the
+    // other way round; 1 when there are none.
+    double factor(Replay_gain_mode mode, double preamp_db = 0) const;
+};
+
+// A tag value such as "-6.54 dB" or "+1.2", nullopt if it doesn't start with a number
+std::optional<double> parse_replay_gain_value(std::string_view text);
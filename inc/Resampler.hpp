@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+enum class Resampler_quality : uint8_t
+{
+    FAST,     // 16 taps, about 80 dB stopband, passband to 85% of Nyquist
+    BALANCED, // 32 taps, about 100 dB, to 91%
+    BEST      // 64 taps, about 120 dB, to 95%
+};
+
+// Polyphase windowed-sinc sample rate converter for interleaved samples that are
+// left-justified in 32 bits, as the decoder produces them. The ratio is kept exact:
+// out_rate/in_rate is reduced to L/M and each output sample takes one of L filter
+// phases over the input. The inner product runs on the widest vector unit the CPU
+// has (AVX2/FMA or SSE2 on x86, NEON on ARM), picked at construction.
+//
+// State carries over between process() calls, so a stream can be fed in any chunk
+// sizes and consecutive tracks of one format splice without a seam.
+class Resampler
+{
+private:
+    using Dot_product = float (*)(const float *coefficients, const float *samples, size_t taps);
+
+    uint32_t m_in_rate;
+    uint32_t m_out_rate;
+    uint8_t m_channels;
+    uint32_t m_up;   // L
+    uint32_t m_down; // M
+    size_t m_taps;
+    std::vector<float> m_coefficients; // m_up phases of m_taps each
+    Dot_product m_dot;
+
+    std::vector<std::vector<float>> m_history; // per channel: unconsumed input, oldest first
+    size_t m_index{};                            // first input sample under the filter
+    uint32_t m_phase{};
+    uint64_t m_input_frames{};  // since the last reset
+    uint64_t m_output_frames{};
+
+public:
+    // largest reduced interpolation factor; covers every pair of the usual rates
+    static constexpr uint32_t MAX_PHASES = 4096;
+
+    // Throws std::invalid_argument for rates whose ratio needs more than MAX_PHASES phases
+    Resampler(uint32_t in_rate, uint32_t out_rate, uint8_t channels, Resampler_quality quality = Resampler_quality::BALANCED);
+
+    // Appends the output for frames interleaved input frames to out
+    void process(const int32_t *in, size_t frames, std::vector<int32_t> &out);
+    // Sizes the history for process() calls of up to max_frames, so they don't allocate
+    void reserve(size_t max_frames);
+    // Output frames that max_frames of input can produce at most
+    size_t max_output_frames(size_t max_frames) const;
+    // Pushes silence through the filter so the last input samples come out too
+    void drain(std::vector<int32_t> &out);
+    // Forgets all buffered input, e.g. after a seek
+    void reset();
+
+    uint32_t in_rate() const { return m_in_rate; }
+    uint32_t out_rate() const { return m_out_rate; }
+    uint8_t channels() const { return m_channels; }
+    size_t taps() const { return m_taps; }
+    uint32_t phases() const { return m_up; }
+    // Delay added by the filter, in input frames
+    size_t latency() const { return m_taps / 2 - 1; }
+    // Name of the inner product implementation in use
+    const char *kernel_name() const;
+};
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+class Async_file_client;
+
+struct Server_endpoint
+{
+    std::string ip;
+    int port{};
+
+    bool operator==(const Server_endpoint &other) const = default;
+};
+
+// Finds file servers from their multicast announcements ("<name>:<port>[:<load>]").
+// Startup goes straight to the last server that worked if it still answers, while a
+// background listener keeps track of every server it hears about so clients can fail
+// over to the best remaining one.
+class Server_discovery
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Server_info
+    {
+        Server_endpoint endpoint;
+        double load{}; // announced load, 0 (idle) to 1 (saturated)
+        std::optional<std::chrono::microseconds> rtt;
+        Clock::time_point last_seen{}; // last announcement, or the probe that found it cached
+        bool failed = false;
+    };
+
+    static constexpr const char *DISCOVERY_GROUP = "239.255.255.250";
+    static constexpr int DISCOVERY_PORT = 8888;
+    // how often File_server announces itself; servers silent for STALE_AFTER are passed over
+    static constexpr auto ANNOUNCE_INTERVAL = std::chrono::seconds(1);
+    static constexpr auto STALE_AFTER = 5 * ANNOUNCE_INTERVAL;
+
+private:
+    std::filesystem::path m_cache_path;
+    std::vector<Server_info> m_servers;
+    std::optional<Server_endpoint> m_current;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::atomic<bool> m_stop{false};
+    std::thread m_listener;
+
+    void listen_loop();
+    void record_announcement(const Server_endpoint &endpoint, double load);
+    Server_info &find_or_add(const Server_endpoint &endpoint);
+    std::optional<Server_endpoint> pick_best_locked();
+    std::optional<Server_endpoint> load_cache() const;
+    void save_cache(const Server_endpoint &endpoint) const;
+
+public:
+    explicit Server_discovery(const std::filesystem::path &cache_path = default_cache_path());
+    ~Server_discovery();
+
+    Server_discovery(const Server_discovery &) = delete;
+    Server_discovery &operator=(const Server_discovery &) = delete;
+
+    // Starts the background listener
+    void start();
+    void stop();
+
+    // Returns the cached server if it answers a probe right away, otherwise waits up to
+    // timeout for announcements and picks the best one. Throws when nothing was found.
+    Server_endpoint find_server(std::chrono::milliseconds timeout = std::chrono::seconds(5));
+
+    // Marks the server as unreachable and switches to the best remaining one
+    std::optional<Server_endpoint> fail_over(const Server_endpoint &failed);
+    // Points the client at the next best server whenever it can't connect
+    void watch(Async_file_client &client);
+
+    std::vector<Server_info> get_servers();
+    std::optional<Server_endpoint> get_current();
+
+    // Measures TCP connect time to the server
+    static std::optional<std::chrono::microseconds> probe(const Server_endpoint &endpoint,
+                                                          std::chrono::milliseconds timeout);
+    // Parses "<name>:<port>[:<load>]", load in percent of the server's connection
+    // limit (0-100, fractions allowed) and returned as a fraction
+    static bool parse_announcement(const std::string &message, int &port, double &load);
+    static std::filesystem::path default_cache_path();
+};
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "Flac_types.hpp"
+#include "Mapped_file.hpp"
+
+struct Indexed_track
+{
+    std::string path; // relative to the library root
+    uint64_t file_size{};
+    int64_t mtime{}; // unix seconds
+    Stream_info stream_info{};
+    std::vector<std::pair<std::string, std::string>> tags; // field names upper-cased
+};
+
+// Read-only, memory-mapped index of a local library. The file is used in place:
+//
+//   header | track records (sorted by path) | tag records | string offsets | string bytes
+//
+// Every string (paths, field names, values) is stored once in a sorted table and
+// referenced by id, so lookups by path or tag become binary searches plus integer
+// compares. Integers are little-endian; the index is rebuilt rather than converted
+// on other byte orders.
+class Tag_index
+{
+public:
+    struct Track
+    {
+        std::string_view path;
+        uint64_t file_size{};
+        int64_t mtime{};
+        uint32_t sample_rate{};
+        uint8_t channels{};
+        uint8_t bits_per_sample{};
+        uint64_t total_samples{};
+
+        double duration() const { return sample_rate == 0 ? 0.0 : static_cast<double>(total_samples) / sample_rate; }
+    };
+
+private:
+    struct File_header;
+    struct Track_record;
+    struct Tag_record;
+
+    Mapped_file m_file;
+
+    const File_header *m_header = nullptr;
+    const Track_record *m_tracks = nullptr;
+    const Tag_record *m_tags = nullptr;
+    const uint32_t *m_string_offsets = nullptr;
+    const char *m_string_bytes = nullptr;
+
+    std::string_view string_at(uint32_t id) const;
+    std::optional<uint32_t> string_id(std::string_view text) const;
+    void close();
+
+public:
+    Tag_index() = default;
+
+    Tag_index(const Tag_index &) = delete;
+    Tag_index &operator=(const Tag_index &) = delete;
+
+    // Maps the index; throws std::runtime_error if the file is missing or malformed
+    void open(const std::filesystem::path &path);
+    bool is_open() const { return m_header != nullptr; }
+
+    size_t size() const;
+    Track track(size_t index) const;
+    std::vector<std::pair<std::string_view, std::string_view>> tags(size_t index) const;
+    // Field names are matched case-insensitively
+    std::optional<std::string_view> tag(size_t index, std::string_view name) const;
+
+    std::optional<size_t> find_path(std::string_view path) const;
+    // Tracks with an exact tag value, in path order
+    std::vector<size_t> find(std::string_view name, std::string_view value) const;
+
+    // Writes a new index atomically (temporary file, then rename); throws on I/O errors
+    static void write(const std::filesystem::path &path, std::vector<Indexed_track> tracks);
+};
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Power-of-two bucket histogram that any thread can record into without locking.
+// Bucket 0 counts zeros, bucket i counts values in [2^(i-1), 2^i).
+class Histogram
+{
+public:
+    static constexpr size_t BUCKETS = 40;
+
+private:
+    std::array<std::atomic<uint64_t>, BUCKETS> m_buckets{};
+    std::atomic<uint64_t> m_count{0};
+    std::atomic<uint64_t> m_sum{0};
+    std::atomic<uint64_t> m_max{0};
+
+public:
+    void record(uint64_t value);
+    // adds the samples of other, e.g. to total up per-file histograms
+    void merge(const Histogram &other);
+
+    uint64_t count() const { return m_count.load(std::memory_order_relaxed); }
+    uint64_t sum() const { return m_sum.load(std::memory_order_relaxed); }
+    uint64_t max() const { return m_max.load(std::memory_order_relaxed); }
+    // Upper bound of the bucket holding the nearest-rank percentile: the smallest sample
+    // with at least the given fraction of the samples at or below it
+    uint64_t percentile(double fraction) const;
+
+    std::string to_json() const;
+};
+
+enum class Transfer_kind : uint8_t
+{
+    LIST,
+    GET,
+    PUT
+};
+
+// "list", "get" or "put", as the stats JSON names them
+const char *transfer_kind_name(Transfer_kind kind);
+
+// Counters for one Async_file_client. Updated from the loop threads with relaxed
+// atomics; readers get a slightly torn but never blocking view.
+class Transfer_stats
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Operation_stats
+    {
+        std::atomic<uint64_t> succeeded{0};
+        std::atomic<uint64_t> failed{0};
+        std::atomic<uint64_t> bytes{0};
+        Histogram duration_us;
+        Histogram first_byte_us;
+    };
+
+private:
+    std::array<Operation_stats, 3> m_operations;
+
+    std::atomic<uint64_t> m_connects{0};
+    std::atomic<uint64_t> m_connect_failures{0};
+    std::atomic<uint64_t> m_reconnects{0};
+    Histogram m_connect_us;
+
+    std::atomic<uint64_t> m_bytes_sent{0};
+    std::atomic<uint64_t> m_send_calls{0};
+    std::atomic<uint64_t> m_send_ns{0};
+    std::atomic<uint64_t> m_bytes_received{0};
+    std::atomic<uint64_t> m_recv_calls{0};
+    std::atomic<uint64_t> m_recv_ns{0};
+    Histogram m_recv_size;
+    Histogram m_recv_gap_us; // time between reads while a transfer waits for data, shows stalls
+
+    Clock::time_point m_created = Clock::now();
+
+public:
+    void record_operation(Transfer_kind kind, bool success, uint64_t bytes, Clock::duration duration,
+                          std::optional<Clock::duration> first_byte);
+    // reconnect: the connection had been up before and had to be opened again
+    void record_connect(bool success, Clock::duration duration, bool reconnect);
+    void record_send(size_t bytes, Clock::duration duration);
+    void record_recv(size_t bytes, Clock::duration duration, std::optional<Clock::duration> gap);
+
+    const Operation_stats &get_operation(Transfer_kind kind) const { return m_operations[static_cast<size_t>(kind)]; }
+
+    std::string to_json() const;
+};
+
+// Periodically writes the JSON snapshot of a set of named Transfer_stats to a file.
+// The file is replaced atomically so readers never see a partial snapshot.
+class Stats_exporter
+{
+private:
+    std::filesystem::path m_path;
+    std::chrono::milliseconds m_interval;
+    std::vector<std::pair<std::string, const Transfer_stats *>> m_sources;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_stop = false;
+    std::thread m_thread;
+
+    void run();
+
+public:
+    Stats_exporter(const std::filesystem::path &path, std::chrono::milliseconds interval);
+    ~Stats_exporter();
+
+    Stats_exporter(const Stats_exporter &) = delete;
+    Stats_exporter &operator=(const Stats_exporter &) = delete;
+
+    // Sources must be added before start() and outlive the exporter
+    void add_source(const std::string &name, const Transfer_stats &stats);
+    void start();
+    void stop();
+
+    void write_snapshot() const;
+    // {"<name>": <stats>, ...} for every source
+    static std::string snapshot(const std::vector<std::pair<std::string, const Transfer_stats *>> &sources);
+};
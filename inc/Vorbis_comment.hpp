@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// The VORBIS_COMMENT block, kept as the one buffer it was read into. The name/value
+// pairs are views into that buffer and are only split out on first access. Names
+// compare case-insensitively, as the spec asks, and repeated names (several ARTIST
+// entries, say) are all kept in file order.
+//
+// The first access parses in place, so an object must not be read from several
+// threads until it has been accessed once.
+class Vorbis_comment
+{
+public:
+    using Comment = std::pair<std::string_view, std::string_view>;
+
+private:
+    std::string m_block;
+    mutable std::string_view m_vendor;
+    mutable std::vector<Comment> m_comments;
+    mutable bool m_parsed = false;
+
+    void parse() const;
+
+public:
+    Vorbis_comment() = default;
+    // block is the body of the metadata block, without the 4-byte block header
+    explicit Vorbis_comment(std::string block) : m_block(std::move(block)) {}
+
+    // the views point into m_block, so copies and moves parse again
+    Vorbis_comment(const Vorbis_comment &other) : m_block(other.m_block) {}
+    Vorbis_comment(Vorbis_comment &&other) noexcept : m_block(std::move(other.m_block)) { other.reset(); }
+    Vorbis_comment &operator=(const Vorbis_comment &other);
+    Vorbis_comment &operator=(Vorbis_comment &&other) noexcept;
+
+    std::string_view vendor() const;
+    // Every NAME=value entry in file order. A length that runs past the end of the
+    // block ends the list; the entries before it are kept.
+    const std::vector<Comment> &comments() const;
+
+    // First value of name, if any
+    std::optional<std::string_view> find(std::string_view name) const;
+    std::vector<std::string_view> find_all(std::string_view name) const;
+
+    bool empty() const { return comments().empty(); }
+    size_t size() const { return comments().size(); }
+    const std::string &data() const { return m_block; }
+
+    void reset();
+
+    static bool names_equal(std::string_view a, std::string_view b);
+};
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+// Reads integer PCM WAV files, plain or WAVE_FORMAT_EXTENSIBLE, 8 to 32 bits.
+// Samples come out right-justified, the way FLAC codes them, not left-justified
+// like Flac::decode_frame() produces them.
+class Wav_reader
+{
+private:
+    std::ifstream m_file;
+    uint32_t m_sample_rate{};
+    uint8_t m_channels{};
+    uint8_t m_bits_per_sample{};
+    uint8_t m_bytes_per_sample{};
+    uint64_t m_total_frames{};
+    uint64_t m_frames_left{};
+    std::vector<char> m_read_buffer;
+
+public:
+    Wav_reader() = default;
+    explicit Wav_reader(const std::filesystem::path &path) { open(path); }
+
+    // Throws std::runtime_error if the file can't be read or isn't integer PCM
+    void open(const std::filesystem::path &path);
+    // Reads up to frames frames into samples, resized to what was read; returns the
+    // frames read, 0 at the end of the data
+    size_t read(std::vector<int32_t> &samples, size_t frames);
+
+    uint32_t sample_rate() const { return m_sample_rate; }
+    uint8_t channels() const { return m_channels; }
+    uint8_t bits_per_sample() const { return m_bits_per_sample; }
+    // 0 when the header doesn't say, as with WAVs written while streaming
+    uint64_t total_frames() const { return m_total_frames; }
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+#include "Flac_types.hpp"
+
+// Writes decoded samples as a PCM WAV file, or as headerless little-endian PCM.
+// Input samples are left-justified in 32 bits, as Flac::decode_frame() produces them;
+// they are stored with the stream's own bit depth rounded up to whole bytes.
+class Wav_writer
+{
+private:
+    std::ofstream m_file;
+    uint32_t m_sample_rate{};
+    uint8_t m_channels{};
+    uint8_t m_bytes_per_sample{};
+    bool m_raw{};
+    uint64_t m_data_bytes{};
+    std::vector<char> m_pack_buffer;
+
+    void write_header();
+
+public:
+    Wav_writer() = default;
+    ~Wav_writer() { close(); }
+
+    Wav_writer(const Wav_writer &) = delete;
+    Wav_writer &operator=(const Wav_writer &) = delete;
+
+    // Throws std::runtime_error if the file can't be created
+    void open(const std::filesystem::path &path, uint32_t sample_rate, uint8_t channels, uint8_t bits_per_sample, bool raw = false);
+    // count is in samples, all channels interleaved
+    void write(const buffer_sample_type *samples, size_t count);
+    // Samples already packed little-endian at the file's width, as pack_samples()
+    // produces them; false if the file couldn't take them
+    bool write_bytes(const char *data, size_t size);
+    // Patches the sizes into the header and carries on after the data, so the file
+    // is complete between writes
+    void update_header();
+    // Fills in the header sizes; also done by the destructor
+    void close();
+
+    bool is_open() const { return m_file.is_open(); }
+    uint64_t data_bytes() const { return m_data_bytes; }
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Thread pool with a task deque per worker. A worker runs its own tasks newest
+// first and, once it runs dry, steals the oldest task of another worker, so tasks
+// queued behind a long one don't wait for it while other cores idle.
+//
+// Tasks submitted from inside a task go to the submitting worker's own deque,
+// which keeps the pieces of a split-up job close together until someone steals them.
+class Work_stealing_pool
+{
+public:
+    // Gets the index of the worker running it, for per-worker scratch state.
+    // Tasks must not throw.
+    using Task = std::function<void(size_t worker)>;
+
+    struct Worker_stats
+    {
+        uint64_t tasks{};
+        uint64_t steals{}; // of tasks, the ones taken from another worker
+        uint64_t busy_ns{};
+    };
+
+private:
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+        std::atomic<uint64_t> executed{0};
+        std::atomic<uint64_t> stolen{0};
+        std::atomic<uint64_t> busy_ns{0};
+        std::thread thread;
+    };
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::atomic<size_t> m_next_worker{0}; // spreads submissions from outside the pool
+
+    std::mutex m_mutex;
+    std::condition_variable m_work_cv;
+    std::condition_variable m_idle_cv;
+    size_t m_pending{}; // submitted and not finished yet
+    size_t m_queued{};  // sitting in a deque
+    bool m_stop = false;
+
+    void run(size_t index);
+    bool take(size_t index, Task &task);
+
+public:
+    // threads = 0 uses one per hardware thread
+    explicit Work_stealing_pool(size_t threads = 0);
+    // Runs what is still queued, then joins the workers
+    ~Work_stealing_pool();
+
+    Work_stealing_pool(const Work_stealing_pool &) = delete;
+    Work_stealing_pool &operator=(const Work_stealing_pool &) = delete;
+
+    size_t size() const { return m_workers.size(); }
+
+    void submit(Task task);
+    // Blocks until every task submitted so far, and every task those submitted, has run
+    void wait();
+
+    std::vector<Worker_stats> stats() const;
+};
@@ -0,0 +1,171 @@
+#include "Alsa_sink.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+namespace
+{
+    snd_pcm_format_t alsa_format(Sample_format format)
+    {
+        switch (format)
+        {
+        case Sample_format::S16:
+            return SND_PCM_FORMAT_S16_LE;
+        case Sample_format::S24_3LE:
+            return SND_PCM_FORMAT_S24_3LE;
+        case Sample_format::S32:
+            return SND_PCM_FORMAT_S32_LE;
+        case Sample_format::FLOAT:
+            return SND_PCM_FORMAT_FLOAT_LE;
+        }
+        return SND_PCM_FORMAT_S32_LE;
+    }
+}
+
+void Alsa_sink::check(int error, const std::string &message)
+{
+    if (error < 0)
+    {
+        std::cerr << message << ": " << snd_strerror(error) << "\n";
+        close();
+        throw std::runtime_error(message);
+    }
+}
+
+Sink_format Alsa_sink::open(const Pcm_format &format)
+{
+    close();
+    // non-blocking, so waiting for the device happens in poll() next to the controls
+    check(snd_pcm_open(&m_handle, m_device.c_str(), SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK), "Cannot open audio device");
+
+    snd_pcm_hw_params_t *params;
+    snd_pcm_hw_params_alloca(&params);
+    check(snd_pcm_hw_params_any(m_handle, params), "Cannot configure audio device");
+    check(snd_pcm_hw_params_set_access(m_handle, params, SND_PCM_ACCESS_RW_INTERLEAVED), "Cannot set access type");
+
+    // the first format in order of preference that the device takes
+    std::vector<Sample_format> formats = preferred_formats(format.bits_per_sample);
+    auto supported = std::find_if(formats.begin(), formats.end(), [&](Sample_format candidate)
+                                  { return snd_pcm_hw_params_test_format(m_handle, params, alsa_format(candidate)) == 0; });
+    Sample_format sample_format = supported == formats.end() ? Sample_format::S32 : *supported;
+    check(snd_pcm_hw_params_set_format(m_handle, params, alsa_format(sample_format)), "Cannot set sample format");
+
+    // multichannel streams fold down to stereo on devices without enough outputs
+    unsigned int channels = format.channels;
+    if (snd_pcm_hw_params_test_channels(m_handle, params, channels) != 0 && Channel_mixer::can_mix(format.channels, 2) &&
+        snd_pcm_hw_params_test_channels(m_handle, params, 2) == 0)
+    {
+        channels = 2;
+    }
+    check(snd_pcm_hw_params_set_channels(m_handle, params, channels), "Cannot set channel count");
+
+    unsigned int actual_rate = format.sample_rate;
+    check(snd_pcm_hw_params_set_rate_near(m_handle, params, &actual_rate, 0), "Cannot set sample rate");
+
+    snd_pcm_uframes_t buffer_size = format.sample_rate; // 1 second buffer
+    check(snd_pcm_hw_params_set_buffer_size_near(m_handle, params, &buffer_size), "Cannot set buffer size");
+    snd_pcm_uframes_t period_size = buffer_size / PERIODS;
+    check(snd_pcm_hw_params_set_period_size_near(m_handle, params, &period_size, 0), "Cannot set period size");
+    check(snd_pcm_hw_params(m_handle, params), "Cannot set parameters");
+
+    return {actual_rate, static_cast<uint8_t>(channels), sample_format, period_size};
+}
+
+void Alsa_sink::close()
+{
+    if (m_handle)
+    {
+        snd_pcm_close(m_handle);
+        m_handle = nullptr;
+    }
+    m_draining = false;
+}
+
+Sink_write Alsa_sink::write(const char *data, size_t frames)
+{
+    Sink_write result;
+    while (true)
+    {
+        snd_pcm_sframes_t written = snd_pcm_writei(m_handle, data, frames);
+        if (written >= 0)
+        {
+            result.frames = written;
+            return result;
+        }
+        if (written == -EAGAIN)
+        {
+            return result;
+        }
+        if (written == -EPIPE)
+        {
+            result.xrun = true;
+        }
+        written = snd_pcm_recover(m_handle, written, 0);
+        if (written < 0)
+        {
+            std::cerr << "Write failed: " << snd_strerror(written) << "\n";
+            result.failed = true;
+            return result;
+        }
+    }
+}
+
+std::vector<pollfd> Alsa_sink::poll_descriptors()
+{
+    int count = snd_pcm_poll_descriptors_count(m_handle);
+    std::vector<pollfd> fds(std::max(count, 0));
+    if (count > 0)
+    {
+        snd_pcm_poll_descriptors(m_handle, fds.data(), count);
+    }
+    return fds;
+}
+
+bool Alsa_sink::writable(const pollfd *fds, size_t count)
+{
+    unsigned short revents = 0;
+    snd_pcm_poll_descriptors_revents(m_handle, const_cast<pollfd *>(fds), count, &revents);
+    // errors wake us too, the next write reports and recovers them
+    return revents & (POLLOUT | POLLERR);
+}
+
+long Alsa_sink::available()
+{
+    return snd_pcm_avail_update(m_handle);
+}
+
+void Alsa_sink::pause(bool paused)
+{
+    snd_pcm_pause(m_handle, paused ? 1 : 0);
+}
+
+void Alsa_sink::drop()
+{
+    // drop what is queued in the device and get it ready for new samples
+    snd_pcm_drop(m_handle);
+    snd_pcm_prepare(m_handle);
+    m_draining = false;
+}
+
+bool Alsa_sink::drain()
+{
+    if (!m_draining)
+    {
+        // non-blocking drain returns at once; the caller polls until the device has played out
+        if (snd_pcm_drain(m_handle) != -EAGAIN)
+        {
+            snd_pcm_prepare(m_handle);
+            return true;
+        }
+        m_draining = true;
+    }
+    // not every plugin signals the end of a drain, so callers look again every period
+    if (snd_pcm_state(m_handle) == SND_PCM_STATE_DRAINING)
+    {
+        return false;
+    }
+    m_draining = false;
+    snd_pcm_prepare(m_handle);
+    return true;
+}
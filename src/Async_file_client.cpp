@@ -0,0 +1,1750 @@
+#include "Async_file_client.hpp"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <optional>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <unordered_map>
+
+#include "Protocol.hpp"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    // What servers answered to the framed hello, by "<ip>:<port>". Shared by all the
+    // clients in the process, so only the first connection to a legacy server waits
+    // out the handshake.
+    struct Framed_support
+    {
+        std::mutex mutex;
+        std::unordered_map<std::string, bool> servers;
+    };
+
+    Framed_support &framed_support()
+    {
+        static Framed_support known;
+        return known;
+    }
+
+    std::string server_key(const std::string &ip, int port)
+    {
+        std::string key = ip;
+        key += ':';
+        key += std::to_string(port);
+        return key;
+    }
+
+    std::optional<bool> known_framed_support(const std::string &server)
+    {
+        Framed_support &known = framed_support();
+        std::lock_guard<std::mutex> lock(known.mutex);
+        auto it = known.servers.find(server);
+        if (it == known.servers.end())
+        {
+            return std::nullopt;
+        }
+        return it->second;
+    }
+
+    void remember_framed_support(const std::string &server, bool framed)
+    {
+        Framed_support &known = framed_support();
+        std::lock_guard<std::mutex> lock(known.mutex);
+        known.servers[server] = framed;
+    }
+}
+
+// Base class of the request state machines driven by a Connection. Each transfer
+// speaks both protocols: a raw byte stream in legacy mode and frames in framed mode.
+class Async_file_client::Transfer
+{
+public:
+    enum class Status
+    {
+        NEED_MORE,
+        DONE,
+        FAILED
+    };
+
+protected:
+    Transfer_result m_result;
+    Transfer_callback m_callback;
+
+    // timing, from the moment the request is queued on a connection
+    Transfer_stats *m_stats = nullptr;
+    Transfer_stats::Clock::time_point m_started{};
+    std::optional<Transfer_stats::Clock::duration> m_first_byte;
+
+    // Accumulates the 4-byte big-endian size that prefixes every legacy response
+    struct Size_header
+    {
+        uint8_t bytes[4]{};
+        uint8_t received{};
+
+        bool complete() const { return received == sizeof(bytes); }
+        size_t feed(const char *data, size_t size)
+        {
+            size_t count = std::min<size_t>(size, sizeof(bytes) - received);
+            std::memcpy(bytes + received, data, count);
+            received += count;
+            return count;
+        }
+        uint32_t value() const
+        {
+            uint32_t network_value;
+            std::memcpy(&network_value, bytes, sizeof(network_value));
+            return ntohl(network_value);
+        }
+    };
+
+    Status fail(const std::string &error)
+    {
+        m_result.error = error;
+        return Status::FAILED;
+    }
+
+public:
+    explicit Transfer(Transfer_callback on_complete) : m_callback(std::move(on_complete)) {}
+    virtual ~Transfer() = default;
+
+    virtual Transfer_kind kind() const = 0;
+
+    // Local preparation before anything is sent (paths, files); sets the error on failure
+    virtual bool prepare() { return true; }
+
+    // legacy protocol: each queued segment is written with its own send call
+    virtual void legacy_request(std::deque<std::vector<char>> &out) = 0;
+    virtual Status on_receive(const char *data, size_t size) = 0;
+
+    // framed protocol
+    virtual std::vector<char> framed_request(uint32_t request_id) = 0;
+    virtual Status on_frame(Protocol::Frame_type type, const char *payload, size_t size) = 0;
+
+    // Streams a request body (uploads) after the request itself has been queued.
+    // produce() fills at most chunk.size() bytes and shrinks chunk to what it wrote.
+    virtual bool has_more_output() const { return false; }
+    virtual size_t produce(std::vector<char> &) { return 0; }
+    // A streamed body may have nothing to send yet. The connection then sets it aside
+    // until the function given to set_wake() is called, from any thread.
+    virtual bool output_ready() const { return true; }
+    virtual void set_wake(std::function<void()>) {}
+    // The source of a streamed body gave up before its end
+    virtual bool output_failed() const { return false; }
+    // Bodies of unknown size can't be announced in the legacy protocol
+    virtual bool needs_framed() const { return false; }
+    // Cleans up partial results after a failure
+    virtual void abort() {}
+    // Legacy mode: the transfer finished before reading the whole response, so the
+    // connection can't be reused for the next request
+    virtual bool leaves_data_behind() const { return false; }
+
+    const std::string &error() const { return m_result.error; }
+
+    void begin_timing(Transfer_stats &stats)
+    {
+        m_stats = &stats;
+        m_started = Transfer_stats::Clock::now();
+    }
+
+    void mark_response()
+    {
+        if (m_stats && !m_first_byte)
+        {
+            m_first_byte = Transfer_stats::Clock::now() - m_started;
+        }
+    }
+
+    void finish(bool success, const std::string &error = {})
+    {
+        m_result.success = success;
+        if (!error.empty())
+        {
+            m_result.error = error;
+        }
+        if (!success)
+        {
+            abort();
+        }
+        if (m_stats)
+        {
+            m_stats->record_operation(kind(), success, m_result.bytes, Transfer_stats::Clock::now() - m_started, m_first_byte);
+        }
+        if (m_callback)
+        {
+            m_callback(std::move(m_result));
+        }
+    }
+};
+
+namespace
+{
+    using Frame_type = Protocol::Frame_type;
+
+    std::vector<char> to_segment(const std::string &text) { return std::vector<char>(text.begin(), text.end()); }
+
+    class List_transfer : public Async_file_client::Transfer
+    {
+    private:
+        Size_header m_header;
+        uint32_t m_size{};
+        std::string m_since_version; // only understood by framed servers
+
+    public:
+        List_transfer(const std::string &since_version, Transfer_callback on_complete)
+            : Transfer(std::move(on_complete)), m_since_version(since_version) {}
+
+        Transfer_kind kind() const override { return Transfer_kind::LIST; }
+
+        void legacy_request(std::deque<std::vector<char>> &out) override
+        {
+            out.push_back(to_segment("LIST"));
+        }
+
+        Status on_receive(const char *data, size_t size) override
+        {
+            if (!m_header.complete())
+            {
+                size_t used = m_header.feed(data, size);
+                data += used;
+                size -= used;
+                if (!m_header.complete())
+                {
+                    return Status::NEED_MORE;
+                }
+                m_size = m_header.value();
+                m_result.data.reserve(m_size);
+            }
+
+            size_t count = std::min<size_t>(size, m_size - m_result.data.size());
+            m_result.data.insert(m_result.data.end(), data, data + count);
+            m_result.bytes = m_result.data.size();
+            return m_result.data.size() == m_size ? Status::DONE : Status::NEED_MORE;
+        }
+
+        std::vector<char> framed_request(uint32_t request_id) override
+        {
+            return Protocol::make_frame(Frame_type::LIST, request_id, m_since_version);
+        }
+
+        Status on_frame(Frame_type type, const char *payload, size_t size) override
+        {
+            switch (type)
+            {
+            case Frame_type::DATA:
+                m_result.data.insert(m_result.data.end(), payload, payload + size);
+                m_result.bytes = m_result.data.size();
+                return Status::NEED_MORE;
+            case Frame_type::END:
+                return Status::DONE;
+            case Frame_type::ERROR:
+                return fail(std::string(payload, size));
+            default:
+                return fail("Unexpected frame in file list");
+            }
+        }
+    };
+
+    class Get_transfer : public Async_file_client::Transfer
+    {
+    private:
+        std::string m_filename;
+        std::string m_save_path;
+        fs::path m_final_path;
+        std::ofstream m_file;
+        Size_header m_header;
+        uint64_t m_remaining{};
+
+        Status open_output()
+        {
+            if (m_remaining == 0)
+            {
+                return fail("File not found or empty");
+            }
+
+            m_file.open(m_final_path, std::ios::binary);
+            if (!m_file)
+            {
+                return fail("Cannot create output file: " + m_final_path.string());
+            }
+            return Status::NEED_MORE;
+        }
+
+        Status write_body(const char *data, size_t size)
+        {
+            size_t count = std::min<uint64_t>(size, m_remaining);
+            m_file.write(data, count);
+            if (!m_file.good())
+            {
+                return fail("Error writing to file");
+            }
+            m_remaining -= count;
+            m_result.bytes += count;
+            return Status::NEED_MORE;
+        }
+
+    public:
+        Get_transfer(const std::string &filename, const std::string &save_path, Transfer_callback on_complete)
+            : Transfer(std::move(on_complete)), m_filename(filename), m_save_path(save_path) {}
+
+        Transfer_kind kind() const override { return Transfer_kind::GET; }
+
+        bool prepare() override
+        {
+            // Construct the full save path
+            if (m_save_path == "." || m_save_path.empty())
+            {
+                m_final_path = fs::current_path() / m_filename;
+            }
+            else
+            {
+                m_final_path = fs::path(m_save_path);
+                if (fs::is_directory(m_final_path))
+                {
+                    m_final_path /= m_filename;
+                }
+            }
+
+            // Create parent directory if it doesn't exist
+            try
+            {
+                fs::path parent = m_final_path.parent_path();
+                if (!parent.empty() && !fs::exists(parent))
+                {
+                    fs::create_directories(parent);
+                }
+            }
+            catch (const fs::filesystem_error &e)
+            {
+                m_result.error = std::string("Failed to create directory: ") + e.what();
+                return false;
+            }
+            return true;
+        }
+
+        void legacy_request(std::deque<std::vector<char>> &out) override
+        {
+            out.push_back(to_segment("GET " + m_filename));
+        }
+
+        Status on_receive(const char *data, size_t size) override
+        {
+            if (!m_header.complete())
+            {
+                size_t used = m_header.feed(data, size);
+                data += used;
+                size -= used;
+                if (!m_header.complete())
+                {
+                    return Status::NEED_MORE;
+                }
+
+                m_remaining = m_header.value();
+                if (open_output() == Status::FAILED)
+                {
+                    return Status::FAILED;
+                }
+            }
+
+            if (write_body(data, size) == Status::FAILED)
+            {
+                return Status::FAILED;
+            }
+            if (m_remaining > 0)
+            {
+                return Status::NEED_MORE;
+            }
+            m_file.close();
+            return Status::DONE;
+        }
+
+        std::vector<char> framed_request(uint32_t request_id) override
+        {
+            return Protocol::make_frame(Frame_type::GET, request_id, m_filename);
+        }
+
+        Status on_frame(Frame_type type, const char *payload, size_t size) override
+        {
+            switch (type)
+            {
+            case Frame_type::BEGIN:
+                if (size < 8)
+                {
+                    return fail("Malformed BEGIN frame");
+                }
+                m_remaining = Protocol::read_u64(payload);
+                return open_output();
+            case Frame_type::DATA:
+                if (!m_file.is_open())
+                {
+                    return fail("File data before BEGIN frame");
+                }
+                return write_body(payload, size);
+            case Frame_type::END:
+                if (m_remaining != 0)
+                {
+                    return fail("Download ended early");
+                }
+                m_file.close();
+                return Status::DONE;
+            case Frame_type::ERROR:
+                return fail(std::string(payload, size));
+            default:
+                return fail("Unexpected frame in download");
+            }
+        }
+
+        void abort() override
+        {
+            // a partial download is useless, don't leave it behind
+            if (m_file.is_open())
+            {
+                m_file.close();
+                std::error_code ec;
+                fs::remove(m_final_path, ec);
+            }
+        }
+    };
+
+    // Reads part of a file into memory. Legacy servers have no ranges, so there the whole
+    // file is requested and the connection is dropped once the range has arrived.
+    class Range_transfer : public Async_file_client::Transfer
+    {
+    private:
+        std::string m_filename;
+        uint64_t m_offset;
+        uint64_t m_length;
+        Size_header m_header;
+        uint64_t m_body_remaining{}; // legacy: bytes of the file not yet received
+
+    public:
+        Range_transfer(const std::string &filename, uint64_t offset, uint64_t length, Transfer_callback on_complete)
+            : Transfer(std::move(on_complete)), m_filename(filename), m_offset(offset), m_length(length) {}
+
+        Transfer_kind kind() const override { return Transfer_kind::GET; }
+
+        void legacy_request(std::deque<std::vector<char>> &out) override
+        {
+            out.push_back(to_segment("GET " + m_filename));
+        }
+
+        Status on_receive(const char *data, size_t size) override
+        {
+            if (!m_header.complete())
+            {
+                size_t used = m_header.feed(data, size);
+                data += used;
+                size -= used;
+                if (!m_header.complete())
+                {
+                    return Status::NEED_MORE;
+                }
+                m_body_remaining = m_header.value();
+                if (m_body_remaining == 0)
+                {
+                    return fail("File not found or empty");
+                }
+            }
+
+            size = std::min<uint64_t>(size, m_body_remaining);
+            uint64_t position = m_header.value() - m_body_remaining;
+            m_body_remaining -= size;
+
+            // keep the part of this chunk that falls inside the range
+            uint64_t start = std::max(position, m_offset);
+            uint64_t end = std::min(position + size, m_offset + m_length);
+            if (start < end)
+            {
+                m_result.data.insert(m_result.data.end(), data + (start - position), data + (end - position));
+                m_result.bytes = m_result.data.size();
+            }
+
+            bool range_complete = position + size >= m_offset + m_length;
+            return (range_complete || m_body_remaining == 0) ? Status::DONE : Status::NEED_MORE;
+        }
+
+        bool leaves_data_behind() const override { return m_body_remaining > 0; }
+
+        std::vector<char> framed_request(uint32_t request_id) override
+        {
+            std::vector<char> payload;
+            Protocol::append_u64(payload, m_offset);
+            Protocol::append_u64(payload, m_length);
+            payload.insert(payload.end(), m_filename.begin(), m_filename.end());
+            return Protocol::make_frame(Frame_type::GET_RANGE, request_id, payload.data(), payload.size());
+        }
+
+        Status on_frame(Frame_type type, const char *payload, size_t size) override
+        {
+            switch (type)
+            {
+            case Frame_type::BEGIN:
+                if (size < 8)
+                {
+                    return fail("Malformed BEGIN frame");
+                }
+                m_result.data.reserve(std::min<uint64_t>(Protocol::read_u64(payload), m_length));
+                return Status::NEED_MORE;
+            case Frame_type::DATA:
+                m_result.data.insert(m_result.data.end(), payload, payload + size);
+                m_result.bytes = m_result.data.size();
+                return Status::NEED_MORE;
+            case Frame_type::END:
+                return Status::DONE;
+            case Frame_type::ERROR:
+                return fail(std::string(payload, size));
+            default:
+                return fail("Unexpected frame in ranged download");
+            }
+        }
+    };
+
+    class Put_transfer : public Async_file_client::Transfer
+    {
+    private:
+        std::string m_filepath;
+        std::string m_filename;
+        uintmax_t m_file_size{};
+        std::ifstream m_file;
+        bool m_body_sent = false;
+        std::string m_response;
+
+    public:
+        Put_transfer(const std::string &filepath, Transfer_callback on_complete)
+            : Transfer(std::move(on_complete)), m_filepath(filepath) {}
+
+        Transfer_kind kind() const override { return Transfer_kind::PUT; }
+
+        bool prepare() override
+        {
+            // Check if file exists and get its size
+            if (!fs::exists(m_filepath))
+            {
+                m_result.error = "File does not exist: " + m_filepath;
+                return false;
+            }
+
+            try
+            {
+                m_file_size = fs::file_size(m_filepath);
+            }
+            catch (const fs::filesystem_error &e)
+            {
+                m_result.error = std::string("Error getting file size: ") + e.what();
+                return false;
+            }
+
+            m_file.open(m_filepath, std::ios::binary);
+            if (!m_file)
+            {
+                m_result.error = "Cannot open file: " + m_filepath;
+                return false;
+            }
+
+            // Get just the filename from the path
+            m_filename = fs::path(m_filepath).filename().string();
+            return true;
+        }
+
+        void legacy_request(std::deque<std::vector<char>> &out) override
+        {
+            out.push_back(to_segment("PUT " + m_filename));
+
+            uint32_t size_net = htonl(static_cast<uint32_t>(m_file_size));
+            const char *size_bytes = reinterpret_cast<const char *>(&size_net);
+            out.emplace_back(size_bytes, size_bytes + sizeof(size_net));
+        }
+
+        std::vector<char> framed_request(uint32_t request_id) override
+        {
+            std::vector<char> payload;
+            Protocol::append_u64(payload, m_file_size);
+            payload.insert(payload.end(), m_filename.begin(), m_filename.end());
+            return Protocol::make_frame(Frame_type::PUT_BEGIN, request_id, payload.data(), payload.size());
+        }
+
+        bool has_more_output() const override { return !m_body_sent; }
+
+        size_t produce(std::vector<char> &chunk) override
+        {
+            m_file.read(chunk.data(), chunk.size());
+            size_t bytes_read = m_file.gcount();
+            chunk.resize(bytes_read);
+            if (!m_file)
+            {
+                m_body_sent = true;
+            }
+            m_result.bytes += bytes_read;
+            return bytes_read;
+        }
+
+        Status on_receive(const char *data, size_t size) override
+        {
+            // Wait for server confirmation
+            m_response.append(data, size);
+            if (m_response == "OK")
+            {
+                return Status::DONE;
+            }
+            if (m_response.size() < 2 && std::string("OK").starts_with(m_response))
+            {
+                return Status::NEED_MORE;
+            }
+            return fail("File upload failed");
+        }
+
+        Status on_frame(Frame_type type, const char *payload, size_t size) override
+        {
+            switch (type)
+            {
+            case Frame_type::OK:
+                return Status::DONE;
+            case Frame_type::ERROR:
+                return fail(std::string(payload, size));
+            default:
+                return fail("Unexpected frame in upload");
+            }
+        }
+    };
+
+    // PUT of a body of unknown size, taken from an Upload_stream as it is written
+    class Stream_put_transfer : public Async_file_client::Transfer
+    {
+    private:
+        std::string m_filename;
+        std::shared_ptr<Upload_stream> m_stream;
+
+    public:
+        Stream_put_transfer(const std::string &filename, std::shared_ptr<Upload_stream> stream, Transfer_callback on_complete)
+            : Transfer(std::move(on_complete)), m_filename(filename), m_stream(std::move(stream)) {}
+
+        Transfer_kind kind() const override { return Transfer_kind::PUT; }
+        bool needs_framed() const override { return true; }
+
+        void legacy_request(std::deque<std::vector<char>> &) override {}
+        Status on_receive(const char *, size_t) override { return fail("Streaming uploads need the framed protocol"); }
+
+        std::vector<char> framed_request(uint32_t request_id) override
+        {
+            std::vector<char> payload;
+            Protocol::append_u64(payload, Protocol::unknown_size);
+            payload.insert(payload.end(), m_filename.begin(), m_filename.end());
+            return Protocol::make_frame(Frame_type::PUT_BEGIN, request_id, payload.data(), payload.size());
+        }
+
+        bool has_more_output() const override { return !m_stream->finished(); }
+        bool output_ready() const override { return m_stream->readable(); }
+        bool output_failed() const override { return m_stream->failed(); }
+        void set_wake(std::function<void()> wake) override { m_stream->set_wake(std::move(wake)); }
+
+        size_t produce(std::vector<char> &chunk) override
+        {
+            size_t bytes_read = m_stream->read(chunk.data(), chunk.size());
+            chunk.resize(bytes_read);
+            m_result.bytes += bytes_read;
+            return bytes_read;
+        }
+
+        Status on_frame(Frame_type type, const char *payload, size_t size) override
+        {
+            switch (type)
+            {
+            case Frame_type::OK:
+                return Status::DONE;
+            case Frame_type::ERROR:
+                return fail(std::string(payload, size));
+            default:
+                return fail("Unexpected frame in upload");
+            }
+        }
+
+        // the writer must not block on a stream nobody reads any more
+        void abort() override { m_stream->cancel(); }
+    };
+}
+
+bool Upload_stream::write(const char *data, size_t size)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_space.wait(lock, [&]
+                 { return m_cancelled || m_buffered < m_buffer_limit; });
+    if (m_cancelled || m_closed)
+    {
+        return false;
+    }
+    bool was_empty = m_buffered == 0;
+    m_chunks.emplace_back(data, data + size);
+    m_buffered += size;
+    // under the lock, so cancel() knows no wake is still running when it returns
+    if (was_empty && m_wake)
+    {
+        m_wake();
+    }
+    return true;
+}
+
+void Upload_stream::close()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_closed)
+    {
+        return;
+    }
+    m_closed = true;
+    if (m_buffered == 0 && m_wake)
+    {
+        m_wake();
+    }
+}
+
+void Upload_stream::fail()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_closed)
+    {
+        return;
+    }
+    m_closed = true;
+    m_failed = true;
+    if (m_buffered == 0 && m_wake)
+    {
+        m_wake();
+    }
+}
+
+void Upload_stream::set_wake(std::function<void()> wake)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_cancelled)
+    {
+        m_wake = std::move(wake);
+    }
+}
+
+size_t Upload_stream::read(char *data, size_t size)
+{
+    size_t copied = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        while (copied < size && !m_chunks.empty())
+        {
+            std::vector<char> &chunk = m_chunks.front();
+            size_t count = std::min(size - copied, chunk.size() - m_front_offset);
+            std::memcpy(data + copied, chunk.data() + m_front_offset, count);
+            copied += count;
+            m_front_offset += count;
+            if (m_front_offset == chunk.size())
+            {
+                m_chunks.pop_front();
+                m_front_offset = 0;
+            }
+        }
+        m_buffered -= copied;
+    }
+    if (copied > 0)
+    {
+        m_space.notify_all();
+    }
+    return copied;
+}
+
+bool Upload_stream::readable() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_buffered > 0 || m_closed || m_cancelled;
+}
+
+bool Upload_stream::finished() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    // a failed body never finishes, its connection is dropped instead
+    return m_cancelled || (m_closed && !m_failed && m_buffered == 0);
+}
+
+bool Upload_stream::failed() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_failed;
+}
+
+void Upload_stream::cancel()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_cancelled = true;
+        m_wake = nullptr;
+        m_chunks.clear();
+        m_buffered = 0;
+    }
+    m_space.notify_all();
+}
+
+// One non-blocking socket owned by a single loop thread. In legacy mode it runs one
+// transfer at a time; in framed mode up to MAX_IN_FLIGHT are pipelined on it.
+class Async_file_client::Connection : public std::enable_shared_from_this<Connection>
+{
+private:
+    enum class State : uint8_t
+    {
+        DISCONNECTED,
+        CONNECTING,
+        HANDSHAKE,
+        CONNECTED
+    };
+
+    static constexpr size_t MAX_IN_FLIGHT = 32;
+    static constexpr int MAX_CONNECT_ATTEMPTS = 3;
+    static constexpr auto HANDSHAKE_TIMEOUT = std::chrono::milliseconds(500);
+
+    Async_file_client &m_client;
+    Event_loop &m_loop;
+    int m_sock = -1;
+    std::string m_server; // "<ip>:<port>" the socket was opened to
+    State m_state = State::DISCONNECTED;
+    bool m_framed = false;
+    uint64_t m_generation{}; // bumped on every close so stale timers can tell
+    uint32_t m_next_request_id = 1;
+    int m_connect_attempts{};
+
+    // taken from the client while the connection is still being set up
+    std::deque<std::unique_ptr<Transfer>> m_waiting;
+    // running transfers by request id; legacy mode only ever has id 0
+    std::unordered_map<uint32_t, std::unique_ptr<Transfer>> m_in_flight;
+    // uploads still streaming their body, served round-robin
+    std::deque<uint32_t> m_senders;
+    // streamed uploads waiting for their writer
+    std::vector<uint32_t> m_parked;
+
+    std::deque<std::vector<char>> m_out;
+    size_t m_out_offset{};
+    std::vector<char> m_chunk;
+    std::vector<char> m_recv_buffer;
+    std::vector<char> m_in; // framed mode and handshake reassembly
+    size_t m_in_offset{};
+
+    bool m_throttled = false;
+    Event_loop::Clock::time_point m_next_io_time{};
+
+    // instrumentation
+    Transfer_stats::Clock::time_point m_connect_started{};
+    Transfer_stats::Clock::time_point m_last_activity{}; // last send or recv, for stall gaps
+    bool m_was_connected = false;
+
+    bool open_socket()
+    {
+        m_connect_started = Transfer_stats::Clock::now();
+        m_sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (m_sock < 0)
+        {
+            return false;
+        }
+
+        // requests are small and written in pieces, don't let Nagle hold them back
+        int no_delay = 1;
+        setsockopt(m_sock, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+
+        std::string ip = m_client.get_server_ip();
+        int port = m_client.get_server_port();
+        m_server = server_key(ip, port);
+        struct sockaddr_in server_addr{};
+        server_addr.sin_family = AF_INET;
+        server_addr.sin_port = htons(port);
+        if (inet_pton(AF_INET, ip.c_str(), &server_addr.sin_addr) <= 0)
+        {
+            close(m_sock);
+            m_sock = -1;
+            return false;
+        }
+
+        if (connect(m_sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0 && errno != EINPROGRESS)
+        {
+            close(m_sock);
+            m_sock = -1;
+            m_client.m_stats.record_connect(false, {}, m_was_connected);
+            return false;
+        }
+
+        m_state = State::CONNECTING;
+        std::weak_ptr<Connection> weak_self = weak_from_this();
+        m_loop.add_fd(m_sock, EPOLLOUT, [weak_self](uint32_t events)
+                      {
+                          if (auto self = weak_self.lock())
+                          {
+                              self->on_event(events);
+                          } });
+        return true;
+    }
+
+    void close_socket()
+    {
+        if (m_sock >= 0)
+        {
+            m_loop.remove_fd(m_sock);
+            close(m_sock);
+            m_sock = -1;
+        }
+        m_state = State::DISCONNECTED;
+        m_framed = false;
+        m_generation++;
+        m_out.clear();
+        m_out_offset = 0;
+        m_in.clear();
+        m_in_offset = 0;
+        m_senders.clear();
+        m_parked.clear();
+        m_throttled = false;
+    }
+
+    size_t capacity() const
+    {
+        return (m_state == State::CONNECTED && m_framed) ? MAX_IN_FLIGHT : 1;
+    }
+
+    bool can_accept() const
+    {
+        return m_in_flight.size() + m_waiting.size() < capacity();
+    }
+
+    void complete(uint32_t request_id, bool success, const std::string &error = {})
+    {
+        auto it = m_in_flight.find(request_id);
+        if (it == m_in_flight.end())
+        {
+            return;
+        }
+        std::unique_ptr<Transfer> transfer = std::move(it->second);
+        m_in_flight.erase(it);
+        std::erase(m_senders, request_id);
+        std::erase(m_parked, request_id);
+        transfer->finish(success, error);
+    }
+
+    // Drops the connection; everything in flight on it is lost
+    void fail_connection(const std::string &error)
+    {
+        close_socket();
+
+        std::unordered_map<uint32_t, std::unique_ptr<Transfer>> in_flight;
+        in_flight.swap(m_in_flight);
+        std::deque<std::unique_ptr<Transfer>> waiting;
+        waiting.swap(m_waiting);
+
+        for (auto &[request_id, transfer] : in_flight)
+        {
+            transfer->finish(false, error);
+        }
+        for (auto &transfer : waiting)
+        {
+            transfer->finish(false, error);
+        }
+        dispatch();
+    }
+
+    bool wants_output() const
+    {
+        return !m_out.empty() || !m_senders.empty() ||
+               (!m_framed && !m_in_flight.empty() && m_in_flight.begin()->second->has_more_output());
+    }
+
+    void update_interest()
+    {
+        if (m_sock < 0 || m_state == State::CONNECTING)
+        {
+            return;
+        }
+        uint32_t events = 0;
+        if (!m_throttled)
+        {
+            events = EPOLLIN;
+            if (wants_output())
+            {
+                events |= EPOLLOUT;
+            }
+        }
+        m_loop.modify_fd(m_sock, events);
+    }
+
+    // Spaces out socket I/O so the connection stays under the client's rate limit
+    void pace(size_t bytes)
+    {
+        size_t limit = m_client.get_rate_limit();
+        auto now = Event_loop::Clock::now();
+        if (limit == 0)
+        {
+            m_next_io_time = now;
+            return;
+        }
+
+        m_next_io_time = std::max(m_next_io_time, now) + std::chrono::microseconds(bytes * 1000000 / limit);
+        if (m_next_io_time <= now)
+        {
+            return;
+        }
+
+        m_throttled = true;
+        std::weak_ptr<Connection> weak_self = weak_from_this();
+        m_loop.run_after(m_next_io_time - now, [weak_self]
+                         {
+                             if (auto self = weak_self.lock())
+                             {
+                                 self->m_throttled = false;
+                                 self->update_interest();
+                             } });
+    }
+
+    void start_transfer(std::unique_ptr<Transfer> transfer)
+    {
+        if (!m_framed && transfer->needs_framed())
+        {
+            transfer->finish(false, "Server does not support the framed protocol");
+            return;
+        }
+        if (!transfer->prepare())
+        {
+            // nothing was sent, the connection is unaffected
+            transfer->finish(false);
+            return;
+        }
+
+        transfer->begin_timing(m_client.m_stats);
+
+        uint32_t request_id = 0;
+        if (m_framed)
+        {
+            request_id = m_next_request_id++;
+            m_out.push_back(transfer->framed_request(request_id));
+            if (transfer->has_more_output())
+            {
+                m_senders.push_back(request_id);
+                std::weak_ptr<Connection> weak_self = weak_from_this();
+                uint64_t generation = m_generation;
+                transfer->set_wake([weak_self, generation, request_id]
+                                   {
+                                       if (auto self = weak_self.lock())
+                                       {
+                                           self->m_loop.post([weak_self, generation, request_id]
+                                                             {
+                                                                 auto self = weak_self.lock();
+                                                                 if (self && self->m_generation == generation)
+                                                                 {
+                                                                     self->unpark(request_id);
+                                                                 } });
+                                       } });
+            }
+        }
+        else
+        {
+            transfer->legacy_request(m_out);
+        }
+        m_in_flight.emplace(request_id, std::move(transfer));
+    }
+
+    void unpark(uint32_t request_id)
+    {
+        auto it = std::find(m_parked.begin(), m_parked.end(), request_id);
+        if (it == m_parked.end())
+        {
+            return;
+        }
+        m_parked.erase(it);
+        m_senders.push_back(request_id);
+        update_interest();
+    }
+
+    void start_waiting()
+    {
+        while (!m_waiting.empty() && m_in_flight.size() < capacity())
+        {
+            std::unique_ptr<Transfer> transfer = std::move(m_waiting.front());
+            m_waiting.pop_front();
+            start_transfer(std::move(transfer));
+        }
+    }
+
+    bool handshake_wanted() const
+    {
+        switch (m_client.get_protocol_mode())
+        {
+        case Protocol_mode::LEGACY:
+            return false;
+        case Protocol_mode::FRAMED:
+            return true;
+        default:
+        {
+            std::optional<bool> known = known_framed_support(m_server);
+            return !known || *known;
+        }
+        }
+    }
+
+    void on_connected()
+    {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        getsockopt(m_sock, SOL_SOCKET, SO_ERROR, &error, &length);
+        auto now = Transfer_stats::Clock::now();
+        m_client.m_stats.record_connect(error == 0, now - m_connect_started, m_was_connected);
+        if (error != 0)
+        {
+            connect_failed();
+            return;
+        }
+        m_connect_attempts = 0;
+        m_was_connected = true;
+        m_last_activity = now;
+
+        if (handshake_wanted())
+        {
+            m_state = State::HANDSHAKE;
+            m_out.push_back(to_segment(Protocol::framed_hello));
+
+            // a legacy server may silently ignore the hello
+            std::weak_ptr<Connection> weak_self = weak_from_this();
+            uint64_t generation = m_generation;
+            m_loop.run_after(HANDSHAKE_TIMEOUT, [weak_self, generation]
+                             {
+                                 auto self = weak_self.lock();
+                                 if (self && self->m_generation == generation && self->m_state == State::HANDSHAKE)
+                                 {
+                                     self->handshake_failed();
+                                 } });
+            update_interest();
+            return;
+        }
+
+        m_state = State::CONNECTED;
+        ready();
+    }
+
+    // Tries the current server, then whichever servers the failure handler switches to
+    bool open_with_failover()
+    {
+        if (open_socket())
+        {
+            return true;
+        }
+        while (++m_connect_attempts < MAX_CONNECT_ATTEMPTS && m_client.on_connect_failure())
+        {
+            if (open_socket())
+            {
+                return true;
+            }
+        }
+        m_connect_attempts = 0;
+        return false;
+    }
+
+    // Nothing has been sent yet, so the waiting transfers can move to another server
+    void connect_failed()
+    {
+        close_socket();
+        if (++m_connect_attempts < MAX_CONNECT_ATTEMPTS && m_client.on_connect_failure() && open_with_failover())
+        {
+            return;
+        }
+        m_connect_attempts = 0;
+        fail_connection("Connection failed");
+    }
+
+    void ready()
+    {
+        start_waiting();
+        dispatch();
+        update_interest();
+    }
+
+    void handshake_failed()
+    {
+        if (m_client.get_protocol_mode() == Protocol_mode::FRAMED)
+        {
+            fail_connection("Server does not support the framed protocol");
+            return;
+        }
+
+        // remember the answer and start over in legacy mode; queued transfers stay queued
+        remember_framed_support(m_server, false);
+        close_socket();
+        if (!open_socket())
+        {
+            fail_connection("Connection failed");
+        }
+    }
+
+    void handle_handshake_input(const char *data, size_t size)
+    {
+        m_in.insert(m_in.end(), data, data + size);
+        std::string_view response(m_in.data(), m_in.size());
+        std::string_view accept(Protocol::framed_accept);
+
+        if (response == accept)
+        {
+            m_in.clear();
+            remember_framed_support(m_server, true);
+            m_framed = true;
+            m_state = State::CONNECTED;
+            ready();
+        }
+        else if (response.size() >= accept.size() || !accept.starts_with(response))
+        {
+            handshake_failed();
+        }
+    }
+
+    void handle_legacy_input(const char *data, size_t size)
+    {
+        if (m_in_flight.empty())
+        {
+            fail_connection("Unexpected data from server");
+            return;
+        }
+
+        Transfer &transfer = *m_in_flight.begin()->second;
+        transfer.mark_response();
+        Transfer::Status status = transfer.on_receive(data, size);
+        if (status == Transfer::Status::DONE)
+        {
+            bool reusable = !transfer.leaves_data_behind();
+            complete(0, true);
+            if (!reusable)
+            {
+                // the next transfer opens a fresh connection
+                close_socket();
+            }
+            dispatch();
+        }
+        else if (status == Transfer::Status::FAILED)
+        {
+            fail_connection(transfer.error());
+        }
+    }
+
+    void handle_framed_input(const char *data, size_t size)
+    {
+        m_in.insert(m_in.end(), data, data + size);
+
+        bool completed_any = false;
+        while (m_in.size() - m_in_offset >= Protocol::frame_header_size)
+        {
+            Protocol::Frame_header header = Protocol::decode_header(m_in.data() + m_in_offset);
+            if (header.length > Protocol::max_frame_payload)
+            {
+                fail_connection("Malformed frame from server");
+                return;
+            }
+            if (m_in.size() - m_in_offset < Protocol::frame_header_size + header.length)
+            {
+                break;
+            }
+
+            const char *payload = m_in.data() + m_in_offset + Protocol::frame_header_size;
+            m_in_offset += Protocol::frame_header_size + header.length;
+
+            // frames for transfers that already failed are dropped
+            auto it = m_in_flight.find(header.request_id);
+            if (it == m_in_flight.end())
+            {
+                continue;
+            }
+
+            it->second->mark_response();
+            Transfer::Status status = it->second->on_frame(header.type, payload, header.length);
+            if (status != Transfer::Status::NEED_MORE)
+            {
+                // a failed request doesn't affect the others sharing the connection
+                complete(header.request_id, status == Transfer::Status::DONE);
+                completed_any = true;
+            }
+        }
+
+        // compact once the consumed prefix dominates the buffer
+        if (m_in_offset == m_in.size())
+        {
+            m_in.clear();
+            m_in_offset = 0;
+        }
+        else if (m_in_offset > m_in.size() / 2)
+        {
+            m_in.erase(m_in.begin(), m_in.begin() + m_in_offset);
+            m_in_offset = 0;
+        }
+
+        if (completed_any)
+        {
+            dispatch();
+        }
+    }
+
+    void handle_input()
+    {
+        // stop as soon as a failure closes (or replaces) the socket
+        uint64_t generation = m_generation;
+        while (!m_throttled && generation == m_generation)
+        {
+            auto recv_start = Transfer_stats::Clock::now();
+            ssize_t received = recv(m_sock, m_recv_buffer.data(), m_recv_buffer.size(), 0);
+            if (received > 0)
+            {
+                auto now = Transfer_stats::Clock::now();
+                std::optional<Transfer_stats::Clock::duration> gap;
+                if (!m_in_flight.empty())
+                {
+                    gap = recv_start - m_last_activity;
+                }
+                m_client.m_stats.record_recv(received, now - recv_start, gap);
+                m_last_activity = now;
+            }
+            if (received < 0)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    return;
+                }
+                fail_connection("Connection error during transfer");
+                return;
+            }
+            if (received == 0)
+            {
+                if (m_state == State::HANDSHAKE)
+                {
+                    handshake_failed();
+                    return;
+                }
+                // an idle connection closed by the server is simply reopened for the next transfer
+                fail_connection("Connection closed by server");
+                return;
+            }
+
+            pace(received);
+            if (m_state == State::HANDSHAKE)
+            {
+                handle_handshake_input(m_recv_buffer.data(), received);
+            }
+            else if (m_framed)
+            {
+                handle_framed_input(m_recv_buffer.data(), received);
+            }
+            else
+            {
+                handle_legacy_input(m_recv_buffer.data(), received);
+            }
+        }
+    }
+
+    // Queues the next piece of a request body, if any transfer has one
+    bool produce_output()
+    {
+        if (!m_framed)
+        {
+            if (m_in_flight.empty() || !m_in_flight.begin()->second->has_more_output())
+            {
+                return false;
+            }
+            m_chunk.resize(m_client.get_buffer_size());
+            size_t produced = m_in_flight.begin()->second->produce(m_chunk);
+            if (produced > 0)
+            {
+                m_out.push_back(std::move(m_chunk));
+                m_chunk = {};
+                pace(produced);
+            }
+            return true;
+        }
+
+        if (m_senders.empty())
+        {
+            return false;
+        }
+        uint32_t request_id = m_senders.front();
+        m_senders.pop_front();
+
+        Transfer &transfer = *m_in_flight.at(request_id);
+        if (!transfer.output_ready())
+        {
+            m_parked.push_back(request_id);
+            return true;
+        }
+        if (transfer.output_failed())
+        {
+            // there's no frame to abandon an upload; the server drops the partial
+            // file when the connection goes away
+            fail_connection("Upload source failed");
+            return false;
+        }
+        m_chunk.resize(std::min<size_t>(m_client.get_buffer_size(), Protocol::max_frame_payload));
+        size_t produced = transfer.produce(m_chunk);
+        if (produced > 0)
+        {
+            m_out.push_back(Protocol::make_frame(Frame_type::PUT_DATA, request_id, m_chunk.data(), produced));
+            pace(produced);
+        }
+        if (transfer.has_more_output())
+        {
+            m_senders.push_back(request_id);
+        }
+        else
+        {
+            m_out.push_back(Protocol::make_frame(Frame_type::PUT_END, request_id));
+        }
+        return true;
+    }
+
+    void handle_output()
+    {
+        uint64_t generation = m_generation;
+        while (!m_throttled && generation == m_generation)
+        {
+            if (m_out.empty())
+            {
+                if (!produce_output())
+                {
+                    break;
+                }
+                continue;
+            }
+
+            std::vector<char> &segment = m_out.front();
+            auto send_start = Transfer_stats::Clock::now();
+            ssize_t sent = send(m_sock, segment.data() + m_out_offset, segment.size() - m_out_offset, MSG_NOSIGNAL);
+            if (sent > 0)
+            {
+                m_last_activity = Transfer_stats::Clock::now();
+                m_client.m_stats.record_send(sent, m_last_activity - send_start);
+            }
+            if (sent < 0)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    break;
+                }
+                fail_connection("Connection error during transfer");
+                return;
+            }
+
+            m_out_offset += sent;
+            if (m_out_offset == segment.size())
+            {
+                m_out.pop_front();
+                m_out_offset = 0;
+            }
+        }
+        update_interest();
+    }
+
+public:
+    bool idle = true; // guarded by the client's mutex
+
+    Connection(Async_file_client &client, Event_loop &loop)
+        : m_client(client), m_loop(loop), m_recv_buffer(std::max<size_t>(64 * 1024, client.get_buffer_size())) {}
+
+    ~Connection()
+    {
+        if (m_sock >= 0)
+        {
+            close(m_sock);
+        }
+    }
+
+    Event_loop &loop() { return m_loop; }
+
+    // Takes pending transfers while the connection has room for them, loop thread only
+    void dispatch()
+    {
+        bool started = false;
+        while (can_accept())
+        {
+            std::unique_ptr<Transfer> transfer = m_client.take_pending(*this);
+            if (!transfer)
+            {
+                break;
+            }
+            if (m_client.cancelled())
+            {
+                transfer->finish(false, "Transfer cancelled");
+                continue;
+            }
+
+            if (m_state == State::DISCONNECTED && !open_with_failover())
+            {
+                transfer->finish(false, "Connection failed");
+                continue;
+            }
+            if (m_state != State::CONNECTED)
+            {
+                m_waiting.push_back(std::move(transfer));
+                continue;
+            }
+            start_transfer(std::move(transfer));
+            started = true;
+        }
+        if (started)
+        {
+            update_interest();
+        }
+    }
+
+    void on_event(uint32_t events)
+    {
+        if (m_state == State::CONNECTING)
+        {
+            on_connected();
+            return;
+        }
+
+        if ((!m_in_flight.empty() || !m_waiting.empty()) && m_client.cancelled())
+        {
+            // the rest of the transfer is still in flight, so the connection can't be reused
+            fail_connection("Transfer cancelled");
+            return;
+        }
+
+        if (events & EPOLLERR)
+        {
+            fail_connection("Connection error");
+            return;
+        }
+        uint64_t generation = m_generation;
+        if (events & (EPOLLIN | EPOLLHUP))
+        {
+            handle_input();
+        }
+        if (generation == m_generation && (events & EPOLLOUT))
+        {
+            handle_output();
+        }
+    }
+
+    void shutdown(const std::string &reason)
+    {
+        close_socket();
+        for (auto &[request_id, transfer] : m_in_flight)
+        {
+            transfer->finish(false, reason);
+        }
+        for (auto &transfer : m_waiting)
+        {
+            transfer->finish(false, reason);
+        }
+        m_in_flight.clear();
+        m_waiting.clear();
+    }
+};
+
+Async_file_client::Async_file_client(const std::string &server_ip, int server_port,
+                                     size_t thread_count, size_t max_connections)
+    : m_server_ip(server_ip), m_server_port(server_port), m_max_connections(std::max<size_t>(max_connections, 1))
+{
+    thread_count = std::clamp<size_t>(thread_count, 1, m_max_connections);
+    for (size_t i = 0; i < thread_count; i++)
+    {
+        m_loops.push_back(std::make_unique<Event_loop>());
+    }
+}
+
+Async_file_client::~Async_file_client()
+{
+    std::deque<std::unique_ptr<Transfer>> pending;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_shutting_down = true;
+        pending.swap(m_pending);
+    }
+    for (auto &transfer : pending)
+    {
+        transfer->finish(false, "Client shut down");
+    }
+
+    for (auto &connection : m_connections)
+    {
+        connection->loop().post([connection]
+                                { connection->shutdown("Client shut down"); });
+    }
+    // joining the loops runs the shutdown tasks
+    m_loops.clear();
+    m_connections.clear();
+}
+
+void Async_file_client::set_server(const std::string &server_ip, int server_port)
+{
+    std::lock_guard<std::mutex> lock(m_server_mutex);
+    m_server_ip = server_ip;
+    m_server_port = server_port;
+}
+
+bool Async_file_client::is_framed() const
+{
+    std::optional<bool> known = known_framed_support(server_key(get_server_ip(), get_server_port()));
+    return known && *known;
+}
+
+std::string Async_file_client::get_server_ip() const
+{
+    std::lock_guard<std::mutex> lock(m_server_mutex);
+    return m_server_ip;
+}
+
+int Async_file_client::get_server_port() const
+{
+    std::lock_guard<std::mutex> lock(m_server_mutex);
+    return m_server_port;
+}
+
+void Async_file_client::set_connect_failure_handler(std::function<bool()> handler)
+{
+    std::lock_guard<std::mutex> lock(m_server_mutex);
+    m_connect_failure_handler = std::move(handler);
+}
+
+bool Async_file_client::on_connect_failure()
+{
+    std::function<bool()> handler;
+    {
+        std::lock_guard<std::mutex> lock(m_server_mutex);
+        handler = m_connect_failure_handler;
+    }
+    return handler && handler();
+}
+
+void Async_file_client::submit(std::unique_ptr<Transfer> transfer)
+{
+    std::shared_ptr<Connection> connection;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_shutting_down)
+        {
+            transfer->finish(false, "Client shut down");
+            return;
+        }
+        m_pending.push_back(std::move(transfer));
+
+        for (auto &candidate : m_connections)
+        {
+            if (candidate->idle)
+            {
+                connection = candidate;
+                break;
+            }
+        }
+        if (!connection && m_connections.size() < m_max_connections)
+        {
+            Event_loop &loop = *m_loops[m_connections.size() % m_loops.size()];
+            connection = std::make_shared<Connection>(*this, loop);
+            m_connections.push_back(connection);
+        }
+        if (!connection)
+        {
+            // every connection is full, the first one with room picks it up
+            return;
+        }
+        connection->idle = false;
+    }
+    connection->loop().post([connection]
+                            { connection->dispatch(); });
+}
+
+std::unique_ptr<Async_file_client::Transfer> Async_file_client::take_pending(Connection &connection)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_pending.empty() || m_shutting_down)
+    {
+        connection.idle = true;
+        return nullptr;
+    }
+    std::unique_ptr<Transfer> transfer = std::move(m_pending.front());
+    m_pending.pop_front();
+    return transfer;
+}
+
+void Async_file_client::list_files(Transfer_callback on_complete, const std::string &since_version)
+{
+    submit(std::make_unique<List_transfer>(since_version, std::move(on_complete)));
+}
+
+void Async_file_client::download_file(const std::string &filename, const std::string &save_path, Transfer_callback on_complete)
+{
+    submit(std::make_unique<Get_transfer>(filename, save_path, std::move(on_complete)));
+}
+
+void Async_file_client::download_range(const std::string &filename, uint64_t offset, uint64_t length,
+                                       Transfer_callback on_complete)
+{
+    submit(std::make_unique<Range_transfer>(filename, offset, length, std::move(on_complete)));
+}
+
+void Async_file_client::upload_file(const std::string &filepath, Transfer_callback on_complete)
+{
+    submit(std::make_unique<Put_transfer>(filepath, std::move(on_complete)));
+}
+
+void Async_file_client::upload_stream(const std::string &filename, std::shared_ptr<Upload_stream> stream,
+                                      Transfer_callback on_complete)
+{
+    submit(std::make_unique<Stream_put_transfer>(filename, std::move(stream), std::move(on_complete)));
+}
+
+namespace
+{
+    // Adapts the callback interface to a future
+    std::pair<Transfer_callback, std::future<Transfer_result>> make_completion()
+    {
+        auto promise = std::make_shared<std::promise<Transfer_result>>();
+        std::future<Transfer_result> future = promise->get_future();
+        return {[promise](Transfer_result result)
+                { promise->set_value(std::move(result)); },
+                std::move(future)};
+    }
+}
+
+std::future<Transfer_result> Async_file_client::list_files(const std::string &since_version)
+{
+    auto [callback, future] = make_completion();
+    list_files(std::move(callback), since_version);
+    return std::move(future);
+}
+
+std::future<Transfer_result> Async_file_client::download_file(const std::string &filename, const std::string &save_path)
+{
+    auto [callback, future] = make_completion();
+    download_file(filename, save_path, std::move(callback));
+    return std::move(future);
+}
+
+std::future<Transfer_result> Async_file_client::download_range(const std::string &filename, uint64_t offset, uint64_t length)
+{
+    auto [callback, future] = make_completion();
+    download_range(filename, offset, length, std::move(callback));
+    return std::move(future);
+}
+
+std::future<Transfer_result> Async_file_client::upload_file(const std::string &filepath)
+{
+    auto [callback, future] = make_completion();
+    upload_file(filepath, std::move(callback));
+    return std::move(future);
+}
+
+std::future<Transfer_result> Async_file_client::upload_stream(const std::string &filename, std::shared_ptr<Upload_stream> stream)
+{
+    auto [callback, future] = make_completion();
+    upload_stream(filename, std::move(stream), std::move(callback));
+    return std::move(future);
+}
+
+std::vector<std::future<Transfer_result>> Async_file_client::download_files(const std::vector<std::string> &filenames,
+                                                                            const std::string &save_path)
+{
+    std::vector<std::future<Transfer_result>> results;
+    results.reserve(filenames.size());
+    for (const auto &filename : filenames)
+    {
+        results.push_back(download_file(filename, save_path));
+    }
+    return results;
+}
@@ -0,0 +1,251 @@
+#include "Audio_sink.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+Null_sink::Null_sink(bool paced, unsigned int rate) : m_paced(paced), m_rate(rate)
+{
+    if (m_paced)
+    {
+        m_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (m_timer_fd < 0)
+        {
+            throw std::runtime_error("Cannot create timerfd");
+        }
+    }
+}
+
+Null_sink::~Null_sink()
+{
+    if (m_timer_fd >= 0)
+    {
+        ::close(m_timer_fd);
+    }
+}
+
+Sink_format Null_sink::open(const Pcm_format &format)
+{
+    // whatever a device would take best
+    m_format.sample_rate = m_rate != 0 ? m_rate : format.sample_rate;
+    m_format.channels = format.channels;
+    m_format.sample_format = preferred_formats(format.bits_per_sample).front();
+    m_buffer_frames = m_format.sample_rate;
+    m_format.period_frames = std::max<size_t>(1, m_buffer_frames / PERIODS);
+    m_open = true;
+    drop();
+    return m_format;
+}
+
+std::string Null_sink::name() const
+{
+    std::string name = m_paced ? "paced" : "null";
+    return m_rate != 0 ? name + "@" + std::to_string(m_rate) : name;
+}
+
+uint64_t Null_sink::played(Clock::time_point now) const
+{
+    if (!m_started)
+    {
+        return 0;
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>((m_paused ? m_paused_at : now) - m_start);
+    uint64_t frames = static_cast<uint64_t>(elapsed.count()) * m_format.sample_rate / 1000000000;
+    return std::min(frames, m_written);
+}
+
+void Null_sink::wake_at(Clock::time_point time)
+{
+    auto delay = std::max<Clock::duration>(std::chrono::duration_cast<std::chrono::nanoseconds>(time - Clock::now()), std::chrono::nanoseconds(1));
+    itimerspec spec{};
+    spec.it_value.tv_sec = std::chrono::duration_cast<std::chrono::seconds>(delay).count();
+    spec.it_value.tv_nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(delay % std::chrono::seconds(1)).count();
+    timerfd_settime(m_timer_fd, 0, &spec, nullptr);
+}
+
+Sink_write Null_sink::write(const char *, size_t frames)
+{
+    if (!m_paced)
+    {
+        return {frames};
+    }
+
+    Sink_write result;
+    Clock::time_point now = Clock::now();
+    if (m_started && !m_paused && m_written > 0 && played(now) >= m_written)
+    {
+        // everything played out before more came: the device would have run dry
+        result.xrun = true;
+        m_started = false;
+    }
+    if (!m_started)
+    {
+        m_started = true;
+        m_start = now;
+        m_written = 0;
+    }
+
+    uint64_t queued = m_written - played(now);
+    result.frames = static_cast<size_t>(std::min<uint64_t>(frames, m_buffer_frames - std::min<uint64_t>(queued, m_buffer_frames)));
+    m_written += result.frames;
+    if (result.frames == 0)
+    {
+        // full: wake up once a period has played
+        uint64_t frame = m_written + m_format.period_frames - m_buffer_frames;
+        wake_at(m_start + std::chrono::nanoseconds(frame * 1000000000 / m_format.sample_rate));
+    }
+    return result;
+}
+
+std::vector<pollfd> Null_sink::poll_descriptors()
+{
+    if (!m_paced)
+    {
+        return {};
+    }
+    return {pollfd{m_timer_fd, POLLIN, 0}};
+}
+
+bool Null_sink::writable(const pollfd *fds, size_t count)
+{
+    if (count == 0 || !(fds[0].revents & POLLIN))
+    {
+        return false;
+    }
+    uint64_t expirations;
+    [[maybe_unused]] ssize_t read_bytes = read(m_timer_fd, &expirations, sizeof(expirations));
+    return true;
+}
+
+long Null_sink::available()
+{
+    if (!m_paced)
+    {
+        return -1;
+    }
+    return static_cast<long>(m_buffer_frames - std::min<uint64_t>(m_written - played(Clock::now()), m_buffer_frames));
+}
+
+void Null_sink::pause(bool paused)
+{
+    if (!m_paced || paused == m_paused)
+    {
+        return;
+    }
+    Clock::time_point now = Clock::now();
+    if (paused)
+    {
+        m_paused_at = now;
+    }
+    else
+    {
+        m_start += now - m_paused_at;
+    }
+    m_paused = paused;
+}
+
+void Null_sink::drop()
+{
+    m_started = false;
+    m_written = 0;
+    m_paused = false;
+    if (m_timer_fd >= 0)
+    {
+        itimerspec disarm{};
+        timerfd_settime(m_timer_fd, 0, &disarm, nullptr);
+    }
+}
+
+bool Null_sink::drain()
+{
+    if (!m_paced || !m_started)
+    {
+        return true;
+    }
+    if (played(Clock::now()) >= m_written)
+    {
+        drop();
+        return true;
+    }
+    wake_at(m_start + std::chrono::nanoseconds(m_written * 1000000000 / m_format.sample_rate));
+    return false;
+}
+
+Sink_format File_sink::open(const Pcm_format &format)
+{
+    if (!m_writer.is_open())
+    {
+        // the narrowest integer format that holds the stream, as WAV stores it
+        m_format.sample_rate = format.sample_rate;
+        m_format.channels = format.channels;
+        m_format.sample_format = format.bits_per_sample <= 16   ? Sample_format::S16
+                                 : format.bits_per_sample <= 24 ? Sample_format::S24_3LE
+                                                                : Sample_format::S32;
+        m_format.period_frames = std::max<size_t>(1, format.sample_rate / PERIODS);
+        m_writer.open(m_path, m_format.sample_rate, m_format.channels, bytes_per_sample(m_format.sample_format) * 8, m_raw);
+    }
+    else if (format.channels != m_format.channels && !Channel_mixer::can_mix(format.channels, m_format.channels))
+    {
+        throw std::runtime_error(m_path.string() + " holds " + std::to_string(m_format.channels) + " channels, cannot mix " +
+                                 std::to_string(format.channels) + " into them");
+    }
+    m_open = true;
+    return m_format;
+}
+
+void File_sink::close()
+{
+    m_open = false;
+    m_writer.update_header();
+}
+
+std::string File_sink::name() const
+{
+    return "file " + m_path.string();
+}
+
+Sink_write File_sink::write(const char *data, size_t frames)
+{
+    size_t frame_bytes = m_format.channels * bytes_per_sample(m_format.sample_format);
+    if (!m_writer.write_bytes(data, frames * frame_bytes))
+    {
+        return {0, false, true};
+    }
+    return {frames};
+}
+
+bool File_sink::drain()
+{
+    m_writer.update_header();
+    return true;
+}
+
+std::unique_ptr<Audio_sink> make_headless_sink(const std::string &spec)
+{
+    if (spec.starts_with("file:") && spec.size() > 5)
+    {
+        std::filesystem::path path = spec.substr(5);
+        bool raw = path.extension() == ".raw" || path.extension() == ".pcm";
+        return std::make_unique<File_sink>(path, raw);
+    }
+
+    std::string kind = spec.substr(0, spec.find('@'));
+    if (kind != "null" && kind != "paced")
+    {
+        return nullptr;
+    }
+    unsigned int rate = 0;
+    if (size_t at = spec.find('@'); at != std::string::npos)
+    {
+        try
+        {
+            rate = static_cast<unsigned int>(std::stoul(spec.substr(at + 1)));
+        }
+        catch (const std::exception &)
+        {
+            return nullptr;
+        }
+    }
+    return std::make_unique<Null_sink>(kind == "paced", rate);
+}
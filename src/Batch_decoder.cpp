@@ -0,0 +1,329 @@
+#include "Batch_decoder.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <numeric>
+#include <sstream>
+
+#include "Flac.hpp"
+#include "Frame_scanner.hpp"
+#include "Mapped_file.hpp"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct Worker_buffers
+    {
+        std::vector<char> read_buffer;
+        std::vector<buffer_sample_type> samples;
+    };
+
+    struct File_state
+    {
+        std::mutex mutex;
+        Batch_file_result result;
+        uint64_t expected_samples{}; // from STREAMINFO, 0 when unknown
+        Clock::time_point first_start = Clock::time_point::max();
+        Clock::time_point last_end{};
+    };
+
+    // Frames from the one at offset, whose first sample is first_sample, up to
+    // end_sample; 0 for the end of the stream
+    struct Range
+    {
+        uint64_t offset{};
+        uint64_t first_sample{};
+        uint64_t end_sample{};
+    };
+
+    // Lends a worker's sample buffer to a decoder for one task
+    class Buffer_loan
+    {
+    private:
+        Flac &m_flac;
+        std::vector<buffer_sample_type> &m_buffer;
+
+    public:
+        Buffer_loan(Flac &flac, std::vector<buffer_sample_type> &buffer) : m_flac(flac), m_buffer(buffer)
+        {
+            m_flac.reuse_buffer(std::move(m_buffer));
+        }
+        ~Buffer_loan() { m_buffer = m_flac.release_buffer(); }
+
+        Buffer_loan(const Buffer_loan &) = delete;
+        Buffer_loan &operator=(const Buffer_loan &) = delete;
+    };
+
+    // Cuts the stream at the first seek point past every split_bytes of audio data.
+    // Without usable seek points the frames to cut at are found with Frame_scanner.
+    std::vector<Range> plan_ranges(const Flac &flac, const fs::path &path, uint64_t file_size, uint64_t split_bytes)
+    {
+        std::vector<Range> ranges{{0, 0, 0}};
+        if (split_bytes == 0 || file_size <= split_bytes)
+        {
+            return ranges;
+        }
+        uint64_t next_cut = split_bytes;
+        for (const Seek_point &point : flac.get_seek_table())
+        {
+            if (point.stream_offset >= next_cut && point.sample_number > ranges.back().first_sample)
+            {
+                ranges.back().end_sample = point.sample_number;
+                ranges.push_back({point.stream_offset, point.sample_number, 0});
+                next_cut = point.stream_offset + split_bytes;
+            }
+        }
+        if (ranges.size() > 1)
+        {
+            return ranges;
+        }
+
+        // only the pages around the cuts are read
+        Mapped_file file(path);
+        if (file.size() <= flac.get_audio_offset())
+        {
+            return ranges;
+        }
+        const uint8_t *audio = reinterpret_cast<const uint8_t *>(file.data()) + flac.get_audio_offset();
+        size_t audio_size = file.size() - flac.get_audio_offset();
+        Frame_scanner scanner(flac.get_stream_info());
+        while (next_cut < audio_size)
+        {
+            std::optional<Frame_location> frame = scanner.find_confirmed_frame(audio, audio_size, next_cut);
+            if (!frame || frame->first_sample <= ranges.back().first_sample)
+            {
+                break;
+            }
+            ranges.back().end_sample = frame->first_sample;
+            ranges.push_back({frame->offset, frame->first_sample, 0});
+            next_cut = frame->offset + split_bytes;
+        }
+        return ranges;
+    }
+
+    void open_stream(std::ifstream &stream, const fs::path &path, std::vector<char> &read_buffer)
+    {
+        stream.rdbuf()->pubsetbuf(read_buffer.data(), read_buffer.size());
+        stream.open(path, std::ios::binary);
+        if (!stream)
+        {
+            throw std::runtime_error("Cannot open file");
+        }
+    }
+}
+
+double Batch_report::utilization() const
+{
+    if (workers.empty() || seconds <= 0)
+    {
+        return 0;
+    }
+    uint64_t busy_ns = 0;
+    for (const auto &worker : workers)
+    {
+        busy_ns += worker.busy_ns;
+    }
+    return busy_ns / 1e9 / (seconds * workers.size());
+}
+
+std::string Batch_report::to_json() const
+{
+    uint64_t steals = 0;
+    for (const auto &worker : workers)
+    {
+        steals += worker.steals;
+    }
+
+    std::ostringstream json;
+    json << "{\"files\":" << files.size() << ",\"failed\":" << failed << ",\"tasks\":" << tasks
+         << ",\"steals\":" << steals << ",\"bytes\":" << bytes << ",\"samples\":" << samples
+         << ",\"audio_seconds\":" << audio_seconds << ",\"seconds\":" << seconds
+         << ",\"realtime_factor\":" << realtime_factor() << ",\"mib_per_second\":" << mib_per_second()
+         << ",\"utilization\":" << utilization() << ",\"workers\":[";
+    for (size_t i = 0; i < workers.size(); i++)
+    {
+        json << (i == 0 ? "" : ",") << "{\"tasks\":" << workers[i].tasks << ",\"steals\":" << workers[i].steals
+             << ",\"busy_ns\":" << workers[i].busy_ns << "}";
+    }
+    json << "],\"per_file\":[";
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        const Batch_file_result &file = files[i];
+        json << (i == 0 ? "" : ",") << "{\"path\":" << std::quoted(file.path.string()) << ",\"ok\":" << (file.ok ? "true" : "false");
+        if (!file.ok)
+        {
+            json << ",\"error\":" << std::quoted(file.error);
+        }
+        json << ",\"bytes\":" << file.bytes << ",\"samples\":" << file.samples << ",\"ranges\":" << file.ranges
+             << ",\"decode_seconds\":" << file.decode_seconds << ",\"wall_seconds\":" << file.wall_seconds << "}";
+    }
+    json << "]}";
+    return json.str();
+}
+
+Batch_report Batch_decoder::run(const std::vector<fs::path> &paths) const
+{
+    auto start = Clock::now();
+
+    std::vector<File_state> files(paths.size());
+    for (size_t i = 0; i < paths.size(); i++)
+    {
+        std::error_code ec;
+        files[i].result.path = paths[i];
+        files[i].result.bytes = fs::file_size(paths[i], ec);
+    }
+
+    Work_stealing_pool pool(m_options.threads);
+    std::vector<Worker_buffers> buffers(pool.size());
+    for (auto &worker_buffers : buffers)
+    {
+        worker_buffers.read_buffer.resize(READ_BUFFER_SIZE);
+    }
+
+    auto decode = [&](Flac &flac, size_t file, uint64_t end_sample, size_t worker)
+    {
+        Buffer_loan loan(flac, buffers[worker].samples);
+        flac.reserve_buffers();
+        const Stream_info &info = flac.get_stream_info();
+        while ((end_sample == 0 || flac.get_sample_count() < end_sample) && !flac.get_reader().eos())
+        {
+            uint64_t first_sample = flac.get_sample_count();
+            flac.decode_frame();
+            if (m_handler)
+            {
+                m_handler({file, info, first_sample, flac.get_audio_buffer(), worker});
+            }
+        }
+        if (end_sample != 0 && flac.get_sample_count() != end_sample)
+        {
+            throw std::runtime_error("Seek point isn't on a frame boundary");
+        }
+    };
+
+    auto finish = [&](size_t file, Clock::time_point task_start, uint64_t samples, const std::string &error)
+    {
+        auto end = Clock::now();
+        File_state &state = files[file];
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.result.samples += samples;
+        state.result.decode_seconds += std::chrono::duration<double>(end - task_start).count();
+        state.first_start = std::min(state.first_start, task_start);
+        state.last_end = std::max(state.last_end, end);
+        if (!error.empty() && state.result.error.empty())
+        {
+            state.result.error = error;
+        }
+    };
+
+    auto decode_range = [&](size_t file, Range range, size_t worker)
+    {
+        auto task_start = Clock::now();
+        std::string error;
+        uint64_t samples = 0;
+        try
+        {
+            std::ifstream stream;
+            open_stream(stream, paths[file], buffers[worker].read_buffer);
+            Flac flac(stream);
+            flac.initialize();
+            flac.seek_to_frame(range.offset, range.first_sample);
+            decode(flac, file, range.end_sample, worker);
+            samples = flac.get_sample_count() - range.first_sample;
+        }
+        catch (const std::exception &e)
+        {
+            error = e.what();
+        }
+        finish(file, task_start, samples, error);
+    };
+
+    // reads the metadata, queues the other ranges of a large file and decodes the first
+    auto decode_file = [&](size_t file, size_t worker)
+    {
+        auto task_start = Clock::now();
+        std::string error;
+        uint64_t samples = 0;
+        try
+        {
+            std::ifstream stream;
+            open_stream(stream, paths[file], buffers[worker].read_buffer);
+            Flac flac(stream);
+            flac.initialize();
+
+            std::vector<Range> ranges = plan_ranges(flac, paths[file], files[file].result.bytes, m_options.split_bytes);
+            {
+                std::lock_guard<std::mutex> lock(files[file].mutex);
+                files[file].result.sample_rate = flac.get_stream_info().sample_rate;
+                files[file].result.channels = flac.get_stream_info().channels;
+                files[file].result.ranges = ranges.size();
+                files[file].expected_samples = flac.get_stream_info().total_samples;
+            }
+            for (size_t i = 1; i < ranges.size(); i++)
+            {
+                pool.submit([&, file, range = ranges[i]](size_t range_worker)
+                            { decode_range(file, range, range_worker); });
+            }
+            decode(flac, file, ranges[0].end_sample, worker);
+            samples = flac.get_sample_count();
+        }
+        catch (const std::exception &e)
+        {
+            error = e.what();
+        }
+        finish(file, task_start, samples, error);
+    };
+
+    // Workers run their newest task first, so queueing the smallest files first
+    // has every worker start on the largest of its share
+    std::vector<size_t> order(paths.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+                     { return files[a].result.bytes < files[b].result.bytes; });
+    for (size_t file : order)
+    {
+        pool.submit([&, file](size_t worker)
+                    { decode_file(file, worker); });
+    }
+    pool.wait();
+
+    Batch_report report;
+    report.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    report.workers = pool.stats();
+    for (const auto &worker : report.workers)
+    {
+        report.tasks += worker.tasks;
+    }
+
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        File_state &state = files[i];
+        Batch_file_result &result = state.result;
+        if (state.last_end > state.first_start)
+        {
+            result.wall_seconds = std::chrono::duration<double>(state.last_end - state.first_start).count();
+        }
+        // every range decoded, now the whole has to add up to what STREAMINFO says
+        if (result.error.empty() && state.expected_samples != 0 && state.expected_samples != result.samples)
+        {
+            result.error = "Decoded " + std::to_string(result.samples) + " samples, STREAMINFO gives " +
+                           std::to_string(state.expected_samples);
+        }
+        result.ok = result.error.empty();
+
+        report.failed += result.ok ? 0 : 1;
+        report.bytes += result.bytes;
+        report.samples += result.samples;
+        if (result.sample_rate != 0)
+        {
+            report.audio_seconds += static_cast<double>(result.samples) / result.sample_rate;
+        }
+        report.files.push_back(std::move(result));
+    }
+    return report;
+}
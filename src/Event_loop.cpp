@@ -0,0 +1,175 @@
+#include "Event_loop.hpp"
+
+#include <cerrno>
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace
+{
+    constexpr uint64_t WAKE_TOKEN = 0;
+}
+
+Event_loop::Event_loop()
+{
+    m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epoll_fd < 0)
+    {
+        throw std::runtime_error("Cannot create epoll instance");
+    }
+
+    m_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_wake_fd < 0)
+    {
+        close(m_epoll_fd);
+        throw std::runtime_error("Cannot create eventfd");
+    }
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.u64 = WAKE_TOKEN;
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_wake_fd, &event);
+
+    m_thread = std::thread(&Event_loop::run, this);
+}
+
+Event_loop::~Event_loop()
+{
+    m_stop = true;
+    uint64_t one = 1;
+    [[maybe_unused]] ssize_t written = write(m_wake_fd, &one, sizeof(one));
+    m_thread.join();
+
+    close(m_wake_fd);
+    close(m_epoll_fd);
+}
+
+void Event_loop::add_fd(int fd, uint32_t events, Handler handler)
+{
+    uint64_t token = m_next_token++;
+    epoll_event event{};
+    event.events = events;
+    event.data.u64 = token;
+    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+    {
+        throw std::runtime_error("Cannot register descriptor with epoll");
+    }
+    m_tokens[fd] = token;
+    m_handlers[token] = std::make_shared<Handler>(std::move(handler));
+}
+
+void Event_loop::modify_fd(int fd, uint32_t events)
+{
+    auto it = m_tokens.find(fd);
+    if (it == m_tokens.end())
+    {
+        return;
+    }
+    epoll_event event{};
+    event.events = events;
+    event.data.u64 = it->second;
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, fd, &event);
+}
+
+void Event_loop::remove_fd(int fd)
+{
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    auto it = m_tokens.find(fd);
+    if (it != m_tokens.end())
+    {
+        m_handlers.erase(it->second);
+        m_tokens.erase(it);
+    }
+}
+
+void Event_loop::post(Task task)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_task_mutex);
+        m_tasks.push_back(std::move(task));
+    }
+    uint64_t one = 1;
+    [[maybe_unused]] ssize_t written = write(m_wake_fd, &one, sizeof(one));
+}
+
+void Event_loop::run_after(Clock::duration delay, Task task)
+{
+    m_timers.push({Clock::now() + delay, m_timer_sequence++, std::move(task)});
+}
+
+void Event_loop::run_tasks()
+{
+    std::vector<Task> tasks;
+    {
+        std::lock_guard<std::mutex> lock(m_task_mutex);
+        tasks.swap(m_tasks);
+    }
+    for (auto &task : tasks)
+    {
+        task();
+    }
+}
+
+void Event_loop::run_timers()
+{
+    auto now = Clock::now();
+    while (!m_timers.empty() && m_timers.top().deadline <= now)
+    {
+        Task task = std::move(const_cast<Timer &>(m_timers.top()).task);
+        m_timers.pop();
+        task();
+    }
+}
+
+int Event_loop::next_timeout_ms()
+{
+    if (m_timers.empty())
+    {
+        return -1;
+    }
+    auto remaining = std::chrono::ceil<std::chrono::milliseconds>(m_timers.top().deadline - Clock::now());
+    return remaining.count() > 0 ? static_cast<int>(remaining.count()) : 0;
+}
+
+void Event_loop::run()
+{
+    static constexpr int MAX_EVENTS = 64;
+    epoll_event events[MAX_EVENTS];
+
+    while (!m_stop)
+    {
+        int ready = epoll_wait(m_epoll_fd, events, MAX_EVENTS, next_timeout_ms());
+        if (ready < 0 && errno != EINTR)
+        {
+            break;
+        }
+
+        for (int i = 0; i < ready; i++)
+        {
+            uint64_t token = events[i].data.u64;
+            if (token == WAKE_TOKEN)
+            {
+                uint64_t count;
+                [[maybe_unused]] ssize_t received = read(m_wake_fd, &count, sizeof(count));
+                continue;
+            }
+
+            // an earlier handler in this batch may have removed the descriptor, and
+            // maybe registered another one under the same number
+            auto it = m_handlers.find(token);
+            if (it == m_handlers.end())
+            {
+                continue;
+            }
+            std::shared_ptr<Handler> handler = it->second;
+            (*handler)(events[i].events);
+        }
+
+        run_tasks();
+        run_timers();
+    }
+
+    // let pending work observe the shutdown (e.g. fail outstanding transfers)
+    run_tasks();
+}
@@ -0,0 +1,725 @@
+#include "File_server.hpp"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <fstream>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <optional>
+#include <poll.h>
+#include <set>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+#include "Protocol.hpp"
+#include "Server_discovery.hpp"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    using Frame_type = Protocol::Frame_type;
+
+    bool send_all(int sock, const char *data, size_t size)
+    {
+        while (size > 0)
+        {
+            ssize_t sent = send(sock, data, size, MSG_NOSIGNAL);
+            if (sent <= 0)
+            {
+                return false;
+            }
+            data += sent;
+            size -= sent;
+        }
+        return true;
+    }
+
+    bool recv_exact(int sock, char *data, size_t size)
+    {
+        while (size > 0)
+        {
+            ssize_t received = recv(sock, data, size, 0);
+            if (received <= 0)
+            {
+                return false;
+            }
+            data += received;
+            size -= received;
+        }
+        return true;
+    }
+
+    bool send_u32(int sock, uint32_t value)
+    {
+        uint32_t network_value = htonl(value);
+        return send_all(sock, reinterpret_cast<const char *>(&network_value), sizeof(network_value));
+    }
+}
+
+File_server::File_server(const fs::path &root, int port, bool announce)
+    : m_root(root), m_port(port), m_announce(announce) {}
+
+File_server::~File_server()
+{
+    stop();
+}
+
+void File_server::start()
+{
+    m_listen_sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (m_listen_sock < 0)
+    {
+        throw std::runtime_error("Cannot create server socket");
+    }
+
+    int reuse = 1;
+    setsockopt(m_listen_sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(m_port);
+    if (bind(m_listen_sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(m_listen_sock, 128) < 0)
+    {
+        close(m_listen_sock);
+        m_listen_sock = -1;
+        throw std::runtime_error("Cannot bind server socket");
+    }
+
+    socklen_t addr_len = sizeof(addr);
+    getsockname(m_listen_sock, (struct sockaddr *)&addr, &addr_len);
+    m_port = ntohs(addr.sin_port);
+
+    m_catalog_epoch = std::to_string(std::chrono::system_clock::now().time_since_epoch().count() ^ getpid());
+
+    m_stop = false;
+    m_accept_thread = std::thread(&File_server::accept_loop, this);
+    if (m_announce)
+    {
+        m_announce_thread = std::thread(&File_server::announce_loop, this);
+    }
+}
+
+void File_server::stop()
+{
+    if (m_listen_sock < 0)
+    {
+        return;
+    }
+
+    m_stop = true;
+    shutdown(m_listen_sock, SHUT_RDWR);
+    m_accept_thread.join();
+    if (m_announce_thread.joinable())
+    {
+        m_announce_thread.join();
+    }
+    close(m_listen_sock);
+    m_listen_sock = -1;
+
+    // unblock workers waiting in recv, then wait for them to leave
+    std::unique_lock<std::mutex> lock(m_workers_mutex);
+    for (int sock : m_client_socks)
+    {
+        ::shutdown(sock, SHUT_RDWR);
+    }
+    m_workers_cv.wait(lock, [&]
+                      { return m_active_connections == 0; });
+}
+
+void File_server::accept_loop()
+{
+    while (!m_stop)
+    {
+        int sock = accept4(m_listen_sock, nullptr, nullptr, SOCK_CLOEXEC);
+        if (sock < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            break;
+        }
+
+        // responses go out as a size followed by the body, don't let Nagle delay them
+        int no_delay = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+
+        {
+            std::lock_guard<std::mutex> lock(m_workers_mutex);
+            m_client_socks.push_back(sock);
+        }
+        m_active_connections++;
+
+        std::thread([this, sock]
+                    {
+                        serve(sock);
+
+                        std::lock_guard<std::mutex> lock(m_workers_mutex);
+                        std::erase(m_client_socks, sock);
+                        close(sock);
+                        m_active_connections--;
+                        m_workers_cv.notify_all(); })
+            .detach();
+    }
+}
+
+void File_server::announce_loop()
+{
+    int sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+    {
+        return;
+    }
+
+    unsigned char ttl = 1;
+    setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+
+    struct sockaddr_in group{};
+    group.sin_family = AF_INET;
+    group.sin_addr.s_addr = inet_addr(Server_discovery::DISCOVERY_GROUP);
+    group.sin_port = htons(Server_discovery::DISCOVERY_PORT);
+
+    while (!m_stop)
+    {
+        // in percent, as Server_discovery::parse_announcement reads it
+        int load_percent = std::min(100, m_active_connections * 100 / MAX_CONNECTIONS);
+        std::string message = "audio_server:" + std::to_string(m_port) + ":" + std::to_string(load_percent);
+        sendto(sock, message.data(), message.size(), 0, (struct sockaddr *)&group, sizeof(group));
+
+        // in short naps, to notice stop()
+        for (auto slept = std::chrono::milliseconds(0); slept < Server_discovery::ANNOUNCE_INTERVAL && !m_stop;
+             slept += std::chrono::milliseconds(100))
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    }
+    close(sock);
+}
+
+bool File_server::valid_name(const std::string &name) const
+{
+    // keep clients inside the served directory
+    return !name.empty() && name != "." && name != ".." && name.find('/') == std::string::npos;
+}
+
+void File_server::rescan_locked()
+{
+    std::map<std::string, Catalog_entry> current;
+    for (const auto &entry : fs::directory_iterator(m_root))
+    {
+        std::string name = entry.path().filename().string();
+        struct stat info{};
+        if (!entry.is_regular_file() || name.ends_with(".part") || ::stat(entry.path().c_str(), &info) != 0)
+        {
+            continue;
+        }
+        current[name] = {static_cast<uint64_t>(info.st_size), static_cast<int64_t>(info.st_mtime)};
+    }
+
+    // every change found by this scan belongs to the next version
+    uint64_t next_version = m_catalog_version + 1;
+    bool changed = false;
+    auto record = [&](const std::string &name)
+    {
+        m_catalog_changes.emplace_back(next_version, name);
+        changed = true;
+    };
+
+    auto old_it = m_catalog.begin();
+    auto new_it = current.begin();
+    while (old_it != m_catalog.end() || new_it != current.end())
+    {
+        if (new_it == current.end() || (old_it != m_catalog.end() && old_it->first < new_it->first))
+        {
+            record((old_it++)->first); // removed
+        }
+        else if (old_it == m_catalog.end() || new_it->first < old_it->first)
+        {
+            record((new_it++)->first); // added
+        }
+        else
+        {
+            if (!(old_it->second == new_it->second))
+            {
+                record(new_it->first);
+            }
+            ++old_it;
+            ++new_it;
+        }
+    }
+
+    if (changed)
+    {
+        m_catalog_version = next_version;
+    }
+    m_catalog = std::move(current);
+
+    while (m_catalog_changes.size() > MAX_CATALOG_CHANGES)
+    {
+        m_oldest_delta_version = m_catalog_changes.front().first;
+        m_catalog_changes.pop_front();
+    }
+}
+
+std::string File_server::format_entry(const std::string &name, const Catalog_entry &entry) const
+{
+    return name + "\t" + std::to_string(entry.size) + "\t" + std::to_string(entry.mtime) + "\n";
+}
+
+std::string File_server::list_catalog(std::string_view since)
+{
+    std::lock_guard<std::mutex> lock(m_catalog_mutex);
+    rescan_locked();
+
+    std::string listing = Protocol::catalog_version_prefix + m_catalog_epoch + "." + std::to_string(m_catalog_version);
+
+    // tokens look like "<epoch>.<version>"
+    std::optional<uint64_t> since_version;
+    size_t dot = since.rfind('.');
+    if (dot != std::string_view::npos && since.substr(0, dot) == m_catalog_epoch)
+    {
+        uint64_t version{};
+        std::string_view digits = since.substr(dot + 1);
+        auto [end, error] = std::from_chars(digits.data(), digits.data() + digits.size(), version);
+        if (error == std::errc{} && end == digits.data() + digits.size() &&
+            version >= m_oldest_delta_version && version <= m_catalog_version)
+        {
+            since_version = version;
+        }
+    }
+
+    if (!since_version)
+    {
+        listing += "\n";
+        for (const auto &[name, entry] : m_catalog)
+        {
+            listing += format_entry(name, entry);
+        }
+        return listing;
+    }
+
+    listing += std::string(Protocol::catalog_delta_suffix) + "\n";
+    std::set<std::string_view> changed;
+    for (auto it = m_catalog_changes.rbegin(); it != m_catalog_changes.rend() && it->first > *since_version; ++it)
+    {
+        changed.insert(it->second);
+    }
+    for (std::string_view name : changed)
+    {
+        auto entry = m_catalog.find(std::string(name));
+        if (entry == m_catalog.end())
+        {
+            // piecewise: "-" + std::string(name) trips GCC's -Wrestrict at -O3
+            listing += '-';
+            listing += name;
+            listing += '\n';
+        }
+        else
+        {
+            listing += '+';
+            listing += format_entry(entry->first, entry->second);
+        }
+    }
+    return listing;
+}
+
+void File_server::serve(int sock)
+{
+    char buffer[1024];
+    while (!m_stop)
+    {
+        ssize_t received = recv(sock, buffer, sizeof(buffer), 0);
+        if (received <= 0)
+        {
+            return;
+        }
+
+        // Legacy commands carry no delimiter. Anything from the first control byte on
+        // is the start of a PUT size that arrived in the same segment as the command.
+        size_t command_length = 0;
+        while (command_length < static_cast<size_t>(received) && static_cast<uint8_t>(buffer[command_length]) >= 0x20)
+        {
+            command_length++;
+        }
+        std::string command(buffer, command_length);
+        std::vector<char> carry(buffer + command_length, buffer + received);
+
+        if (command == Protocol::framed_hello)
+        {
+            if (send_all(sock, Protocol::framed_accept, std::strlen(Protocol::framed_accept)))
+            {
+                serve_framed(sock);
+            }
+            return;
+        }
+
+        if (command == "LIST")
+        {
+            std::string listing = list_catalog({});
+            if (!send_u32(sock, listing.size()) || !send_all(sock, listing.data(), listing.size()))
+            {
+                return;
+            }
+        }
+        else if (command.starts_with("GET "))
+        {
+            std::string name = command.substr(4);
+            fs::path path = m_root / name;
+            std::error_code ec;
+            uint64_t file_size = fs::is_regular_file(path, ec) ? fs::file_size(path, ec) : 0;
+            // the legacy size field has 32 bits: larger files get the not-found reply,
+            // they are only served over the framed protocol
+            if (!valid_name(name) || ec || file_size > UINT32_MAX)
+            {
+                if (!send_u32(sock, 0))
+                {
+                    return;
+                }
+                continue;
+            }
+
+            std::ifstream file(path, std::ios::binary);
+            uint32_t size = static_cast<uint32_t>(file_size);
+            if (!send_u32(sock, size))
+            {
+                return;
+            }
+
+            std::vector<char> chunk(Protocol::data_chunk_size);
+            while (file)
+            {
+                file.read(chunk.data(), chunk.size());
+                if (file.gcount() > 0 && !send_all(sock, chunk.data(), file.gcount()))
+                {
+                    return;
+                }
+            }
+        }
+        else if (command.starts_with("PUT "))
+        {
+            std::string name = command.substr(4);
+
+            char size_bytes[4];
+            size_t from_carry = std::min<size_t>(carry.size(), sizeof(size_bytes));
+            std::memcpy(size_bytes, carry.data(), from_carry);
+            if (!recv_exact(sock, size_bytes + from_carry, sizeof(size_bytes) - from_carry))
+            {
+                return;
+            }
+            uint32_t size = Protocol::read_u32(size_bytes);
+
+            // the body must be drained even when the name is rejected
+            fs::path part_path = m_root / (name + ".part");
+            std::ofstream file;
+            if (valid_name(name))
+            {
+                file.open(part_path, std::ios::binary);
+            }
+
+            uint32_t remaining = size;
+            size_t carried_body = std::min<size_t>(carry.size() - from_carry, remaining);
+            file.write(carry.data() + from_carry, carried_body);
+            remaining -= carried_body;
+
+            std::vector<char> chunk(Protocol::data_chunk_size);
+            while (remaining > 0)
+            {
+                ssize_t count = recv(sock, chunk.data(), std::min<size_t>(chunk.size(), remaining), 0);
+                if (count <= 0)
+                {
+                    return;
+                }
+                file.write(chunk.data(), count);
+                remaining -= count;
+            }
+
+            bool stored = file.is_open() && file.good();
+            file.close();
+            std::error_code ec;
+            if (stored)
+            {
+                fs::rename(part_path, m_root / name, ec);
+                stored = !ec;
+            }
+            else
+            {
+                fs::remove(part_path, ec);
+            }
+
+            const char *response = stored ? "OK" : "ERR";
+            if (!send_all(sock, response, std::strlen(response)))
+            {
+                return;
+            }
+        }
+        // unknown commands are ignored, like the real server does
+    }
+}
+
+void File_server::serve_framed(int sock)
+{
+    struct Download
+    {
+        uint32_t request_id;
+        std::ifstream file;
+        uint64_t remaining;
+    };
+
+    struct Upload
+    {
+        std::ofstream file;
+        fs::path part_path;
+        fs::path final_path;
+        uint64_t expected;
+        uint64_t received;
+        bool failed;
+    };
+
+    std::deque<Download> downloads;
+    std::unordered_map<uint32_t, Upload> uploads;
+    std::deque<std::vector<char>> out;
+    size_t out_offset = 0;
+    std::vector<char> in;
+    std::vector<char> recv_buffer(Protocol::data_chunk_size);
+    std::vector<char> chunk(Protocol::data_chunk_size);
+
+    auto send_error = [&](uint32_t request_id, const std::string &message)
+    {
+        out.push_back(Protocol::make_frame(Frame_type::ERROR, request_id, message));
+    };
+
+    auto handle_frame = [&](Protocol::Frame_header header, const char *payload)
+    {
+        switch (header.type)
+        {
+        case Frame_type::LIST:
+        {
+            std::string listing = list_catalog(std::string_view(payload, header.length));
+            for (size_t offset = 0; offset < listing.size(); offset += Protocol::data_chunk_size)
+            {
+                size_t count = std::min<size_t>(Protocol::data_chunk_size, listing.size() - offset);
+                out.push_back(Protocol::make_frame(Frame_type::DATA, header.request_id, listing.data() + offset, count));
+            }
+            out.push_back(Protocol::make_frame(Frame_type::END, header.request_id));
+            break;
+        }
+        case Frame_type::GET:
+        case Frame_type::GET_RANGE:
+        {
+            uint64_t offset = 0;
+            uint64_t length = Protocol::unknown_size;
+            if (header.type == Frame_type::GET_RANGE)
+            {
+                if (header.length < 16)
+                {
+                    send_error(header.request_id, "Malformed range request");
+                    break;
+                }
+                offset = Protocol::read_u64(payload);
+                length = Protocol::read_u64(payload + 8);
+                payload += 16;
+                header.length -= 16;
+            }
+
+            std::string name(payload, header.length);
+            fs::path path = m_root / name;
+            std::error_code ec;
+            if (!valid_name(name) || !fs::is_regular_file(path, ec))
+            {
+                send_error(header.request_id, "File not found: " + name);
+                break;
+            }
+
+            // ranges past the end are cut short, possibly to nothing
+            uint64_t size = fs::file_size(path, ec);
+            offset = std::min(offset, size);
+            Download download{header.request_id, std::ifstream(path, std::ios::binary), std::min(length, size - offset)};
+            download.file.seekg(offset);
+            std::vector<char> size_payload;
+            Protocol::append_u64(size_payload, download.remaining);
+            out.push_back(Protocol::make_frame(Frame_type::BEGIN, header.request_id, size_payload.data(), size_payload.size()));
+            if (download.remaining == 0)
+            {
+                out.push_back(Protocol::make_frame(Frame_type::END, header.request_id));
+                break;
+            }
+            downloads.push_back(std::move(download));
+            break;
+        }
+        case Frame_type::PUT_BEGIN:
+        {
+            if (header.length < 8)
+            {
+                send_error(header.request_id, "Malformed upload request");
+                break;
+            }
+            std::string name(payload + 8, header.length - 8);
+            Upload upload{{}, m_root / (name + ".part"), m_root / name, Protocol::read_u64(payload), 0, !valid_name(name)};
+            if (!upload.failed)
+            {
+                upload.file.open(upload.part_path, std::ios::binary);
+                upload.failed = !upload.file;
+            }
+            uploads[header.request_id] = std::move(upload);
+            break;
+        }
+        case Frame_type::PUT_DATA:
+        {
+            auto it = uploads.find(header.request_id);
+            if (it != uploads.end() && !it->second.failed)
+            {
+                it->second.file.write(payload, header.length);
+                it->second.received += header.length;
+                it->second.failed = !it->second.file.good();
+            }
+            break;
+        }
+        case Frame_type::PUT_END:
+        {
+            auto it = uploads.find(header.request_id);
+            if (it == uploads.end())
+            {
+                send_error(header.request_id, "Unknown upload");
+                break;
+            }
+            Upload &upload = it->second;
+            upload.file.close();
+            std::error_code ec;
+            bool complete = upload.expected == Protocol::unknown_size || upload.expected == upload.received;
+            if (!upload.failed && complete)
+            {
+                fs::rename(upload.part_path, upload.final_path, ec);
+            }
+            if (upload.failed || !complete || ec)
+            {
+                fs::remove(upload.part_path, ec);
+                send_error(header.request_id, "File upload failed");
+            }
+            else
+            {
+                out.push_back(Protocol::make_frame(Frame_type::OK, header.request_id));
+            }
+            uploads.erase(it);
+            break;
+        }
+        default:
+            send_error(header.request_id, "Unsupported request");
+            break;
+        }
+    };
+
+    // set instead of returning, so the half-finished uploads are always dropped below
+    bool closed = false;
+    while (!m_stop && !closed)
+    {
+        // refill the output with one chunk per download in turn so responses interleave
+        if (out.empty() && !downloads.empty())
+        {
+            Download &download = downloads.front();
+            download.file.read(chunk.data(), std::min<uint64_t>(chunk.size(), download.remaining));
+            size_t count = download.file.gcount();
+            if (count == 0)
+            {
+                send_error(download.request_id, "Read error");
+                downloads.pop_front();
+                continue;
+            }
+            out.push_back(Protocol::make_frame(Frame_type::DATA, download.request_id, chunk.data(), count));
+            download.remaining -= count;
+            if (download.remaining == 0)
+            {
+                out.push_back(Protocol::make_frame(Frame_type::END, download.request_id));
+                downloads.pop_front();
+            }
+            else
+            {
+                downloads.push_back(std::move(download));
+                downloads.pop_front();
+            }
+        }
+
+        struct pollfd pfd{sock, POLLIN, 0};
+        if (!out.empty())
+        {
+            pfd.events |= POLLOUT;
+        }
+        if (poll(&pfd, 1, 200) <= 0)
+        {
+            continue;
+        }
+
+        if (pfd.revents & (POLLIN | POLLHUP | POLLERR))
+        {
+            ssize_t received = recv(sock, recv_buffer.data(), recv_buffer.size(), MSG_DONTWAIT);
+            if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+            {
+                break;
+            }
+            if (received > 0)
+            {
+                in.insert(in.end(), recv_buffer.data(), recv_buffer.data() + received);
+
+                size_t offset = 0;
+                while (in.size() - offset >= Protocol::frame_header_size)
+                {
+                    Protocol::Frame_header header = Protocol::decode_header(in.data() + offset);
+                    if (header.length > Protocol::max_frame_payload)
+                    {
+                        closed = true;
+                        break;
+                    }
+                    if (in.size() - offset < Protocol::frame_header_size + header.length)
+                    {
+                        break;
+                    }
+                    handle_frame(header, in.data() + offset + Protocol::frame_header_size);
+                    offset += Protocol::frame_header_size + header.length;
+                }
+                in.erase(in.begin(), in.begin() + offset);
+                if (closed)
+                {
+                    break;
+                }
+            }
+        }
+
+        while (!out.empty())
+        {
+            std::vector<char> &frame = out.front();
+            ssize_t sent = send(sock, frame.data() + out_offset, frame.size() - out_offset, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (sent < 0)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    break;
+                }
+                closed = true;
+                break;
+            }
+            out_offset += sent;
+            if (out_offset == frame.size())
+            {
+                out.pop_front();
+                out_offset = 0;
+            }
+        }
+    }
+
+    // drop half-finished uploads
+    for (auto &[request_id, upload] : uploads)
+    {
+        upload.file.close();
+        std::error_code ec;
+        fs::remove(upload.part_path, ec);
+    }
+}
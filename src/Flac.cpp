@@ -1,19 +1,46 @@
 #include "Flac.hpp"
 
-Flac::~Flac()
+#include <algorithm>
+
+#include "Flac_metadata.hpp"
+#include "Frame_scanner.hpp"
+
+Flac::Flac(std::istream &flac_stream)
+    : m_flac_stream(flac_stream), m_reader(m_flac_stream), m_decode_audio(&Flac::decode_audio<0, 0, 0>) {}
+
+void Flac::initialize()
 {
-    if (m_flac_stream.is_open())
+    if (m_flac_stream.good())
     {
-        m_flac_stream.close();
+        check_flac_marker();
+        read_metadata();
+        m_audio_offset = m_flac_stream.tellg();
+        select_decode_path();
     }
 }
 
-void Flac::initialize()
+void Flac::select_decode_path()
 {
-    if (m_flac_stream.is_open() && m_flac_stream.good())
+    // stereo and mono 16-bit and stereo 24-bit cover nearly every file, and most of
+    // them use 4096-sample blocks
+    bool blocks_4096 = m_stream_info.max_block_size == 4096;
+    uint8_t channels = m_stream_info.channels;
+    uint8_t bits_per_sample = m_stream_info.bits_per_sample;
+    if (channels == 2 && bits_per_sample == 16)
     {
-        check_flac_marker();
-        read_metadata();
+        m_decode_audio = blocks_4096 ? &Flac::decode_audio<2, 16, 4096> : &Flac::decode_audio<2, 16, 0>;
+    }
+    else if (channels == 2 && bits_per_sample == 24)
+    {
+        m_decode_audio = blocks_4096 ? &Flac::decode_audio<2, 24, 4096> : &Flac::decode_audio<2, 24, 0>;
+    }
+    else if (channels == 1 && bits_per_sample == 16)
+    {
+        m_decode_audio = blocks_4096 ? &Flac::decode_audio<1, 16, 4096> : &Flac::decode_audio<1, 16, 0>;
+    }
+    else
+    {
+        m_decode_audio = &Flac::decode_audio<0, 0, 0>;
     }
 }
 
@@ -48,23 +75,19 @@ void Flac::read_metadata()
             m_flac_stream.seekg(block_length, std::ios::cur);
             break;
         case block_type::APPLICATION:
-            // TODO: implement function for APPLICATION block
-            m_flac_stream.seekg(block_length, std::ios::cur);
+            read_metadata_block_APPLICATION(block_length);
             break;
         case block_type::SEEKTABLE:
-            // TODO: implement function for SEEKTABLE block
-            m_flac_stream.seekg(block_length, std::ios::cur);
+            read_metadata_block_SEEKTABLE(block_length);
             break;
         case block_type::VORBIS_COMMENT:
-            read_metadata_block_VORBIS_COMMENT();
+            read_metadata_block_VORBIS_COMMENT(block_length);
             break;
         case block_type::CUESHEET:
-            // TODO: implement function for CUESHEET block
-            m_flac_stream.seekg(block_length, std::ios::cur);
+            read_metadata_block_CUESHEET(block_length);
             break;
         case block_type::PICTURE:
-            // TODO: implement function for PICTURE block
-            m_flac_stream.seekg(block_length, std::ios::cur);
+            read_metadata_block_PICTURE(block_length);
             break;
         default:
             throw std::runtime_error("Unknown block type");
@@ -87,36 +110,108 @@ void Flac::read_metadata_block_STREAMINFO()
     m_flac_stream.seekg(16, std::ios::cur); // skipping 16 bytes (md5 signature)
 }
 
-void Flac::read_metadata_block_VORBIS_COMMENT()
+void Flac::read_metadata_block_APPLICATION(uint32_t block_length)
 {
-    uint32_t vendor_length;
-    m_flac_stream.read(reinterpret_cast<char *>(&vendor_length), 4);
-
-    std::vector<char> vendor_data(vendor_length);
-    m_flac_stream.read(vendor_data.data(), vendor_length);
-    m_vorbis_comment.vendor_string = std::string(vendor_data.begin(), vendor_data.end());
+    if (block_length < 4)
+    {
+        throw std::runtime_error("APPLICATION block is too short");
+    }
+    Application_info application;
+    application.id = m_reader.read_bits_unsigned(32);
+    application.data_offset = m_flac_stream.tellg();
+    application.data_length = block_length - 4;
+    m_applications.push_back(application);
 
-    uint32_t user_comment_count;
-    m_flac_stream.read(reinterpret_cast<char *>(&user_comment_count), 4);
+    m_flac_stream.seekg(application.data_length, std::ios::cur);
+}
 
-    m_vorbis_comment.user_comments.clear();
-    for (uint32_t i = 0; i < user_comment_count; i++)
+void Flac::read_metadata_block_CUESHEET(uint32_t block_length)
+{
+    if (block_length < Flac_metadata::cuesheet_header_size)
+    {
+        throw std::runtime_error("CUESHEET block is too short");
+    }
+    char header[Flac_metadata::cuesheet_header_size];
+    m_flac_stream.read(header, sizeof(header));
+    if (m_flac_stream.gcount() != sizeof(header))
     {
-        uint32_t comment_length;
-        m_flac_stream.read(reinterpret_cast<char *>(&comment_length), 4);
+        throw std::runtime_error("CUESHEET block is truncated");
+    }
+
+    Cuesheet_info cuesheet;
+    Flac_metadata::parse_cuesheet_header(header, cuesheet);
+    cuesheet.location = {block_type::CUESHEET, static_cast<uint64_t>(m_flac_stream.tellg()),
+                         static_cast<uint32_t>(block_length - sizeof(header))};
+    m_cuesheet = std::move(cuesheet);
 
-        std::vector<char> comment_data(comment_length);
-        m_flac_stream.read(comment_data.data(), comment_length);
-        std::string comment(comment_data.begin(), comment_data.end());
+    m_flac_stream.seekg(block_length - sizeof(header), std::ios::cur);
+}
 
-        size_t delimiter_pos = comment.find('=');
-        if (delimiter_pos != std::string::npos)
+void Flac::read_metadata_block_PICTURE(uint32_t block_length)
+{
+    // only the small fields are read, the image is skipped
+    uint32_t remaining = block_length;
+    auto read_field = [&]()
+    {
+        if (remaining < 4)
+        {
+            throw std::runtime_error("PICTURE block is truncated");
+        }
+        remaining -= 4;
+        return static_cast<uint32_t>(m_reader.read_bits_unsigned(32));
+    };
+    auto read_string = [&](std::string &out)
+    {
+        uint32_t length = read_field();
+        if (length > remaining)
         {
-            std::string key = comment.substr(0, delimiter_pos);
-            std::string value = comment.substr(delimiter_pos + 1);
-            m_vorbis_comment.user_comments[key] = value;
+            throw std::runtime_error("PICTURE block is truncated");
         }
+        out.resize(length);
+        m_flac_stream.read(out.data(), length);
+        remaining -= length;
+    };
+
+    Picture_info picture;
+    picture.picture_type = read_field();
+    read_string(picture.mime_type);
+    read_string(picture.description);
+    picture.width = read_field();
+    picture.height = read_field();
+    picture.color_depth = read_field();
+    picture.indexed_colors = read_field();
+    picture.data_length = read_field();
+    if (picture.data_length > remaining)
+    {
+        throw std::runtime_error("PICTURE block is truncated");
     }
+    picture.data_offset = m_flac_stream.tellg();
+    m_pictures.push_back(std::move(picture));
+
+    m_flac_stream.seekg(remaining, std::ios::cur);
+}
+
+void Flac::read_metadata_block_SEEKTABLE(uint32_t block_length)
+{
+    std::vector<char> table(block_length);
+    m_flac_stream.read(table.data(), block_length);
+    if (static_cast<uint32_t>(m_flac_stream.gcount()) != block_length)
+    {
+        throw std::runtime_error("SEEKTABLE block is truncated");
+    }
+    m_seek_table = Flac_metadata::parse_seek_table(table.data(), table.size());
+}
+
+void Flac::read_metadata_block_VORBIS_COMMENT(uint32_t block_length)
+{
+    // kept whole; the comments are split out when they are first asked for
+    std::string block(block_length, '\0');
+    m_flac_stream.read(block.data(), block_length);
+    if (static_cast<uint32_t>(m_flac_stream.gcount()) != block_length)
+    {
+        throw std::runtime_error("VORBIS_COMMENT block is truncated");
+    }
+    m_vorbis_comment = Vorbis_comment(std::move(block));
 }
 
 void Flac::decode_frame()
@@ -125,7 +220,10 @@ void Flac::decode_frame()
     {
         return;
     }
+    FLAC_PROFILE_ONLY(auto frame_start = Flac_profile::Clock::now();)
+    FLAC_PROFILE_ONLY(uint64_t frame_offset = m_reader.bytes_read();)
 
+    m_reader.reset_crc();
     if (m_reader.read_bits_unsigned(14) != Flac_constants::frame_sync_code)
     {
         throw std::runtime_error("Invalid sync code in frame header");
@@ -146,71 +244,270 @@ void Flac::decode_frame()
         throw std::runtime_error("2nd reserved bit in frame isn't 0");
     }
 
-    m_frame_info.frame_or_sample_number = decode_utf8(m_flac_stream);
+    m_frame_info.frame_or_sample_number = decode_utf8(m_reader);
 
     m_frame_info.block_size = decode_block_size(block_size_code);
     m_frame_info.sample_rate = decode_sample_rate(sample_rate_code);
 
+    uint8_t header_crc = m_reader.crc8();
     m_frame_info.crc_8 = m_reader.read_bits_unsigned(8);
+    if (m_frame_info.crc_8 != header_crc)
+    {
+        throw std::runtime_error("Frame header CRC mismatch");
+    }
+
+    // damaged data gets this far when resyncing, and the buffers are sized from
+    // STREAMINFO: the same checks as Frame_scanner::parse_header
+    if (m_frame_info.channel_assignment > 10)
+    {
+        throw std::runtime_error("Channel assignment has reserved value");
+    }
+    uint8_t frame_channels = m_frame_info.channel_assignment < 8 ? m_frame_info.channel_assignment + 1 : 2;
+    if (frame_channels != m_stream_info.channels)
+    {
+        throw std::runtime_error("Frame channel count differs from STREAMINFO");
+    }
+    if (m_stream_info.max_block_size != 0 && m_frame_info.block_size > m_stream_info.max_block_size)
+    {
+        throw std::runtime_error("Frame block size exceeds STREAMINFO maximum");
+    }
+    if (m_stream_info.sample_rate != 0 && m_frame_info.sample_rate != m_stream_info.sample_rate)
+    {
+        throw std::runtime_error("Frame sample rate differs from STREAMINFO");
+    }
+    if (m_stream_info.bits_per_sample != 0 && m_frame_info.bits_per_sample != m_stream_info.bits_per_sample)
+    {
+        throw std::runtime_error("Frame sample size differs from STREAMINFO");
+    }
+
+    (this->*m_decode_audio)();
+
+    m_reader.align_to_byte();
+    uint16_t frame_crc = m_reader.crc16();
+    m_frame_info.crc_16 = m_reader.read_bits_unsigned(16);
+    if (m_frame_info.crc_16 != frame_crc)
+    {
+        throw std::runtime_error("Frame CRC mismatch");
+    }
+    m_sample_count += m_frame_info.block_size;
+    m_frame_count++;
+
+    FLAC_PROFILE_ONLY(m_profile.record_frame(m_frame_info.channel_assignment, m_frame_info.block_size,
+                                             m_reader.bytes_read() - frame_offset,
+                                             std::chrono::duration_cast<std::chrono::nanoseconds>(Flac_profile::Clock::now() - frame_start).count());)
+}
+
+uint64_t Flac::seek(uint64_t target_sample)
+{
+    // closest seek point at or before the target, or the first frame
+    uint64_t sample = 0;
+    uint64_t offset = 0;
+    auto point = std::upper_bound(m_seek_table.begin(), m_seek_table.end(), target_sample, [](uint64_t target, const Seek_point &point)
+                                  { return target < point.sample_number; });
+    if (point != m_seek_table.begin())
+    {
+        --point;
+        sample = point->sample_number;
+        offset = point->stream_offset;
+    }
+
+    m_flac_stream.clear();
+    m_flac_stream.seekg(m_audio_offset + offset);
+    m_reader.reset();
+
+    // decode forward until the frame that holds the target, then back up to its start
+    while (!m_reader.eos())
+    {
+        std::streampos frame_start = m_flac_stream.tellg();
+        decode_frame();
+        if (sample + m_frame_info.block_size > target_sample)
+        {
+            m_flac_stream.clear();
+            m_flac_stream.seekg(frame_start);
+            m_reader.reset();
+            break;
+        }
+        sample += m_frame_info.block_size;
+    }
+    m_sample_count = sample;
+    return sample;
+}
 
-    m_audio_buffer.resize(m_stream_info.channels * m_frame_info.block_size);
+void Flac::seek_to_frame(uint64_t stream_offset, uint64_t first_sample)
+{
+    m_flac_stream.clear();
+    m_flac_stream.seekg(m_audio_offset + stream_offset);
+    m_reader.reset();
+    m_sample_count = first_sample;
+}
+
+uint64_t Flac::resync()
+{
+    m_flac_stream.clear();
+    std::streamoff start = m_flac_stream.tellg();
+    if (start < 0)
+    {
+        throw std::runtime_error("Cannot resynchronize a stream that isn't seekable");
+    }
+
+    // windows overlap by half, so a frame is never only partly in the one that finds it
+    Frame_scanner scanner(m_stream_info);
+    std::vector<uint8_t> window(std::max<size_t>(RESYNC_WINDOW, 4 * size_t{m_stream_info.max_frame_size}));
+    std::streamoff position = start;
+    while (true)
+    {
+        m_flac_stream.clear();
+        m_flac_stream.seekg(position);
+        m_flac_stream.read(reinterpret_cast<char *>(window.data()), window.size());
+        size_t size = m_flac_stream.gcount();
+        bool at_end = size < window.size();
+
+        std::optional<Frame_location> frame = scanner.find_confirmed_frame(window.data(), size);
+        if (!frame && at_end)
+        {
+            // the last frame has no successor to confirm it
+            frame = scanner.find_frame(window.data(), size);
+        }
+        if (frame)
+        {
+            position += frame->offset;
+            m_sample_count = frame->first_sample;
+            break;
+        }
+        if (at_end)
+        {
+            position += size;
+            break;
+        }
+        position += size / 2;
+    }
+
+    m_flac_stream.clear();
+    m_flac_stream.seekg(position);
+    m_reader.reset();
+    return position - start;
+}
+
+void Flac::reserve_buffers()
+{
+    size_t block_size = m_stream_info.max_block_size == 0 ? 65535 : m_stream_info.max_block_size;
+    size_t size = m_audio_buffer.size();
+    m_audio_buffer.resize(std::max(size, block_size * m_stream_info.channels));
+    m_audio_buffer.resize(size);
+}
+
+std::vector<Virtual_track> Flac::read_virtual_tracks()
+{
+    if (!m_cuesheet)
+    {
+        return {};
+    }
+
+    // the track list was skipped by read_metadata(), fetch it without losing our place
+    std::streampos position = m_flac_stream.tellg();
+    std::vector<char> track_list(m_cuesheet->location.length);
+    m_flac_stream.clear();
+    m_flac_stream.seekg(m_cuesheet->location.offset);
+    m_flac_stream.read(track_list.data(), track_list.size());
+    bool complete = static_cast<size_t>(m_flac_stream.gcount()) == track_list.size();
+    m_flac_stream.clear();
+    m_flac_stream.seekg(position);
+    if (!complete)
+    {
+        throw std::runtime_error("CUESHEET block is truncated");
+    }
+
+    std::vector<Cue_track> tracks;
+    if (!Flac_metadata::parse_cue_tracks(track_list.data(), track_list.size(), m_cuesheet->track_count, tracks))
+    {
+        throw std::runtime_error("CUESHEET block is malformed");
+    }
+    return Flac_metadata::virtual_tracks(tracks, m_stream_info.total_samples);
+}
+
+template <uint8_t Channels, uint8_t Bits_per_sample, uint16_t Block_size>
+void Flac::decode_audio()
+{
+    // the last frame is usually shorter
+    if constexpr (Block_size != 0)
+    {
+        if (m_frame_info.block_size != Block_size)
+        {
+            decode_audio<Channels, Bits_per_sample, 0>();
+            return;
+        }
+    }
+    if constexpr (Bits_per_sample != 0)
+    {
+        if (m_frame_info.bits_per_sample != Bits_per_sample)
+        {
+            decode_audio<0, 0, 0>();
+            return;
+        }
+    }
+    const uint32_t channel_count = channels<Channels>();
+    const uint32_t sample_count = block_size<Block_size>();
+    const uint8_t bits_per_sample = Bits_per_sample != 0 ? Bits_per_sample : m_frame_info.bits_per_sample;
+
+    m_audio_buffer.resize(channel_count * sample_count);
 
     if (m_frame_info.channel_assignment <= 0b0111)
     {
-        for (m_channel_index = 0; m_channel_index < m_stream_info.channels; m_channel_index++)
+        for (m_channel_index = 0; m_channel_index < channel_count; m_channel_index++)
         {
-            decode_subframe(m_frame_info.bits_per_sample);
+            decode_subframe<Channels, Block_size>(bits_per_sample);
         }
     }
     else if (m_frame_info.channel_assignment <= 0b1010)
     {
         m_channel_index = 0;
-        decode_subframe(m_frame_info.bits_per_sample + ((m_frame_info.channel_assignment == 0b1001) ? 1 : 0));
+        decode_subframe<Channels, Block_size>(bits_per_sample + ((m_frame_info.channel_assignment == 0b1001) ? 1 : 0));
 
         m_channel_index = 1;
-        decode_subframe(m_frame_info.bits_per_sample + ((m_frame_info.channel_assignment == 0b1001) ? 0 : 1));
+        decode_subframe<Channels, Block_size>(bits_per_sample + ((m_frame_info.channel_assignment == 0b1001) ? 0 : 1));
 
+        FLAC_PROFILE_ONLY(Flac_profile::Timer timer(m_profile.decorrelation_ns);)
+
+        buffer_sample_type *samples = m_audio_buffer.data();
         if (m_frame_info.channel_assignment == 8)
         {
-            for (uint16_t i = 0; i < 2 * m_frame_info.block_size; i += 2)
+            for (uint32_t i = 0; i < 2 * sample_count; i += 2)
             {
-                m_audio_buffer[i + 1] = m_audio_buffer[i] - m_audio_buffer[i + 1];
+                samples[i + 1] = samples[i] - samples[i + 1];
             }
         }
         else if (m_frame_info.channel_assignment == 9)
         {
-            for (uint16_t i = 0; i < 2 * m_frame_info.block_size; i += 2)
+            for (uint32_t i = 0; i < 2 * sample_count; i += 2)
             {
-                m_audio_buffer[i] += m_audio_buffer[i + 1];
+                samples[i] += samples[i + 1];
             }
         }
         else if (m_frame_info.channel_assignment == 10)
         {
             int64_t mid{};
-            for (uint16_t i = 0; i < 2 * m_frame_info.block_size; i += 2)
+            for (uint32_t i = 0; i < 2 * sample_count; i += 2)
             {
-                mid = (uint64_t)m_audio_buffer[i] << 1;
-                mid |= m_audio_buffer[i + 1] & 1;
-                m_audio_buffer[i] = (mid + m_audio_buffer[i + 1]) >> 1;
-                m_audio_buffer[i + 1] = (mid - m_audio_buffer[i + 1]) >> 1;
+                mid = (uint64_t)samples[i] << 1;
+                mid |= samples[i + 1] & 1;
+                samples[i] = (mid + samples[i + 1]) >> 1;
+                samples[i + 1] = (mid - samples[i + 1]) >> 1;
             }
         }
     }
 
 // #define WAV // comment this out, when using playback functionality
 #ifndef WAV
-    for (size_t i = 0; i < m_audio_buffer.size(); i++)
+    buffer_sample_type *samples = m_audio_buffer.data();
+    const uint32_t size = channel_count * sample_count;
+    for (uint32_t i = 0; i < size; i++)
     {
-        m_audio_buffer[i] = m_audio_buffer[i] << (32 - m_frame_info.bits_per_sample);
+        samples[i] = samples[i] << (32 - bits_per_sample);
     }
 #endif
-
-    m_sample_count += m_frame_info.block_size;
-    m_frame_count++;
-    m_reader.align_to_byte();
-    m_frame_info.crc_16 = m_reader.read_bits_unsigned(16);
 }
 
+template <uint8_t Channels, uint16_t Block_size>
 void Flac::decode_subframe(uint8_t bits_per_sample)
 {
     if (m_reader.read_bits_unsigned(1) != 0)
@@ -224,29 +521,37 @@ void Flac::decode_subframe(uint8_t bits_per_sample)
     {
         throw std::runtime_error("subframe type has reserved value");
     }
+    FLAC_PROFILE_ONLY(auto subframe_start = Flac_profile::Clock::now();)
+    FLAC_PROFILE_ONLY(Flac_profile::Subframe_kind kind{};)
 
     uint8_t wasted_bits_per_sample{};
     if (m_reader.read_bits_unsigned(1))
     {
         wasted_bits_per_sample = static_cast<uint8_t>(decode_unary(m_reader)) + 1;
         bits_per_sample -= wasted_bits_per_sample;
+        FLAC_PROFILE_ONLY(m_profile.wasted_bits_subframes++;)
     }
 
+    const uint32_t channel_count = channels<Channels>();
+    const uint32_t sample_count = block_size<Block_size>();
+    buffer_sample_type *samples = m_audio_buffer.data() + m_channel_index;
     uint8_t predictor_order{};
 
     if (subframe_type_code == 0b000000)
     {
-        buffer_sample_type value = m_reader.read_bits_unsigned(bits_per_sample);
-        for (uint16_t i = 0; i < m_stream_info.channels * m_frame_info.block_size; i += m_stream_info.channels)
+        FLAC_PROFILE_ONLY(kind = Flac_profile::CONSTANT;)
+        buffer_sample_type value = m_reader.read_bits_signed(bits_per_sample);
+        for (uint32_t i = 0; i < sample_count; i++)
         {
-            m_audio_buffer[i + m_channel_index] = value;
+            samples[i * channel_count] = value;
         }
     }
     else if (subframe_type_code == 0b000001)
     {
-        for (uint16_t i = 0; i < m_stream_info.channels * m_frame_info.block_size; i += m_stream_info.channels)
+        FLAC_PROFILE_ONLY(kind = Flac_profile::VERBATIM;)
+        for (uint32_t i = 0; i < sample_count; i++)
         {
-            m_audio_buffer[i + m_channel_index] = m_reader.read_bits_signed(bits_per_sample);
+            samples[i * channel_count] = m_reader.read_bits_signed(bits_per_sample);
         }
     }
     else if ((subframe_type_code & 0b111000) == 0b001000)
@@ -256,12 +561,24 @@ void Flac::decode_subframe(uint8_t bits_per_sample)
         {
             throw std::runtime_error("SUBFRAME_FIXED has invalid order");
         }
-        decode_subframe_fixed(predictor_order, bits_per_sample);
+        FLAC_PROFILE_ONLY(kind = Flac_profile::FIXED;)
+        FLAC_PROFILE_ONLY(m_profile.fixed_orders[predictor_order]++;)
+        if (predictor_order > sample_count)
+        {
+            throw std::runtime_error("SUBFRAME_FIXED order exceeds block size");
+        }
+        decode_subframe_fixed<Channels, Block_size>(predictor_order, bits_per_sample);
     }
     else if ((subframe_type_code & 0b100000) == 0b100000)
     {
         predictor_order = (subframe_type_code & 0b011111) + 1;
-        decode_subframe_lpc(predictor_order, bits_per_sample);
+        FLAC_PROFILE_ONLY(kind = Flac_profile::LPC;)
+        FLAC_PROFILE_ONLY(m_profile.lpc_orders[predictor_order]++;)
+        if (predictor_order > sample_count)
+        {
+            throw std::runtime_error("SUBFRAME_LPC order exceeds block size");
+        }
+        decode_subframe_lpc<Channels, Block_size>(predictor_order, bits_per_sample);
     }
     else
     {
@@ -269,29 +586,35 @@ void Flac::decode_subframe(uint8_t bits_per_sample)
     }
     if (wasted_bits_per_sample > 0)
     {
-        for (uint16_t i = 0; i < m_audio_buffer.size(); i += m_stream_info.channels)
+        for (uint32_t i = 0; i < sample_count; i++)
         {
-            m_audio_buffer[i + m_channel_index] <<= wasted_bits_per_sample;
+            samples[i * channel_count] <<= wasted_bits_per_sample;
         }
     }
+    FLAC_PROFILE_ONLY(m_profile.record_subframe(kind, m_frame_info.block_size,
+                                                std::chrono::duration_cast<std::chrono::nanoseconds>(Flac_profile::Clock::now() - subframe_start).count());)
 }
 
+template <uint8_t Channels, uint16_t Block_size>
 void Flac::decode_subframe_fixed(uint8_t predictor_order, uint8_t bits_per_sample)
 {
-    for (uint8_t i = 0; i < m_stream_info.channels * predictor_order; i += m_stream_info.channels)
+    const uint32_t channel_count = channels<Channels>();
+    for (uint8_t i = 0; i < predictor_order; i++)
     {
-        m_audio_buffer[i + m_channel_index] = m_reader.read_bits_signed(bits_per_sample);
+        m_audio_buffer[i * channel_count + m_channel_index] = m_reader.read_bits_signed(bits_per_sample);
     }
-    decode_residuals(predictor_order);
+    decode_residuals<Channels, Block_size>(predictor_order);
 
-    linear_prediction(predictor_order, Flac_constants::fixed_prediction_coefficients[predictor_order], 0);
+    linear_prediction<Channels, Block_size>(predictor_order, Flac_constants::fixed_prediction_coefficients[predictor_order], 0);
 }
 
+template <uint8_t Channels, uint16_t Block_size>
 void Flac::decode_subframe_lpc(uint8_t predictor_order, uint8_t bits_per_sample)
 {
-    for (uint8_t i = 0; i < m_stream_info.channels * predictor_order; i += m_stream_info.channels)
+    const uint32_t channel_count = channels<Channels>();
+    for (uint8_t i = 0; i < predictor_order; i++)
     {
-        m_audio_buffer[i + m_channel_index] = m_reader.read_bits_signed(bits_per_sample);
+        m_audio_buffer[i * channel_count + m_channel_index] = m_reader.read_bits_signed(bits_per_sample);
     }
 
     uint8_t qlp_bit_precision = m_reader.read_bits_unsigned(4);
@@ -300,6 +623,7 @@ void Flac::decode_subframe_lpc(uint8_t predictor_order, uint8_t bits_per_sample)
         throw std::runtime_error("Invalid QLP precission");
     }
     qlp_bit_precision++;
+    FLAC_PROFILE_ONLY(m_profile.lpc_precisions[qlp_bit_precision - 1]++;)
 
     int8_t qlp_shift = m_reader.read_bits_signed(5);
 
@@ -309,26 +633,33 @@ void Flac::decode_subframe_lpc(uint8_t predictor_order, uint8_t bits_per_sample)
         predictor_coefficients[i] = m_reader.read_bits_signed(qlp_bit_precision);
     }
 
-    decode_residuals(predictor_order);
+    decode_residuals<Channels, Block_size>(predictor_order);
 
-    linear_prediction(predictor_order, predictor_coefficients, qlp_shift);
+    linear_prediction<Channels, Block_size>(predictor_order, predictor_coefficients, qlp_shift);
 }
 
+template <uint8_t Channels, uint16_t Block_size>
 void Flac::linear_prediction(uint8_t predictor_order, const int16_t *predictor_coefficients, int8_t qlp_shift)
 {
-    for (uint16_t i = m_stream_info.channels * predictor_order; i < m_audio_buffer.size(); i += m_stream_info.channels)
+    FLAC_PROFILE_ONLY(Flac_profile::Timer timer(m_profile.prediction_ns);)
+    const uint32_t channel_count = channels<Channels>();
+    const uint32_t sample_count = block_size<Block_size>();
+    buffer_sample_type *samples = m_audio_buffer.data() + m_channel_index;
+    for (uint32_t i = predictor_order; i < sample_count; i++)
     {
         int64_t prediction{};
-        for (uint16_t j = 0; j < m_stream_info.channels * predictor_order; j += m_stream_info.channels)
+        for (uint8_t j = 0; j < predictor_order; j++)
         {
-            prediction += m_audio_buffer[i - m_stream_info.channels - j + m_channel_index] * predictor_coefficients[j / m_stream_info.channels];
+            prediction += samples[(i - 1 - j) * channel_count] * predictor_coefficients[j];
         }
-        m_audio_buffer[i + m_channel_index] += (prediction >> qlp_shift);
+        samples[i * channel_count] += (prediction >> qlp_shift);
     }
 }
 
+template <uint8_t Channels, uint16_t Block_size>
 void Flac::decode_residuals(uint8_t predictor_order)
 {
+    FLAC_PROFILE_ONLY(Flac_profile::Timer timer(m_profile.residual_ns);)
     uint8_t residual_coding_method = m_reader.read_bits_unsigned(2);
     if (residual_coding_method == 0b10 || residual_coding_method == 0b11)
     {
@@ -336,30 +667,35 @@ void Flac::decode_residuals(uint8_t predictor_order)
     }
     uint8_t parameter_bit_size = residual_coding_method == 0b00 ? 4 : 5;
     uint8_t rice_partition_order = m_reader.read_bits_unsigned(4);
+    FLAC_PROFILE_ONLY(m_profile.partition_orders[rice_partition_order]++;)
     uint16_t rice_partition_count = 1 << rice_partition_order;
-    uint16_t rice_partition_size = (m_frame_info.block_size) / rice_partition_count;
+    uint32_t rice_partition_size = block_size<Block_size>() >> rice_partition_order;
 
     uint8_t escape_code = (residual_coding_method == 0) ? 0xF : 0x1F;
 
+    const uint32_t channel_count = channels<Channels>();
+    buffer_sample_type *samples = m_audio_buffer.data() + m_channel_index;
     for (uint16_t i = 0; i < rice_partition_count; i++)
     {
         uint8_t rice_parameter = m_reader.read_bits_unsigned(parameter_bit_size);
-        uint16_t start = (i * rice_partition_size + ((i == 0) ? predictor_order : 0));
-        uint16_t end = ((i + 1) * rice_partition_size);
+        uint32_t start = (i * rice_partition_size + ((i == 0) ? predictor_order : 0));
+        uint32_t end = ((i + 1) * rice_partition_size);
 
         if (rice_parameter != escape_code)
         {
-            for (size_t j = m_stream_info.channels * start; j < m_stream_info.channels * end; j += m_stream_info.channels)
+            FLAC_PROFILE_ONLY(m_profile.rice_parameters[rice_parameter]++;)
+            for (uint32_t j = start; j < end; j++)
             {
-                m_audio_buffer[j + m_channel_index] = decode_and_unfold_rice(rice_parameter, m_reader);
+                samples[j * channel_count] = decode_and_unfold_rice(rice_parameter, m_reader);
             }
         }
         else
         {
             uint8_t bit_count = m_reader.read_bits_unsigned(5);
-            for (size_t j = m_stream_info.channels * start; j < m_stream_info.channels * end; j += m_stream_info.channels)
+            FLAC_PROFILE_ONLY(m_profile.escaped_partitions++;)
+            for (uint32_t j = start; j < end; j++)
             {
-                m_audio_buffer[j + m_channel_index] = m_reader.read_bits_signed(bit_count);
+                samples[j * channel_count] = m_reader.read_bits_signed(bit_count);
             }
         }
     }
@@ -0,0 +1,710 @@
+#include "Flac_encoder.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+
+#include "Flac_constants.hpp"
+#include "Flac_crc.hpp"
+#include "Work_stealing_pool.hpp"
+
+namespace
+{
+    constexpr uint8_t MAX_RICE_PARAMETER = 30;
+    constexpr uint8_t MAX_NARROW_RICE_PARAMETER = 14; // with 4-bit parameters 15 is the escape code
+    constexpr uint8_t MAX_PARTITION_ORDER = 8;
+    constexpr int64_t MAX_RESIDUAL = INT32_MAX; // residuals have to fit 32 bits, signed
+    constexpr uint8_t SUBFRAME_HEADER_BITS = 8;
+
+    uint64_t fold(int64_t value)
+    {
+        return value >= 0 ? static_cast<uint64_t>(value) << 1 : (static_cast<uint64_t>(~value) << 1) | 1;
+    }
+
+    // coefficient precision by block size, as the reference encoder picks it
+    uint8_t qlp_precision(uint32_t count)
+    {
+        if (count <= 192)
+            return 7;
+        if (count <= 384)
+            return 8;
+        if (count <= 576)
+            return 9;
+        if (count <= 1152)
+            return 10;
+        if (count <= 2304)
+            return 11;
+        if (count <= 4608)
+            return 12;
+        return 13;
+    }
+
+    // Index of value in a code table, skipping the reserved zero entries; -1 if absent
+    template <typename Value, size_t N>
+    int find_code(const Value (&table)[N], uint32_t value)
+    {
+        for (size_t i = 1; i < N; i++)
+        {
+            if (table[i] != 0 && table[i] == value)
+            {
+                return static_cast<int>(i);
+            }
+        }
+        return -1;
+    }
+
+    // The frame number as the decoder's decode_utf8 reads it, up to 36 bits in 7 bytes
+    void write_utf8(Bit_writer &out, uint64_t value)
+    {
+        if (value < 0x80)
+        {
+            out.write_bits_unsigned(static_cast<uint32_t>(value), 8);
+            return;
+        }
+        int bytes = value <= 0x7FF ? 2 : value <= 0xFFFF ? 3 : value <= 0x1FFFFF ? 4 : value <= 0x3FFFFFF ? 5 : value <= 0x7FFFFFFF ? 6 : 7;
+        uint32_t prefix = (0xFF00 >> bytes) & 0xFF;
+        out.write_bits_unsigned(prefix | static_cast<uint32_t>(value >> (6 * (bytes - 1))), 8);
+        for (int i = bytes - 2; i >= 0; i--)
+        {
+            out.write_bits_unsigned(0x80 | ((value >> (6 * i)) & 0x3F), 8);
+        }
+    }
+
+    // Levinson-Durbin recursion on the autocorrelation. coefficients[order - 1] holds
+    // the predictor of that order, error[order - 1] its prediction error. Returns the
+    // highest order that could be computed.
+    uint8_t levinson_durbin(const double *autocorrelation, uint8_t max_order,
+                            double (*coefficients)[Frame_encoder::MAX_LPC_ORDER], double *error)
+    {
+        double lpc[Frame_encoder::MAX_LPC_ORDER]{};
+        double prediction_error = autocorrelation[0];
+        for (uint8_t i = 0; i < max_order; i++)
+        {
+            if (prediction_error <= 0)
+            {
+                return i;
+            }
+            double reflection = -autocorrelation[i + 1];
+            for (uint8_t j = 0; j < i; j++)
+            {
+                reflection -= lpc[j] * autocorrelation[i - j];
+            }
+            reflection /= prediction_error;
+
+            lpc[i] = reflection;
+            for (uint8_t j = 0; j < i / 2; j++)
+            {
+                double value = lpc[j];
+                lpc[j] += reflection * lpc[i - 1 - j];
+                lpc[i - 1 - j] += reflection * value;
+            }
+            if (i & 1)
+            {
+                lpc[i / 2] += lpc[i / 2] * reflection;
+            }
+            prediction_error *= 1 - reflection * reflection;
+
+            // the decoder adds the prediction, so the signs flip
+            for (uint8_t j = 0; j <= i; j++)
+            {
+                coefficients[i][j] = -lpc[j];
+            }
+            error[i] = prediction_error;
+        }
+        return max_order;
+    }
+}
+
+Encoder_settings Encoder_settings::for_level(int level)
+{
+    static const Encoder_settings levels[MAX_LEVEL + 1] = {
+        {.block_size = 1152, .max_lpc_order = 0, .max_partition_order = 3, .stereo_decorrelation = false},
+        {.block_size = 1152, .max_lpc_order = 0, .max_partition_order = 3},
+        {.block_size = 1152, .max_lpc_order = 0, .max_partition_order = 4},
+        {.block_size = 4096, .max_lpc_order = 6, .max_partition_order = 4, .stereo_decorrelation = false},
+        {.block_size = 4096, .max_lpc_order = 8, .max_partition_order = 4},
+        {.block_size = 4096, .max_lpc_order = 8, .max_partition_order = 5},
+        {.block_size = 4096, .max_lpc_order = 8, .max_partition_order = 6},
+        {.block_size = 4096, .max_lpc_order = 12, .max_partition_order = 6},
+        {.block_size = 4096, .max_lpc_order = 12, .max_partition_order = 6, .exhaustive_lpc_order = true},
+    };
+    return levels[std::clamp(level, 0, MAX_LEVEL)];
+}
+
+Frame_encoder::Rice_plan Frame_encoder::plan_rice(const int64_t *residual, uint32_t count, uint8_t order)
+{
+    // every partition needs the same length, and the first one room for the warm-up
+    uint8_t max_order = std::min(m_settings.max_partition_order, MAX_PARTITION_ORDER);
+    while (max_order > 0 && ((count & ((1u << max_order) - 1)) != 0 || (count >> max_order) <= order))
+    {
+        max_order--;
+    }
+
+    size_t partitions = size_t{1} << max_order;
+    uint32_t size = count >> max_order;
+    m_partition_sums.assign(partitions, 0);
+    for (size_t i = 0; i < partitions; i++)
+    {
+        uint32_t end = (i + 1) * size;
+        for (uint32_t j = (i == 0 ? order : i * size); j < end; j++)
+        {
+            m_partition_sums[i] += fold(residual[j]);
+        }
+    }
+
+    // from the finest partitioning down, merging neighbours on the way
+    Rice_plan best;
+    best.bits = UINT64_MAX;
+    Rice_plan candidate;
+    for (int partition_order = max_order; partition_order >= 0; partition_order--)
+    {
+        partitions = size_t{1} << partition_order;
+        size = count >> partition_order;
+        candidate.partition_order = partition_order;
+        candidate.bits = 2 + 4; // coding method and partition order
+        uint8_t largest = 0;
+        for (size_t i = 0; i < partitions; i++)
+        {
+            uint64_t samples = size - (i == 0 ? order : 0);
+            uint64_t sum = m_partition_sums[i];
+            uint8_t parameter = 0;
+            while (parameter < MAX_RICE_PARAMETER && (samples << (parameter + 1)) <= sum)
+            {
+                parameter++;
+            }
+            candidate.parameters[i] = parameter;
+            candidate.bits += samples * (parameter + 1) + (sum >> parameter);
+            largest = std::max(largest, parameter);
+        }
+        candidate.wide_parameters = largest > MAX_NARROW_RICE_PARAMETER;
+        candidate.bits += partitions * (candidate.wide_parameters ? 5 : 4);
+        if (candidate.bits < best.bits)
+        {
+            best = candidate;
+        }
+
+        for (size_t i = 0; i < partitions / 2; i++)
+        {
+            m_partition_sums[i] = m_partition_sums[2 * i] + m_partition_sums[2 * i + 1];
+        }
+    }
+    return best;
+}
+
+bool Frame_encoder::lpc_residual(const int64_t *samples, uint32_t count, const Subframe_plan &plan, int64_t *residual) const
+{
+    for (uint32_t i = plan.order; i < count; i++)
+    {
+        int64_t prediction = 0;
+        for (uint8_t j = 0; j < plan.order; j++)
+        {
+            prediction += plan.coefficients[j] * samples[i - 1 - j];
+        }
+        residual[i] = samples[i] - (prediction >> plan.shift);
+        if (residual[i] > MAX_RESIDUAL || residual[i] < -MAX_RESIDUAL)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Frame_encoder::plan_lpc(const int64_t *samples, uint32_t count, uint8_t bits_per_sample, Subframe_plan &best)
+{
+    uint8_t max_order = std::min<uint32_t>({m_settings.max_lpc_order, MAX_LPC_ORDER, count - 1});
+    if (max_order == 0)
+    {
+        return;
+    }
+
+    // Tukey(0.5) window, the reference encoder's default
+    if (m_window.size() != count)
+    {
+        m_window.resize(count);
+        uint32_t taper = count / 4;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            uint32_t distance = std::min(i, count - 1 - i);
+            m_window[i] = distance >= taper ? 1.0 : 0.5 - 0.5 * std::cos(M_PI * distance / taper);
+        }
+    }
+    m_windowed.resize(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        m_windowed[i] = samples[i] * m_window[i];
+    }
+
+    double autocorrelation[MAX_LPC_ORDER + 1]{};
+    for (uint8_t lag = 0; lag <= max_order; lag++)
+    {
+        double sum = 0;
+        for (uint32_t i = lag; i < count; i++)
+        {
+            sum += m_windowed[i] * m_windowed[i - lag];
+        }
+        autocorrelation[lag] = sum;
+    }
+    if (autocorrelation[0] == 0)
+    {
+        return;
+    }
+
+    double coefficients[MAX_LPC_ORDER][MAX_LPC_ORDER]{};
+    double error[MAX_LPC_ORDER]{};
+    max_order = levinson_durbin(autocorrelation, max_order, coefficients, error);
+    if (max_order == 0)
+    {
+        return;
+    }
+    uint8_t precision = qlp_precision(count);
+
+    // Without the exhaustive search only the order whose prediction error promises
+    // the fewest bits is encoded
+    uint8_t first_order = 1;
+    if (!m_settings.exhaustive_lpc_order)
+    {
+        double best_estimate = INFINITY;
+        for (uint8_t order = 1; order <= max_order; order++)
+        {
+            double residual_bits = error[order - 1] > 0 ? std::max(0.0, 0.5 * std::log2(error[order - 1] * 0.5 / count)) : 0;
+            double estimate = residual_bits * (count - order) + order * (precision + bits_per_sample);
+            if (estimate < best_estimate)
+            {
+                best_estimate = estimate;
+                first_order = order;
+            }
+        }
+        max_order = first_order;
+    }
+
+    Subframe_plan candidate;
+    candidate.kind = Subframe_plan::LPC;
+    candidate.precision = precision;
+    for (uint8_t order = first_order; order <= max_order; order++)
+    {
+        // quantized with error feedback, so the rounding errors don't add up
+        const double *lpc = coefficients[order - 1];
+        double largest = 0;
+        for (uint8_t i = 0; i < order; i++)
+        {
+            largest = std::max(largest, std::fabs(lpc[i]));
+        }
+        if (largest <= 0)
+        {
+            continue;
+        }
+        int exponent;
+        std::frexp(largest, &exponent);
+        int shift = std::min(precision - 1 - exponent, 15);
+        if (shift < 0)
+        {
+            continue;
+        }
+        int32_t limit = (1 << (precision - 1)) - 1;
+        double rounding_error = 0;
+        for (uint8_t i = 0; i < order; i++)
+        {
+            rounding_error += lpc[i] * (1 << shift);
+            int32_t value = std::clamp<int32_t>(static_cast<int32_t>(std::lround(rounding_error)), -limit - 1, limit);
+            rounding_error -= value;
+            candidate.coefficients[i] = value;
+        }
+        candidate.order = order;
+        candidate.shift = static_cast<int8_t>(shift);
+
+        if (!lpc_residual(samples, count, candidate, m_residual.data()))
+        {
+            continue;
+        }
+        candidate.rice = plan_rice(m_residual.data(), count, order);
+        candidate.bits = SUBFRAME_HEADER_BITS + order * bits_per_sample + 4 + 5 + order * precision + candidate.rice.bits;
+        if (candidate.bits < best.bits)
+        {
+            best = candidate;
+            std::swap(m_residual, m_best_residual);
+        }
+    }
+}
+
+void Frame_encoder::write_residual(const int64_t *residual, uint32_t count, uint8_t order, const Rice_plan &plan, Bit_writer &out) const
+{
+    out.write_bits_unsigned(plan.wide_parameters ? 1 : 0, 2);
+    out.write_bits_unsigned(plan.partition_order, 4);
+    uint8_t parameter_bits = plan.wide_parameters ? 5 : 4;
+    size_t partitions = size_t{1} << plan.partition_order;
+    uint32_t size = count >> plan.partition_order;
+    for (size_t i = 0; i < partitions; i++)
+    {
+        uint8_t parameter = plan.parameters[i];
+        out.write_bits_unsigned(parameter, parameter_bits);
+        uint32_t end = (i + 1) * size;
+        for (uint32_t j = (i == 0 ? order : i * size); j < end; j++)
+        {
+            out.write_rice_signed(residual[j], parameter);
+        }
+    }
+}
+
+void Frame_encoder::encode_subframe(int64_t *samples, uint32_t count, uint8_t bits_per_sample, Bit_writer &out)
+{
+    out.clear();
+    if (std::all_of(samples + 1, samples + count, [&](int64_t value)
+                    { return value == samples[0]; }))
+    {
+        out.write_bits_unsigned(0, SUBFRAME_HEADER_BITS);
+        out.write_bits_signed(samples[0], bits_per_sample);
+        return;
+    }
+
+    // low bits that are zero in every sample are left out
+    uint64_t used_bits = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        used_bits |= static_cast<uint64_t>(samples[i]);
+    }
+    uint8_t wasted_bits = static_cast<uint8_t>(std::countr_zero(used_bits));
+    if (wasted_bits > 0)
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            samples[i] >>= wasted_bits;
+        }
+        bits_per_sample -= wasted_bits;
+    }
+
+    m_residual.resize(count);
+    m_best_residual.resize(count);
+
+    Subframe_plan best;
+    best.kind = Subframe_plan::VERBATIM;
+    best.bits = SUBFRAME_HEADER_BITS + uint64_t{count} * bits_per_sample;
+
+    // the fixed predictor with the smallest residual magnitude
+    if (count > MAX_FIXED_ORDER)
+    {
+        uint64_t totals[MAX_FIXED_ORDER + 1]{};
+        for (uint32_t i = MAX_FIXED_ORDER; i < count; i++)
+        {
+            int64_t e0 = samples[i];
+            int64_t e1 = e0 - samples[i - 1];
+            int64_t e2 = e1 - (samples[i - 1] - samples[i - 2]);
+            int64_t e3 = e2 - (samples[i - 1] - 2 * samples[i - 2] + samples[i - 3]);
+            int64_t e4 = e3 - (samples[i - 1] - 3 * samples[i - 2] + 3 * samples[i - 3] - samples[i - 4]);
+            totals[0] += std::abs(e0);
+            totals[1] += std::abs(e1);
+            totals[2] += std::abs(e2);
+            totals[3] += std::abs(e3);
+            totals[4] += std::abs(e4);
+        }
+        uint8_t order = static_cast<uint8_t>(std::min_element(totals, totals + MAX_FIXED_ORDER + 1) - totals);
+
+        Subframe_plan fixed;
+        fixed.kind = Subframe_plan::FIXED;
+        fixed.order = order;
+        std::copy_n(Flac_constants::fixed_prediction_coefficients[order], order, fixed.coefficients.begin());
+        if (lpc_residual(samples, count, fixed, m_residual.data()))
+        {
+            fixed.rice = plan_rice(m_residual.data(), count, order);
+            fixed.bits = SUBFRAME_HEADER_BITS + order * bits_per_sample + fixed.rice.bits;
+            if (fixed.bits < best.bits)
+            {
+                best = fixed;
+                std::swap(m_residual, m_best_residual);
+            }
+        }
+    }
+    plan_lpc(samples, count, bits_per_sample, best);
+
+    uint8_t type = best.kind == Subframe_plan::VERBATIM ? 0b000001
+                   : best.kind == Subframe_plan::FIXED  ? 0b001000 | best.order
+                                                        : 0b100000 | (best.order - 1);
+    out.write_bits_unsigned(0, 1);
+    out.write_bits_unsigned(type, 6);
+    if (wasted_bits > 0)
+    {
+        out.write_bits_unsigned(1, 1);
+        out.write_unary(wasted_bits - 1);
+    }
+    else
+    {
+        out.write_bits_unsigned(0, 1);
+    }
+
+    if (best.kind == Subframe_plan::VERBATIM)
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            out.write_bits_signed(samples[i], bits_per_sample);
+        }
+        return;
+    }
+    for (uint8_t i = 0; i < best.order; i++)
+    {
+        out.write_bits_signed(samples[i], bits_per_sample);
+    }
+    if (best.kind == Subframe_plan::LPC)
+    {
+        out.write_bits_unsigned(best.precision - 1, 4);
+        out.write_bits_signed(best.shift, 5);
+        for (uint8_t i = 0; i < best.order; i++)
+        {
+            out.write_bits_signed(best.coefficients[i], best.precision);
+        }
+    }
+    write_residual(m_best_residual.data(), count, best.order, best.rice, out);
+}
+
+void Frame_encoder::write_header(uint32_t count, uint8_t channel_assignment, uint64_t frame_number)
+{
+    m_frame.clear();
+    m_frame.write_bits_unsigned(Flac_constants::frame_sync_code, 14);
+    m_frame.write_bits_unsigned(0, 1); // reserved
+    m_frame.write_bits_unsigned(0, 1); // fixed block size, frames are numbered
+
+    int block_size_code = find_code(Flac_constants::block_sizes, count);
+    if (block_size_code < 0)
+    {
+        block_size_code = count <= 256 ? 0b0110 : 0b0111;
+    }
+
+    uint32_t rate = m_stream_info.sample_rate;
+    int sample_rate_code = find_code(Flac_constants::sample_rates, rate);
+    if (sample_rate_code < 0)
+    {
+        sample_rate_code = rate % 1000 == 0 && rate / 1000 <= 255 ? 0b1100
+                           : rate <= 65535                        ? 0b1101
+                           : rate % 10 == 0 && rate / 10 <= 65535 ? 0b1110
+                                                                  : 0b0000; // from STREAMINFO
+    }
+    int sample_size_code = std::max(find_code(Flac_constants::bits_per_sample_table, m_stream_info.bits_per_sample), 0);
+
+    m_frame.write_bits_unsigned(block_size_code, 4);
+    m_frame.write_bits_unsigned(sample_rate_code, 4);
+    m_frame.write_bits_unsigned(channel_assignment, 4);
+    m_frame.write_bits_unsigned(sample_size_code, 3);
+    m_frame.write_bits_unsigned(0, 1); // reserved
+    write_utf8(m_frame, frame_number);
+
+    if (block_size_code == 0b0110)
+    {
+        m_frame.write_bits_unsigned(count - 1, 8);
+    }
+    else if (block_size_code == 0b0111)
+    {
+        m_frame.write_bits_unsigned(count - 1, 16);
+    }
+    if (sample_rate_code == 0b1100)
+    {
+        m_frame.write_bits_unsigned(rate / 1000, 8);
+    }
+    else if (sample_rate_code == 0b1101)
+    {
+        m_frame.write_bits_unsigned(rate, 16);
+    }
+    else if (sample_rate_code == 0b1110)
+    {
+        m_frame.write_bits_unsigned(rate / 10, 16);
+    }
+    m_frame.write_bits_unsigned(Flac_crc::crc8(m_frame.bytes().data(), m_frame.bytes().size()), 8);
+}
+
+void Frame_encoder::encode(const int32_t *samples, uint32_t count, uint64_t frame_number, std::vector<uint8_t> &out)
+{
+    uint8_t channels = m_stream_info.channels;
+    uint8_t bits_per_sample = m_stream_info.bits_per_sample;
+    for (uint8_t channel = 0; channel < channels; channel++)
+    {
+        m_channels[channel].resize(count);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            m_channels[channel][i] = samples[i * channels + channel];
+        }
+    }
+
+    // 32-bit side channels would need 33 bits
+    uint8_t channel_assignment = channels - 1;
+    std::array<uint8_t, 8> order{0, 1, 2, 3, 4, 5, 6, 7}; // subframes, in the order they go out
+    if (channels == 2 && m_settings.stereo_decorrelation && bits_per_sample < 32)
+    {
+        std::vector<int64_t> &mid = m_channels[2];
+        std::vector<int64_t> &side = m_channels[3];
+        mid.resize(count);
+        side.resize(count);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            mid[i] = (m_channels[0][i] + m_channels[1][i]) >> 1;
+            side[i] = m_channels[0][i] - m_channels[1][i];
+        }
+        for (uint8_t channel = 0; channel < 4; channel++)
+        {
+            encode_subframe(m_channels[channel].data(), count, bits_per_sample + (channel == 3 ? 1 : 0), m_subframes[channel]);
+        }
+
+        uint64_t left = m_subframes[0].bit_count(), right = m_subframes[1].bit_count();
+        uint64_t mid_bits = m_subframes[2].bit_count(), side_bits = m_subframes[3].bit_count();
+        uint64_t smallest = std::min({left + right, left + side_bits, side_bits + right, mid_bits + side_bits});
+        if (smallest == mid_bits + side_bits)
+        {
+            channel_assignment = 0b1010;
+            order = {2, 3};
+        }
+        else if (smallest == left + side_bits)
+        {
+            channel_assignment = 0b1000;
+            order = {0, 3};
+        }
+        else if (smallest == side_bits + right)
+        {
+            channel_assignment = 0b1001;
+            order = {3, 1};
+        }
+    }
+    else
+    {
+        for (uint8_t channel = 0; channel < channels; channel++)
+        {
+            encode_subframe(m_channels[channel].data(), count, bits_per_sample, m_subframes[channel]);
+        }
+    }
+
+    write_header(count, channel_assignment, frame_number);
+    for (uint8_t i = 0; i < channels; i++)
+    {
+        m_frame.append(m_subframes[order[i]]);
+    }
+    m_frame.align_to_byte();
+    m_frame.write_bits_unsigned(Flac_crc::crc16(m_frame.bytes().data(), m_frame.bytes().size()), 16);
+    out.assign(m_frame.bytes().begin(), m_frame.bytes().end());
+}
+
+std::vector<uint8_t> Flac_encoder::stream_header(const Stream_info &stream_info)
+{
+    Bit_writer header;
+    header.write_bits_unsigned(Flac_constants::flac_marker, 32);
+    header.write_bits_unsigned(1, 1); // last metadata block
+    header.write_bits_unsigned(static_cast<uint32_t>(block_type::STREAMINFO), 7);
+    header.write_bits_unsigned(34, 24);
+    header.write_bits_unsigned(stream_info.min_block_size, 16);
+    header.write_bits_unsigned(stream_info.max_block_size, 16);
+    header.write_bits_unsigned(stream_info.min_frame_size, 24);
+    header.write_bits_unsigned(stream_info.max_frame_size, 24);
+    header.write_bits_unsigned(stream_info.sample_rate, 20);
+    header.write_bits_unsigned(stream_info.channels - 1, 3);
+    header.write_bits_unsigned(stream_info.bits_per_sample - 1, 5);
+    header.write_bits_unsigned(static_cast<uint32_t>(stream_info.total_samples >> 32), 4);
+    header.write_bits_unsigned(static_cast<uint32_t>(stream_info.total_samples), 32);
+    for (int i = 0; i < 4; i++)
+    {
+        header.write_bits_unsigned(0, 32); // MD5, not computed
+    }
+    return header.bytes();
+}
+
+Encode_report Flac_encoder::encode(Wav_reader &input, const Output &output) const
+{
+    auto start = std::chrono::steady_clock::now();
+
+    Encode_report report;
+    Stream_info &info = report.stream_info;
+    info.sample_rate = input.sample_rate();
+    info.channels = input.channels();
+    info.bits_per_sample = input.bits_per_sample();
+    info.total_samples = input.total_frames();
+    info.min_block_size = info.max_block_size = m_settings.block_size;
+    if (info.total_samples != 0 && info.total_samples < m_settings.block_size)
+    {
+        info.min_block_size = info.max_block_size = static_cast<uint16_t>(info.total_samples);
+    }
+
+    std::vector<uint8_t> header = stream_header(info);
+    if (!output(header.data(), header.size()))
+    {
+        throw std::runtime_error("Encoding stopped by the output");
+    }
+    report.output_bytes = header.size();
+
+    struct Slot
+    {
+        std::vector<int32_t> samples;
+        uint32_t count{};
+        std::vector<uint8_t> frame;
+        bool done = false;
+    };
+
+    std::mutex mutex;
+    std::condition_variable frame_done;
+    size_t threads = m_threads == 0 ? std::max(1u, std::thread::hardware_concurrency()) : m_threads;
+    std::vector<Frame_encoder> encoders(threads, Frame_encoder(m_settings, info));
+    std::vector<Slot> slots(threads * BLOCKS_PER_THREAD);
+    // declared last, so its destructor finishes the queued frames while the slots are still there
+    Work_stealing_pool pool(threads);
+
+    uint64_t next_read = 0;
+    uint64_t next_write = 0;
+    uint64_t samples_read = 0;
+    bool input_done = false;
+    uint32_t bytes_per_sample = (info.bits_per_sample + 7) / 8;
+    info.min_frame_size = UINT32_MAX;
+
+    while (true)
+    {
+        // keep every slot busy, then hand out the oldest frame
+        if (!input_done && next_read - next_write < slots.size())
+        {
+            Slot &slot = slots[next_read % slots.size()];
+            slot.count = input.read(slot.samples, m_settings.block_size);
+            if (slot.count == 0)
+            {
+                input_done = true;
+                continue;
+            }
+            samples_read += slot.count;
+            report.input_bytes += uint64_t{slot.count} * info.channels * bytes_per_sample;
+
+            uint64_t frame_number = next_read++;
+            pool.submit([&, slot = &slot, frame_number](size_t worker)
+                        {
+                            encoders[worker].encode(slot->samples.data(), slot->count, frame_number, slot->frame);
+                            {
+                                std::lock_guard<std::mutex> lock(mutex);
+                                slot->done = true;
+                            }
+                            frame_done.notify_all(); });
+            continue;
+        }
+        if (next_write == next_read)
+        {
+            break;
+        }
+
+        Slot &slot = slots[next_write++ % slots.size()];
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            frame_done.wait(lock, [&]
+                            { return slot.done; });
+            slot.done = false;
+        }
+        uint32_t frame_size = static_cast<uint32_t>(slot.frame.size());
+        info.min_frame_size = std::min(info.min_frame_size, frame_size);
+        info.max_frame_size = std::max(info.max_frame_size, frame_size);
+        report.frames++;
+        report.output_bytes += frame_size;
+        if (!output(slot.frame.data(), slot.frame.size()))
+        {
+            pool.wait();
+            throw std::runtime_error("Encoding stopped by the output");
+        }
+    }
+
+    if (report.frames == 0)
+    {
+        info.min_frame_size = 0;
+    }
+    info.total_samples = samples_read;
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return report;
+}
@@ -0,0 +1,125 @@
+#include "Flac_profile.hpp"
+
+#include <sstream>
+
+namespace
+{
+    template <size_t N>
+    void add(std::array<uint64_t, N> &target, const std::array<uint64_t, N> &source)
+    {
+        for (size_t i = 0; i < N; i++)
+        {
+            target[i] += source[i];
+        }
+    }
+
+    // {"<index + offset>":count,...} for the non-zero entries
+    template <size_t N>
+    std::string counts_json(const std::array<uint64_t, N> &counts, size_t offset = 0)
+    {
+        std::ostringstream json;
+        json << "{";
+        bool first = true;
+        for (size_t i = 0; i < N; i++)
+        {
+            if (counts[i] == 0)
+            {
+                continue;
+            }
+            json << (first ? "" : ",") << "\"" << i + offset << "\":" << counts[i];
+            first = false;
+        }
+        json << "}";
+        return json.str();
+    }
+
+    double per_sample(uint64_t ns, uint64_t samples)
+    {
+        return samples == 0 ? 0 : static_cast<double>(ns) / samples;
+    }
+}
+
+void Flac_profile::record_frame(uint8_t channel_assignment, uint16_t block_size, uint64_t bytes, uint64_t ns)
+{
+    frames++;
+    samples += block_size;
+    bytes_read += bytes;
+    frame_ns += ns;
+    frame_time_ns.record(ns);
+    frame_bytes.record(bytes);
+    channel_assignments[channel_assignment <= 0b0111 ? 0 : channel_assignment - 0b0111]++;
+}
+
+void Flac_profile::record_subframe(Subframe_kind kind, uint16_t block_size, uint64_t ns)
+{
+    Subframe_stats &stats = subframes[kind];
+    stats.count++;
+    stats.samples += block_size;
+    stats.ns += ns;
+}
+
+void Flac_profile::merge(const Flac_profile &other)
+{
+    frames += other.frames;
+    samples += other.samples;
+    bytes_read += other.bytes_read;
+    frame_ns += other.frame_ns;
+    residual_ns += other.residual_ns;
+    prediction_ns += other.prediction_ns;
+    decorrelation_ns += other.decorrelation_ns;
+    frame_time_ns.merge(other.frame_time_ns);
+    frame_bytes.merge(other.frame_bytes);
+
+    for (size_t i = 0; i < SUBFRAME_KINDS; i++)
+    {
+        subframes[i].count += other.subframes[i].count;
+        subframes[i].samples += other.subframes[i].samples;
+        subframes[i].ns += other.subframes[i].ns;
+    }
+    wasted_bits_subframes += other.wasted_bits_subframes;
+    add(channel_assignments, other.channel_assignments);
+    add(fixed_orders, other.fixed_orders);
+    add(lpc_orders, other.lpc_orders);
+    add(lpc_precisions, other.lpc_precisions);
+    add(partition_orders, other.partition_orders);
+    add(rice_parameters, other.rice_parameters);
+    escaped_partitions += other.escaped_partitions;
+}
+
+std::string Flac_profile::to_json() const
+{
+    static const char *const kind_names[SUBFRAME_KINDS] = {"constant", "verbatim", "fixed", "lpc"};
+    static const char *const assignment_names[4] = {"independent", "left_side", "side_right", "mid_side"};
+
+    // whatever isn't residuals, prediction or decorrelation: headers, warm-up samples, CRCs
+    uint64_t measured = residual_ns + prediction_ns + decorrelation_ns;
+    uint64_t other_ns = frame_ns > measured ? frame_ns - measured : 0;
+
+    std::ostringstream json;
+    json << "{\"frames\":" << frames << ",\"samples\":" << samples << ",\"bytes_read\":" << bytes_read
+         << ",\"ns_per_sample\":" << per_sample(frame_ns, samples)
+         << ",\"time_ns\":{\"frame\":" << frame_ns << ",\"residual\":" << residual_ns
+         << ",\"prediction\":" << prediction_ns << ",\"decorrelation\":" << decorrelation_ns
+         << ",\"other\":" << other_ns << "}"
+         << ",\"frame_time_ns\":" << frame_time_ns.to_json()
+         << ",\"frame_bytes\":" << frame_bytes.to_json() << ",\"subframes\":{";
+    for (size_t i = 0; i < SUBFRAME_KINDS; i++)
+    {
+        const Subframe_stats &stats = subframes[i];
+        json << (i == 0 ? "" : ",") << "\"" << kind_names[i] << "\":{\"count\":" << stats.count
+             << ",\"samples\":" << stats.samples << ",\"ns\":" << stats.ns
+             << ",\"ns_per_sample\":" << per_sample(stats.ns, stats.samples) << "}";
+    }
+    json << "},\"wasted_bits_subframes\":" << wasted_bits_subframes << ",\"channel_assignments\":{";
+    for (size_t i = 0; i < channel_assignments.size(); i++)
+    {
+        json << (i == 0 ? "" : ",") << "\"" << assignment_names[i] << "\":" << channel_assignments[i];
+    }
+    json << "},\"fixed_orders\":" << counts_json(fixed_orders)
+         << ",\"lpc_orders\":" << counts_json(lpc_orders)
+         << ",\"lpc_precisions\":" << counts_json(lpc_precisions, 1)
+         << ",\"partition_orders\":" << counts_json(partition_orders)
+         << ",\"rice_parameters\":" << counts_json(rice_parameters)
+         << ",\"escaped_partitions\":" << escaped_partitions << "}";
+    return json.str();
+}
@@ -0,0 +1,335 @@
+#include "Frame_scanner.hpp"
+
+#include <algorithm>
+
+#include "Flac_constants.hpp"
+#include "Flac_crc.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCANNER_X86 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SCANNER_NEON 1
+#endif
+
+namespace
+{
+    bool is_sync(const uint8_t *bytes)
+    {
+        return bytes[0] == 0xFF && (bytes[1] & 0xFE) == 0xF8;
+    }
+
+    size_t find_sync_scalar(const uint8_t *data, size_t size, size_t from)
+    {
+        for (size_t i = from; i + 1 < size; i++)
+        {
+            if (is_sync(data + i))
+            {
+                return i;
+            }
+        }
+        return size;
+    }
+
+#if SCANNER_X86
+    // Compares every byte with 0xFF and, through a second load one byte further on,
+    // the byte after it with 0xF8 or 0xF9
+    size_t find_sync_sse2(const uint8_t *data, size_t size, size_t from)
+    {
+        const __m128i ff = _mm_set1_epi8(static_cast<char>(0xFF));
+        const __m128i fe = _mm_set1_epi8(static_cast<char>(0xFE));
+        const __m128i f8 = _mm_set1_epi8(static_cast<char>(0xF8));
+        size_t i = from;
+        for (; i + 17 <= size; i += 16)
+        {
+            __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+            __m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + 1));
+            __m128i match = _mm_and_si128(_mm_cmpeq_epi8(first, ff), _mm_cmpeq_epi8(_mm_and_si128(second, fe), f8));
+            int mask = _mm_movemask_epi8(match);
+            if (mask != 0)
+            {
+                return i + __builtin_ctz(mask);
+            }
+        }
+        return find_sync_scalar(data, size, i);
+    }
+
+    __attribute__((target("avx2"))) size_t find_sync_avx2(const uint8_t *data, size_t size, size_t from)
+    {
+        const __m256i ff = _mm256_set1_epi8(static_cast<char>(0xFF));
+        const __m256i fe = _mm256_set1_epi8(static_cast<char>(0xFE));
+        const __m256i f8 = _mm256_set1_epi8(static_cast<char>(0xF8));
+        size_t i = from;
+        for (; i + 33 <= size; i += 32)
+        {
+            __m256i first = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+            __m256i second = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i + 1));
+            __m256i match = _mm256_and_si256(_mm256_cmpeq_epi8(first, ff), _mm256_cmpeq_epi8(_mm256_and_si256(second, fe), f8));
+            uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(match));
+            if (mask != 0)
+            {
+                return i + __builtin_ctz(mask);
+            }
+        }
+        return find_sync_sse2(data, size, i);
+    }
+
+    bool has_avx2()
+    {
+        static const bool supported = __builtin_cpu_supports("avx2");
+        return supported;
+    }
+#elif SCANNER_NEON
+    size_t find_sync_neon(const uint8_t *data, size_t size, size_t from)
+    {
+        const uint8x16_t ff = vdupq_n_u8(0xFF);
+        const uint8x16_t fe = vdupq_n_u8(0xFE);
+        const uint8x16_t f8 = vdupq_n_u8(0xF8);
+        size_t i = from;
+        for (; i + 17 <= size; i += 16)
+        {
+            uint8x16_t first = vld1q_u8(data + i);
+            uint8x16_t second = vld1q_u8(data + i + 1);
+            uint8x16_t match = vandq_u8(vceqq_u8(first, ff), vceqq_u8(vandq_u8(second, fe), f8));
+            // no movemask: any match at all, then the scalar search finds it
+            if (vmaxvq_u8(match) != 0)
+            {
+                return find_sync_scalar(data, i + 17, i);
+            }
+        }
+        return find_sync_scalar(data, size, i);
+    }
+#endif
+
+    // The coded frame or sample number, as decode_utf8 reads it; 0 bytes if malformed
+    size_t read_utf8(const uint8_t *data, size_t size, uint64_t &value)
+    {
+        uint8_t first = data[0];
+        size_t length;
+        if (first < 0x80)
+        {
+            value = first;
+            return 1;
+        }
+        else if ((first & 0xE0) == 0xC0)
+        {
+            length = 2;
+            value = first & 0x1F;
+        }
+        else if ((first & 0xF0) == 0xE0)
+        {
+            length = 3;
+            value = first & 0x0F;
+        }
+        else if ((first & 0xF8) == 0xF0)
+        {
+            length = 4;
+            value = first & 0x07;
+        }
+        else if ((first & 0xFC) == 0xF8)
+        {
+            length = 5;
+            value = first & 0x03;
+        }
+        else if ((first & 0xFE) == 0xFC)
+        {
+            length = 6;
+            value = first & 0x01;
+        }
+        else if (first == 0xFE)
+        {
+            length = 7;
+            value = 0;
+        }
+        else
+        {
+            return 0;
+        }
+
+        if (length > size)
+        {
+            return 0;
+        }
+        for (size_t i = 1; i < length; i++)
+        {
+            if ((data[i] & 0xC0) != 0x80)
+            {
+                return 0;
+            }
+            value = (value << 6) | (data[i] & 0x3F);
+        }
+        return length;
+    }
+
+    // How far apart two consecutive frame headers can be at most
+    uint64_t frame_size_limit(const Stream_info &stream_info)
+    {
+        if (stream_info.max_frame_size != 0)
+        {
+            return stream_info.max_frame_size;
+        }
+        // a verbatim frame, the side channel one bit wider
+        uint64_t block_size = stream_info.max_block_size == 0 ? 65535 : stream_info.max_block_size;
+        uint64_t bits_per_sample = stream_info.bits_per_sample == 0 ? 32 : stream_info.bits_per_sample;
+        uint64_t channels = stream_info.channels == 0 ? 8 : stream_info.channels;
+        return (block_size * channels * (bits_per_sample + 1) + 7) / 8 + channels + Frame_scanner::MAX_HEADER_SIZE + 2;
+    }
+}
+
+size_t Frame_scanner::find_sync(const uint8_t *data, size_t size, size_t from)
+{
+#if SCANNER_X86
+    return has_avx2() ? find_sync_avx2(data, size, from) : find_sync_sse2(data, size, from);
+#elif SCANNER_NEON
+    return find_sync_neon(data, size, from);
+#else
+    return find_sync_scalar(data, size, from);
+#endif
+}
+
+std::optional<Frame_location> Frame_scanner::parse_header(const uint8_t *data, size_t size) const
+{
+    // sync code and blocking strategy, codes, a 1-byte number, CRC-8
+    if (size < 6 || !is_sync(data))
+    {
+        return std::nullopt;
+    }
+    bool variable_blocking = data[1] & 1;
+    uint8_t block_size_code = data[2] >> 4;
+    uint8_t sample_rate_code = data[2] & 0x0F;
+    uint8_t channel_assignment = data[3] >> 4;
+    uint8_t sample_size_code = (data[3] >> 1) & 0x07;
+    if (block_size_code == 0 || sample_rate_code == 0x0F || channel_assignment > 10 || sample_size_code == 3 || (data[3] & 1))
+    {
+        return std::nullopt;
+    }
+
+    size_t position = 4;
+    uint64_t number;
+    size_t number_size = read_utf8(data + position, size - position, number);
+    // frame numbers have at most 31 bits, sample numbers 36
+    if (number_size == 0 || (!variable_blocking && number_size > 6))
+    {
+        return std::nullopt;
+    }
+    position += number_size;
+
+    size_t extra_size = (block_size_code == 6 ? 1 : block_size_code == 7 ? 2 : 0) +
+                        (sample_rate_code == 12 ? 1 : sample_rate_code >= 13 ? 2 : 0);
+    if (position + extra_size + 1 > size)
+    {
+        return std::nullopt;
+    }
+    uint32_t block_size = Flac_constants::block_sizes[block_size_code];
+    if (block_size_code == 6)
+    {
+        block_size = data[position++] + 1;
+    }
+    else if (block_size_code == 7)
+    {
+        block_size = ((data[position] << 8) | data[position + 1]) + 1;
+        position += 2;
+    }
+    uint32_t sample_rate = Flac_constants::sample_rates[sample_rate_code];
+    if (sample_rate_code == 12)
+    {
+        sample_rate = data[position++] * 1000;
+    }
+    else if (sample_rate_code >= 13)
+    {
+        sample_rate = (data[position] << 8) | data[position + 1];
+        sample_rate *= sample_rate_code == 14 ? 10 : 1;
+        position += 2;
+    }
+
+    if (Flac_crc::crc8(data, position) != data[position])
+    {
+        return std::nullopt;
+    }
+
+    // a valid header, but it has to belong to this stream
+    const Stream_info &info = m_stream_info;
+    uint8_t channels = channel_assignment < 8 ? channel_assignment + 1 : 2;
+    uint8_t bits_per_sample = Flac_constants::bits_per_sample_table[sample_size_code];
+    if ((info.channels != 0 && channels != info.channels) ||
+        (info.max_block_size != 0 && block_size > info.max_block_size) ||
+        (info.sample_rate != 0 && sample_rate_code != 0 && sample_rate != info.sample_rate) ||
+        (info.bits_per_sample != 0 && sample_size_code != 0 && bits_per_sample != info.bits_per_sample))
+    {
+        return std::nullopt;
+    }
+
+    Frame_location location;
+    location.block_size = block_size;
+    location.header_size = static_cast<uint8_t>(position + 1);
+    location.first_sample = variable_blocking ? number : number * (info.max_block_size != 0 ? info.max_block_size : block_size);
+    if (info.total_samples != 0 && location.first_sample >= info.total_samples)
+    {
+        return std::nullopt;
+    }
+    return location;
+}
+
+std::optional<Frame_location> Frame_scanner::find_frame(const uint8_t *data, size_t size, size_t from) const
+{
+    for (size_t offset = find_sync(data, size, from); offset < size; offset = find_sync(data, size, offset + 1))
+    {
+        std::optional<Frame_location> location = parse_header(data + offset, size - offset);
+        if (location)
+        {
+            location->offset = offset;
+            return location;
+        }
+    }
+    return std::nullopt;
+}
+
+std::optional<Frame_location> Frame_scanner::find_confirmed_frame(const uint8_t *data, size_t size, size_t from) const
+{
+    uint64_t limit = frame_size_limit(m_stream_info);
+    for (std::optional<Frame_location> candidate = find_frame(data, size, from); candidate;
+         candidate = find_frame(data, size, candidate->offset + 1))
+    {
+        // sync patterns in the candidate's audio data may pass too, look past them
+        uint64_t next_sample = candidate->first_sample + candidate->block_size;
+        size_t end = static_cast<size_t>(std::min<uint64_t>(size, candidate->offset + limit + MAX_HEADER_SIZE));
+        for (std::optional<Frame_location> next = find_frame(data, end, candidate->offset + candidate->header_size); next;
+             next = find_frame(data, end, next->offset + next->header_size))
+        {
+            if (next->first_sample == next_sample)
+            {
+                return candidate;
+            }
+        }
+    }
+    return std::nullopt;
+}
+
+std::vector<Frame_location> Frame_scanner::scan(const uint8_t *data, size_t size) const
+{
+    std::vector<Frame_location> locations;
+    for (std::optional<Frame_location> location = find_frame(data, size); location;
+         location = find_frame(data, size, location->offset + location->header_size))
+    {
+        locations.push_back(*location);
+    }
+    return locations;
+}
+
+std::optional<Frame_location> Frame_scanner::find_last_frame(const uint8_t *data, size_t size) const
+{
+    uint64_t limit = frame_size_limit(m_stream_info);
+    std::vector<Frame_location> locations = scan(data, size);
+    for (size_t last = locations.size(); last-- > 1;)
+    {
+        for (size_t previous = last; previous-- > 0 && locations[last].offset - locations[previous].offset <= limit;)
+        {
+            if (locations[previous].first_sample + locations[previous].block_size == locations[last].first_sample)
+            {
+                return locations[last];
+            }
+        }
+    }
+    return std::nullopt;
+}
@@ -0,0 +1,307 @@
+#include "Library_scanner.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <fcntl.h>
+#include <mutex>
+#include <optional>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+#include "Flac_metadata.hpp"
+#include "Frame_scanner.hpp"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    using Flac_metadata::block_header_size;
+
+    bool is_flac_path(const fs::path &path)
+    {
+        std::string extension = path.extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c)
+                       { return static_cast<char>(std::tolower(c)); });
+        return extension == ".flac";
+    }
+
+    // A window over the file that is refilled with pread when a block falls outside it
+    class Block_reader
+    {
+    private:
+        int m_fd;
+        uint64_t m_file_size;
+        std::vector<char> m_window;
+        uint64_t m_window_offset{};
+        uint64_t &m_bytes_read;
+
+    public:
+        Block_reader(int fd, uint64_t file_size, uint64_t &bytes_read)
+            : m_fd(fd), m_file_size(file_size), m_bytes_read(bytes_read) {}
+
+        // length bytes at offset, or nullptr if the file is shorter or can't be read
+        const char *at(uint64_t offset, uint64_t length)
+        {
+            if (offset >= m_window_offset && offset + length <= m_window_offset + m_window.size())
+            {
+                return m_window.data() + (offset - m_window_offset);
+            }
+            if (offset > m_file_size || length > m_file_size - offset)
+            {
+                return nullptr;
+            }
+
+            m_window.resize(std::min<uint64_t>(std::max<uint64_t>(length, Library_scanner::READ_SIZE), m_file_size - offset));
+            m_window_offset = offset;
+            size_t filled = 0;
+            while (filled < m_window.size())
+            {
+                ssize_t n = pread(m_fd, m_window.data() + filled, m_window.size() - filled, offset + filled);
+                if (n <= 0)
+                {
+                    m_window.clear();
+                    return nullptr;
+                }
+                filled += n;
+                m_bytes_read += n;
+            }
+            return m_window.data();
+        }
+    };
+
+    // Streams encoded as they were sent leave the sample count in STREAMINFO at 0; the
+    // number and size of the last frame give it. 0 if the tail holds no frames.
+    uint64_t count_samples(Block_reader &reader, uint64_t file_size, const Stream_info &stream_info)
+    {
+        uint64_t tail = std::min<uint64_t>(file_size, std::max<uint64_t>(Library_scanner::READ_SIZE, 3 * uint64_t{stream_info.max_frame_size}));
+        const char *data = reader.at(file_size - tail, tail);
+        if (!data)
+        {
+            return 0;
+        }
+        Frame_scanner scanner(stream_info);
+        std::optional<Frame_location> last = scanner.find_last_frame(reinterpret_cast<const uint8_t *>(data), tail);
+        return last ? last->first_sample + last->block_size : 0;
+    }
+
+    Indexed_track copy_indexed(const Tag_index &index, size_t position)
+    {
+        Tag_index::Track track = index.track(position);
+        Indexed_track copy;
+        copy.path = track.path;
+        copy.file_size = track.file_size;
+        copy.mtime = track.mtime;
+        copy.stream_info.sample_rate = track.sample_rate;
+        copy.stream_info.channels = track.channels;
+        copy.stream_info.bits_per_sample = track.bits_per_sample;
+        copy.stream_info.total_samples = track.total_samples;
+        for (auto [name, value] : index.tags(position))
+        {
+            copy.tags.emplace_back(name, value);
+        }
+        return copy;
+    }
+}
+
+Library_scanner::Library_scanner(fs::path root, size_t threads)
+    : m_root(std::move(root)), m_threads(threads)
+{
+    if (m_threads == 0)
+    {
+        m_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+}
+
+bool Library_scanner::read_track(const fs::path &path, Indexed_track &track, std::string &error, uint64_t &bytes_read)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        error = "Cannot open file";
+        return false;
+    }
+    struct stat info{};
+    if (fstat(fd, &info) != 0)
+    {
+        close(fd);
+        error = "Cannot stat file";
+        return false;
+    }
+    track.file_size = info.st_size;
+    track.mtime = info.st_mtime;
+
+    Block_reader reader(fd, info.st_size, bytes_read);
+    bool found_stream_info = false;
+    bool found_comment = false;
+    error.clear();
+
+    const char *marker = reader.at(0, 4);
+    if (!marker || !Flac_metadata::has_flac_marker(marker, 4))
+    {
+        error = "File is not a valid FLAC file";
+    }
+
+    for (uint64_t position = 4; error.empty() && !(found_stream_info && found_comment);)
+    {
+        const char *block = reader.at(position, block_header_size);
+        if (!block)
+        {
+            error = "Truncated FLAC metadata";
+            break;
+        }
+        auto [is_last, type, length] = Flac_metadata::parse_block_header(block);
+
+        if (type == block_type::STREAMINFO || type == block_type::VORBIS_COMMENT)
+        {
+            const char *body = reader.at(position + block_header_size, length);
+            if (!body)
+            {
+                error = "Truncated FLAC metadata";
+                break;
+            }
+            if (type == block_type::STREAMINFO)
+            {
+                if (length < Flac_metadata::stream_info_size)
+                {
+                    error = "STREAMINFO block is too short";
+                    break;
+                }
+                track.stream_info = Flac_metadata::parse_stream_info(body);
+                found_stream_info = true;
+            }
+            else
+            {
+                bool parsed = Flac_metadata::parse_vorbis_comment(body, length, [&](std::string_view name, std::string_view value)
+                                                                  {
+                                                                      std::string key(name);
+                                                                      for (auto &c : key)
+                                                                      {
+                                                                          c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+                                                                      }
+                                                                      track.tags.emplace_back(std::move(key), value); });
+                if (!parsed)
+                {
+                    error = "Malformed VORBIS_COMMENT block";
+                    break;
+                }
+                found_comment = true;
+            }
+        }
+
+        position += block_header_size + length;
+        if (is_last)
+        {
+            break;
+        }
+    }
+
+    if (error.empty() && found_stream_info && track.stream_info.total_samples == 0)
+    {
+        track.stream_info.total_samples = count_samples(reader, info.st_size, track.stream_info);
+    }
+    close(fd);
+    if (error.empty() && !found_stream_info)
+    {
+        error = "FLAC file has no STREAMINFO block";
+    }
+    return error.empty();
+}
+
+std::vector<Indexed_track> Library_scanner::scan(Scan_report &report, const Tag_index *previous) const
+{
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<fs::path> paths;
+    std::error_code ec;
+    for (fs::recursive_directory_iterator it(m_root, fs::directory_options::skip_permission_denied, ec), end; it != end; it.increment(ec))
+    {
+        if (ec)
+        {
+            break;
+        }
+        if (it->is_regular_file(ec) && is_flac_path(it->path()))
+        {
+            paths.push_back(it->path());
+        }
+    }
+
+    std::vector<std::optional<Indexed_track>> results(paths.size());
+    std::atomic<size_t> next_path{0};
+    std::atomic<size_t> reused{0};
+    std::atomic<uint64_t> bytes_read{0};
+    std::mutex errors_mutex;
+
+    auto worker = [&]()
+    {
+        uint64_t worker_bytes = 0;
+        std::string error;
+        for (size_t i = next_path.fetch_add(1, std::memory_order_relaxed); i < paths.size();
+             i = next_path.fetch_add(1, std::memory_order_relaxed))
+        {
+            std::string relative_path = paths[i].lexically_relative(m_root).generic_string();
+
+            struct stat info{};
+            if (previous && stat(paths[i].c_str(), &info) == 0)
+            {
+                std::optional<size_t> known = previous->find_path(relative_path);
+                if (known)
+                {
+                    Tag_index::Track track = previous->track(*known);
+                    if (track.file_size == static_cast<uint64_t>(info.st_size) && track.mtime == info.st_mtime)
+                    {
+                        results[i] = copy_indexed(*previous, *known);
+                        reused.fetch_add(1, std::memory_order_relaxed);
+                        continue;
+                    }
+                }
+            }
+
+            Indexed_track track;
+            track.path = relative_path;
+            if (read_track(paths[i], track, error, worker_bytes))
+            {
+                results[i] = std::move(track);
+            }
+            else
+            {
+                std::lock_guard<std::mutex> lock(errors_mutex);
+                report.errors.emplace_back(relative_path, error);
+            }
+        }
+        bytes_read.fetch_add(worker_bytes, std::memory_order_relaxed);
+    };
+
+    std::vector<std::thread> threads;
+    size_t thread_count = std::min(m_threads, std::max<size_t>(1, paths.size()));
+    for (size_t i = 1; i < thread_count; i++)
+    {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+
+    std::vector<Indexed_track> tracks;
+    tracks.reserve(paths.size());
+    for (auto &result : results)
+    {
+        if (result)
+        {
+            tracks.push_back(std::move(*result));
+        }
+    }
+
+    report.files = paths.size();
+    report.reused = reused;
+    report.parsed = tracks.size() - report.reused;
+    report.failed = report.errors.size();
+    report.bytes_read = bytes_read;
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::sort(report.errors.begin(), report.errors.end());
+    return tracks;
+}
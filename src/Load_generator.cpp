@@ -0,0 +1,227 @@
+#include "Load_generator.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <unistd.h>
+
+#include "File_client.hpp"
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    std::filesystem::path make_payload(const std::filesystem::path &path, size_t size, uint32_t seed)
+    {
+        // random bytes, so nothing on the way gets to compress them
+        std::vector<char> data(size);
+        std::mt19937 rng(seed);
+        for (char &byte : data)
+        {
+            byte = static_cast<char>(rng());
+        }
+        std::ofstream out(path, std::ios::binary);
+        out.write(data.data(), data.size());
+        if (!out)
+        {
+            throw std::runtime_error("Cannot write " + path.string());
+        }
+        return path;
+    }
+
+    std::string get_name(size_t index)
+    {
+        return "load_get_" + std::to_string(index) + ".bin";
+    }
+}
+
+uint32_t Load_report::Command::percentile(double fraction) const
+{
+    if (latency_us.empty())
+    {
+        return 0;
+    }
+    // nearest rank: the smallest sample with at least fraction of them at or below it
+    size_t rank = static_cast<size_t>(std::ceil(fraction * latency_us.size()));
+    return latency_us[std::clamp<size_t>(rank, 1, latency_us.size()) - 1];
+}
+
+uint64_t Load_report::operations() const
+{
+    uint64_t total = 0;
+    for (const Command &command : commands)
+    {
+        total += command.succeeded + command.failed;
+    }
+    return total;
+}
+
+std::string Load_report::to_json() const
+{
+    std::ostringstream json;
+    json << "{\"sessions\":" << sessions << ",\"seconds\":" << seconds << ",\"operations\":" << operations()
+         << ",\"ops_per_s\":" << operations_per_second() << ",\"commands\":{";
+    for (size_t i = 0; i < commands.size(); i++)
+    {
+        const Command &command = commands[i];
+        json << (i == 0 ? "" : ",") << "\"" << transfer_kind_name(static_cast<Transfer_kind>(i)) << "\":{"
+             << "\"succeeded\":" << command.succeeded
+             << ",\"failed\":" << command.failed
+             << ",\"bytes\":" << command.bytes
+             << ",\"ops_per_s\":" << (seconds > 0 ? (command.succeeded + command.failed) / seconds : 0)
+             << ",\"p50_us\":" << command.percentile(0.5)
+             << ",\"p99_us\":" << command.percentile(0.99)
+             << ",\"p999_us\":" << command.percentile(0.999)
+             << ",\"max_us\":" << (command.latency_us.empty() ? 0 : command.latency_us.back()) << "}";
+    }
+    json << "}}";
+    return json.str();
+}
+
+Load_generator::Load_generator(Load_options options)
+    : m_options(std::move(options)),
+      m_work_dir(std::filesystem::temp_directory_path() / ("load_generator_" + std::to_string(getpid())))
+{
+    if (m_options.sessions == 0 || m_options.file_count == 0)
+    {
+        throw std::runtime_error("Load needs at least one session and one file");
+    }
+    if (std::all_of(m_options.mix.begin(), m_options.mix.end(), [](unsigned int weight)
+                    { return weight == 0; }))
+    {
+        throw std::runtime_error("Load mix has no commands");
+    }
+    std::filesystem::create_directories(m_work_dir);
+}
+
+Load_generator::~Load_generator()
+{
+    std::error_code ec;
+    std::filesystem::remove_all(m_work_dir, ec);
+}
+
+void Load_generator::seed_server(const std::filesystem::path &payload)
+{
+    Async_file_client client(m_options.ip, m_options.port);
+    for (size_t i = 0; i < m_options.file_count; i++)
+    {
+        // uploads go by the local file's name
+        std::filesystem::path path = m_work_dir / get_name(i);
+        std::filesystem::copy_file(payload, path, std::filesystem::copy_options::overwrite_existing);
+        Transfer_result result = client.upload_file(path.string()).get();
+        std::filesystem::remove(path);
+        if (!result.success)
+        {
+            throw std::runtime_error("Cannot upload " + get_name(i) + ": " + result.error);
+        }
+    }
+}
+
+Load_report Load_generator::run()
+{
+    std::filesystem::path payload = make_payload(m_work_dir / "payload.bin", m_options.file_size, m_options.seed);
+    seed_server(payload);
+
+    struct Session
+    {
+        std::array<Load_report::Command, 3> commands;
+        std::string error;
+    };
+    std::vector<Session> sessions(m_options.sessions);
+    // in operation mode every session takes requests from here until it runs out
+    std::atomic<int64_t> remaining{static_cast<int64_t>(m_options.operations)};
+
+    auto session_loop = [&](size_t index, Clock::time_point deadline)
+    {
+        Session &session = sessions[index];
+        try
+        {
+            std::filesystem::path session_dir = m_work_dir / ("session_" + std::to_string(index));
+            std::filesystem::create_directories(session_dir);
+            std::filesystem::path put_path = session_dir / ("load_put_" + std::to_string(index) + ".bin");
+            std::filesystem::copy_file(payload, put_path, std::filesystem::copy_options::overwrite_existing);
+
+            File_client client(m_options.ip, m_options.port);
+            Async_file_client &transport = client.get_transport();
+            std::mt19937 rng(m_options.seed + static_cast<uint32_t>(index) + 1);
+            std::discrete_distribution<int> pick_command(m_options.mix.begin(), m_options.mix.end());
+            std::uniform_int_distribution<size_t> pick_file(0, m_options.file_count - 1);
+
+            while (m_options.operations > 0 ? remaining.fetch_sub(1, std::memory_order_relaxed) > 0 : Clock::now() < deadline)
+            {
+                Transfer_kind kind = static_cast<Transfer_kind>(pick_command(rng));
+                auto start = Clock::now();
+                Transfer_result result;
+                switch (kind)
+                {
+                case Transfer_kind::LIST:
+                    // a full listing, as a client that has just connected asks for
+                    result = transport.list_files().get();
+                    break;
+                case Transfer_kind::GET:
+                    result = transport.download_file(get_name(pick_file(rng)), session_dir.string()).get();
+                    break;
+                case Transfer_kind::PUT:
+                    result = transport.upload_file(put_path.string()).get();
+                    break;
+                }
+                auto latency = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+
+                Load_report::Command &command = session.commands[static_cast<size_t>(kind)];
+                if (result.success)
+                {
+                    command.succeeded++;
+                    command.bytes += result.bytes;
+                    command.latency_us.push_back(static_cast<uint32_t>(std::min<int64_t>(latency, UINT32_MAX)));
+                }
+                else
+                {
+                    command.failed++;
+                }
+            }
+        }
+        catch (const std::exception &e)
+        {
+            session.error = e.what();
+        }
+    };
+
+    Load_report report;
+    report.sessions = m_options.sessions;
+    auto start = Clock::now();
+    {
+        std::vector<std::jthread> threads;
+        for (size_t i = 0; i < m_options.sessions; i++)
+        {
+            threads.emplace_back(session_loop, i, start + m_options.duration);
+        }
+    }
+    report.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    for (const Session &session : sessions)
+    {
+        if (!session.error.empty())
+        {
+            throw std::runtime_error("Load session failed: " + session.error);
+        }
+        for (size_t i = 0; i < report.commands.size(); i++)
+        {
+            const Load_report::Command &from = session.commands[i];
+            Load_report::Command &to = report.commands[i];
+            to.succeeded += from.succeeded;
+            to.failed += from.failed;
+            to.bytes += from.bytes;
+            to.latency_us.insert(to.latency_us.end(), from.latency_us.begin(), from.latency_us.end());
+        }
+    }
+    for (Load_report::Command &command : report.commands)
+    {
+        std::sort(command.latency_us.begin(), command.latency_us.end());
+    }
+    return report;
+}
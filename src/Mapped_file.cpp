@@ -0,0 +1,78 @@
+#include "Mapped_file.hpp"
+
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+Mapped_file::Mapped_file(Mapped_file &&other) noexcept
+    : m_data(std::exchange(other.m_data, nullptr)), m_size(std::exchange(other.m_size, 0)),
+      m_open(std::exchange(other.m_open, false))
+{
+}
+
+Mapped_file &Mapped_file::operator=(Mapped_file &&other) noexcept
+{
+    if (this != &other)
+    {
+        close();
+        m_data = std::exchange(other.m_data, nullptr);
+        m_size = std::exchange(other.m_size, 0);
+        m_open = std::exchange(other.m_open, false);
+    }
+    return *this;
+}
+
+void Mapped_file::open(const std::filesystem::path &path)
+{
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Cannot open file: " + path.string());
+    }
+    struct stat info{};
+    if (fstat(fd, &info) != 0)
+    {
+        ::close(fd);
+        throw std::runtime_error("Cannot stat file: " + path.string());
+    }
+
+    // mmap refuses empty mappings; an empty file is simply open with no data
+    if (info.st_size > 0)
+    {
+        void *data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            ::close(fd);
+            throw std::runtime_error("Cannot map file: " + path.string());
+        }
+        m_data = static_cast<const char *>(data);
+        m_size = info.st_size;
+    }
+    ::close(fd);
+    m_open = true;
+}
+
+void Mapped_file::close()
+{
+    if (m_data)
+    {
+        munmap(const_cast<char *>(m_data), m_size);
+    }
+    m_data = nullptr;
+    m_size = 0;
+    m_open = false;
+}
+
+std::string_view Mapped_file::range(uint64_t offset, uint64_t length) const
+{
+    if (offset > m_size || length > m_size - offset)
+    {
+        throw std::out_of_range("Range is outside of the mapped file");
+    }
+    return {m_data + offset, length};
+}
@@ -0,0 +1,218 @@
+#include "Metadata_peek.hpp"
+
+#include <algorithm>
+#include <sstream>
+
+#include "Flac.hpp"
+#include "Flac_metadata.hpp"
+
+namespace
+{
+    using Flac_metadata::block_header_size;
+
+    constexpr uint8_t all_wanted = (1 << static_cast<uint8_t>(block_type::STREAMINFO)) |
+                                   (1 << static_cast<uint8_t>(block_type::SEEKTABLE)) |
+                                   (1 << static_cast<uint8_t>(block_type::VORBIS_COMMENT));
+
+    bool wanted_block(block_type type)
+    {
+        return type == block_type::STREAMINFO || type == block_type::SEEKTABLE || type == block_type::VORBIS_COMMENT;
+    }
+
+    bool located_block(block_type type)
+    {
+        return type == block_type::PICTURE || type == block_type::CUESHEET || type == block_type::APPLICATION;
+    }
+}
+
+struct Metadata_peeker::Peek
+{
+    Peek_result result;
+    Peek_callback on_complete;
+
+    std::vector<char> window; // last fetched range of the file
+    uint64_t window_offset{};
+    uint64_t position{};       // file offset of the next thing to parse
+    size_t last_block_header{}; // offset in result.metadata.header of the last copied block
+    uint8_t wanted_found{};     // bit per wanted block type
+    size_t fetches{};
+
+    // bytes available in the window at the file offset, or nullptr if not all of them are there
+    const char *at(uint64_t offset, uint64_t length) const
+    {
+        if (offset < window_offset || offset + length > window_offset + window.size())
+        {
+            return nullptr;
+        }
+        return window.data() + (offset - window_offset);
+    }
+};
+
+void Metadata_peeker::peek(const std::string &filename, Peek_callback on_complete)
+{
+    auto peek = std::make_shared<Peek>();
+    peek->result.filename = filename;
+    peek->on_complete = std::move(on_complete);
+    fetch(peek, 0, m_initial_range);
+}
+
+std::future<Peek_result> Metadata_peeker::peek(const std::string &filename)
+{
+    auto promise = std::make_shared<std::promise<Peek_result>>();
+    std::future<Peek_result> future = promise->get_future();
+    peek(filename, [promise](Peek_result result)
+         { promise->set_value(std::move(result)); });
+    return future;
+}
+
+std::vector<Peek_result> Metadata_peeker::peek_all(const std::vector<std::string> &filenames)
+{
+    std::vector<std::future<Peek_result>> futures;
+    futures.reserve(filenames.size());
+    for (const auto &filename : filenames)
+    {
+        futures.push_back(peek(filename));
+    }
+
+    std::vector<Peek_result> results;
+    results.reserve(futures.size());
+    for (auto &future : futures)
+    {
+        results.push_back(future.get());
+    }
+    return results;
+}
+
+std::future<Transfer_result> Metadata_peeker::fetch_block(const std::string &filename, const Block_location &block)
+{
+    return m_client.download_range(filename, block.offset, block.length);
+}
+
+void Metadata_peeker::fetch(std::shared_ptr<Peek> peek, uint64_t offset, uint64_t length)
+{
+    if (++peek->fetches > MAX_FETCHES)
+    {
+        peek->result.error = "Too many metadata blocks";
+        peek->on_complete(std::move(peek->result));
+        return;
+    }
+
+    m_client.download_range(peek->result.filename, offset, length, [this, peek, offset](Transfer_result transfer)
+                            {
+                                if (!transfer.success)
+                                {
+                                    peek->result.error = transfer.error;
+                                    peek->on_complete(std::move(peek->result));
+                                    return;
+                                }
+                                peek->result.metadata.bytes_fetched += transfer.data.size();
+                                peek->window = std::move(transfer.data);
+                                peek->window_offset = offset;
+                                advance(peek); });
+}
+
+void Metadata_peeker::advance(std::shared_ptr<Peek> peek)
+{
+    std::vector<char> &header = peek->result.metadata.header;
+
+    if (peek->position == 0)
+    {
+        const char *marker = peek->at(0, 4);
+        if (!marker || !Flac_metadata::has_flac_marker(marker, 4))
+        {
+            peek->result.error = "File is not a valid FLAC file";
+            peek->on_complete(std::move(peek->result));
+            return;
+        }
+        header.assign(marker, marker + 4);
+        peek->position = 4;
+    }
+
+    while (true)
+    {
+        const char *block = peek->at(peek->position, block_header_size);
+        if (!block)
+        {
+            if (peek->window_offset == peek->position)
+            {
+                // asked for this very offset and got nothing back: the file ended
+                peek->result.error = "Truncated FLAC metadata";
+                peek->on_complete(std::move(peek->result));
+                return;
+            }
+            // past the wanted blocks only block headers are still needed
+            uint64_t range = peek->wanted_found == all_wanted ? block_header_size : m_initial_range;
+            fetch(peek, peek->position, std::max<uint64_t>(block_header_size, range));
+            return;
+        }
+
+        auto [is_last, type, length] = Flac_metadata::parse_block_header(block);
+
+        if (wanted_block(type))
+        {
+            const char *body = peek->at(peek->position, block_header_size + length);
+            if (!body)
+            {
+                if (peek->window_offset == peek->position)
+                {
+                    // fetched exactly this block and it still doesn't fit
+                    peek->result.error = "Truncated FLAC metadata";
+                    peek->on_complete(std::move(peek->result));
+                    return;
+                }
+                fetch(peek, peek->position, std::max<uint64_t>(block_header_size + length, m_initial_range));
+                return;
+            }
+            peek->last_block_header = header.size();
+            header.insert(header.end(), body, body + block_header_size + length);
+            peek->wanted_found |= 1 << static_cast<uint8_t>(type);
+        }
+        else if (located_block(type))
+        {
+            peek->result.metadata.blocks.push_back({type, peek->position + block_header_size, length});
+        }
+
+        peek->position += block_header_size + length;
+
+        if (is_last || (peek->wanted_found == all_wanted && !m_locate_blocks))
+        {
+            finish(peek);
+            return;
+        }
+    }
+}
+
+void Metadata_peeker::finish(std::shared_ptr<Peek> peek)
+{
+    Track_metadata &metadata = peek->result.metadata;
+    if (!(peek->wanted_found & (1 << static_cast<uint8_t>(block_type::STREAMINFO))))
+    {
+        peek->result.error = "FLAC file has no STREAMINFO block";
+        peek->on_complete(std::move(peek->result));
+        return;
+    }
+
+    // the copied blocks form a complete header once the last one is flagged as such
+    for (size_t offset = 4; offset < metadata.header.size();)
+    {
+        uint8_t &flags = reinterpret_cast<uint8_t &>(metadata.header[offset]);
+        flags = offset == peek->last_block_header ? (flags | 0x80) : (flags & 0x7F);
+        offset += block_header_size + Flac_metadata::read_be24(&metadata.header[offset + 1]);
+    }
+
+    try
+    {
+        std::istringstream stream(std::string(metadata.header.begin(), metadata.header.end()));
+        Flac flac(stream);
+        flac.initialize();
+        metadata.stream_info = flac.get_stream_info();
+        metadata.vorbis_comment = flac.get_vorbis_comment();
+        peek->result.success = true;
+    }
+    catch (const std::exception &e)
+    {
+        peek->result.error = e.what();
+    }
+    peek->window.clear();
+    peek->on_complete(std::move(peek->result));
+}
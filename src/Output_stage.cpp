@@ -0,0 +1,562 @@
+#include "Output_stage.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define OUTPUT_X86 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define OUTPUT_NEON 1
+#endif
+
+namespace
+{
+    constexpr float SAMPLE_TO_FLOAT = 1.0f / 2147483648.0f;
+    constexpr int GAIN_SHIFT = 29;
+
+    // Inputs beyond the limit are clamped before the gain, which keeps the 64-bit
+    // product within 32 bits after the shift: the saturation the SIMD kernels need
+    int32_t gain_limit(Fixed_gain gain)
+    {
+        if (gain <= UNITY_GAIN)
+        {
+            return INT32_MAX;
+        }
+        return static_cast<int32_t>(((int64_t{1} << 60) - 1) / gain);
+    }
+
+    int32_t apply_gain(int32_t sample, Fixed_gain gain, int32_t limit)
+    {
+        sample = std::clamp(sample, -limit, limit);
+        return static_cast<int32_t>((int64_t{sample} * gain) >> GAIN_SHIFT);
+    }
+
+    void store_sample(int32_t sample, Sample_format format, char *out)
+    {
+        switch (format)
+        {
+        case Sample_format::S16:
+        {
+            int16_t value = static_cast<int16_t>(sample >> 16);
+            std::memcpy(out, &value, 2);
+            break;
+        }
+        case Sample_format::S24_3LE:
+        {
+            uint32_t value = static_cast<uint32_t>(sample);
+            out[0] = static_cast<char>(value >> 8);
+            out[1] = static_cast<char>(value >> 16);
+            out[2] = static_cast<char>(value >> 24);
+            break;
+        }
+        case Sample_format::S32:
+            std::memcpy(out, &sample, 4);
+            break;
+        case Sample_format::FLOAT:
+        {
+            float value = static_cast<float>(sample) * SAMPLE_TO_FLOAT;
+            std::memcpy(out, &value, 4);
+            break;
+        }
+        }
+    }
+
+    void pack_gain_scalar(const int32_t *in, size_t count, Sample_format format, Fixed_gain gain, char *out)
+    {
+        int32_t limit = gain_limit(gain);
+        size_t sample_bytes = bytes_per_sample(format);
+        for (size_t i = 0; i < count; i++)
+        {
+            store_sample(apply_gain(in[i], gain, limit), format, out + i * sample_bytes);
+        }
+    }
+
+    void pack_s16_scalar(const int32_t *in, size_t count, char *out)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            int16_t value = static_cast<int16_t>(in[i] >> 16);
+            std::memcpy(out + 2 * i, &value, 2);
+        }
+    }
+
+    void pack_s24_scalar(const int32_t *in, size_t count, char *out)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            uint32_t value = static_cast<uint32_t>(in[i]);
+            out[3 * i] = static_cast<char>(value >> 8);
+            out[3 * i + 1] = static_cast<char>(value >> 16);
+            out[3 * i + 2] = static_cast<char>(value >> 24);
+        }
+    }
+
+    void pack_float_scalar(const int32_t *in, size_t count, char *out)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            float value = static_cast<float>(in[i]) * SAMPLE_TO_FLOAT;
+            std::memcpy(out + 4 * i, &value, 4);
+        }
+    }
+
+#if OUTPUT_X86
+    void pack_s16_sse2(const int32_t *in, size_t count, char *out)
+    {
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            __m128i low = _mm_srai_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i)), 16);
+            __m128i high = _mm_srai_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i + 4)), 16);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 2 * i), _mm_packs_epi32(low, high));
+        }
+        pack_s16_scalar(in + i, count - i, out + 2 * i);
+    }
+
+    __attribute__((target("ssse3"))) void pack_s24_ssse3(const int32_t *in, size_t count, char *out)
+    {
+        // top three bytes of each of four samples into the low 12 bytes
+        const __m128i shuffle = _mm_setr_epi8(1, 2, 3, 5, 6, 7, 9, 10, 11, 13, 14, 15, -1, -1, -1, -1);
+        size_t i = 0;
+        // each store writes 16 bytes of which 12 are kept, so stop while 4 spare remain
+        for (; i + 8 <= count; i += 4)
+        {
+            __m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 3 * i), _mm_shuffle_epi8(samples, shuffle));
+        }
+        pack_s24_scalar(in + i, count - i, out + 3 * i);
+    }
+
+    void pack_float_sse2(const int32_t *in, size_t count, char *out)
+    {
+        const __m128 scale = _mm_set1_ps(SAMPLE_TO_FLOAT);
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128 samples = _mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i)));
+            _mm_storeu_ps(reinterpret_cast<float *>(out + 4 * i), _mm_mul_ps(samples, scale));
+        }
+        pack_float_scalar(in + i, count - i, out + 4 * i);
+    }
+
+    bool has_ssse3()
+    {
+        static const bool supported = __builtin_cpu_supports("ssse3");
+        return supported;
+    }
+
+    bool has_sse41()
+    {
+        static const bool supported = __builtin_cpu_supports("sse4.1");
+        return supported;
+    }
+
+    // The gain and the pack share one pass over the samples, four at a time
+    template <Sample_format format>
+    __attribute__((target("sse4.1"))) void pack_gain_sse41(const int32_t *in, size_t count, Fixed_gain gain, char *out)
+    {
+        const __m128i gains = _mm_set1_epi32(gain);
+        const __m128i limit = _mm_set1_epi32(gain_limit(gain));
+        const __m128i negative_limit = _mm_sub_epi32(_mm_setzero_si128(), limit);
+        const __m128i high_halves = _mm_set_epi32(-1, 0, -1, 0);
+        const __m128i shuffle = _mm_setr_epi8(1, 2, 3, 5, 6, 7, 9, 10, 11, 13, 14, 15, -1, -1, -1, -1);
+        const __m128 scale = _mm_set1_ps(SAMPLE_TO_FLOAT);
+        constexpr size_t sample_bytes = format == Sample_format::S16 ? 2 : format == Sample_format::S24_3LE ? 3 : 4;
+        // S24 stores 16 bytes to keep 12, so it stops while 4 spare samples remain
+        constexpr size_t slack = format == Sample_format::S24_3LE ? 8 : 4;
+
+        size_t i = 0;
+        for (; i + slack <= count; i += 4)
+        {
+            __m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+            samples = _mm_min_epi32(_mm_max_epi32(samples, negative_limit), limit);
+            // 32x32 -> 64-bit products of the even and odd lanes; bits 29 to 60 are the result
+            __m128i even = _mm_slli_epi64(_mm_mul_epi32(samples, gains), 3);
+            __m128i odd = _mm_slli_epi64(_mm_mul_epi32(_mm_srli_epi64(samples, 32), gains), 3);
+            samples = _mm_or_si128(_mm_srli_epi64(even, 32), _mm_and_si128(odd, high_halves));
+
+            char *target = out + i * sample_bytes;
+            if constexpr (format == Sample_format::S16)
+            {
+                __m128i shifted = _mm_srai_epi32(samples, 16);
+                _mm_storel_epi64(reinterpret_cast<__m128i *>(target), _mm_packs_epi32(shifted, shifted));
+            }
+            else if constexpr (format == Sample_format::S24_3LE)
+            {
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(target), _mm_shuffle_epi8(samples, shuffle));
+            }
+            else if constexpr (format == Sample_format::S32)
+            {
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(target), samples);
+            }
+            else
+            {
+                _mm_storeu_ps(reinterpret_cast<float *>(target), _mm_mul_ps(_mm_cvtepi32_ps(samples), scale));
+            }
+        }
+        pack_gain_scalar(in + i, count - i, format, gain, out + i * sample_bytes);
+    }
+#endif
+
+#if OUTPUT_NEON
+    void pack_s16_neon(const int32_t *in, size_t count, char *out)
+    {
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            int16x4_t low = vshrn_n_s32(vld1q_s32(in + i), 16);
+            int16x4_t high = vshrn_n_s32(vld1q_s32(in + i + 4), 16);
+            vst1q_s16(reinterpret_cast<int16_t *>(out + 2 * i), vcombine_s16(low, high));
+        }
+        pack_s16_scalar(in + i, count - i, out + 2 * i);
+    }
+
+    void pack_float_neon(const int32_t *in, size_t count, char *out)
+    {
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            float32x4_t samples = vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(in + i)), SAMPLE_TO_FLOAT);
+            vst1q_f32(reinterpret_cast<float *>(out + 4 * i), samples);
+        }
+        pack_float_scalar(in + i, count - i, out + 4 * i);
+    }
+
+    template <Sample_format format>
+    void pack_gain_neon(const int32_t *in, size_t count, Fixed_gain gain, char *out)
+    {
+        const int32x2_t gains = vdup_n_s32(gain);
+        const int32x4_t limit = vdupq_n_s32(gain_limit(gain));
+        const int32x4_t negative_limit = vnegq_s32(limit);
+        constexpr size_t sample_bytes = format == Sample_format::S16 ? 2 : 4;
+
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            int32x4_t samples = vminq_s32(vmaxq_s32(vld1q_s32(in + i), negative_limit), limit);
+            int64x2_t low = vmull_s32(vget_low_s32(samples), gains);
+            int64x2_t high = vmull_s32(vget_high_s32(samples), gains);
+            samples = vcombine_s32(vmovn_s64(vshrq_n_s64(low, GAIN_SHIFT)), vmovn_s64(vshrq_n_s64(high, GAIN_SHIFT)));
+
+            char *target = out + i * sample_bytes;
+            if constexpr (format == Sample_format::S16)
+            {
+                vst1_s16(reinterpret_cast<int16_t *>(target), vshrn_n_s32(samples, 16));
+            }
+            else if constexpr (format == Sample_format::S32)
+            {
+                vst1q_s32(reinterpret_cast<int32_t *>(target), samples);
+            }
+            else
+            {
+                vst1q_f32(reinterpret_cast<float *>(target), vmulq_n_f32(vcvtq_f32_s32(samples), SAMPLE_TO_FLOAT));
+            }
+        }
+        pack_gain_scalar(in + i, count - i, format, gain, out + i * sample_bytes);
+    }
+#endif
+}
+
+Fixed_gain to_fixed_gain(double linear)
+{
+    double scaled = std::nearbyint(linear * UNITY_GAIN);
+    return static_cast<Fixed_gain>(std::clamp(scaled, 0.0, static_cast<double>(INT32_MAX)));
+}
+
+size_t bytes_per_sample(Sample_format format)
+{
+    switch (format)
+    {
+    case Sample_format::S16:
+        return 2;
+    case Sample_format::S24_3LE:
+        return 3;
+    case Sample_format::S32:
+    case Sample_format::FLOAT:
+        return 4;
+    }
+    return 4;
+}
+
+const char *format_name(Sample_format format)
+{
+    switch (format)
+    {
+    case Sample_format::S16:
+        return "S16_LE";
+    case Sample_format::S24_3LE:
+        return "S24_3LE";
+    case Sample_format::S32:
+        return "S32_LE";
+    case Sample_format::FLOAT:
+        return "FLOAT_LE";
+    }
+    return "?";
+}
+
+std::vector<Sample_format> preferred_formats(uint8_t bits_per_sample)
+{
+    // S16 for 16-bit sources, S32 for anything deeper: it holds every bit as well, most
+    // cards take 24-bit audio only in 32-bit containers, and packing it is a plain copy.
+    // Packed S24 and FLOAT come next, S16 is the last resort.
+    if (bits_per_sample <= 16)
+    {
+        return {Sample_format::S16, Sample_format::S32, Sample_format::S24_3LE, Sample_format::FLOAT};
+    }
+    if (bits_per_sample <= 24)
+    {
+        return {Sample_format::S32, Sample_format::S24_3LE, Sample_format::FLOAT, Sample_format::S16};
+    }
+    return {Sample_format::S32, Sample_format::FLOAT, Sample_format::S24_3LE, Sample_format::S16};
+}
+
+void pack_samples_reference(const int32_t *in, size_t count, Sample_format format, char *out, Fixed_gain gain)
+{
+    if (gain != UNITY_GAIN)
+    {
+        return pack_gain_scalar(in, count, format, gain, out);
+    }
+    switch (format)
+    {
+    case Sample_format::S16:
+        pack_s16_scalar(in, count, out);
+        break;
+    case Sample_format::S24_3LE:
+        pack_s24_scalar(in, count, out);
+        break;
+    case Sample_format::S32:
+        std::memcpy(out, in, count * 4);
+        break;
+    case Sample_format::FLOAT:
+        pack_float_scalar(in, count, out);
+        break;
+    }
+}
+
+void pack_samples(const int32_t *in, size_t count, Sample_format format, char *out, Fixed_gain gain)
+{
+    if (gain != UNITY_GAIN)
+    {
+#if OUTPUT_X86
+        if (has_sse41())
+        {
+            switch (format)
+            {
+            case Sample_format::S16:
+                return pack_gain_sse41<Sample_format::S16>(in, count, gain, out);
+            case Sample_format::S24_3LE:
+                return pack_gain_sse41<Sample_format::S24_3LE>(in, count, gain, out);
+            case Sample_format::S32:
+                return pack_gain_sse41<Sample_format::S32>(in, count, gain, out);
+            case Sample_format::FLOAT:
+                return pack_gain_sse41<Sample_format::FLOAT>(in, count, gain, out);
+            }
+        }
+#elif OUTPUT_NEON
+        switch (format)
+        {
+        case Sample_format::S16:
+            return pack_gain_neon<Sample_format::S16>(in, count, gain, out);
+        case Sample_format::S32:
+            return pack_gain_neon<Sample_format::S32>(in, count, gain, out);
+        case Sample_format::FLOAT:
+            return pack_gain_neon<Sample_format::FLOAT>(in, count, gain, out);
+        default:
+            break;
+        }
+#endif
+        return pack_gain_scalar(in, count, format, gain, out);
+    }
+
+#if OUTPUT_X86
+    switch (format)
+    {
+    case Sample_format::S16:
+        return pack_s16_sse2(in, count, out);
+    case Sample_format::S24_3LE:
+        if (has_ssse3())
+        {
+            return pack_s24_ssse3(in, count, out);
+        }
+        break;
+    case Sample_format::FLOAT:
+        return pack_float_sse2(in, count, out);
+    default:
+        break;
+    }
+#elif OUTPUT_NEON
+    switch (format)
+    {
+    case Sample_format::S16:
+        return pack_s16_neon(in, count, out);
+    case Sample_format::FLOAT:
+        return pack_float_neon(in, count, out);
+    default:
+        break;
+    }
+#endif
+    pack_samples_reference(in, count, format, out);
+}
+
+const char *pack_kernel_name(Sample_format format, bool with_gain)
+{
+    if (with_gain)
+    {
+#if OUTPUT_X86
+        return has_sse41() ? "sse4.1" : "scalar";
+#elif OUTPUT_NEON
+        return format == Sample_format::S24_3LE ? "scalar" : "neon";
+#else
+        return "scalar";
+#endif
+    }
+    if (format == Sample_format::S32)
+    {
+        return "memcpy";
+    }
+#if OUTPUT_X86
+    if (format == Sample_format::S24_3LE)
+    {
+        return has_ssse3() ? "ssse3" : "scalar";
+    }
+    return "sse2";
+#elif OUTPUT_NEON
+    return format == Sample_format::S24_3LE ? "scalar" : "neon";
+#else
+    return "scalar";
+#endif
+}
+
+bool Channel_mixer::can_mix(uint8_t in_channels, uint8_t out_channels)
+{
+    return in_channels == out_channels || (out_channels == 2 && in_channels >= 1 && in_channels <= 8);
+}
+
+Channel_mixer::Channel_mixer(uint8_t in_channels, uint8_t out_channels)
+    : m_in_channels(in_channels), m_out_channels(out_channels), m_matrix(in_channels * out_channels, 0.0f)
+{
+    if (!can_mix(in_channels, out_channels))
+    {
+        throw std::invalid_argument("Cannot mix " + std::to_string(in_channels) + " channels into " + std::to_string(out_channels));
+    }
+    if (passthrough())
+    {
+        for (uint8_t channel = 0; channel < in_channels; channel++)
+        {
+            m_matrix[channel * in_channels + channel] = 1.0f;
+        }
+        return;
+    }
+
+    // FLAC channel order for each count; -1 is the LFE, which is left out
+    constexpr float minus_3db = 0.70710678f;
+    enum Role : int8_t { LFE = -1, LEFT, RIGHT, CENTER, LEFT_SURROUND, RIGHT_SURROUND, MONO };
+    static constexpr Role layouts[9][8] = {
+        {},
+        {MONO},
+        {LEFT, RIGHT},
+        {LEFT, RIGHT, CENTER},
+        {LEFT, RIGHT, LEFT_SURROUND, RIGHT_SURROUND},
+        {LEFT, RIGHT, CENTER, LEFT_SURROUND, RIGHT_SURROUND},
+        {LEFT, RIGHT, CENTER, LFE, LEFT_SURROUND, RIGHT_SURROUND},
+        {LEFT, RIGHT, CENTER, LFE, CENTER, LEFT_SURROUND, RIGHT_SURROUND}, // back centre
+        {LEFT, RIGHT, CENTER, LFE, LEFT_SURROUND, RIGHT_SURROUND, LEFT_SURROUND, RIGHT_SURROUND}};
+
+    float *left = &m_matrix[0];
+    float *right = &m_matrix[in_channels];
+    for (uint8_t channel = 0; channel < in_channels; channel++)
+    {
+        switch (layouts[in_channels][channel])
+        {
+        case MONO:
+            left[channel] = right[channel] = 1.0f;
+            break;
+        case LEFT:
+            left[channel] = 1.0f;
+            break;
+        case RIGHT:
+            right[channel] = 1.0f;
+            break;
+        case CENTER:
+            left[channel] = right[channel] = minus_3db;
+            break;
+        case LEFT_SURROUND:
+            left[channel] = minus_3db;
+            break;
+        case RIGHT_SURROUND:
+            right[channel] = minus_3db;
+            break;
+        case LFE:
+            break;
+        }
+    }
+
+    // scale both rows by the larger sum so full-scale input stays in range
+    float left_sum = 0;
+    float right_sum = 0;
+    for (uint8_t channel = 0; channel < in_channels; channel++)
+    {
+        left_sum += left[channel];
+        right_sum += right[channel];
+    }
+    float scale = 1.0f / std::max({left_sum, right_sum, 1.0f});
+    for (auto &coefficient : m_matrix)
+    {
+        coefficient *= scale;
+    }
+}
+
+void Channel_mixer::process(const int32_t *in, size_t frames, std::vector<int32_t> &out) const
+{
+    out.resize(frames * m_out_channels);
+    if (passthrough())
+    {
+        std::copy(in, in + frames * m_in_channels, out.begin());
+        return;
+    }
+
+    // the rows are fixed per stream, so the compiler can keep them in registers
+    // and vectorize across the channels of a frame
+    for (size_t frame = 0; frame < frames; frame++)
+    {
+        const int32_t *samples = in + frame * m_in_channels;
+        for (uint8_t out_channel = 0; out_channel < m_out_channels; out_channel++)
+        {
+            const float *row = &m_matrix[out_channel * m_in_channels];
+            float sum = 0;
+            for (uint8_t channel = 0; channel < m_in_channels; channel++)
+            {
+                sum += row[channel] * static_cast<float>(samples[channel]);
+            }
+            // the scaled matrix can't exceed full scale, only rounding can nudge past it
+            sum = std::clamp(sum, -2147483648.0f, 2147483520.0f);
+            out[frame * m_out_channels + out_channel] = static_cast<int32_t>(std::lrint(sum));
+        }
+    }
+}
+
+void Gain_stage::pack(const int32_t *in, size_t frames, uint8_t channels, Sample_format format, char *out)
+{
+    if (m_current == m_target)
+    {
+        pack_samples(in, frames * channels, format, out, m_current);
+        return;
+    }
+
+    // constant gain within each step keeps the kernels vectorized
+    size_t step_frames = std::max<size_t>(1, (frames + RAMP_STEPS - 1) / RAMP_STEPS);
+    size_t sample_bytes = bytes_per_sample(format);
+    int64_t start = m_current;
+    int64_t change = int64_t{m_target} - m_current;
+    for (size_t frame = 0; frame < frames; frame += step_frames)
+    {
+        size_t count = std::min(step_frames, frames - frame);
+        auto gain = static_cast<Fixed_gain>(start + change * static_cast<int64_t>(frame + count) / static_cast<int64_t>(frames));
+        pack_samples(in + frame * channels, count * channels, format, out + frame * channels * sample_bytes, gain);
+    }
+    m_current = m_target;
+}
@@ -0,0 +1,990 @@
+#include "Playback_engine.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <poll.h>
+#include <sstream>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "Flac.hpp"
+#include "Realtime.hpp"
+
+namespace
+{
+    uint8_t format_bits(Sample_format format)
+    {
+        // the float mantissa holds 24 bits exactly
+        return format == Sample_format::FLOAT ? 24 : static_cast<uint8_t>(bytes_per_sample(format) * 8);
+    }
+}
+
+Playback_controls::Playback_controls()
+{
+    m_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_event_fd < 0)
+    {
+        throw std::runtime_error("Cannot create eventfd");
+    }
+}
+
+Playback_controls::~Playback_controls()
+{
+    close(m_event_fd);
+}
+
+void Playback_controls::notify()
+{
+    uint64_t one = 1;
+    [[maybe_unused]] ssize_t written = ::write(m_event_fd, &one, sizeof(one));
+}
+
+void Playback_controls::clear_events()
+{
+    uint64_t count;
+    [[maybe_unused]] ssize_t read_bytes = read(m_event_fd, &count, sizeof(count));
+}
+
+struct Playback_engine::Open_track
+{
+    Playback_engine &engine; // for its status lines
+    Playback_item item;
+    std::string file_name;    // for the log, made here so playback doesn't have to
+    std::string announcement; // the track's details, printed when it starts playing
+    std::ifstream stream;
+    Flac flac;
+    std::vector<Virtual_track> cue_tracks;
+    std::vector<int32_t> samples; // the next decoded frame, ready to be written
+    uint64_t skip_samples{};      // left to drop after a seek
+    Replay_gain replay_gain;
+    Open_track *next_retired = nullptr; // while Helper holds it back for want of a message slot
+
+    // Opens and parses the file and decodes its first frame
+    Open_track(Playback_engine &playback_engine, Playback_item playback_item)
+        : engine(playback_engine), item(std::move(playback_item)), file_name(item.path.filename().string()),
+          stream(item.path, std::ios::binary), flac(stream)
+    {
+        if (!stream)
+        {
+            throw std::runtime_error("Cannot open " + item.path.string());
+        }
+        flac.initialize();
+        flac.reserve_buffers();
+        prefault(samples, max_block_frames() * flac.get_stream_info().channels);
+        replay_gain = Replay_gain::from_comments(flac.get_vorbis_comment());
+        cue_tracks = flac.read_virtual_tracks();
+        announcement = describe();
+        if (item.start_track > 0 && static_cast<size_t>(item.start_track) <= cue_tracks.size())
+        {
+            jump_to(item.start_track - 1);
+        }
+        decode();
+    }
+
+    Pcm_format format() const
+    {
+        const Stream_info &info = flac.get_stream_info();
+        return {info.sample_rate, info.channels, info.bits_per_sample};
+    }
+
+    size_t max_block_frames() const
+    {
+        uint16_t block_size = flac.get_stream_info().max_block_size;
+        return block_size == 0 ? 65535 : block_size;
+    }
+
+    double remaining_seconds() const
+    {
+        const Stream_info &info = flac.get_stream_info();
+        if (info.total_samples == 0 || info.sample_rate == 0)
+        {
+            return 0; // unknown length, open the next track as soon as possible
+        }
+        uint64_t position = std::min(flac.get_sample_count(), info.total_samples);
+        return static_cast<double>(info.total_samples - position) / info.sample_rate;
+    }
+
+    // Fills samples with the next frame; false at the end of the stream. Damaged
+    // frames are skipped, playback goes on with the next intact one.
+    bool decode()
+    {
+        samples.clear();
+        while (samples.empty())
+        {
+            if (flac.get_reader().eos())
+            {
+                return false;
+            }
+            try
+            {
+                flac.decode_frame();
+            }
+            catch (const std::runtime_error &e)
+            {
+                uint64_t position = flac.get_sample_count();
+                uint64_t skipped_bytes = flac.resync();
+                engine.post(std::cerr, "%s: %s, skipped %llu bytes and %llu samples", file_name.c_str(), e.what(),
+                            static_cast<unsigned long long>(skipped_bytes),
+                            static_cast<unsigned long long>(flac.get_sample_count() - std::min(position, flac.get_sample_count())));
+                continue;
+            }
+            const auto &buffer = flac.get_audio_buffer();
+            size_t channels = flac.get_stream_info().channels;
+            size_t skipped = std::min<size_t>(skip_samples * channels, buffer.size());
+            skip_samples -= skipped / channels;
+            samples.assign(buffer.begin() + skipped, buffer.end());
+        }
+        return true;
+    }
+
+    void jump_to(size_t index)
+    {
+        const Virtual_track &track = cue_tracks[index];
+        skip_samples = track.start_sample - flac.seek(track.start_sample);
+        engine.post(std::cout, "Track %d", int(track.number));
+    }
+
+    void step_track(int step)
+    {
+        // the track we are in is the last one that started at or before the position
+        uint64_t position = flac.get_sample_count();
+        auto current = std::upper_bound(cue_tracks.begin(), cue_tracks.end(), position, [](uint64_t sample, const Virtual_track &track)
+                                        { return sample < track.start_sample; });
+        long index = std::distance(cue_tracks.begin(), current) - 1 + step;
+        jump_to(std::clamp<long>(index, 0, cue_tracks.size() - 1));
+        decode();
+    }
+
+    std::string describe() const
+    {
+        std::ostringstream text;
+        text << "Now Playing: " << item.name << "\n";
+        const Vorbis_comment &comments = flac.get_vorbis_comment();
+        if (auto artist = comments.find("ARTIST"))
+        {
+            text << "Artist: " << *artist << "\n";
+        }
+        if (auto title = comments.find("TITLE"))
+        {
+            text << "Track Title: " << *title << "\n";
+        }
+        for (const auto &picture : flac.get_pictures())
+        {
+            // the image itself stays in the file
+            text << "Picture: " << picture.mime_type << " " << picture.width << "x" << picture.height
+                 << ", " << picture.data_length / 1024 << " KiB\n";
+        }
+        if (!cue_tracks.empty())
+        {
+            text << "Cue sheet: " << cue_tracks.size() << " tracks\n";
+        }
+        return text.str();
+    }
+};
+
+// The two helper threads of play(). The opener waits for the playback loop to ask
+// for the next track, opens it and publishes it in a one-track slot; the printer
+// prints the status lines the loop queues and closes the tracks it has finished
+// with, calling on_finished for them. The loop side only touches atomics, the
+// preallocated queue and eventfds, so it never waits on a file, a download, the
+// terminal or the allocator.
+class Playback_engine::Helper
+{
+public:
+    using Open_next = std::function<std::unique_ptr<Open_track>(const std::atomic<bool> *cancel)>;
+
+    static constexpr size_t MESSAGE_SLOTS = 64;
+    static constexpr size_t TEXT_SIZE = 256;
+    // kept free for finished tracks, which can't be dropped like status lines
+    static constexpr size_t RESERVED_SLOTS = 8;
+
+private:
+    struct Message
+    {
+        std::ostream *out = nullptr; // prints text, or track's announcement when text is empty
+        Open_track *track = nullptr; // without out: finished with, to be closed
+        char text[TEXT_SIZE];
+    };
+
+    // states of the handoff slot
+    enum Handoff : int
+    {
+        IDLE,
+        REQUESTED, // the opener is at work
+        READY      // m_opened holds the result, nullptr when there was no next track
+    };
+
+    Open_next m_open_next;
+    const Item_finished &m_on_finished;
+    Playback_controls &m_controls;
+
+    std::atomic<int> m_handoff{IDLE};
+    std::unique_ptr<Open_track> m_opened; // written by the opener before READY, taken by the loop after it
+    std::atomic<bool> m_cancel{false};
+
+    // single producer, the loop, and single consumer, the printer
+    std::array<Message, MESSAGE_SLOTS> m_messages{};
+    std::atomic<size_t> m_head{0};
+    std::atomic<size_t> m_tail{0};
+    std::atomic<size_t> m_dropped{0};
+    // finished tracks that found the queue full, oldest first; loop side only
+    Open_track *m_retired_head = nullptr;
+    Open_track *m_retired_tail = nullptr;
+
+    std::atomic<bool> m_stop{false};
+    int m_open_fd = -1;
+    int m_print_fd = -1;
+    std::thread m_opener;
+    std::thread m_printer;
+
+    static void wake(int fd)
+    {
+        uint64_t one = 1;
+        [[maybe_unused]] ssize_t written = ::write(fd, &one, sizeof(one));
+    }
+
+    static void sleep_on(int fd)
+    {
+        uint64_t count;
+        [[maybe_unused]] ssize_t read_bytes = read(fd, &count, sizeof(count));
+    }
+
+    void open_loop()
+    {
+        while (true)
+        {
+            sleep_on(m_open_fd);
+            if (m_stop)
+            {
+                return;
+            }
+            if (m_handoff.load(std::memory_order_acquire) == REQUESTED)
+            {
+                m_opened = m_open_next(&m_cancel);
+                m_handoff.store(READY, std::memory_order_release);
+                // the loop may be waiting for it
+                m_controls.notify();
+            }
+        }
+    }
+
+    void print_messages()
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t head = m_head.load(std::memory_order_acquire);
+        for (; tail != head; tail++)
+        {
+            Message &message = m_messages[tail % MESSAGE_SLOTS];
+            if (message.out && message.text[0] != '\0')
+            {
+                *message.out << message.text << std::endl;
+            }
+            else if (message.out)
+            {
+                *message.out << message.track->announcement << std::flush;
+            }
+            else
+            {
+                m_on_finished(message.track->item);
+                delete message.track;
+            }
+            m_tail.store(tail + 1, std::memory_order_release);
+        }
+        if (size_t dropped = m_dropped.exchange(0); dropped > 0)
+        {
+            std::cerr << dropped << " status lines dropped" << std::endl;
+        }
+    }
+
+    void print_loop()
+    {
+        while (!m_stop)
+        {
+            sleep_on(m_print_fd);
+            print_messages();
+        }
+        print_messages();
+    }
+
+    // nullptr when the queue is full, or only has the reserved slots left and reserved isn't set
+    Message *next_slot(bool reserved)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        size_t used = head - m_tail.load(std::memory_order_acquire);
+        if (used >= MESSAGE_SLOTS - (reserved ? 0 : RESERVED_SLOTS))
+        {
+            return nullptr;
+        }
+        return &m_messages[head % MESSAGE_SLOTS];
+    }
+
+    void close_fds()
+    {
+        for (int fd : {m_open_fd, m_print_fd})
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+        }
+    }
+
+    void publish()
+    {
+        m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        wake(m_print_fd);
+    }
+
+public:
+    Helper(Open_next open_next, const Item_finished &on_finished, Playback_controls &controls)
+        : m_open_next(std::move(open_next)), m_on_finished(on_finished), m_controls(controls)
+    {
+        m_open_fd = eventfd(0, EFD_CLOEXEC);
+        m_print_fd = eventfd(0, EFD_CLOEXEC);
+        if (m_open_fd < 0 || m_print_fd < 0)
+        {
+            close_fds();
+            throw std::runtime_error("Cannot create eventfd");
+        }
+        m_opener = std::thread(&Helper::open_loop, this);
+        m_printer = std::thread(&Helper::print_loop, this);
+    }
+
+    // Prints what is still queued and closes the tracks left over. A next_item still
+    // waiting for a download is cancelled, nothing is going to play it.
+    ~Helper()
+    {
+        m_cancel = true;
+        m_stop = true;
+        wake(m_open_fd);
+        wake(m_print_fd);
+        m_opener.join();
+        m_printer.join();
+        while (m_retired_head)
+        {
+            Open_track *track = m_retired_head;
+            m_retired_head = track->next_retired;
+            m_on_finished(track->item);
+            delete track;
+        }
+        if (m_opened)
+        {
+            m_on_finished(m_opened->item);
+        }
+        close_fds();
+    }
+
+    Helper(const Helper &) = delete;
+    Helper &operator=(const Helper &) = delete;
+
+    // From the playback loop from here on
+
+    // Asks the opener for the next track, unless it was asked already
+    void request_open()
+    {
+        int expected = IDLE;
+        if (m_handoff.compare_exchange_strong(expected, REQUESTED, std::memory_order_acq_rel))
+        {
+            wake(m_open_fd);
+        }
+    }
+    bool requested() const { return m_handoff.load(std::memory_order_relaxed) != IDLE; }
+    bool ready() const { return m_handoff.load(std::memory_order_acquire) == READY; }
+    // The opened track, once ready(); nullptr when there is none
+    std::unique_ptr<Open_track> take()
+    {
+        std::unique_ptr<Open_track> track = std::move(m_opened);
+        m_handoff.store(IDLE, std::memory_order_release);
+        return track;
+    }
+    void post(std::ostream &out, const char *format, va_list args)
+    {
+        Message *message = next_slot(false);
+        if (!message)
+        {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        message->out = &out;
+        message->track = nullptr;
+        vsnprintf(message->text, TEXT_SIZE, format, args);
+        publish();
+    }
+
+    void announce(Open_track &track)
+    {
+        Message *message = next_slot(false);
+        if (!message)
+        {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        message->out = &std::cout;
+        message->track = &track;
+        message->text[0] = '\0';
+        publish();
+    }
+
+    // Hands a track the loop is done with to the printer, which closes it after the
+    // lines queued before. The reserved slots leave room for the one or two tracks
+    // there are at a time; should the printer be stuck in on_finished even so, the
+    // track waits here for flush_retired() rather than the loop for the printer.
+    void retire(std::unique_ptr<Open_track> track)
+    {
+        Open_track *finished = track.release();
+        if (m_retired_tail)
+        {
+            m_retired_tail->next_retired = finished;
+        }
+        else
+        {
+            m_retired_head = finished;
+        }
+        m_retired_tail = finished;
+        flush_retired();
+    }
+
+    // Passes on the tracks retire() held back, as far as there are slots; once a period
+    void flush_retired()
+    {
+        while (m_retired_head)
+        {
+            Message *message = next_slot(true);
+            if (!message)
+            {
+                return;
+            }
+            Open_track *track = m_retired_head;
+            m_retired_head = track->next_retired;
+            if (!m_retired_head)
+            {
+                m_retired_tail = nullptr;
+            }
+            track->next_retired = nullptr;
+            message->out = nullptr;
+            message->track = track;
+            publish();
+        }
+    }
+};
+
+Playback_engine::~Playback_engine()
+{
+    close_device();
+}
+
+void Playback_engine::update_gain()
+{
+    double volume = m_volume_db <= MIN_VOLUME_DB ? 0 : std::pow(10.0, m_volume_db / 20);
+    m_gain.set_target(to_fixed_gain(m_track_gain * volume));
+}
+
+void Playback_engine::set_replay_gain(Replay_gain_mode mode, double preamp_db)
+{
+    m_replay_gain_mode = mode;
+    m_preamp_db = preamp_db;
+}
+
+void Playback_engine::set_realtime(bool enabled, int priority)
+{
+    m_realtime = enabled;
+    m_realtime_priority = priority;
+}
+
+void Playback_engine::set_volume_db(double volume_db)
+{
+    m_volume_db = std::clamp(volume_db, MIN_VOLUME_DB, 0.0);
+    update_gain();
+}
+
+void Playback_engine::close_device()
+{
+    if (m_sink->is_open())
+    {
+        m_sink->close();
+    }
+    m_format = {};
+    m_device_rate = 0;
+    m_device_channels = 0;
+    m_device_paused = false;
+    m_mixer.reset();
+    m_resampler.reset();
+}
+
+bool Playback_engine::configure(const Pcm_format &format)
+{
+    if (m_sink->is_open() && format.sample_rate == m_format.sample_rate && format.channels == m_format.channels &&
+        format.bits_per_sample <= format_bits(m_sample_format))
+    {
+        return false;
+    }
+    if (m_sink->is_open())
+    {
+        // let the previous track play out before the sink changes under it
+        drain();
+        close_device();
+    }
+
+    Sink_format sink_format = m_sink->open(format);
+    unsigned int actual_rate = sink_format.sample_rate;
+    unsigned int channels = sink_format.channels;
+    Sample_format sample_format = sink_format.sample_format;
+    m_period_frames = sink_format.period_frames;
+    m_period_ms = std::max(1u, static_cast<unsigned int>(m_period_frames * 1000 / actual_rate));
+
+    std::vector<pollfd> descriptors = m_sink->poll_descriptors();
+    m_poll_fds.assign(2, pollfd{-1, 0, 0});
+    m_poll_fds.insert(m_poll_fds.end(), descriptors.begin(), descriptors.end());
+
+    m_format = format;
+    m_device_rate = actual_rate;
+    m_device_channels = static_cast<uint8_t>(channels);
+    m_sample_format = sample_format;
+    m_negotiations++;
+    // a fresh stream has nothing to ramp from
+    m_gain.settle();
+
+    if (sample_format != Sample_format::S32)
+    {
+        post(std::cout, "Output format %s", format_name(sample_format));
+    }
+    if (channels != format.channels)
+    {
+        // mixing comes first so the resampler has fewer channels to work on
+        m_mixer = std::make_unique<Channel_mixer>(format.channels, m_device_channels);
+        post(std::cout, "Mixing %d channels down to %u", int(format.channels), channels);
+    }
+    if (actual_rate != format.sample_rate)
+    {
+        try
+        {
+            m_resampler = std::make_unique<Resampler>(format.sample_rate, actual_rate, m_device_channels, m_quality);
+            post(std::cout, "Resampling %u Hz to %u Hz", static_cast<unsigned int>(format.sample_rate), actual_rate);
+        }
+        catch (const std::invalid_argument &e)
+        {
+            post(std::cerr, "%s, playing at the device rate", e.what());
+        }
+    }
+    return true;
+}
+
+Playback_engine::Write_status Playback_engine::write(const std::vector<int32_t> &samples)
+{
+    Clock::time_point start = Clock::now();
+    const int32_t *data = samples.data();
+    size_t frames = samples.size() / m_format.channels;
+    if (m_mixer)
+    {
+        m_mixer->process(data, frames, m_mixed);
+        data = m_mixed.data();
+    }
+    if (m_resampler)
+    {
+        m_resampled.clear();
+        m_resampler->process(data, frames, m_resampled);
+        data = m_resampled.data();
+        frames = m_resampled.size() / m_device_channels;
+    }
+    m_stats.record_stage(Playback_stage::CONVERT, Clock::now() - start);
+    return write_frames(data, frames);
+}
+
+Playback_engine::Write_status Playback_engine::write_frames(const int32_t *samples, size_t frames)
+{
+    // S32 at unity gain goes out as it is, anything else is packed and scaled in one pass
+    const char *data = reinterpret_cast<const char *>(samples);
+    if (m_sample_format != Sample_format::S32 || !m_gain.is_unity())
+    {
+        Clock::time_point start = Clock::now();
+        m_packed.resize(frames * m_device_channels * bytes_per_sample(m_sample_format));
+        m_gain.pack(samples, frames, m_device_channels, m_sample_format, m_packed.data());
+        data = m_packed.data();
+        m_stats.record_stage(Playback_stage::CONVERT, Clock::now() - start);
+    }
+    size_t frame_bytes = m_device_channels * bytes_per_sample(m_sample_format);
+
+    while (frames > 0)
+    {
+        if (m_controls && m_controls->paused && !interrupted())
+        {
+            pause();
+        }
+        if (interrupted())
+        {
+            return Write_status::INTERRUPTED;
+        }
+
+        Clock::time_point start = Clock::now();
+        Sink_write written = m_sink->write(data, frames);
+        m_stats.record_stage(Playback_stage::OUTPUT, Clock::now() - start);
+        if (written.xrun)
+        {
+            m_stats.record_xrun();
+        }
+        if (written.failed)
+        {
+            return Write_status::FAILED;
+        }
+        if (written.frames == 0)
+        {
+            // the sink is full: sleep until a period has played or a control comes in,
+            // a period at most for sinks that can't be polled
+            if (wait(true, m_poll_fds.size() > 2 ? -1 : static_cast<int>(m_period_ms)))
+            {
+                record_wakeup();
+            }
+            continue;
+        }
+        data += written.frames * frame_bytes;
+        frames -= written.frames;
+    }
+    return Write_status::DONE;
+}
+
+bool Playback_engine::wait(bool device, int timeout_ms)
+{
+    nfds_t count = device ? m_poll_fds.size() : 2;
+    m_poll_fds[0] = {m_controls ? m_controls->event_fd() : -1, POLLIN, 0};
+    m_poll_fds[1] = {m_controls && m_controls->on_input ? m_controls->input_fd : -1, POLLIN, 0};
+    Clock::time_point start = Clock::now();
+    int ready = poll(m_poll_fds.data(), count, timeout_ms);
+    m_waited += Clock::now() - start;
+    if (ready <= 0)
+    {
+        return false;
+    }
+
+    if (m_poll_fds[0].revents)
+    {
+        m_controls->clear_events();
+    }
+    if (m_poll_fds[1].revents)
+    {
+        m_controls->on_input();
+    }
+    if (m_controls)
+    {
+        if (int step = m_controls->volume_step.exchange(0); step != 0)
+        {
+            set_volume_db(m_volume_db + step * VOLUME_STEP_DB);
+            post(std::cout, "Volume %g dB", m_volume_db);
+        }
+    }
+
+    if (!device || count == 2)
+    {
+        return false;
+    }
+    return m_sink->writable(m_poll_fds.data() + 2, count - 2);
+}
+
+void Playback_engine::record_wakeup()
+{
+    // poll() fires once a period is free; whatever is free beyond that played out
+    // while the thread wasn't scheduled yet
+    long available = m_sink->available();
+    if (available >= 0 && m_device_rate > 0)
+    {
+        size_t late_frames = static_cast<size_t>(available) > m_period_frames ? available - m_period_frames : 0;
+        m_stats.record_wakeup(late_frames * 1000000 / m_device_rate);
+    }
+}
+
+bool Playback_engine::interrupted()
+{
+    if (!m_controls)
+    {
+        return false;
+    }
+    if (!m_can_step)
+    {
+        // nothing to step through, don't cut the write short for it
+        m_controls->track_step = 0;
+    }
+    return m_controls->stop || m_controls->track_step != 0;
+}
+
+void Playback_engine::pause()
+{
+    m_device_paused = true;
+    m_sink->pause(true);
+    post(std::cout, "Paused");
+    // nothing to do but wait for the controls
+    while (m_controls->paused && !interrupted())
+    {
+        wait(false);
+    }
+    if (m_controls->stop)
+    {
+        return; // flush() drops the paused stream
+    }
+    m_sink->pause(false);
+    m_device_paused = false;
+    post(std::cout, "Resumed");
+}
+
+void Playback_engine::flush()
+{
+    m_sink->drop();
+    m_device_paused = false;
+    m_gain.settle();
+    if (m_resampler)
+    {
+        m_resampler->reset();
+    }
+}
+
+bool Playback_engine::drain()
+{
+    if (m_resampler)
+    {
+        m_resampled.clear();
+        m_resampler->drain(m_resampled);
+        if (write_frames(m_resampled.data(), m_resampled.size() / m_device_channels) == Write_status::INTERRUPTED &&
+            m_controls && m_controls->stop)
+        {
+            flush();
+            return false;
+        }
+    }
+
+    // poll until the sink has played out; not every sink signals the end of a drain,
+    // so look again every period
+    while (!m_sink->drain())
+    {
+        if (m_controls && m_controls->stop)
+        {
+            flush();
+            return false;
+        }
+        wait(true, m_period_ms);
+    }
+    return true;
+}
+
+void Playback_engine::reserve_buffers(size_t max_frames)
+{
+    size_t output_frames = max_frames;
+    if (m_mixer)
+    {
+        prefault(m_mixed, max_frames * m_device_channels);
+    }
+    if (m_resampler)
+    {
+        m_resampler->reserve(max_frames);
+        output_frames = m_resampler->max_output_frames(max_frames);
+        prefault(m_resampled, output_frames * m_device_channels);
+    }
+    prefault(m_packed, output_frames * m_device_channels * bytes_per_sample(m_sample_format));
+}
+
+void Playback_engine::start_gain(const Open_track &track)
+{
+    m_track_gain = track.replay_gain.factor(m_replay_gain_mode, m_preamp_db);
+    if (m_track_gain != 1)
+    {
+        post(std::cout, "ReplayGain %.2f dB", 20 * std::log10(m_track_gain));
+    }
+    update_gain();
+}
+
+void Playback_engine::post(std::ostream &out, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    if (m_helper && std::this_thread::get_id() == m_playback_thread)
+    {
+        m_helper->post(out, format, args);
+    }
+    else
+    {
+        char text[Helper::TEXT_SIZE];
+        vsnprintf(text, sizeof(text), format, args);
+        out << text << std::endl;
+    }
+    va_end(args);
+}
+
+bool Playback_engine::play(Playback_item first, const Next_item &next_item, const Item_finished &on_finished, Playback_controls &controls)
+{
+    auto open_track = [this](Playback_item item)
+    {
+        m_stats.record_stage(Playback_stage::FETCH, item.fetch_time);
+        Clock::time_point start = Clock::now();
+        auto track = std::make_unique<Open_track>(*this, std::move(item));
+        m_stats.record_stage(Playback_stage::OPEN, Clock::now() - start);
+        return track;
+    };
+    // runs on the opener thread
+    auto open_next = [&next_item, &open_track](const std::atomic<bool> *cancel) -> std::unique_ptr<Open_track>
+    {
+        // an item that can't be opened is reported and skipped
+        while (std::optional<Playback_item> item = next_item(cancel))
+        {
+            std::string name = item->name;
+            try
+            {
+                return open_track(std::move(*item));
+            }
+            catch (const std::exception &e)
+            {
+                std::cerr << name << ": " << e.what() << std::endl;
+            }
+        }
+        return nullptr;
+    };
+
+    std::unique_ptr<Open_track> current = open_track(std::move(first));
+
+    // the controls and the helper are only valid for this call; the helper's threads
+    // start before the real-time policy is taken, so they keep the normal one
+    Helper helper(open_next, on_finished, controls);
+    struct Play_scope
+    {
+        Playback_engine &engine;
+        ~Play_scope()
+        {
+            engine.m_controls = nullptr;
+            engine.m_helper = nullptr;
+        }
+    } play_scope{*this};
+    m_controls = &controls;
+    m_helper = &helper;
+    m_playback_thread = std::this_thread::get_id();
+
+    std::optional<Realtime_scope> realtime;
+    if (m_realtime)
+    {
+        realtime.emplace(m_realtime_priority);
+        const char *memory = realtime->memory_locked() ? ", memory locked" : ", memory not locked";
+        if (realtime->scheduled())
+        {
+            post(std::cout, "Real-time playback: %s priority %d%s", realtime->policy_name(), realtime->priority(), memory);
+        }
+        else
+        {
+            post(std::cout, "Real-time playback: %s%s", realtime->policy_name(), memory);
+        }
+    }
+
+    m_can_step = !current->cue_tracks.empty();
+    configure(current->format());
+    reserve_buffers(current->max_block_frames());
+    helper.announce(*current);
+    start_gain(*current);
+    // nothing is playing yet, so start at the track's gain rather than ramp to it
+    m_gain.settle();
+
+    bool stopped = false;
+    bool failed = false;
+    while (current)
+    {
+        helper.flush_retired();
+        if (controls.stop)
+        {
+            flush();
+            stopped = true;
+            break;
+        }
+        if (controls.paused)
+        {
+            pause();
+            continue;
+        }
+        if (int step = controls.track_step.exchange(0); step != 0 && m_can_step)
+        {
+            current->step_track(step);
+            flush();
+        }
+
+        if (!helper.requested() && current->remaining_seconds() < std::chrono::duration<double>(PRIME_AHEAD).count())
+        {
+            helper.request_open();
+        }
+
+        // a block's work is everything but the waiting; its play time is the budget
+        Clock::time_point block_start = Clock::now();
+        Clock::duration waited = m_waited;
+        auto play_time = std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(double(current->samples.size()) / m_format.channels / m_format.sample_rate));
+
+        Write_status status = current->samples.empty() ? Write_status::DONE : write(current->samples);
+        if (status == Write_status::FAILED)
+        {
+            failed = true;
+            break;
+        }
+        if (status == Write_status::INTERRUPTED)
+        {
+            continue; // the top of the loop stops or steps
+        }
+        Clock::time_point decode_start = Clock::now();
+        bool more = current->decode();
+        Clock::time_point block_end = Clock::now();
+        m_stats.record_stage(Playback_stage::DECODE, block_end - decode_start);
+        m_stats.record_stage(Playback_stage::WAIT, m_waited - waited);
+        m_stats.record_block(block_end - block_start - (m_waited - waited), play_time);
+        if (more)
+        {
+            continue;
+        }
+
+        // the track is done: its last samples are queued, the next one follows on directly
+        helper.retire(std::move(current));
+        helper.request_open();
+        // the next one may still be downloading; the sink plays out what it holds
+        // meanwhile, and the controls are served as during a track
+        while (!helper.ready() && !controls.stop)
+        {
+            helper.flush_retired();
+            if (controls.paused)
+            {
+                pause();
+                continue;
+            }
+            wait(false, m_period_ms);
+        }
+        if (controls.stop)
+        {
+            flush();
+            stopped = true;
+            break;
+        }
+        current = helper.take();
+        if (current)
+        {
+            m_can_step = !current->cue_tracks.empty();
+            configure(current->format());
+            reserve_buffers(current->max_block_frames());
+            helper.announce(*current);
+            start_gain(*current);
+        }
+    }
+
+    if (current)
+    {
+        helper.retire(std::move(current));
+    }
+    if (!stopped && !failed)
+    {
+        // play out the tail, then leave the sink open and ready for the next session
+        stopped = !drain();
+    }
+    else if (failed)
+    {
+        close_device();
+    }
+    if (realtime)
+    {
+        post(std::cout, "Xruns %zu, worst wakeup %g ms late, headroom %d%%", static_cast<size_t>(m_stats.xruns()),
+             m_stats.worst_wakeup_us() / 1000.0, int(100 * m_stats.min_headroom()));
+    }
+    return !stopped;
+}
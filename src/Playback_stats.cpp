@@ -0,0 +1,69 @@
+#include "Playback_stats.hpp"
+
+#include <iomanip>
+#include <sstream>
+
+namespace
+{
+    const char *stage_names[] = {"fetch", "open", "decode", "convert", "output", "wait"};
+}
+
+void Playback_stats::record_xrun()
+{
+    m_xruns.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Playback_stats::record_wakeup(uint64_t late_us)
+{
+    m_wakeup_late_us.record(late_us);
+}
+
+void Playback_stats::record_block(Clock::duration busy, Clock::duration play_time)
+{
+    if (play_time.count() > 0)
+    {
+        m_load_permille.record(static_cast<uint64_t>(busy.count() * 1000 / play_time.count()));
+    }
+    m_played_us.fetch_add(std::chrono::duration_cast<std::chrono::microseconds>(play_time).count(), std::memory_order_relaxed);
+}
+
+void Playback_stats::record_stage(Playback_stage stage, Clock::duration time)
+{
+    m_stage_us[static_cast<size_t>(stage)].record(std::chrono::duration_cast<std::chrono::microseconds>(time).count());
+}
+
+double Playback_stats::min_headroom() const
+{
+    if (m_load_permille.count() == 0)
+    {
+        return 1;
+    }
+    return 1 - static_cast<double>(m_load_permille.max()) / 1000;
+}
+
+std::string Playback_stats::to_json() const
+{
+    std::ostringstream json;
+    json << "{\"xruns\":" << xruns()
+         << ",\"min_headroom\":" << min_headroom()
+         << ",\"wakeup_late_us\":" << m_wakeup_late_us.to_json()
+         << ",\"load_permille\":" << m_load_permille.to_json()
+         << ",\"played_s\":" << played_seconds() << ",\"stage_us\":{";
+    for (size_t stage = 0; stage < STAGES; stage++)
+    {
+        json << (stage ? "," : "") << "\"" << stage_names[stage] << "\":" << m_stage_us[stage].to_json();
+    }
+    json << "}}";
+    return json.str();
+}
+
+std::string Playback_stats::summary() const
+{
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(1) << played_seconds() << " s of audio:";
+    for (size_t stage = 0; stage < STAGES; stage++)
+    {
+        line << (stage ? ", " : " ") << stage_names[stage] << " " << m_stage_us[stage].sum() / 1000.0 << " ms";
+    }
+    return line.str();
+}
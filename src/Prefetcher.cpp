@@ -0,0 +1,224 @@
+#include "Prefetcher.hpp"
+
+#include <algorithm>
+#include <sys/resource.h>
+
+Prefetcher::Prefetcher(const std::string &server_ip, int server_port, const fs::path &save_dir,
+                       size_t depth, size_t rate_limit)
+    : m_client(server_ip, server_port), m_save_dir(save_dir), m_depth(depth), m_rate_limit(rate_limit)
+{
+    m_client.set_cancel_flag(&m_stop);
+    m_client.set_rate_limit(m_rate_limit);
+    m_worker = std::thread(&Prefetcher::worker_loop, this);
+}
+
+Prefetcher::~Prefetcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cv.notify_all();
+    m_worker.join();
+}
+
+void Prefetcher::enqueue(const std::string &filename)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queue.push_back(filename);
+        m_tracks.try_emplace(filename, Track_state::QUEUED);
+    }
+    m_cv.notify_all();
+}
+
+std::optional<std::string> Prefetcher::pop_next()
+{
+    std::optional<std::string> next;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_queue.empty())
+        {
+            return std::nullopt;
+        }
+        next = m_queue.front();
+        m_queue.pop_front();
+    }
+    // the prefetch window moved by one track
+    m_cv.notify_all();
+    return next;
+}
+
+void Prefetcher::requeue_front(const std::string &filename)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queue.push_front(filename);
+        auto it = m_tracks.find(filename);
+        // a prefetch still running for it carries on, the track is next in line again
+        if (it == m_tracks.end() || it->second != Track_state::DOWNLOADING)
+        {
+            std::error_code ec;
+            fs::remove(local_path(filename), ec);
+            m_tracks[filename] = Track_state::QUEUED;
+        }
+    }
+    m_cv.notify_all();
+}
+
+size_t Prefetcher::queue_size()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_queue.size();
+}
+
+std::deque<std::string> Prefetcher::queued_tracks()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_queue;
+}
+
+// Must be called with m_mutex held
+std::optional<std::string> Prefetcher::pick_next_download()
+{
+    // never compete with a foreground download for the track that is about to play
+    if (m_foreground_busy)
+    {
+        return std::nullopt;
+    }
+
+    size_t window = std::min(m_depth, m_queue.size());
+    for (size_t i = 0; i < window; i++)
+    {
+        auto it = m_tracks.find(m_queue[i]);
+        if (it != m_tracks.end() && it->second == Track_state::QUEUED)
+        {
+            return m_queue[i];
+        }
+    }
+    return std::nullopt;
+}
+
+void Prefetcher::worker_loop()
+{
+    // On Linux this lowers the priority of the calling thread only, so decoding and
+    // playback always win over prefetch when the CPU is contended
+    setpriority(PRIO_PROCESS, 0, 10);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stop)
+    {
+        std::optional<std::string> next;
+        m_cv.wait(lock, [&]
+                  { return m_stop || (next = pick_next_download()).has_value(); });
+        if (m_stop)
+        {
+            break;
+        }
+
+        std::string filename = *next;
+        m_tracks[filename] = Track_state::DOWNLOADING;
+        m_client.set_rate_limit(m_rate_limit);
+        lock.unlock();
+
+        // download under a temporary name so a half-written file is never played
+        fs::path part_path = m_save_dir / (filename + ".part");
+        bool ok = m_client.download_file(filename, part_path.string());
+        if (ok)
+        {
+            std::error_code ec;
+            fs::rename(part_path, local_path(filename), ec);
+            ok = !ec;
+        }
+
+        lock.lock();
+        auto it = m_tracks.find(filename);
+        if (it != m_tracks.end())
+        {
+            it->second = ok ? Track_state::READY : Track_state::FAILED;
+        }
+        m_cv.notify_all();
+    }
+}
+
+std::optional<fs::path> Prefetcher::acquire(const std::string &filename, File_client &foreground_client,
+                                            const std::atomic<bool> *cancel)
+{
+    auto cancelled = [cancel]
+    {
+        return cancel != nullptr && cancel->load();
+    };
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto it = m_tracks.find(filename);
+
+    if (it != m_tracks.end() && it->second == Track_state::DOWNLOADING)
+    {
+        // lift the bandwidth cap, the user is waiting for this one now
+        m_client.set_rate_limit(0);
+        // nothing notifies about cancel, so look at it now and then
+        while (!m_cv.wait_for(lock, CANCEL_CHECK_INTERVAL, [&]
+                              {
+                                  auto state = m_tracks.find(filename);
+                                  return m_stop || cancelled() || state == m_tracks.end() || state->second != Track_state::DOWNLOADING; }))
+        {
+        }
+        m_client.set_rate_limit(m_rate_limit);
+        if (cancelled())
+        {
+            return std::nullopt;
+        }
+        it = m_tracks.find(filename);
+    }
+
+    if (it != m_tracks.end() && it->second == Track_state::READY)
+    {
+        return local_path(filename);
+    }
+
+    // not prefetched yet (or prefetch failed), fetch it on the foreground connection
+    // and keep the prefetcher from starting new downloads until it's done
+    if (it != m_tracks.end())
+    {
+        it->second = Track_state::DOWNLOADING;
+    }
+    m_foreground_busy = true;
+    lock.unlock();
+    foreground_client.set_cancel_flag(cancel);
+    bool ok = foreground_client.download_file(filename, local_path(filename).string());
+    foreground_client.set_cancel_flag(nullptr);
+    lock.lock();
+    m_foreground_busy = false;
+
+    it = m_tracks.find(filename);
+    if (it != m_tracks.end())
+    {
+        it->second = ok ? Track_state::READY : Track_state::FAILED;
+    }
+    m_cv.notify_all();
+
+    if (!ok)
+    {
+        return std::nullopt;
+    }
+    return local_path(filename);
+}
+
+void Prefetcher::release(const std::string &filename)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::error_code ec;
+        fs::remove(local_path(filename), ec);
+
+        // the same track may be queued again further down
+        if (std::find(m_queue.begin(), m_queue.end(), filename) != m_queue.end())
+        {
+            m_tracks[filename] = Track_state::QUEUED;
+        }
+        else
+        {
+            m_tracks.erase(filename);
+        }
+    }
+    m_cv.notify_all();
+}
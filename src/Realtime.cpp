@@ -0,0 +1,80 @@
+#include "Realtime.hpp"
+
+#include <algorithm>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+Realtime_scope::Realtime_scope(int priority)
+{
+    pthread_getschedparam(pthread_self(), &m_old_policy, &m_old_param);
+
+    // unprivileged users may still be allowed up to RLIMIT_RTPRIO
+    rlimit limit{};
+    int allowed = priority;
+    if (getrlimit(RLIMIT_RTPRIO, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+    {
+        allowed = std::min<int>(priority, static_cast<int>(limit.rlim_cur));
+    }
+    for (int policy : {SCHED_FIFO, SCHED_RR})
+    {
+        for (int candidate : {priority, allowed})
+        {
+            sched_param param{};
+            param.sched_priority = std::clamp(candidate, sched_get_priority_min(policy), sched_get_priority_max(policy));
+            if (candidate > 0 && pthread_setschedparam(pthread_self(), policy, &param) == 0)
+            {
+                m_policy = policy;
+                m_priority = param.sched_priority;
+                break;
+            }
+        }
+        if (scheduled())
+        {
+            break;
+        }
+    }
+
+    m_memory_locked = mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+    prefault_stack();
+}
+
+Realtime_scope::~Realtime_scope()
+{
+    if (m_memory_locked)
+    {
+        munlockall();
+    }
+    if (scheduled())
+    {
+        pthread_setschedparam(pthread_self(), m_old_policy, &m_old_param);
+    }
+}
+
+const char *Realtime_scope::policy_name() const
+{
+    switch (m_policy)
+    {
+    case SCHED_FIFO:
+        return "SCHED_FIFO";
+    case SCHED_RR:
+        return "SCHED_RR";
+    default:
+        return "SCHED_OTHER";
+    }
+}
+
+void Realtime_scope::demote_current_thread()
+{
+    sched_param param{};
+    pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+}
+
+__attribute__((noinline)) void Realtime_scope::prefault_stack()
+{
+    [[maybe_unused]] volatile unsigned char stack[STACK_PREFAULT];
+    for (size_t offset = 0; offset < STACK_PREFAULT; offset += 4096)
+    {
+        stack[offset] = 0;
+    }
+}
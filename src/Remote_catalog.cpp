@@ -0,0 +1,229 @@
+#include "Remote_catalog.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <map>
+
+#include "Protocol.hpp"
+
+namespace
+{
+    // Splits off the text up to the delimiter (or the end) and advances past it
+    std::string_view next_field(std::string_view &text, char delimiter)
+    {
+        size_t end = text.find(delimiter);
+        std::string_view field = text.substr(0, end);
+        text = end == std::string_view::npos ? std::string_view{} : text.substr(end + 1);
+        return field;
+    }
+
+    template <typename T>
+    std::optional<T> parse_number(std::string_view field)
+    {
+        T value{};
+        auto [end, error] = std::from_chars(field.data(), field.data() + field.size(), value);
+        if (field.empty() || error != std::errc{} || end != field.data() + field.size())
+        {
+            return std::nullopt;
+        }
+        return value;
+    }
+
+    bool by_name(const Catalog_entry &a, const Catalog_entry &b) { return a.name < b.name; }
+}
+
+bool Remote_catalog::parse_entry(std::string_view line, Catalog_entry &entry)
+{
+    if (!line.empty() && line.back() == '\r')
+    {
+        line.remove_suffix(1);
+    }
+
+    entry = {};
+    entry.name = next_field(line, '\t');
+    if (entry.name.empty())
+    {
+        return false;
+    }
+
+    entry.size = parse_number<uint64_t>(next_field(line, '\t'));
+    entry.mtime = parse_number<int64_t>(next_field(line, '\t'));
+    entry.duration = parse_number<double>(next_field(line, '\t'));
+    while (!line.empty())
+    {
+        std::string_view tag = next_field(line, '\t');
+        size_t equals = tag.find('=');
+        if (equals != std::string_view::npos)
+        {
+            entry.tags.emplace_back(tag.substr(0, equals), tag.substr(equals + 1));
+        }
+    }
+    return true;
+}
+
+bool Remote_catalog::apply(std::string_view listing)
+{
+    // optional "#version <token>[ delta]" header
+    std::string version;
+    bool delta = false;
+    if (listing.starts_with(Protocol::catalog_version_prefix))
+    {
+        std::string_view header = next_field(listing, '\n');
+        header.remove_prefix(std::string_view(Protocol::catalog_version_prefix).size());
+        if (header.ends_with(Protocol::catalog_delta_suffix))
+        {
+            header.remove_suffix(std::string_view(Protocol::catalog_delta_suffix).size());
+            delta = true;
+        }
+        version = header;
+    }
+
+    if (!delta)
+    {
+        std::vector<Catalog_entry> previous = std::move(m_entries);
+        m_entries.clear();
+        while (!listing.empty())
+        {
+            Catalog_entry entry;
+            if (parse_entry(next_field(listing, '\n'), entry))
+            {
+                m_entries.push_back(std::move(entry));
+            }
+        }
+        std::stable_sort(m_entries.begin(), m_entries.end(), by_name);
+        // a name listed twice keeps its last line
+        auto duplicates = std::unique(m_entries.rbegin(), m_entries.rend(), [](const Catalog_entry &a, const Catalog_entry &b)
+                                      { return a.name == b.name; });
+        m_entries.erase(m_entries.begin(), duplicates.base());
+
+        // keep details learned earlier for files that look unchanged
+        for (auto &entry : m_entries)
+        {
+            auto old = std::lower_bound(previous.begin(), previous.end(), entry, by_name);
+            if (old != previous.end() && old->name == entry.name && old->size == entry.size &&
+                old->mtime == entry.mtime && !entry.duration && entry.tags.empty())
+            {
+                entry.duration = old->duration;
+                entry.tags = std::move(old->tags);
+            }
+        }
+
+        m_version = std::move(version);
+        rebuild_index();
+        return true;
+    }
+
+    if (m_version.empty())
+    {
+        return false;
+    }
+
+    // Collect the changes by name, then merge them into the sorted entries in one pass
+    std::map<std::string, std::optional<Catalog_entry>, std::less<>> changes;
+    while (!listing.empty())
+    {
+        std::string_view line = next_field(listing, '\n');
+        if (line.size() < 2)
+        {
+            continue;
+        }
+        Catalog_entry entry;
+        if (line.front() == '+' && parse_entry(line.substr(1), entry))
+        {
+            std::string name = entry.name;
+            changes[name] = std::move(entry);
+        }
+        else if (line.front() == '-')
+        {
+            line.remove_prefix(1);
+            if (line.back() == '\r')
+            {
+                line.remove_suffix(1);
+            }
+            changes[std::string(line)] = std::nullopt;
+        }
+    }
+
+    std::vector<Catalog_entry> merged;
+    merged.reserve(m_entries.size() + changes.size());
+    auto change = changes.begin();
+    for (auto &entry : m_entries)
+    {
+        for (; change != changes.end() && change->first < entry.name; ++change)
+        {
+            if (change->second)
+            {
+                merged.push_back(std::move(*change->second));
+            }
+        }
+        if (change != changes.end() && change->first == entry.name)
+        {
+            if (change->second)
+            {
+                merged.push_back(std::move(*change->second));
+            }
+            ++change;
+            continue;
+        }
+        merged.push_back(std::move(entry));
+    }
+    for (; change != changes.end(); ++change)
+    {
+        if (change->second)
+        {
+            merged.push_back(std::move(*change->second));
+        }
+    }
+
+    m_entries = std::move(merged);
+    m_version = std::move(version);
+    rebuild_index();
+    return true;
+}
+
+void Remote_catalog::clear()
+{
+    m_entries.clear();
+    m_index.clear();
+    m_version.clear();
+}
+
+bool Remote_catalog::set_details(std::string_view name, double duration,
+                                 std::vector<std::pair<std::string, std::string>> tags)
+{
+    auto it = m_index.find(name);
+    if (it == m_index.end())
+    {
+        return false;
+    }
+    Catalog_entry &entry = m_entries[it->second];
+    entry.duration = duration;
+    entry.tags = std::move(tags);
+    return true;
+}
+
+void Remote_catalog::rebuild_index()
+{
+    m_index.clear();
+    m_index.reserve(m_entries.size());
+    for (size_t i = 0; i < m_entries.size(); i++)
+    {
+        m_index.emplace(m_entries[i].name, i);
+    }
+}
+
+const Catalog_entry *Remote_catalog::find(std::string_view name) const
+{
+    auto it = m_index.find(name);
+    return it == m_index.end() ? nullptr : &m_entries[it->second];
+}
+
+std::span<const Catalog_entry> Remote_catalog::find_prefix(std::string_view prefix) const
+{
+    auto first = std::lower_bound(m_entries.begin(), m_entries.end(), prefix, [](const Catalog_entry &entry, std::string_view value)
+                                  { return entry.name < value; });
+    // names sharing the prefix are contiguous in sorted order
+    auto last = std::partition_point(first, m_entries.end(), [&](const Catalog_entry &entry)
+                                     { return std::string_view(entry.name).starts_with(prefix); });
+    return {first, last};
+}
@@ -0,0 +1,62 @@
+#include "Replay_gain.hpp"
+
+#include <charconv>
+#include <cmath>
+
+std::optional<double> parse_replay_gain_value(std::string_view text)
+{
+    while (!text.empty() && (text.front() == ' ' || text.front() == '\t'))
+    {
+        text.remove_prefix(1);
+    }
+    // from_chars takes a minus sign but not a plus
+    if (!text.empty() && text.front() == '+')
+    {
+        text.remove_prefix(1);
+    }
+    double value = 0;
+    auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (error != std::errc() || !std::isfinite(value))
+    {
+        return std::nullopt;
+    }
+    return value;
+}
+
+Replay_gain Replay_gain::from_comments(const Vorbis_comment &comments)
+{
+    auto field = [&](std::string_view name) -> std::optional<double>
+    {
+        auto value = comments.find(name);
+        return value ? parse_replay_gain_value(*value) : std::nullopt;
+    };
+
+    Replay_gain gain;
+    gain.track_gain = field("REPLAYGAIN_TRACK_GAIN");
+    gain.track_peak = field("REPLAYGAIN_TRACK_PEAK");
+    gain.album_gain = field("REPLAYGAIN_ALBUM_GAIN");
+    gain.album_peak = field("REPLAYGAIN_ALBUM_PEAK");
+    return gain;
+}
+
+double Replay_gain::factor(Replay_gain_mode mode, double preamp_db) const
+{
+    if (mode == Replay_gain_mode::OFF)
+    {
+        return 1;
+    }
+    bool album = mode == Replay_gain_mode::ALBUM ? album_gain.has_value() : !track_gain.has_value();
+    const std::optional<double> &gain = album ? album_gain : track_gain;
+    const std::optional<double> &peak = album ? album_peak : track_peak;
+    if (!gain)
+    {
+        return 1;
+    }
+
+    double linear = std::pow(10.0, (*gain + preamp_db) / 20);
+    if (peak && *peak > 0 && linear * *peak > 1)
+    {
+        linear = 1 / *peak;
+    }
+    return linear;
+}
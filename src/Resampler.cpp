@@ -0,0 +1,299 @@
+#include "Resampler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <stdexcept>
+
+#include "Realtime.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RESAMPLER_X86 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define RESAMPLER_NEON 1
+#endif
+
+namespace
+{
+    struct Preset
+    {
+        size_t taps;
+        double kaiser_beta;
+        double passband; // fraction of the lower Nyquist frequency left untouched
+    };
+
+    Preset preset_for(Resampler_quality quality)
+    {
+        switch (quality)
+        {
+        case Resampler_quality::FAST:
+            return {16, 7.0, 0.85};
+        case Resampler_quality::BEST:
+            return {64, 12.0, 0.95};
+        case Resampler_quality::BALANCED:
+        default:
+            return {32, 9.5, 0.91};
+        }
+    }
+
+    // zeroth order modified Bessel function of the first kind, for the Kaiser window
+    double bessel_i0(double x)
+    {
+        double sum = 1.0;
+        double term = 1.0;
+        for (int k = 1; k < 64 && term > sum * 1e-17; k++)
+        {
+            term *= (x / (2.0 * k)) * (x / (2.0 * k));
+            sum += term;
+        }
+        return sum;
+    }
+
+    // taps are always a multiple of 8, so no kernel needs a scalar tail
+    float dot_scalar(const float *coefficients, const float *samples, size_t taps)
+    {
+        float sum[8]{};
+        for (size_t i = 0; i < taps; i += 8)
+        {
+            for (size_t j = 0; j < 8; j++)
+            {
+                sum[j] += coefficients[i + j] * samples[i + j];
+            }
+        }
+        return ((sum[0] + sum[4]) + (sum[1] + sum[5])) + ((sum[2] + sum[6]) + (sum[3] + sum[7]));
+    }
+
+#if RESAMPLER_X86
+    float dot_sse2(const float *coefficients, const float *samples, size_t taps)
+    {
+        __m128 sum0 = _mm_setzero_ps();
+        __m128 sum1 = _mm_setzero_ps();
+        for (size_t i = 0; i < taps; i += 8)
+        {
+            sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(coefficients + i), _mm_loadu_ps(samples + i)));
+            sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(coefficients + i + 4), _mm_loadu_ps(samples + i + 4)));
+        }
+        __m128 sum = _mm_add_ps(sum0, sum1);
+        sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+        sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+        return _mm_cvtss_f32(sum);
+    }
+
+    __attribute__((target("avx2,fma"))) float dot_avx2(const float *coefficients, const float *samples, size_t taps)
+    {
+        __m256 sum0 = _mm256_setzero_ps();
+        __m256 sum1 = _mm256_setzero_ps();
+        size_t i = 0;
+        for (; i + 16 <= taps; i += 16)
+        {
+            sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(coefficients + i), _mm256_loadu_ps(samples + i), sum0);
+            sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(coefficients + i + 8), _mm256_loadu_ps(samples + i + 8), sum1);
+        }
+        if (i < taps)
+        {
+            sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(coefficients + i), _mm256_loadu_ps(samples + i), sum0);
+        }
+        __m256 sum = _mm256_add_ps(sum0, sum1);
+        __m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+        half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+        half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 1));
+        return _mm_cvtss_f32(half);
+    }
+#endif
+
+#if RESAMPLER_NEON
+    float dot_neon(const float *coefficients, const float *samples, size_t taps)
+    {
+        float32x4_t sum0 = vdupq_n_f32(0);
+        float32x4_t sum1 = vdupq_n_f32(0);
+        for (size_t i = 0; i < taps; i += 8)
+        {
+            sum0 = vmlaq_f32(sum0, vld1q_f32(coefficients + i), vld1q_f32(samples + i));
+            sum1 = vmlaq_f32(sum1, vld1q_f32(coefficients + i + 4), vld1q_f32(samples + i + 4));
+        }
+        float32x4_t sum = vaddq_f32(sum0, sum1);
+        float32x2_t pair = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
+        return vget_lane_f32(vpadd_f32(pair, pair), 0);
+    }
+#endif
+
+    constexpr float SAMPLE_TO_FLOAT = 1.0f / 2147483648.0f;
+
+    int32_t float_to_sample(float value)
+    {
+        // clip instead of wrapping when the filter rings above full scale; 2^31 - 128 is
+        // the largest float below 2^31
+        float scaled = std::clamp(value * 2147483648.0f, -2147483648.0f, 2147483520.0f);
+        return static_cast<int32_t>(std::lrint(scaled));
+    }
+}
+
+Resampler::Resampler(uint32_t in_rate, uint32_t out_rate, uint8_t channels, Resampler_quality quality)
+    : m_in_rate(in_rate), m_out_rate(out_rate), m_channels(channels)
+{
+    if (in_rate == 0 || out_rate == 0 || channels == 0)
+    {
+        throw std::invalid_argument("Resampler needs non-zero rates and channels");
+    }
+    uint32_t divisor = std::gcd(in_rate, out_rate);
+    m_up = out_rate / divisor;
+    m_down = in_rate / divisor;
+    if (m_up > MAX_PHASES)
+    {
+        throw std::invalid_argument("Unsupported resampling ratio " + std::to_string(in_rate) + " -> " + std::to_string(out_rate));
+    }
+
+    Preset preset = preset_for(quality);
+    m_taps = preset.taps;
+
+    // cutoff in cycles per input sample, below the lower of the two Nyquist frequencies
+    double cutoff = 0.5 * preset.passband * std::min(1.0, static_cast<double>(out_rate) / in_rate);
+    double center = static_cast<double>(m_taps / 2 - 1);
+    double half_width = m_taps / 2.0;
+    double window_scale = 1.0 / bessel_i0(preset.kaiser_beta);
+
+    m_coefficients.resize(m_up * m_taps);
+    for (uint32_t phase = 0; phase < m_up; phase++)
+    {
+        float *row = &m_coefficients[phase * m_taps];
+        double sum = 0;
+        for (size_t tap = 0; tap < m_taps; tap++)
+        {
+            // distance of this input sample from the output instant, in input samples
+            double distance = static_cast<double>(tap) - center - static_cast<double>(phase) / m_up;
+            double x = 2.0 * cutoff * distance;
+            double sinc = x == 0 ? 1.0 : std::sin(M_PI * x) / (M_PI * x);
+            double ratio = distance / half_width;
+            double window = std::abs(ratio) >= 1.0 ? 0.0 : bessel_i0(preset.kaiser_beta * std::sqrt(1.0 - ratio * ratio)) * window_scale;
+            double value = 2.0 * cutoff * sinc * window;
+            row[tap] = static_cast<float>(value);
+            sum += value;
+        }
+        // unity gain at DC for every phase, otherwise the phases ripple against each other
+        for (size_t tap = 0; tap < m_taps; tap++)
+        {
+            row[tap] = static_cast<float>(row[tap] / sum);
+        }
+    }
+
+    m_dot = dot_scalar;
+#if RESAMPLER_X86
+    m_dot = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") ? dot_avx2 : dot_sse2;
+#elif RESAMPLER_NEON
+    m_dot = dot_neon;
+#endif
+
+    reset();
+}
+
+const char *Resampler::kernel_name() const
+{
+#if RESAMPLER_X86
+    if (m_dot == dot_avx2)
+        return "avx2";
+    if (m_dot == dot_sse2)
+        return "sse2";
+#elif RESAMPLER_NEON
+    if (m_dot == dot_neon)
+        return "neon";
+#endif
+    return "scalar";
+}
+
+void Resampler::reset()
+{
+    // start as if the stream had been preceded by silence; assign() keeps the allocations
+    m_history.resize(m_channels);
+    for (auto &history : m_history)
+    {
+        history.assign(latency(), 0.0f);
+    }
+    m_index = 0;
+    m_phase = 0;
+    m_input_frames = 0;
+    m_output_frames = 0;
+}
+
+void Resampler::reserve(size_t max_frames)
+{
+    // what stays behind between calls is less than one filter window
+    for (auto &history : m_history)
+    {
+        prefault(history, 2 * m_taps + max_frames);
+    }
+}
+
+size_t Resampler::max_output_frames(size_t max_frames) const
+{
+    return (uint64_t(max_frames) + m_taps) * m_up / m_down + 1;
+}
+
+void Resampler::process(const int32_t *in, size_t frames, std::vector<int32_t> &out)
+{
+    // deinterleave behind what is left from the previous call
+    size_t buffered = m_history[0].size();
+    for (uint8_t channel = 0; channel < m_channels; channel++)
+    {
+        std::vector<float> &history = m_history[channel];
+        history.resize(buffered + frames);
+        float *samples = history.data() + buffered;
+        for (size_t i = 0; i < frames; i++)
+        {
+            samples[i] = static_cast<float>(in[i * m_channels + channel]) * SAMPLE_TO_FLOAT;
+        }
+    }
+    size_t available = buffered + frames;
+    m_input_frames += frames;
+
+    // output frames whose filter window lies within the buffered input
+    size_t frames_out = 0;
+    if (m_index + m_taps <= available)
+    {
+        uint64_t last_position = uint64_t(available - m_taps) * m_up; // in 1/L input samples
+        uint64_t position = uint64_t(m_index) * m_up + m_phase;
+        frames_out = (last_position - position) / m_down + 1;
+    }
+
+    size_t out_offset = out.size();
+    out.resize(out_offset + frames_out * m_channels);
+    int32_t *output = out.data() + out_offset;
+    for (size_t frame = 0; frame < frames_out; frame++)
+    {
+        const float *coefficients = &m_coefficients[m_phase * m_taps];
+        for (uint8_t channel = 0; channel < m_channels; channel++)
+        {
+            *output++ = float_to_sample(m_dot(coefficients, m_history[channel].data() + m_index, m_taps));
+        }
+        m_phase += m_down;
+        m_index += m_phase / m_up;
+        m_phase %= m_up;
+    }
+    m_output_frames += frames_out;
+
+    // keep only what the filter still has to see
+    size_t consumed = std::min(m_index, available);
+    for (auto &history : m_history)
+    {
+        history.erase(history.begin(), history.begin() + consumed);
+    }
+    m_index -= consumed;
+}
+
+void Resampler::drain(std::vector<int32_t> &out)
+{
+    // one output frame per L/M of input, the ones still behind the filter's delay
+    uint64_t total = (m_input_frames * m_up + m_down - 1) / m_down;
+    uint64_t missing = total - m_output_frames;
+    size_t expected = out.size() + missing * m_channels;
+
+    std::vector<int32_t> silence(m_taps * m_channels, 0);
+    process(silence.data(), m_taps, out);
+    // only the delayed input is wanted, not the filtered silence after it
+    if (out.size() > expected)
+    {
+        out.resize(expected);
+    }
+    reset();
+}
@@ -0,0 +1,382 @@
+#include "Server_discovery.hpp"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "Async_file_client.hpp"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    // time to keep listening after the first announcement so that closer servers can answer too
+    constexpr auto COLLECT_WINDOW = std::chrono::milliseconds(150);
+    constexpr auto PROBE_TIMEOUT = std::chrono::milliseconds(500);
+}
+
+Server_discovery::Server_discovery(const fs::path &cache_path) : m_cache_path(cache_path) {}
+
+Server_discovery::~Server_discovery()
+{
+    stop();
+}
+
+fs::path Server_discovery::default_cache_path()
+{
+    if (const char *cache_home = std::getenv("XDG_CACHE_HOME"); cache_home && *cache_home)
+    {
+        return fs::path(cache_home) / "audio_client" / "last_server";
+    }
+    if (const char *home = std::getenv("HOME"); home && *home)
+    {
+        return fs::path(home) / ".cache" / "audio_client" / "last_server";
+    }
+    return {};
+}
+
+void Server_discovery::start()
+{
+    if (m_listener.joinable())
+    {
+        return;
+    }
+    m_stop = false;
+    m_listener = std::thread(&Server_discovery::listen_loop, this);
+}
+
+void Server_discovery::stop()
+{
+    m_stop = true;
+    m_cv.notify_all();
+    if (m_listener.joinable())
+    {
+        m_listener.join();
+    }
+}
+
+bool Server_discovery::parse_announcement(const std::string &message, int &port, double &load)
+{
+    // Parse server port from message
+    size_t colon_pos = message.find(':');
+    if (colon_pos == std::string::npos)
+    {
+        return false;
+    }
+
+    try
+    {
+        size_t consumed = 0;
+        port = std::stoi(message.substr(colon_pos + 1), &consumed);
+
+        load = 0.0;
+        size_t load_pos = colon_pos + 1 + consumed;
+        if (load_pos < message.size() && message[load_pos] == ':')
+        {
+            // always a percentage of the server's connection limit, "1" is 1 %
+            load = std::clamp(std::stod(message.substr(load_pos + 1)) / 100.0, 0.0, 1.0);
+        }
+    }
+    catch (const std::exception &)
+    {
+        return false;
+    }
+    return port > 0 && port <= 65535;
+}
+
+std::optional<std::chrono::microseconds> Server_discovery::probe(const Server_endpoint &endpoint,
+                                                                 std::chrono::milliseconds timeout)
+{
+    struct sockaddr_in server_addr{};
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(endpoint.port);
+    if (inet_pton(AF_INET, endpoint.ip.c_str(), &server_addr.sin_addr) <= 0)
+    {
+        return std::nullopt;
+    }
+
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+    {
+        return std::nullopt;
+    }
+
+    auto start = Clock::now();
+    int result = connect(sock, (struct sockaddr *)&server_addr, sizeof(server_addr));
+    if (result < 0 && errno == EINPROGRESS)
+    {
+        struct pollfd pfd{sock, POLLOUT, 0};
+        result = poll(&pfd, 1, static_cast<int>(timeout.count())) == 1 ? 0 : -1;
+        if (result == 0)
+        {
+            int error = 0;
+            socklen_t length = sizeof(error);
+            getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &length);
+            result = error == 0 ? 0 : -1;
+        }
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start);
+    close(sock);
+
+    if (result < 0)
+    {
+        return std::nullopt;
+    }
+    return elapsed;
+}
+
+Server_discovery::Server_info &Server_discovery::find_or_add(const Server_endpoint &endpoint)
+{
+    for (auto &server : m_servers)
+    {
+        if (server.endpoint == endpoint)
+        {
+            return server;
+        }
+    }
+    Server_info server;
+    server.endpoint = endpoint;
+    m_servers.push_back(server);
+    return m_servers.back();
+}
+
+void Server_discovery::record_announcement(const Server_endpoint &endpoint, double load)
+{
+    bool needs_probe;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Server_info &server = find_or_add(endpoint);
+        server.load = load;
+        server.last_seen = Clock::now();
+        needs_probe = !server.rtt || server.failed;
+    }
+
+    // probe outside the lock, it can take up to PROBE_TIMEOUT
+    std::optional<std::chrono::microseconds> rtt;
+    if (needs_probe)
+    {
+        rtt = probe(endpoint, PROBE_TIMEOUT);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Server_info &server = find_or_add(endpoint);
+        if (needs_probe)
+        {
+            server.rtt = rtt;
+            server.failed = !rtt;
+        }
+    }
+    m_cv.notify_all();
+}
+
+void Server_discovery::listen_loop()
+{
+    int sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+    {
+        return;
+    }
+
+    // Allow reuse of port
+    int reuse = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    // Bind to discovery port
+    struct sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(DISCOVERY_PORT);
+    bind(sock, (struct sockaddr *)&addr, sizeof(addr));
+
+    // Join multicast group
+    struct ip_mreq mreq{};
+    mreq.imr_multiaddr.s_addr = inet_addr(DISCOVERY_GROUP);
+    mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+    setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+
+    char buffer[1024];
+    while (!m_stop)
+    {
+        // wake up regularly to notice stop()
+        struct pollfd pfd{sock, POLLIN, 0};
+        if (poll(&pfd, 1, 200) <= 0)
+        {
+            continue;
+        }
+
+        struct sockaddr_in server_addr{};
+        socklen_t addr_len = sizeof(server_addr);
+        ssize_t received = recvfrom(sock, buffer, sizeof(buffer) - 1, 0,
+                                    (struct sockaddr *)&server_addr, &addr_len);
+        if (received <= 0)
+        {
+            continue;
+        }
+
+        buffer[received] = '\0';
+        int port;
+        double load;
+        if (!parse_announcement(buffer, port, load))
+        {
+            continue;
+        }
+
+        char ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &server_addr.sin_addr, ip, sizeof(ip));
+        record_announcement({ip, port}, load);
+    }
+
+    close(sock);
+}
+
+// Lower is better: round-trip time scaled up by how busy the server says it is.
+// Servers that stopped announcing are likely gone and no longer compete.
+std::optional<Server_endpoint> Server_discovery::pick_best_locked()
+{
+    const Server_info *best = nullptr;
+    double best_score = std::numeric_limits<double>::infinity();
+    auto now = Clock::now();
+
+    for (const auto &server : m_servers)
+    {
+        if (server.failed || !server.rtt || now - server.last_seen > STALE_AFTER)
+        {
+            continue;
+        }
+        double score = server.rtt->count() * (1.0 + server.load);
+        if (score < best_score)
+        {
+            best_score = score;
+            best = &server;
+        }
+    }
+
+    if (!best)
+    {
+        return std::nullopt;
+    }
+    return best->endpoint;
+}
+
+Server_endpoint Server_discovery::find_server(std::chrono::milliseconds timeout)
+{
+    // keep collecting announcements for fail-over even when the cache hits
+    start();
+
+    // fast path: the last server we used is usually still there
+    if (auto cached = load_cache())
+    {
+        if (auto rtt = probe(*cached, PROBE_TIMEOUT))
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            Server_info &server = find_or_add(*cached);
+            server.rtt = rtt;
+            server.last_seen = Clock::now();
+            server.failed = false;
+            m_current = *cached;
+            return *cached;
+        }
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto deadline = Clock::now() + timeout;
+    if (!m_cv.wait_until(lock, deadline, [&]
+                         { return pick_best_locked().has_value(); }))
+    {
+        throw std::runtime_error("No server found");
+    }
+
+    // give other servers that announce at about the same time a chance to compete
+    m_cv.wait_until(lock, std::min(deadline, Clock::now() + COLLECT_WINDOW), [&]
+                    { return m_stop.load(); });
+
+    m_current = pick_best_locked();
+    Server_endpoint chosen = *m_current;
+    lock.unlock();
+
+    save_cache(chosen);
+    return chosen;
+}
+
+std::optional<Server_endpoint> Server_discovery::fail_over(const Server_endpoint &failed)
+{
+    std::optional<Server_endpoint> next;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        find_or_add(failed).failed = true;
+        next = pick_best_locked();
+        if (next)
+        {
+            m_current = next;
+        }
+    }
+
+    if (next)
+    {
+        save_cache(*next);
+    }
+    return next;
+}
+
+void Server_discovery::watch(Async_file_client &client)
+{
+    client.set_connect_failure_handler([this, &client]
+                                       {
+                                           auto next = fail_over({client.get_server_ip(), client.get_server_port()});
+                                           if (!next)
+                                           {
+                                               return false;
+                                           }
+                                           client.set_server(next->ip, next->port);
+                                           return true; });
+}
+
+std::vector<Server_discovery::Server_info> Server_discovery::get_servers()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_servers;
+}
+
+std::optional<Server_endpoint> Server_discovery::get_current()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_current;
+}
+
+std::optional<Server_endpoint> Server_discovery::load_cache() const
+{
+    if (m_cache_path.empty())
+    {
+        return std::nullopt;
+    }
+
+    std::ifstream cache(m_cache_path);
+    Server_endpoint endpoint;
+    if (!(cache >> endpoint.ip >> endpoint.port))
+    {
+        return std::nullopt;
+    }
+    return endpoint;
+}
+
+void Server_discovery::save_cache(const Server_endpoint &endpoint) const
+{
+    if (m_cache_path.empty())
+    {
+        return;
+    }
+
+    std::error_code ec;
+    fs::create_directories(m_cache_path.parent_path(), ec);
+    std::ofstream cache(m_cache_path, std::ios::trunc);
+    cache << endpoint.ip << " " << endpoint.port << "\n";
+}
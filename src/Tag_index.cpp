@@ -0,0 +1,349 @@
+#include "Tag_index.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    constexpr char INDEX_MAGIC[4] = {'F', 'T', 'I', 'X'};
+    constexpr uint32_t INDEX_VERSION = 1;
+
+    std::string to_upper(std::string_view text)
+    {
+        std::string upper(text);
+        for (auto &c : upper)
+        {
+            c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+        }
+        return upper;
+    }
+
+    void require_little_endian()
+    {
+        if constexpr (std::endian::native != std::endian::little)
+        {
+            throw std::runtime_error("Tag index is only supported on little-endian hosts");
+        }
+    }
+}
+
+struct Tag_index::File_header
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t track_count;
+    uint32_t tag_count;
+    uint32_t string_count;
+    uint32_t reserved;
+    uint64_t tracks_offset;
+    uint64_t tags_offset;
+    uint64_t string_offsets_offset; // string_count + 1 entries
+    uint64_t string_bytes_offset;
+    uint64_t string_bytes_size;
+};
+
+struct Tag_index::Track_record
+{
+    uint64_t file_size;
+    int64_t mtime;
+    uint64_t total_samples;
+    uint32_t path_id;
+    uint32_t sample_rate;
+    uint32_t first_tag;
+    uint32_t tag_count;
+    uint8_t channels;
+    uint8_t bits_per_sample;
+    uint8_t reserved[6];
+};
+
+struct Tag_index::Tag_record
+{
+    uint32_t name_id;
+    uint32_t value_id;
+};
+
+void Tag_index::close()
+{
+    m_file.close();
+    m_header = nullptr;
+}
+
+void Tag_index::open(const fs::path &path)
+{
+    require_little_endian();
+    close();
+
+    m_file.open(path);
+    if (m_file.size() < sizeof(File_header))
+    {
+        m_file.close();
+        throw std::runtime_error("Tag index is truncated: " + path.string());
+    }
+    const char *data = m_file.data();
+    size_t size = m_file.size();
+
+    // Check every offset and id once here so the accessors can trust them
+    const auto *header = reinterpret_cast<const File_header *>(data);
+    auto section_fits = [&](uint64_t offset, uint64_t count, uint64_t element_size)
+    {
+        return offset % 8 == 0 && offset <= size && count <= (size - offset) / element_size;
+    };
+    bool valid = std::memcmp(header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0 &&
+                 header->version == INDEX_VERSION &&
+                 section_fits(header->tracks_offset, header->track_count, sizeof(Track_record)) &&
+                 section_fits(header->tags_offset, header->tag_count, sizeof(Tag_record)) &&
+                 section_fits(header->string_offsets_offset, uint64_t(header->string_count) + 1, sizeof(uint32_t)) &&
+                 header->string_bytes_offset <= size && header->string_bytes_size <= size - header->string_bytes_offset;
+    if (!valid)
+    {
+        m_file.close();
+        throw std::runtime_error("Tag index is malformed: " + path.string());
+    }
+
+    m_tracks = reinterpret_cast<const Track_record *>(data + header->tracks_offset);
+    m_tags = reinterpret_cast<const Tag_record *>(data + header->tags_offset);
+    m_string_offsets = reinterpret_cast<const uint32_t *>(data + header->string_offsets_offset);
+    m_string_bytes = data + header->string_bytes_offset;
+
+    for (uint32_t i = 0; i < header->string_count && valid; i++)
+    {
+        valid = m_string_offsets[i] <= m_string_offsets[i + 1];
+    }
+    valid = valid && m_string_offsets[header->string_count] <= header->string_bytes_size;
+    for (uint32_t i = 0; i < header->track_count && valid; i++)
+    {
+        const Track_record &track = m_tracks[i];
+        valid = track.path_id < header->string_count && track.first_tag <= header->tag_count &&
+                track.tag_count <= header->tag_count - track.first_tag;
+    }
+    for (uint32_t i = 0; i < header->tag_count && valid; i++)
+    {
+        valid = m_tags[i].name_id < header->string_count && m_tags[i].value_id < header->string_count;
+    }
+    if (!valid)
+    {
+        m_file.close();
+        throw std::runtime_error("Tag index is malformed: " + path.string());
+    }
+    m_header = header;
+}
+
+std::string_view Tag_index::string_at(uint32_t id) const
+{
+    return {m_string_bytes + m_string_offsets[id], m_string_offsets[id + 1] - m_string_offsets[id]};
+}
+
+std::optional<uint32_t> Tag_index::string_id(std::string_view text) const
+{
+    // the string table is sorted
+    uint32_t low = 0;
+    uint32_t high = m_header->string_count;
+    while (low < high)
+    {
+        uint32_t middle = low + (high - low) / 2;
+        if (string_at(middle) < text)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    if (low < m_header->string_count && string_at(low) == text)
+    {
+        return low;
+    }
+    return std::nullopt;
+}
+
+size_t Tag_index::size() const
+{
+    return m_header ? m_header->track_count : 0;
+}
+
+Tag_index::Track Tag_index::track(size_t index) const
+{
+    const Track_record &record = m_tracks[index];
+    return {string_at(record.path_id), record.file_size, record.mtime, record.sample_rate,
+            record.channels, record.bits_per_sample, record.total_samples};
+}
+
+std::vector<std::pair<std::string_view, std::string_view>> Tag_index::tags(size_t index) const
+{
+    const Track_record &record = m_tracks[index];
+    std::vector<std::pair<std::string_view, std::string_view>> result;
+    result.reserve(record.tag_count);
+    for (uint32_t i = record.first_tag; i < record.first_tag + record.tag_count; i++)
+    {
+        result.emplace_back(string_at(m_tags[i].name_id), string_at(m_tags[i].value_id));
+    }
+    return result;
+}
+
+std::optional<std::string_view> Tag_index::tag(size_t index, std::string_view name) const
+{
+    std::optional<uint32_t> name_id = string_id(to_upper(name));
+    if (!name_id)
+    {
+        return std::nullopt;
+    }
+    const Track_record &record = m_tracks[index];
+    for (uint32_t i = record.first_tag; i < record.first_tag + record.tag_count; i++)
+    {
+        if (m_tags[i].name_id == *name_id)
+        {
+            return string_at(m_tags[i].value_id);
+        }
+    }
+    return std::nullopt;
+}
+
+std::optional<size_t> Tag_index::find_path(std::string_view path) const
+{
+    // records are sorted by path, and so are the string ids
+    std::optional<uint32_t> path_id = string_id(path);
+    if (!path_id)
+    {
+        return std::nullopt;
+    }
+    const Track_record *end = m_tracks + size();
+    const Track_record *found = std::lower_bound(m_tracks, end, *path_id, [](const Track_record &record, uint32_t id)
+                                                 { return record.path_id < id; });
+    if (found == end || found->path_id != *path_id)
+    {
+        return std::nullopt;
+    }
+    return found - m_tracks;
+}
+
+std::vector<size_t> Tag_index::find(std::string_view name, std::string_view value) const
+{
+    std::vector<size_t> matches;
+    std::optional<uint32_t> name_id = string_id(to_upper(name));
+    std::optional<uint32_t> value_id = string_id(value);
+    if (!name_id || !value_id)
+    {
+        return matches;
+    }
+
+    for (size_t index = 0; index < size(); index++)
+    {
+        const Track_record &record = m_tracks[index];
+        for (uint32_t i = record.first_tag; i < record.first_tag + record.tag_count; i++)
+        {
+            if (m_tags[i].name_id == *name_id && m_tags[i].value_id == *value_id)
+            {
+                matches.push_back(index);
+                break;
+            }
+        }
+    }
+    return matches;
+}
+
+void Tag_index::write(const fs::path &path, std::vector<Indexed_track> tracks)
+{
+    require_little_endian();
+    static_assert(sizeof(File_header) == 64 && sizeof(Track_record) == 48 && sizeof(Tag_record) == 8);
+
+    // sort first: the string table below holds views into the tracks
+    std::sort(tracks.begin(), tracks.end(), [](const Indexed_track &a, const Indexed_track &b)
+              { return a.path < b.path; });
+
+    // intern every string into one sorted table
+    std::vector<std::string_view> strings;
+    for (auto &track : tracks)
+    {
+        strings.push_back(track.path);
+        for (auto &[name, value] : track.tags)
+        {
+            name = to_upper(name);
+            strings.push_back(name);
+            strings.push_back(value);
+        }
+    }
+    std::sort(strings.begin(), strings.end());
+    strings.erase(std::unique(strings.begin(), strings.end()), strings.end());
+    auto id_of = [&](std::string_view text)
+    {
+        return static_cast<uint32_t>(std::lower_bound(strings.begin(), strings.end(), text) - strings.begin());
+    };
+
+    std::vector<Track_record> track_records;
+    std::vector<Tag_record> tag_records;
+    track_records.reserve(tracks.size());
+    for (const auto &track : tracks)
+    {
+        Track_record record{};
+        record.file_size = track.file_size;
+        record.mtime = track.mtime;
+        record.total_samples = track.stream_info.total_samples;
+        record.path_id = id_of(track.path);
+        record.sample_rate = track.stream_info.sample_rate;
+        record.first_tag = static_cast<uint32_t>(tag_records.size());
+        record.tag_count = static_cast<uint32_t>(track.tags.size());
+        record.channels = track.stream_info.channels;
+        record.bits_per_sample = track.stream_info.bits_per_sample;
+        track_records.push_back(record);
+
+        for (const auto &[name, value] : track.tags)
+        {
+            tag_records.push_back({id_of(name), id_of(value)});
+        }
+    }
+
+    std::vector<uint32_t> string_offsets;
+    string_offsets.reserve(strings.size() + 1);
+    std::string string_bytes;
+    for (auto text : strings)
+    {
+        string_offsets.push_back(static_cast<uint32_t>(string_bytes.size()));
+        string_bytes += text;
+    }
+    string_offsets.push_back(static_cast<uint32_t>(string_bytes.size()));
+
+    auto align = [](uint64_t offset)
+    { return (offset + 7) & ~uint64_t{7}; };
+
+    File_header header{};
+    std::memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header.version = INDEX_VERSION;
+    header.track_count = static_cast<uint32_t>(track_records.size());
+    header.tag_count = static_cast<uint32_t>(tag_records.size());
+    header.string_count = static_cast<uint32_t>(strings.size());
+    header.tracks_offset = sizeof(File_header);
+    header.tags_offset = align(header.tracks_offset + track_records.size() * sizeof(Track_record));
+    header.string_offsets_offset = align(header.tags_offset + tag_records.size() * sizeof(Tag_record));
+    header.string_bytes_offset = header.string_offsets_offset + string_offsets.size() * sizeof(uint32_t);
+    header.string_bytes_size = string_bytes.size();
+
+    fs::path temp_path = path;
+    temp_path += ".tmp";
+    {
+        std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+        auto write_at = [&](uint64_t offset, const void *data, size_t size)
+        {
+            // pad up to the section start
+            static const char zeros[8]{};
+            file.write(zeros, offset - static_cast<uint64_t>(file.tellp()));
+            file.write(static_cast<const char *>(data), size);
+        };
+        write_at(0, &header, sizeof(header));
+        write_at(header.tracks_offset, track_records.data(), track_records.size() * sizeof(Track_record));
+        write_at(header.tags_offset, tag_records.data(), tag_records.size() * sizeof(Tag_record));
+        write_at(header.string_offsets_offset, string_offsets.data(), string_offsets.size() * sizeof(uint32_t));
+        write_at(header.string_bytes_offset, string_bytes.data(), string_bytes.size());
+        if (!file.good())
+        {
+            throw std::runtime_error("Cannot write tag index: " + temp_path.string());
+        }
+    }
+    fs::rename(temp_path, path);
+}
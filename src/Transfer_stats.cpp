@@ -0,0 +1,281 @@
+#include "Transfer_stats.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    uint64_t to_us(Transfer_stats::Clock::duration duration)
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+    }
+
+    uint64_t to_ns(Transfer_stats::Clock::duration duration)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+    }
+
+    uint64_t load(const std::atomic<uint64_t> &counter)
+    {
+        return counter.load(std::memory_order_relaxed);
+    }
+
+    void add(std::atomic<uint64_t> &counter, uint64_t value)
+    {
+        counter.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    // bytes per second, 0 when nothing was timed
+    uint64_t rate(uint64_t bytes, uint64_t microseconds)
+    {
+        return microseconds == 0 ? 0 : bytes * 1000000 / microseconds;
+    }
+}
+
+const char *transfer_kind_name(Transfer_kind kind)
+{
+    switch (kind)
+    {
+    case Transfer_kind::LIST:
+        return "list";
+    case Transfer_kind::GET:
+        return "get";
+    case Transfer_kind::PUT:
+        return "put";
+    }
+    return "";
+}
+
+void Histogram::record(uint64_t value)
+{
+    size_t bucket = std::min<size_t>(std::bit_width(value), BUCKETS - 1);
+    m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(value, std::memory_order_relaxed);
+
+    uint64_t current = m_max.load(std::memory_order_relaxed);
+    while (value > current && !m_max.compare_exchange_weak(current, value, std::memory_order_relaxed))
+    {
+    }
+}
+
+void Histogram::merge(const Histogram &other)
+{
+    for (size_t i = 0; i < BUCKETS; i++)
+    {
+        m_buckets[i].fetch_add(other.m_buckets[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    m_count.fetch_add(other.count(), std::memory_order_relaxed);
+    m_sum.fetch_add(other.sum(), std::memory_order_relaxed);
+
+    uint64_t value = other.max();
+    uint64_t current = m_max.load(std::memory_order_relaxed);
+    while (value > current && !m_max.compare_exchange_weak(current, value, std::memory_order_relaxed))
+    {
+    }
+}
+
+uint64_t Histogram::percentile(double fraction) const
+{
+    uint64_t total = count();
+    if (total == 0)
+    {
+        return 0;
+    }
+
+    // nearest rank: the bucket of the smallest sample with at least fraction of them at or below it
+    uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(fraction * total)));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; i++)
+    {
+        seen += m_buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank)
+        {
+            uint64_t upper = i == 0 ? 0 : (uint64_t{1} << i) - 1;
+            return std::min(upper, max());
+        }
+    }
+    return max();
+}
+
+std::string Histogram::to_json() const
+{
+    std::ostringstream json;
+    json << "{\"count\":" << count() << ",\"sum\":" << sum() << ",\"max\":" << max()
+         << ",\"p50\":" << percentile(0.5) << ",\"p99\":" << percentile(0.99) << ",\"buckets\":[";
+
+    // only non-empty buckets, as [upper bound, count]
+    bool first = true;
+    for (size_t i = 0; i < BUCKETS; i++)
+    {
+        uint64_t bucket_count = m_buckets[i].load(std::memory_order_relaxed);
+        if (bucket_count == 0)
+        {
+            continue;
+        }
+        json << (first ? "" : ",") << "[" << (i == 0 ? 0 : (uint64_t{1} << i) - 1) << "," << bucket_count << "]";
+        first = false;
+    }
+    json << "]}";
+    return json.str();
+}
+
+void Transfer_stats::record_operation(Transfer_kind kind, bool success, uint64_t bytes, Clock::duration duration,
+                                      std::optional<Clock::duration> first_byte)
+{
+    Operation_stats &operation = m_operations[static_cast<size_t>(kind)];
+    add(success ? operation.succeeded : operation.failed, 1);
+    add(operation.bytes, bytes);
+    operation.duration_us.record(to_us(duration));
+    if (first_byte)
+    {
+        operation.first_byte_us.record(to_us(*first_byte));
+    }
+}
+
+void Transfer_stats::record_connect(bool success, Clock::duration duration, bool reconnect)
+{
+    if (!success)
+    {
+        add(m_connect_failures, 1);
+        return;
+    }
+    add(m_connects, 1);
+    if (reconnect)
+    {
+        add(m_reconnects, 1);
+    }
+    m_connect_us.record(to_us(duration));
+}
+
+void Transfer_stats::record_send(size_t bytes, Clock::duration duration)
+{
+    add(m_bytes_sent, bytes);
+    add(m_send_calls, 1);
+    add(m_send_ns, to_ns(duration));
+}
+
+void Transfer_stats::record_recv(size_t bytes, Clock::duration duration, std::optional<Clock::duration> gap)
+{
+    add(m_bytes_received, bytes);
+    add(m_recv_calls, 1);
+    add(m_recv_ns, to_ns(duration));
+    m_recv_size.record(bytes);
+    if (gap)
+    {
+        m_recv_gap_us.record(to_us(*gap));
+    }
+}
+
+std::string Transfer_stats::to_json() const
+{
+    std::ostringstream json;
+    json << "{\"uptime_us\":" << to_us(Clock::now() - m_created) << ",\"operations\":{";
+    for (size_t i = 0; i < m_operations.size(); i++)
+    {
+        const Operation_stats &operation = m_operations[i];
+        uint64_t bytes = load(operation.bytes);
+        json << (i == 0 ? "" : ",") << "\"" << transfer_kind_name(static_cast<Transfer_kind>(i)) << "\":{"
+             << "\"succeeded\":" << load(operation.succeeded)
+             << ",\"failed\":" << load(operation.failed)
+             << ",\"bytes\":" << bytes
+             << ",\"throughput_bps\":" << rate(bytes, operation.duration_us.sum())
+             << ",\"duration_us\":" << operation.duration_us.to_json()
+             << ",\"first_byte_us\":" << operation.first_byte_us.to_json() << "}";
+    }
+
+    json << "},\"connections\":{"
+         << "\"connects\":" << load(m_connects)
+         << ",\"reconnects\":" << load(m_reconnects)
+         << ",\"failures\":" << load(m_connect_failures)
+         << ",\"connect_us\":" << m_connect_us.to_json() << "}"
+         << ",\"socket\":{"
+         << "\"bytes_sent\":" << load(m_bytes_sent)
+         << ",\"send_calls\":" << load(m_send_calls)
+         << ",\"send_us\":" << load(m_send_ns) / 1000
+         << ",\"bytes_received\":" << load(m_bytes_received)
+         << ",\"recv_calls\":" << load(m_recv_calls)
+         << ",\"recv_us\":" << load(m_recv_ns) / 1000
+         << ",\"recv_size\":" << m_recv_size.to_json()
+         << ",\"recv_gap_us\":" << m_recv_gap_us.to_json() << "}}";
+    return json.str();
+}
+
+Stats_exporter::Stats_exporter(const fs::path &path, std::chrono::milliseconds interval)
+    : m_path(path), m_interval(interval) {}
+
+Stats_exporter::~Stats_exporter()
+{
+    stop();
+}
+
+void Stats_exporter::add_source(const std::string &name, const Transfer_stats &stats)
+{
+    m_sources.emplace_back(name, &stats);
+}
+
+void Stats_exporter::start()
+{
+    if (m_thread.joinable())
+    {
+        return;
+    }
+    m_stop = false;
+    m_thread = std::thread(&Stats_exporter::run, this);
+}
+
+void Stats_exporter::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cv.notify_all();
+    if (m_thread.joinable())
+    {
+        m_thread.join();
+    }
+}
+
+void Stats_exporter::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_cv.wait_for(lock, m_interval, [&]
+                          { return m_stop; }))
+    {
+        write_snapshot();
+    }
+    // leave the final numbers behind
+    write_snapshot();
+}
+
+void Stats_exporter::write_snapshot() const
+{
+    fs::path temp_path = m_path;
+    temp_path += ".tmp";
+    {
+        std::ofstream file(temp_path, std::ios::trunc);
+        if (!file)
+        {
+            return;
+        }
+        file << snapshot(m_sources) << "\n";
+    }
+    std::error_code ec;
+    fs::rename(temp_path, m_path, ec);
+}
+
+std::string Stats_exporter::snapshot(const std::vector<std::pair<std::string, const Transfer_stats *>> &sources)
+{
+    std::string json = "{";
+    for (size_t i = 0; i < sources.size(); i++)
+    {
+        json += (i == 0 ? "\"" : ",\"") + sources[i].first + "\":" + sources[i].second->to_json();
+    }
+    return json + "}";
+}
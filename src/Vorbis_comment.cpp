@@ -0,0 +1,140 @@
+#include "Vorbis_comment.hpp"
+
+#include <algorithm>
+#include <cctype>
+
+#include "Flac_metadata.hpp"
+
+Vorbis_comment &Vorbis_comment::operator=(const Vorbis_comment &other)
+{
+    if (this != &other)
+    {
+        m_block = other.m_block;
+        m_comments.clear();
+        m_vendor = {};
+        m_parsed = false;
+    }
+    return *this;
+}
+
+Vorbis_comment &Vorbis_comment::operator=(Vorbis_comment &&other) noexcept
+{
+    if (this != &other)
+    {
+        m_block = std::move(other.m_block);
+        m_comments.clear();
+        m_vendor = {};
+        m_parsed = false;
+        other.reset();
+    }
+    return *this;
+}
+
+void Vorbis_comment::reset()
+{
+    m_block.clear();
+    m_comments.clear();
+    m_vendor = {};
+    m_parsed = false;
+}
+
+void Vorbis_comment::parse() const
+{
+    m_parsed = true;
+    m_comments.clear();
+    m_vendor = {};
+
+    // all lengths are 32-bit little-endian
+    std::string_view block(m_block);
+    if (block.size() < 4 || block.size() - 4 < Flac_metadata::read_le32(block.data()))
+    {
+        return;
+    }
+    m_vendor = block.substr(4, Flac_metadata::read_le32(block.data()));
+    block.remove_prefix(4 + m_vendor.size());
+
+    if (block.size() < 4)
+    {
+        return;
+    }
+    uint32_t comment_count = Flac_metadata::read_le32(block.data());
+    block.remove_prefix(4);
+    // every entry takes at least 4 bytes, so a corrupt count can't reserve much
+    m_comments.reserve(std::min<size_t>(comment_count, block.size() / 4));
+
+    for (uint32_t i = 0; i < comment_count; i++)
+    {
+        if (block.size() < 4 || block.size() - 4 < Flac_metadata::read_le32(block.data()))
+        {
+            return;
+        }
+        std::string_view comment = block.substr(4, Flac_metadata::read_le32(block.data()));
+        block.remove_prefix(4 + comment.size());
+
+        size_t delimiter_pos = comment.find('=');
+        if (delimiter_pos != std::string_view::npos)
+        {
+            m_comments.emplace_back(comment.substr(0, delimiter_pos), comment.substr(delimiter_pos + 1));
+        }
+    }
+}
+
+std::string_view Vorbis_comment::vendor() const
+{
+    if (!m_parsed)
+    {
+        parse();
+    }
+    return m_vendor;
+}
+
+const std::vector<Vorbis_comment::Comment> &Vorbis_comment::comments() const
+{
+    if (!m_parsed)
+    {
+        parse();
+    }
+    return m_comments;
+}
+
+std::optional<std::string_view> Vorbis_comment::find(std::string_view name) const
+{
+    for (const auto &[key, value] : comments())
+    {
+        if (names_equal(key, name))
+        {
+            return value;
+        }
+    }
+    return std::nullopt;
+}
+
+std::vector<std::string_view> Vorbis_comment::find_all(std::string_view name) const
+{
+    std::vector<std::string_view> values;
+    for (const auto &[key, value] : comments())
+    {
+        if (names_equal(key, name))
+        {
+            values.push_back(value);
+        }
+    }
+    return values;
+}
+
+bool Vorbis_comment::names_equal(std::string_view a, std::string_view b)
+{
+    // field names are restricted to printable ASCII, so a byte-wise fold is enough
+    if (a.size() != b.size())
+    {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        if (std::toupper(static_cast<unsigned char>(a[i])) != std::toupper(static_cast<unsigned char>(b[i])))
+        {
+            return false;
+        }
+    }
+    return true;
+}
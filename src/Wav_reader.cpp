@@ -0,0 +1,120 @@
+#include "Wav_reader.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+    constexpr uint16_t FORMAT_PCM = 1;
+    constexpr uint16_t FORMAT_EXTENSIBLE = 0xFFFE;
+
+    uint32_t get_le(const char *data, size_t bytes)
+    {
+        uint32_t value = 0;
+        for (size_t i = 0; i < bytes; i++)
+        {
+            value |= uint32_t(static_cast<uint8_t>(data[i])) << (8 * i);
+        }
+        return value;
+    }
+}
+
+void Wav_reader::open(const std::filesystem::path &path)
+{
+    m_file.close();
+    m_file.clear();
+    m_file.open(path, std::ios::binary);
+    if (!m_file)
+    {
+        throw std::runtime_error("Cannot open " + path.string());
+    }
+
+    char riff[12];
+    if (!m_file.read(riff, sizeof(riff)) || std::memcmp(riff, "RIFF", 4) != 0 || std::memcmp(riff + 8, "WAVE", 4) != 0)
+    {
+        throw std::runtime_error(path.string() + " is not a WAV file");
+    }
+
+    bool found_format = false;
+    while (true)
+    {
+        char chunk[8];
+        if (!m_file.read(chunk, sizeof(chunk)))
+        {
+            throw std::runtime_error(path.string() + " has no data chunk");
+        }
+        uint32_t size = get_le(chunk + 4, 4);
+
+        if (std::memcmp(chunk, "fmt ", 4) == 0)
+        {
+            std::vector<char> format(size);
+            if (size < 16 || !m_file.read(format.data(), size))
+            {
+                throw std::runtime_error(path.string() + " has a malformed fmt chunk");
+            }
+            uint16_t tag = get_le(format.data(), 2);
+            if (tag == FORMAT_EXTENSIBLE && size >= 26)
+            {
+                // the first two bytes of the sub-format GUID carry the actual format
+                tag = get_le(format.data() + 24, 2);
+            }
+            m_channels = get_le(format.data() + 2, 2);
+            m_sample_rate = get_le(format.data() + 4, 4);
+            m_bits_per_sample = get_le(format.data() + 14, 2);
+            m_bytes_per_sample = (m_bits_per_sample + 7) / 8;
+            if (tag != FORMAT_PCM || m_channels == 0 || m_channels > 8 || m_bits_per_sample < 8 ||
+                m_bits_per_sample > 32 || m_sample_rate == 0)
+            {
+                throw std::runtime_error(path.string() + " isn't 8 to 32-bit integer PCM with up to 8 channels");
+            }
+            found_format = true;
+            m_file.seekg(size & 1, std::ios::cur);
+        }
+        else if (std::memcmp(chunk, "data", 4) == 0)
+        {
+            if (!found_format)
+            {
+                throw std::runtime_error(path.string() + " has data before its fmt chunk");
+            }
+            // streamed WAVs leave the size at its maximum; they run to the end of the file
+            m_total_frames = size == UINT32_MAX ? 0 : size / (m_channels * m_bytes_per_sample);
+            m_frames_left = size == UINT32_MAX ? UINT64_MAX : m_total_frames;
+            return;
+        }
+        else
+        {
+            // chunks are padded to an even size
+            m_file.seekg(size + (size & 1), std::ios::cur);
+        }
+    }
+}
+
+size_t Wav_reader::read(std::vector<int32_t> &samples, size_t frames)
+{
+    frames = static_cast<size_t>(std::min<uint64_t>(frames, m_frames_left));
+    size_t frame_bytes = m_channels * m_bytes_per_sample;
+    m_read_buffer.resize(frames * frame_bytes);
+    m_file.read(m_read_buffer.data(), m_read_buffer.size());
+    frames = m_file.gcount() / frame_bytes;
+    m_frames_left = m_file ? m_frames_left - frames : 0;
+
+    // 8-bit WAV is unsigned, everything wider is signed
+    size_t count = frames * m_channels;
+    samples.resize(count);
+    const char *in = m_read_buffer.data();
+    uint32_t shift = 32 - 8 * m_bytes_per_sample;
+    for (size_t i = 0; i < count; i++)
+    {
+        uint32_t value = get_le(in, m_bytes_per_sample);
+        if (m_bytes_per_sample == 1)
+        {
+            value ^= 0x80;
+        }
+        // sign-extend from the container width, then drop the padding bits below the depth
+        int32_t sample = static_cast<int32_t>(value << shift) >> shift;
+        samples[i] = sample >> (8 * m_bytes_per_sample - m_bits_per_sample);
+        in += m_bytes_per_sample;
+    }
+    return frames;
+}
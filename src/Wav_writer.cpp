@@ -0,0 +1,116 @@
+#include "Wav_writer.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace
+{
+    constexpr size_t WAV_HEADER_SIZE = 44;
+
+    void put_le(char *out, uint32_t value, size_t bytes)
+    {
+        for (size_t i = 0; i < bytes; i++)
+        {
+            out[i] = static_cast<char>(value >> (8 * i));
+        }
+    }
+}
+
+void Wav_writer::open(const std::filesystem::path &path, uint32_t sample_rate, uint8_t channels, uint8_t bits_per_sample, bool raw)
+{
+    close();
+    m_file.open(path, std::ios::binary | std::ios::trunc);
+    if (!m_file)
+    {
+        throw std::runtime_error("Cannot create " + path.string());
+    }
+    m_sample_rate = sample_rate;
+    m_channels = channels;
+    m_bytes_per_sample = (bits_per_sample + 7) / 8;
+    m_raw = raw;
+    m_data_bytes = 0;
+    if (!m_raw)
+    {
+        // sizes are patched in by close()
+        write_header();
+    }
+}
+
+void Wav_writer::write_header()
+{
+    char header[WAV_HEADER_SIZE];
+    uint32_t data_size = static_cast<uint32_t>(std::min<uint64_t>(m_data_bytes, UINT32_MAX - 36));
+    uint32_t block_align = m_channels * m_bytes_per_sample;
+
+    std::copy_n("RIFF", 4, header);
+    put_le(header + 4, 36 + data_size + (data_size & 1), 4); // odd data is padded
+    std::copy_n("WAVEfmt ", 8, header + 8);
+    put_le(header + 16, 16, 4);                                 // fmt chunk size
+    put_le(header + 20, 1, 2);                                  // PCM
+    put_le(header + 22, m_channels, 2);
+    put_le(header + 24, m_sample_rate, 4);
+    put_le(header + 28, m_sample_rate * block_align, 4);        // byte rate
+    put_le(header + 32, block_align, 2);
+    put_le(header + 34, m_bytes_per_sample * 8, 2);
+    std::copy_n("data", 4, header + 36);
+    put_le(header + 40, data_size, 4);
+    m_file.write(header, sizeof(header));
+}
+
+void Wav_writer::write(const buffer_sample_type *samples, size_t count)
+{
+    // 8-bit WAV is unsigned, everything wider is signed
+    uint32_t shift = 32 - 8 * m_bytes_per_sample;
+    m_pack_buffer.resize(count * m_bytes_per_sample);
+    char *out = m_pack_buffer.data();
+    for (size_t i = 0; i < count; i++)
+    {
+        uint32_t value = static_cast<uint32_t>(static_cast<int32_t>(samples[i]) >> shift);
+        if (m_bytes_per_sample == 1)
+        {
+            value ^= 0x80;
+        }
+        put_le(out, value, m_bytes_per_sample);
+        out += m_bytes_per_sample;
+    }
+    m_file.write(m_pack_buffer.data(), m_pack_buffer.size());
+    m_data_bytes += m_pack_buffer.size();
+}
+
+bool Wav_writer::write_bytes(const char *data, size_t size)
+{
+    m_file.write(data, size);
+    m_data_bytes += size;
+    return static_cast<bool>(m_file);
+}
+
+void Wav_writer::update_header()
+{
+    if (!m_file.is_open() || m_raw)
+    {
+        return;
+    }
+    std::streampos end = m_file.tellp();
+    m_file.seekp(0);
+    write_header();
+    m_file.seekp(end);
+    m_file.flush();
+}
+
+void Wav_writer::close()
+{
+    if (!m_file.is_open())
+    {
+        return;
+    }
+    if (!m_raw)
+    {
+        if (m_data_bytes & 1)
+        {
+            m_file.put('\0');
+        }
+        m_file.seekp(0);
+        write_header();
+    }
+    m_file.close();
+}
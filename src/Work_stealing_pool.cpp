@@ -0,0 +1,143 @@
+#include "Work_stealing_pool.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+namespace
+{
+    // the pool and worker index of the current thread, for submissions from a task
+    thread_local const Work_stealing_pool *current_pool = nullptr;
+    thread_local size_t current_worker = 0;
+}
+
+Work_stealing_pool::Work_stealing_pool(size_t threads)
+{
+    if (threads == 0)
+    {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < threads; i++)
+    {
+        m_workers.push_back(std::make_unique<Worker>());
+    }
+    for (size_t i = 0; i < threads; i++)
+    {
+        m_workers[i]->thread = std::thread(&Work_stealing_pool::run, this, i);
+    }
+}
+
+Work_stealing_pool::~Work_stealing_pool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_work_cv.notify_all();
+    for (auto &worker : m_workers)
+    {
+        worker->thread.join();
+    }
+}
+
+void Work_stealing_pool::submit(Task task)
+{
+    size_t index = current_pool == this ? current_worker
+                                        : m_next_worker.fetch_add(1, std::memory_order_relaxed) % m_workers.size();
+    {
+        // counted before it is queued, so no count ever drops below zero while a
+        // worker takes the task right away
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pending++;
+        m_queued++;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_workers[index]->mutex);
+        m_workers[index]->tasks.push_back(std::move(task));
+    }
+    m_work_cv.notify_one();
+}
+
+void Work_stealing_pool::wait()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_idle_cv.wait(lock, [this]
+                   { return m_pending == 0; });
+}
+
+bool Work_stealing_pool::take(size_t index, Task &task)
+{
+    {
+        Worker &own = *m_workers[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty())
+        {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+    for (size_t i = 1; i < m_workers.size(); i++)
+    {
+        Worker &victim = *m_workers[(index + i) % m_workers.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty())
+        {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            m_workers[index]->stolen.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+void Work_stealing_pool::run(size_t index)
+{
+    current_pool = this;
+    current_worker = index;
+    Worker &worker = *m_workers[index];
+
+    while (true)
+    {
+        Task task;
+        if (take(index, task))
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_queued--;
+            }
+            auto start = std::chrono::steady_clock::now();
+            task(index);
+            worker.busy_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count(),
+                                     std::memory_order_relaxed);
+            worker.executed.fetch_add(1, std::memory_order_relaxed);
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (--m_pending == 0)
+            {
+                m_idle_cv.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_work_cv.wait(lock, [this]
+                       { return m_stop || m_queued > 0; });
+        if (m_stop && m_queued == 0)
+        {
+            return;
+        }
+    }
+}
+
+std::vector<Work_stealing_pool::Worker_stats> Work_stealing_pool::stats() const
+{
+    std::vector<Worker_stats> stats;
+    for (const auto &worker : m_workers)
+    {
+        stats.push_back({worker->executed.load(std::memory_order_relaxed),
+                         worker->stolen.load(std::memory_order_relaxed),
+                         worker->busy_ns.load(std::memory_order_relaxed)});
+    }
+    return stats;
+}
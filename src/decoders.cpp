@@ -1,59 +1,81 @@
 #include "decoders.hpp"
 
-uint64_t decode_utf8(std::ifstream &file_stream)
+namespace
 {
-    unsigned char first_byte;
-    file_stream.read(reinterpret_cast<char *>(&first_byte), 1);
-
-    static const struct
+    template <typename Next_byte>
+    uint64_t decode_utf8_bytes(Next_byte next_byte)
     {
-        uint8_t mask;
-        uint8_t match;
-        uint8_t bits;
-    } utf8_masks[] = {
-        {0x80, 0x00, 0},
-        {0xE0, 0xC0, 1},
-        {0xF0, 0xE0, 2},
-        {0xF8, 0xF0, 3},
-        {0xFC, 0xF8, 4},
-        {0xFE, 0xFC, 5},
-        {0xFF, 0xFE, 6}};
+        unsigned char first_byte = next_byte();
 
-    uint64_t code_point = 0;
-    size_t additional_bytes = 0;
+        static const struct
+        {
+            uint8_t mask;
+            uint8_t match;
+            uint8_t bits;
+        } utf8_masks[] = {
+            {0x80, 0x00, 0},
+            {0xE0, 0xC0, 1},
+            {0xF0, 0xE0, 2},
+            {0xF8, 0xF0, 3},
+            {0xFC, 0xF8, 4},
+            {0xFE, 0xFC, 5},
+            {0xFF, 0xFE, 6}};
 
-    for (const auto &mask : utf8_masks)
-    {
-        if ((first_byte & mask.mask) == mask.match)
+        uint64_t code_point = 0;
+        size_t additional_bytes = 0;
+
+        for (const auto &mask : utf8_masks)
         {
-            code_point = first_byte & ~mask.mask; // Strip the prefix bits
-            additional_bytes = mask.bits;
-            break;
+            if ((first_byte & mask.mask) == mask.match)
+            {
+                code_point = first_byte & ~mask.mask; // Strip the prefix bits
+                additional_bytes = mask.bits;
+                break;
+            }
         }
-    }
 
-    if (additional_bytes > 6)
-    {
-        throw std::runtime_error("Invalid UTF-8 encoding: too many bytes");
-    }
-
-    for (size_t i = 0; i < additional_bytes; ++i)
-    {
-        unsigned char next_byte;
-        file_stream.read(reinterpret_cast<char *>(&next_byte), 1);
+        if (additional_bytes > 6)
+        {
+            throw std::runtime_error("Invalid UTF-8 encoding: too many bytes");
+        }
 
-        if ((next_byte & 0xC0) != 0x80)
+        for (size_t i = 0; i < additional_bytes; ++i)
         {
-            throw std::runtime_error("Invalid continuation byte in UTF-8");
+            unsigned char continuation = next_byte();
+
+            if ((continuation & 0xC0) != 0x80)
+            {
+                throw std::runtime_error("Invalid continuation byte in UTF-8");
+            }
+
+            code_point = (code_point << 6) | (continuation & 0x3F);
         }
 
-        code_point = (code_point << 6) | (next_byte & 0x3F);
+        return code_point;
     }
+}
+
+uint64_t decode_utf8(std::istream &file_stream)
+{
+    auto next_byte = [&]()
+    {
+        unsigned char byte;
+        file_stream.read(reinterpret_cast<char *>(&byte), 1);
+        return byte;
+    };
+    return decode_utf8_bytes(next_byte);
+}
 
-    return code_point;
+uint64_t decode_utf8(Bit_reader<std::istream> &reader)
+{
+    auto next_byte = [&]()
+    {
+        return static_cast<unsigned char>(reader.read_bits_unsigned(8));
+    };
+    return decode_utf8_bytes(next_byte);
 }
 
-uint64_t decode_unary(Bit_reader<std::ifstream> &reader)
+uint64_t decode_unary(Bit_reader<std::istream> &reader)
 {
     uint64_t result = 0;
 
@@ -64,7 +86,7 @@ uint64_t decode_unary(Bit_reader<std::ifstream> &reader)
     return result;
 }
 
-int64_t decode_and_unfold_rice(uint8_t rice_parameter, Bit_reader<std::ifstream> &reader)
+int64_t decode_and_unfold_rice(uint8_t rice_parameter, Bit_reader<std::istream> &reader)
 {
     uint64_t quotient = decode_unary(reader);
     uint64_t remainder = reader.read_bits_unsigned(rice_parameter);
@@ -1,48 +1,125 @@
+#include "Alsa_sink.hpp"
 #include "File_client.hpp"
+#include "File_server.hpp"
 #include "Flac.hpp"
+#include "Load_generator.hpp"
+#include "Metadata_peek.hpp"
+#include "Playback_engine.hpp"
+#include "Prefetcher.hpp"
+#include "Server_discovery.hpp"
+#include "Transfer_stats.hpp"
 #include <algorithm>
-#include <alsa/asoundlib.h>
-#include <atomic>
 #include <csignal>
 #include <cstdlib>
 #include <fstream>
 #include <functional>
+#include <iomanip>
 #include <iostream>
 #include <sstream>
 #include <stdio.h>
+#include <strings.h>
 #include <termios.h>
-#include <thread>
 #include <unistd.h>
 
 const std::string DEFAULT_SAVE_PATH = "../temp";
 const std::string PCM_DEVICE = "default";
-
-std::vector<int32_t> convert_to_32bit(const std::vector<int64_t> &buffer)
-{
-    std::vector<int32_t> converted_buffer;
-    converted_buffer.reserve(buffer.size());
-
-    for (const auto &sample : buffer)
-    {
-        converted_buffer.push_back(static_cast<int32_t>(sample));
-    }
-
-    return converted_buffer;
-}
+const Resampler_quality RESAMPLER_QUALITY = Resampler_quality::BALANCED; // when the device won't run at the track's rate
+const Replay_gain_mode REPLAY_GAIN_MODE = Replay_gain_mode::TRACK; // from the REPLAYGAIN_* tags
+const double REPLAY_GAIN_PREAMP_DB = 0;
+const size_t PREFETCH_DEPTH = 2;                    // queued tracks downloaded ahead of time
+const size_t PREFETCH_RATE_LIMIT = 2 * 1024 * 1024; // bytes per second
+const size_t METADATA_CONNECTIONS = 4; // parallel ranged requests for track details
+const size_t MAX_METADATA_PEEKS = 256;  // per listing, the rest is shown without details
+const char *STATS_FILE_ENV = "AUDIO_CLIENT_STATS_FILE";   // periodic JSON snapshot of the transfer stats
+const char *REALTIME_ENV = "AUDIO_CLIENT_REALTIME";       // "1" plays on a SCHED_FIFO thread with locked memory
+const char *FLAC_LEVEL_ENV = "AUDIO_CLIENT_FLAC_LEVEL";   // 0-8, compression level for WAVs that are sent
+const char *SINK_ENV = "AUDIO_CLIENT_SINK";               // "alsa:DEVICE", or a sink without sound card, see make_headless_sink
+const int REALTIME_PRIORITY = 70;
+const auto STATS_INTERVAL = std::chrono::seconds(10);
 
 inline void show_command_list()
 {
     std::cout << "\nCommands:\n"
-              << "list - List available files\n"
-              << "send <filename> - Send a file to the server\n"
-              << "play <filename> - Play a file\n"
+              << "list [prefix] - List available files\n"
+              << "send <filename> - Send a file to the server, WAVs encoded to FLAC\n"
+              << "play <filename> [track] - Play a file, from a track of its cue sheet\n"
+              << "queue <filename> - Add a file to the play queue\n"
+              << "next - Play the queued files\n"
+              << "stats - Show transfer and playback statistics as JSON\n"
               << "exit - Quit the program\n"
               << "\nPlayback Controls:\n"
               << "Press 'p' to pause/resume playback\n"
               << "Press 's' or 'q' to stop playback\n"
+              << "Press 'n' or 'b' for the next or previous track of a cue sheet\n"
+              << "Press '+' or '-' to change the volume\n"
               << "\nEnter command: ";
 }
 
+// Fetches duration and tags of the listed FLAC files that the catalog doesn't know yet
+void peek_catalog_details(Remote_catalog &catalog, Metadata_peeker &peeker, const std::string &prefix)
+{
+    std::vector<std::string> names;
+    for (const auto &entry : catalog.find_prefix(prefix))
+    {
+        if (!entry.duration && entry.name.ends_with(".flac") && names.size() < MAX_METADATA_PEEKS)
+        {
+            names.push_back(entry.name);
+        }
+    }
+
+    for (auto &result : peeker.peek_all(names))
+    {
+        if (!result.success)
+        {
+            continue;
+        }
+        std::vector<std::pair<std::string, std::string>> tags;
+        for (auto [name, value] : result.metadata.vorbis_comment.comments())
+        {
+            tags.emplace_back(name, value);
+        }
+        catalog.set_details(result.filename, result.metadata.duration(), std::move(tags));
+    }
+}
+
+void show_catalog(const Remote_catalog &catalog, const std::string &prefix)
+{
+    auto matches = catalog.find_prefix(prefix);
+    if (matches.empty())
+    {
+        std::cout << "No files available" << std::endl;
+        return;
+    }
+
+    std::cout << "Available files:\n";
+    for (const auto &entry : matches)
+    {
+        std::cout << entry.name;
+        if (entry.duration)
+        {
+            int seconds = static_cast<int>(*entry.duration + 0.5);
+            std::cout << "  [" << seconds / 60 << ":" << (seconds % 60 < 10 ? "0" : "") << seconds % 60 << "]";
+        }
+
+        std::string artist;
+        std::string title;
+        for (const auto &[key, value] : entry.tags)
+        {
+            // field names are case-insensitive
+            if (strcasecmp(key.c_str(), "ARTIST") == 0)
+                artist = value;
+            else if (strcasecmp(key.c_str(), "TITLE") == 0)
+                title = value;
+        }
+        if (!title.empty())
+        {
+            std::cout << "  " << (artist.empty() ? "" : artist + " - ") << title;
+        }
+        std::cout << "\n";
+    }
+    std::cout << std::flush;
+}
+
 void clear_temp_directory()
 {
     fs::path dir_path = DEFAULT_SAVE_PATH; // Hardcoded relative path
@@ -64,177 +141,361 @@ void handle_signal(int signal)
     }
 }
 
-void handleAlsaError(int error, const std::string &message, snd_pcm_t *handle = nullptr)
+// Plays first and whatever next_item hands out on the engine, with the keyboard
+// controls. Keys are read by the engine's playback loop, which polls stdin next to
+// the device. Returns false when the user stopped playback.
+bool playAudio(Playback_engine &engine, Playback_item first, const Playback_engine::Next_item &next_item,
+               const Playback_engine::Item_finished &on_finished)
 {
-    if (error < 0)
+    Playback_controls controls;
+    controls.input_fd = STDIN_FILENO;
+    controls.on_input = [&controls]()
     {
-        std::cerr << message << ": " << snd_strerror(error) << "\n";
-        if (handle)
+        char c;
+        if (read(STDIN_FILENO, &c, 1) <= 0)
         {
-            snd_pcm_close(handle);
+            return;
         }
-        throw std::runtime_error(message);
-    }
-}
+        if (c == 'p')
+        {
+            controls.paused = !controls.paused;
+        }
+        else if (c == 'n' || c == 'b')
+        {
+            controls.track_step += c == 'n' ? 1 : -1;
+        }
+        else if (c == '+' || c == '=' || c == '-')
+        {
+            controls.volume_step += c == '-' ? -1 : 1;
+        }
+        else if (c == 's' || c == 'q')
+        {
+            controls.stop = true;
+            std::cout << "Playback stopped" << std::endl;
+        }
+    };
 
-void playAudio(const std::string &filename)
-{
-    std::ifstream flac_stream(filename, std::ios::binary);
-    Flac player(flac_stream);
-    player.initialize();
-    int sample_rate = player.get_stream_info().sample_rate;
-    int channels = player.get_stream_info().channels;
-
-    std::cout << "Now Playing: " << "\n";
-    const auto &comments = player.get_vorbis_comment().user_comments;
-    auto it = comments.find("ARTIST");
-    if (it != comments.end())
-    {
-        std::cout << "Artist: " << it->second << "\n";
-    }
-    else
-    {
-        std::cout << "Track Title not found.\n";
-    }
-    it = comments.find("TITLE");
-    if (it != comments.end())
+    // Disable canonical mode and echo so single key presses come through
+    struct termios old_tio, new_tio;
+    tcgetattr(STDIN_FILENO, &old_tio);
+    new_tio = old_tio;
+    new_tio.c_lflag &= (~ICANON & ~ECHO);
+    tcsetattr(STDIN_FILENO, TCSANOW, &new_tio);
+
+    bool completed = false;
+    try
     {
-        std::cout << "Track Title: " << it->second << "\n";
+        completed = engine.play(std::move(first), next_item, on_finished, controls);
     }
-    else
+    catch (...)
     {
-        std::cout << "Track Title not found.\n";
+        tcsetattr(STDIN_FILENO, TCSANOW, &old_tio);
+        throw;
     }
 
-    snd_pcm_t *handle;
-    snd_pcm_hw_params_t *params;
-
-    // Open PCM device for playback
-    handleAlsaError(snd_pcm_open(&handle, PCM_DEVICE.c_str(), SND_PCM_STREAM_PLAYBACK, 0), "Cannot open audio device");
-
-    // Allocate hardware parameters object
-    snd_pcm_hw_params_alloca(&params);
-
-    // Fill params with default values
-    handleAlsaError(snd_pcm_hw_params_any(handle, params), "Cannot configure audio device", handle);
-
-    // Set parameters
-    handleAlsaError(snd_pcm_hw_params_set_access(handle, params, SND_PCM_ACCESS_RW_INTERLEAVED), "Cannot set access type", handle);
-    handleAlsaError(snd_pcm_hw_params_set_format(handle, params, SND_PCM_FORMAT_S32_LE), "Cannot set sample format", handle);
-    handleAlsaError(snd_pcm_hw_params_set_channels(handle, params, channels), "Cannot set channel count", handle);
-
-    // Set sample rate
-    unsigned int actual_rate = sample_rate;
-    handleAlsaError(snd_pcm_hw_params_set_rate_near(handle, params, &actual_rate, 0), "Cannot set sample rate", handle);
-
-    // Set buffer size
-    snd_pcm_uframes_t buffer_size = sample_rate; // 1 second buffer
-    handleAlsaError(snd_pcm_hw_params_set_buffer_size_near(handle, params, &buffer_size), "Cannot set buffer size", handle);
-
-    // Apply hardware parameters
-    handleAlsaError(snd_pcm_hw_params(handle, params), "Cannot set parameters", handle);
-
-    // Atomic flag to control pause state
-    std::atomic<bool> is_paused(false);
-    std::atomic<bool> stop_playback(false);
-    std::atomic<bool> stop_input_thread(false);
+    // Restore the old terminal settings
+    tcsetattr(STDIN_FILENO, TCSANOW, &old_tio);
+    return completed;
+}
 
-    // Input handling thread
-    std::thread input_thread([&]()
-                             {
-    struct termios old_tio, new_tio;
-    
-    // Get the terminal settings
-    tcgetattr(STDIN_FILENO, &old_tio);
-    
-    // Make a copy to modify
-    new_tio = old_tio;
-    
-    // Disable canonical mode and echo
-    new_tio.c_lflag &= (~ICANON & ~ECHO);
-    
-    // Set the new settings immediately
-    tcsetattr(STDIN_FILENO, TCSANOW, &new_tio);
-    
-    while (!stop_input_thread) {
-        fd_set fds;
-        struct timeval tv;
-        
-        FD_ZERO(&fds);
-        FD_SET(STDIN_FILENO, &fds);
-        
-        // Set timeout to 100ms
-        tv.tv_sec = 0;
-        tv.tv_usec = 100000;
-        
-        // Check for input
-        if (select(STDIN_FILENO + 1, &fds, NULL, NULL, &tv) > 0) {
-            char c;
-            if (read(STDIN_FILENO, &c, 1) > 0) {
-                if (c == 'p') {
-                    is_paused = !is_paused;
-                    snd_pcm_pause(handle, is_paused);
-                    std::cout << (is_paused ? "Paused" : "Resumed") << std::endl;
-                } else if (c == 's' || c == 'q') {
-                    stop_playback = true;
-                    stop_input_thread = true;
-                    snd_pcm_drop(handle);
-                    std::cout << "Playback stopped" << std::endl;
+// Non-interactive load mode for capacity tests:
+//   audio_client --load [--server <ip>:<port>] [--sessions <n>] [--duration <s> | --operations <n>]
+//                [--mix list=1,get=8,put=1] [--size <bytes>] [--files <n>] [--json]
+// Without --server the load goes to an in-process File_server on a temporary
+// directory, so the numbers can be taken offline; it shares the machine with the
+// sessions, so a server of its own gives the truer capacity.
+int run_load(int argc, char *argv[])
+{
+    Load_options options;
+    bool json = false;
+    bool usage = false;
+    try
+    {
+        for (int i = 2; i < argc; i++)
+        {
+            std::string arg = argv[i];
+            bool has_value = i + 1 < argc;
+            if (arg == "--server" && has_value)
+            {
+                std::string address = argv[++i];
+                size_t colon = address.rfind(':');
+                if (colon == std::string::npos)
+                {
+                    usage = true;
                     break;
                 }
+                options.ip = address.substr(0, colon);
+                options.port = std::stoi(address.substr(colon + 1));
+            }
+            else if (arg == "--sessions" && has_value)
+            {
+                options.sessions = std::stoul(argv[++i]);
+            }
+            else if (arg == "--duration" && has_value)
+            {
+                options.duration = std::chrono::milliseconds(static_cast<int64_t>(std::stod(argv[++i]) * 1000));
+            }
+            else if (arg == "--operations" && has_value)
+            {
+                options.operations = std::stoull(argv[++i]);
+            }
+            else if (arg == "--mix" && has_value)
+            {
+                // name=weight pairs; commands that are left out aren't sent
+                options.mix = {0, 0, 0};
+                std::stringstream mix(argv[++i]);
+                std::string entry;
+                while (std::getline(mix, entry, ','))
+                {
+                    size_t equals = entry.find('=');
+                    std::string name = entry.substr(0, equals);
+                    unsigned int weight = equals == std::string::npos ? 1 : std::stoul(entry.substr(equals + 1));
+                    size_t kind = name == "list" ? 0 : name == "get" ? 1 : name == "put" ? 2 : 3;
+                    if (kind == 3)
+                    {
+                        usage = true;
+                        break;
+                    }
+                    options.mix[kind] = weight;
+                }
+            }
+            else if (arg == "--size" && has_value)
+            {
+                options.file_size = std::stoul(argv[++i]);
+            }
+            else if (arg == "--files" && has_value)
+            {
+                options.file_count = std::stoul(argv[++i]);
+            }
+            else if (arg == "--json")
+            {
+                json = true;
+            }
+            else
+            {
+                usage = true;
             }
         }
     }
-    
-    // Restore the old terminal settings
-    tcsetattr(STDIN_FILENO, TCSANOW, &old_tio); });
+    catch (const std::exception &)
+    {
+        usage = true;
+    }
+    if (usage)
+    {
+        std::cerr << "Usage: " << argv[0] << " --load [--server <ip>:<port>] [--sessions <n>] [--duration <s> | --operations <n>]"
+                  << " [--mix list=1,get=8,put=1] [--size <bytes>] [--files <n>] [--json]" << std::endl;
+        return 1;
+    }
 
-    // Main playback loop
-    while (!player.get_reader().eos() && !stop_playback)
+    std::optional<File_server> server;
+    fs::path served_dir = fs::temp_directory_path() / ("audio_client_load_" + std::to_string(getpid()));
+    int status = 0;
+    try
     {
-        if (!is_paused)
+        if (options.port == 0)
         {
-            player.decode_frame();
-            std::vector<int32_t> buffer = convert_to_32bit(player.get_audio_buffer());
+            fs::create_directories(served_dir);
+            server.emplace(served_dir);
+            server->start();
+            options.port = server->get_port();
+        }
+        if (!json)
+        {
+            std::cout << "Load on " << options.ip << ":" << options.port << (server ? " (in-process server)" : "") << ": "
+                      << options.sessions << " sessions, ";
+            if (options.operations > 0)
+            {
+                std::cout << options.operations << " operations" << std::endl;
+            }
+            else
+            {
+                std::cout << options.duration.count() / 1000.0 << " s" << std::endl;
+            }
+        }
 
-            snd_pcm_sframes_t frames = snd_pcm_writei(handle, buffer.data(), buffer.size() / channels);
-            if (frames < 0)
+        Load_generator generator(options);
+        Load_report report = generator.run();
+        for (const Load_report::Command &command : report.commands)
+        {
+            if (command.failed > 0)
             {
-                frames = snd_pcm_recover(handle, frames, 0);
-                if (frames < 0)
-                {
-                    std::cerr << "Write failed: " << snd_strerror(frames) << "\n";
-                    break;
-                }
+                status = 1;
             }
         }
+
+        if (json)
+        {
+            std::cout << report.to_json() << "\n";
+        }
         else
         {
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            std::cout << "\n"
+                      << report.operations() << " operations in " << std::fixed << std::setprecision(2) << report.seconds << " s, "
+                      << std::setprecision(1) << report.operations_per_second() << " ops/s\n\n"
+                      << std::left << std::setw(8) << "command" << std::right << std::setw(10) << "ops" << std::setw(8) << "failed"
+                      << std::setw(10) << "ops/s" << std::setw(10) << "MiB/s" << std::setw(10) << "p50 us" << std::setw(10) << "p99 us"
+                      << std::setw(10) << "p999 us" << std::setw(10) << "max us" << "\n";
+            for (Transfer_kind kind : {Transfer_kind::LIST, Transfer_kind::GET, Transfer_kind::PUT})
+            {
+                const Load_report::Command &command = report.commands[static_cast<size_t>(kind)];
+                uint64_t count = command.succeeded + command.failed;
+                if (count == 0)
+                {
+                    continue;
+                }
+                std::cout << std::left << std::setw(8) << transfer_kind_name(kind) << std::right << std::setw(10) << count
+                          << std::setw(8) << command.failed << std::setw(10) << count / report.seconds << std::setw(10)
+                          << command.bytes / report.seconds / (1024 * 1024) << std::setw(10) << command.percentile(0.5)
+                          << std::setw(10) << command.percentile(0.99) << std::setw(10) << command.percentile(0.999)
+                          << std::setw(10) << (command.latency_us.empty() ? 0 : command.latency_us.back()) << "\n";
+            }
         }
+        std::cout << std::flush;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        status = 1;
     }
 
-    // Signal input thread to stop and wait for it
-    stop_playback = true;
-    stop_input_thread = true;
-    input_thread.join();
-
-    // Clean up
-    snd_pcm_drain(handle);
-    snd_pcm_close(handle);
+    if (server)
+    {
+        server->stop();
+        std::error_code ec;
+        fs::remove_all(served_dir, ec);
+    }
+    return status;
 }
 
-int main()
+int main(int argc, char *argv[])
 {
+    if (argc > 1 && std::string(argv[1]) == "--load")
+    {
+        return run_load(argc, argv);
+    }
     std::signal(SIGINT, handle_signal);
-    std::vector<char> file_list;
+    Remote_catalog catalog;
     try
     {
-        auto [server_ip, server_port] = File_client::discover_server();
+        // keeps listening for other servers in the background so clients can fail over
+        Server_discovery discovery;
+        auto [server_ip, server_port] = discovery.find_server();
         std::cout << "Found server at " << server_ip << ":" << server_port << std::endl;
 
         File_client client(server_ip, server_port);
-        client.list_files(file_list);
+        discovery.watch(client.get_transport());
+
+        Async_file_client metadata_client(server_ip, server_port, 1, METADATA_CONNECTIONS);
+        discovery.watch(metadata_client);
+        Metadata_peeker peeker(metadata_client);
+
+        if (client.refresh_catalog(catalog))
+        {
+            peek_catalog_details(catalog, peeker, "");
+            show_catalog(catalog, "");
+        }
+
+        Prefetcher prefetcher(server_ip, server_port, DEFAULT_SAVE_PATH, PREFETCH_DEPTH, PREFETCH_RATE_LIMIT);
+        discovery.watch(prefetcher.get_client().get_transport());
+
+        std::vector<std::pair<std::string, const Transfer_stats *>> stats_sources = {
+            {"foreground", &client.get_stats()},
+            {"prefetch", &prefetcher.get_client().get_stats()},
+            {"metadata", &metadata_client.get_stats()}};
+        std::unique_ptr<Stats_exporter> stats_exporter;
+        if (const char *stats_file = std::getenv(STATS_FILE_ENV); stats_file && *stats_file)
+        {
+            stats_exporter = std::make_unique<Stats_exporter>(stats_file, STATS_INTERVAL);
+            for (const auto &[name, stats] : stats_sources)
+            {
+                stats_exporter->add_source(name, *stats);
+            }
+            stats_exporter->start();
+        }
+
+        auto track_exists = [&](const std::string &filename)
+        {
+            return catalog.contains(filename);
+        };
+
+        // the sound card unless the environment picks another sink, e.g. to benchmark
+        // the pipeline on a machine without one
+        std::unique_ptr<Audio_sink> sink;
+        bool headless = false;
+        if (const char *spec = std::getenv(SINK_ENV); spec && *spec)
+        {
+            std::string sink_spec = spec;
+            if (sink_spec.starts_with("alsa:"))
+            {
+                sink = std::make_unique<Alsa_sink>(sink_spec.substr(5));
+            }
+            else if ((sink = make_headless_sink(sink_spec)))
+            {
+                headless = true;
+                std::cout << "Playing to " << sink->name() << std::endl;
+            }
+            else
+            {
+                std::cerr << "Unknown sink " << sink_spec << ", playing on " << PCM_DEVICE << std::endl;
+            }
+        }
+        if (!sink)
+        {
+            sink = std::make_unique<Alsa_sink>(PCM_DEVICE);
+        }
+
+        // the sink stays open between tracks and commands
+        Playback_engine engine(std::move(sink), RESAMPLER_QUALITY);
+        engine.set_replay_gain(REPLAY_GAIN_MODE, REPLAY_GAIN_PREAMP_DB);
+        if (const char *realtime = std::getenv(REALTIME_ENV); realtime && std::string(realtime) == "1")
+        {
+            engine.set_realtime(true, REALTIME_PRIORITY);
+        }
+
+        int flac_level = Encoder_settings::DEFAULT_LEVEL;
+        if (const char *level = std::getenv(FLAC_LEVEL_ENV); level && *level)
+        {
+            flac_level = std::atoi(level);
+        }
+
+        auto acquire_item = [&](const std::string &filename, int start_track = 0,
+                                const std::atomic<bool> *cancel = nullptr) -> std::optional<Playback_item>
+        {
+            auto fetch_start = std::chrono::steady_clock::now();
+            auto local_path = prefetcher.acquire(filename, client, cancel);
+            if (!local_path)
+            {
+                return std::nullopt;
+            }
+            return Playback_item{filename, *local_path, start_track, std::chrono::steady_clock::now() - fetch_start};
+        };
+        auto release_item = [&](const Playback_item &item)
+        {
+            prefetcher.release(item.name);
+        };
+
+        // without a sound card the point is the time each stage took
+        auto play_items = [&](Playback_item first, const Playback_engine::Next_item &next_item)
+        {
+            bool completed = playAudio(engine, std::move(first), next_item, release_item);
+            if (headless)
+            {
+                std::cout << "Pipeline: " << engine.stats().summary() << std::endl;
+            }
+            return completed;
+        };
+
+        auto play_track = [&](const std::string &filename, int start_track = 0)
+        {
+            auto item = acquire_item(filename, start_track);
+            if (!item)
+            {
+                return false;
+            }
+            return play_items(std::move(*item), [](const std::atomic<bool> *) -> std::optional<Playback_item>
+                              { return std::nullopt; });
+        };
 
         std::string command;
         while (true)
@@ -256,12 +517,26 @@ int main()
                 cmd_code = 3;
             else if (cmd == "exit")
                 cmd_code = 4;
+            else if (cmd == "queue")
+                cmd_code = 5;
+            else if (cmd == "next")
+                cmd_code = 6;
+            else if (cmd == "stats")
+                cmd_code = 7;
 
             switch (cmd_code)
             {
             case 1:
-                client.list_files(file_list);
+            {
+                std::string prefix;
+                iss >> prefix;
+                if (client.refresh_catalog(catalog))
+                {
+                    peek_catalog_details(catalog, peeker, prefix);
+                    show_catalog(catalog, prefix);
+                }
                 break;
+            }
             case 2:
             {
                 std::string filename;
@@ -271,7 +546,14 @@ int main()
                     std::cout << "Invalid command format" << std::endl;
                     continue;
                 }
-                client.upload_file(filename);
+                if (filename.ends_with(".wav"))
+                {
+                    client.upload_encoded(filename, Encoder_settings::for_level(flac_level));
+                }
+                else
+                {
+                    client.upload_file(filename);
+                }
                 break;
             }
             case 3:
@@ -283,20 +565,77 @@ int main()
                     std::cout << "Invalid command format" << std::endl;
                     continue;
                 }
-                if (std::search(file_list.begin(), file_list.end(), filename.begin(), filename.end()) == file_list.end())
+                if (!track_exists(filename))
                 {
                     std::cout << "File not found" << std::endl;
                     break;
                 }
-                client.download_file(filename, DEFAULT_SAVE_PATH);
-
-                playAudio(DEFAULT_SAVE_PATH + "/" + filename);
-                clear_temp_directory();
+                int start_track = 0;
+                iss >> start_track;
+                play_track(filename, start_track);
                 break;
             }
             case 4:
                 clear_temp_directory();
                 return 0;
+            case 5:
+            {
+                std::string filename;
+                iss >> filename;
+                if (filename.empty())
+                {
+                    std::cout << "Invalid command format" << std::endl;
+                    continue;
+                }
+                if (!track_exists(filename))
+                {
+                    std::cout << "File not found" << std::endl;
+                    break;
+                }
+                prefetcher.enqueue(filename);
+                std::cout << "Queued " << filename << " (" << prefetcher.queue_size() << " in queue)" << std::endl;
+                break;
+            }
+            case 6:
+            {
+                if (prefetcher.queue_size() == 0)
+                {
+                    std::cout << "Play queue is empty" << std::endl;
+                    break;
+                }
+                // play through the queue gaplessly until it runs out or the user stops playback
+                auto next_queued = [&](const std::atomic<bool> *cancel) -> std::optional<Playback_item>
+                {
+                    // once playback stops the rest of the queue stays queued
+                    while (!(cancel && *cancel))
+                    {
+                        auto next = prefetcher.pop_next();
+                        if (!next)
+                        {
+                            break;
+                        }
+                        if (auto item = acquire_item(*next, 0, cancel))
+                        {
+                            return item;
+                        }
+                        if (cancel && *cancel)
+                        {
+                            // stopped while it was being fetched, so it was never played
+                            prefetcher.requeue_front(*next);
+                        }
+                    }
+                    return std::nullopt;
+                };
+                if (auto first = next_queued(nullptr))
+                {
+                    play_items(std::move(*first), next_queued);
+                }
+                break;
+            }
+            case 7:
+                std::cout << Stats_exporter::snapshot(stats_sources) << "\n"
+                          << "{\"playback\":" << engine.stats().to_json() << "}" << std::endl;
+                break;
             default:
                 std::cout << "Unknown command" << std::endl;
                 break;
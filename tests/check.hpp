@@ -0,0 +1,16 @@
+#pragma once
+
+#include <iostream>
+
+// Tests are plain executables run by ctest: each failed check is reported and
+// makes main return nonzero
+inline int failures = 0;
+
+inline void check(bool ok, const char *what)
+{
+    if (!ok)
+    {
+        std::cerr << "FAILED: " << what << std::endl;
+        failures++;
+    }
+}
@@ -0,0 +1,53 @@
+#include "Output_stage.hpp"
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "check.hpp"
+
+// Gains above +6 dB: ReplayGain boosts quiet tracks by that much and more
+
+int main()
+{
+    double linear = std::pow(10.0, 9.0 / 20);
+    Fixed_gain gain = to_fixed_gain(linear);
+    check(std::abs(static_cast<double>(gain) / UNITY_GAIN - linear) < 1e-6, "+9 dB is representable");
+
+    // a quarter of full scale ends up at about 0.7, anything above 0.355 saturates
+    std::vector<int32_t> in(64);
+    for (size_t i = 0; i < in.size(); i++)
+    {
+        in[i] = (i % 4 == 3) ? INT32_MAX - static_cast<int32_t>(i) : (i % 2 ? -1 : 1) * (INT32_C(1) << 29);
+    }
+
+    for (Sample_format format : {Sample_format::S16, Sample_format::S24_3LE, Sample_format::S32, Sample_format::FLOAT})
+    {
+        std::vector<char> out(in.size() * bytes_per_sample(format));
+        std::vector<char> expected(out.size());
+        pack_samples(in.data(), in.size(), format, out.data(), gain);
+        pack_samples_reference(in.data(), in.size(), format, expected.data(), gain);
+        check(out == expected, format_name(format));
+    }
+
+    std::vector<int32_t> out(in.size());
+    pack_samples(in.data(), in.size(), Sample_format::S32, reinterpret_cast<char *>(out.data()), gain);
+    double boosted = std::ldexp(linear, 29);
+    check(std::abs(out[0] - boosted) <= 1 && std::abs(out[1] + boosted) <= 1, "quarter scale is boosted by +9 dB");
+    check(out[3] == INT32_MAX - 1 || out[3] == INT32_MAX, "full scale saturates");
+
+    // ramping up to the boost passes through every gain in between without wrapping
+    Gain_stage stage;
+    stage.set_target(gain);
+    std::vector<int32_t> ramp_in(1024, INT32_C(1) << 29);
+    std::vector<int32_t> ramp_out(ramp_in.size());
+    stage.pack(ramp_in.data(), ramp_in.size(), 1, Sample_format::S32, reinterpret_cast<char *>(ramp_out.data()));
+    bool rising = true;
+    for (size_t i = 1; i < ramp_out.size(); i++)
+    {
+        rising = rising && ramp_out[i] >= ramp_out[i - 1];
+    }
+    check(rising && std::abs(ramp_out.back() - boosted) <= 1, "ramp to +9 dB");
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,72 @@
+#include "File_server.hpp"
+#include "Prefetcher.hpp"
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "check.hpp"
+
+// Cancelling a play while its track is being fetched must leave the play queue and
+// the download directory as they were before the track was taken off the queue.
+
+namespace fs = std::filesystem;
+
+int main()
+{
+    fs::path base = fs::temp_directory_path() / ("prefetcher_test_" + std::to_string(getpid()));
+    fs::path root = base / "server";
+    fs::path save_dir = base / "save";
+    fs::create_directories(root);
+    fs::create_directories(save_dir);
+    {
+        std::ofstream out(root / "track.bin", std::ios::binary);
+        std::vector<char> data(4 * 1024 * 1024, 'x');
+        out.write(data.data(), data.size());
+    }
+
+    {
+        File_server server(root);
+        server.start();
+
+        // no prefetch, so the fetch happens on the foreground client like a cold start
+        Prefetcher prefetcher("127.0.0.1", server.get_port(), save_dir, 0, 0);
+        File_client client("127.0.0.1", server.get_port());
+        client.set_rate_limit(256 * 1024);
+        prefetcher.enqueue("track.bin");
+        prefetcher.enqueue("other.bin");
+
+        std::atomic<bool> cancel{false};
+        std::thread stopper([&]
+                            {
+                                std::this_thread::sleep_for(std::chrono::milliseconds(300));
+                                cancel = true; });
+        auto next = prefetcher.pop_next();
+        auto path = prefetcher.acquire(*next, client, &cancel);
+        if (!path && cancel)
+        {
+            prefetcher.requeue_front(*next);
+        }
+        stopper.join();
+
+        check(!path, "acquire gives up once cancelled");
+        check(prefetcher.queued_tracks() == std::deque<std::string>{"track.bin", "other.bin"},
+              "queue is unchanged after the cancel");
+        check(fs::is_empty(save_dir), "nothing is left in the save directory");
+
+        // and the track still plays when it comes up again
+        client.set_rate_limit(0);
+        next = prefetcher.pop_next();
+        path = prefetcher.acquire(*next, client);
+        check(path && fs::file_size(*path) == 4 * 1024 * 1024, "requeued track is fetched in full");
+        prefetcher.release(*next);
+        check(fs::is_empty(save_dir), "release removes the played track");
+
+        server.stop();
+    }
+
+    fs::remove_all(base);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,33 @@
+#include "Transfer_stats.hpp"
+
+#include "check.hpp"
+
+// Histogram percentiles are nearest rank, at bucket resolution
+
+int main()
+{
+    // buckets [0], [1], [2, 3], [4, 7], ... so these two land in different ones
+    Histogram two;
+    two.record(1);
+    two.record(100);
+    check(two.percentile(0.5) == 1, "p50 of two samples is the lower one");
+    check(two.percentile(0.51) == 100, "above half of two samples is the upper one");
+    check(two.percentile(0.99) == 100, "p99 of two samples is the upper one");
+    check(two.percentile(0.0) == 1, "p0 is the first sample");
+    check(two.percentile(1.0) == 100, "p100 is the maximum");
+
+    Histogram hundred;
+    for (uint64_t value = 1; value <= 100; value++)
+    {
+        hundred.record(value);
+    }
+    // the 50th sample is 50, in bucket [32, 63]; the 99th is 99, in [64, 127] capped at the max
+    check(hundred.percentile(0.5) == 63, "p50 of 1..100");
+    check(hundred.percentile(0.99) == 100, "p99 of 1..100");
+    // the 31st sample is 31, the last one in bucket [16, 31]
+    check(hundred.percentile(0.31) == 31, "p31 of 1..100");
+
+    check(Histogram().percentile(0.5) == 0, "empty histogram");
+
+    return failures == 0 ? 0 : 1;
+}
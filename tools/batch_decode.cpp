@@ -0,0 +1,127 @@
+#include "Batch_decoder.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Decodes FLAC files and directories of them on all cores, as an integrity check:
+//   batch_decode [--threads N] [--split-mib N] [--json] PATH...
+//
+// Directories are searched recursively for .flac files. Prints the time every file
+// took and the throughput of the whole batch, or the Batch_report as JSON.
+// --split-mib sets the size above which a file is decoded in parallel ranges,
+// 0 keeps every file in one piece. Exits with 1 if any file failed.
+
+namespace fs = std::filesystem;
+
+bool is_flac_path(const fs::path &path)
+{
+    std::string extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c)
+                   { return static_cast<char>(std::tolower(c)); });
+    return extension == ".flac";
+}
+
+void collect(const fs::path &path, std::vector<fs::path> &paths)
+{
+    std::error_code ec;
+    if (!fs::is_directory(path, ec))
+    {
+        paths.push_back(path);
+        return;
+    }
+    std::vector<fs::path> found;
+    for (fs::recursive_directory_iterator it(path, fs::directory_options::skip_permission_denied, ec), end; it != end; it.increment(ec))
+    {
+        if (ec)
+        {
+            break;
+        }
+        if (it->is_regular_file(ec) && is_flac_path(it->path()))
+        {
+            found.push_back(it->path());
+        }
+    }
+    std::sort(found.begin(), found.end());
+    paths.insert(paths.end(), found.begin(), found.end());
+}
+
+void print_report(const Batch_report &report)
+{
+    for (const Batch_file_result &file : report.files)
+    {
+        std::cout << std::fixed << std::setprecision(1) << std::setw(9) << file.decode_seconds * 1000 << " ms"
+                  << std::setw(9) << file.wall_seconds * 1000 << " ms wall" << std::setw(4) << file.ranges << "x  "
+                  << file.path.string();
+        if (!file.ok)
+        {
+            std::cout << "  FAILED: " << file.error;
+        }
+        std::cout << std::endl;
+    }
+
+    uint64_t steals = 0;
+    for (const auto &worker : report.workers)
+    {
+        steals += worker.steals;
+    }
+    uint64_t minutes = static_cast<uint64_t>(report.audio_seconds) / 60;
+    std::cout << "Decoded " << report.files.size() << " files, " << report.failed << " failed: "
+              << minutes / 60 << " h " << minutes % 60 << " min of audio in " << std::setprecision(2) << report.seconds << " s, "
+              << std::setprecision(0) << report.realtime_factor() << "x realtime, " << std::setprecision(1)
+              << report.mib_per_second() << " MiB/s" << std::endl;
+    std::cout << report.tasks << " tasks on " << report.workers.size() << " threads, " << steals << " stolen, "
+              << std::setprecision(0) << report.utilization() * 100 << "% busy" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    Batch_options options;
+    bool json = false;
+    std::vector<fs::path> paths;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc)
+        {
+            options.threads = std::stoul(argv[++i]);
+        }
+        else if (arg == "--split-mib" && i + 1 < argc)
+        {
+            options.split_bytes = static_cast<uint64_t>(std::stod(argv[++i]) * 1024 * 1024);
+        }
+        else if (arg == "--json")
+        {
+            json = true;
+        }
+        else if (!arg.starts_with("--"))
+        {
+            collect(arg, paths);
+        }
+        else
+        {
+            paths.clear();
+            break;
+        }
+    }
+    if (paths.empty())
+    {
+        std::cerr << "Usage: " << argv[0] << " [--threads N] [--split-mib N] [--json] PATH..." << std::endl;
+        return 1;
+    }
+
+    Batch_decoder decoder(options);
+    Batch_report report = decoder.run(paths);
+    if (json)
+    {
+        std::cout << report.to_json() << std::endl;
+    }
+    else
+    {
+        print_report(report);
+    }
+    return report.failed == 0 ? 0 : 1;
+}
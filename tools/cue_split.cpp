@@ -0,0 +1,165 @@
+#include "Flac.hpp"
+#include "Wav_writer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+// Splits a single-file album into one file per track of its embedded cue sheet.
+// Every track is decoded on its own stream, seeking straight to its first frame:
+//   cue_split <album.flac> <output dir> [--raw] [--threads N]
+
+namespace fs = std::filesystem;
+
+struct Split_result
+{
+    Virtual_track track;
+    bool success = false;
+    std::string error;
+    fs::path output;
+    double seconds{};
+};
+
+void split_track(const fs::path &album, const fs::path &output, const Virtual_track &track, bool raw)
+{
+    std::ifstream stream(album, std::ios::binary);
+    Flac flac(stream);
+    flac.initialize();
+    const Stream_info &info = flac.get_stream_info();
+
+    Wav_writer writer;
+    writer.open(output, info.sample_rate, info.channels, info.bits_per_sample, raw);
+
+    uint64_t position = flac.seek(track.start_sample);
+    while (position < track.end_sample && !flac.get_reader().eos())
+    {
+        flac.decode_frame();
+        const auto &buffer = flac.get_audio_buffer();
+        uint64_t frame_samples = buffer.size() / info.channels;
+
+        // trim the parts of the first and last frame that belong to the neighbours
+        uint64_t first = track.start_sample > position ? track.start_sample - position : 0;
+        uint64_t last = std::min<uint64_t>(frame_samples, track.end_sample - position);
+        if (first < last)
+        {
+            writer.write(buffer.data() + first * info.channels, (last - first) * info.channels);
+        }
+        position += frame_samples;
+    }
+    writer.close();
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " <album.flac> <output dir> [--raw] [--threads N]" << std::endl;
+        return 1;
+    }
+
+    fs::path album = argv[1];
+    fs::path output_dir = argv[2];
+    bool raw = false;
+    size_t thread_count = std::thread::hardware_concurrency();
+    for (int i = 3; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--raw")
+        {
+            raw = true;
+        }
+        else if (arg == "--threads" && i + 1 < argc)
+        {
+            thread_count = std::stoul(argv[++i]);
+        }
+    }
+
+    std::vector<Virtual_track> tracks;
+    try
+    {
+        std::ifstream stream(album, std::ios::binary);
+        if (!stream)
+        {
+            throw std::runtime_error("Cannot open " + album.string());
+        }
+        Flac flac(stream);
+        flac.initialize();
+        tracks = flac.read_virtual_tracks();
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    if (tracks.empty())
+    {
+        std::cerr << album << " has no cue sheet with audio tracks" << std::endl;
+        return 1;
+    }
+    fs::create_directories(output_dir);
+
+    // each track is an independent job: own stream, own decoder, own output file
+    std::vector<Split_result> results(tracks.size());
+    std::atomic<size_t> next_track{0};
+    auto worker = [&]()
+    {
+        for (size_t i = next_track++; i < tracks.size(); i = next_track++)
+        {
+            Split_result &result = results[i];
+            result.track = tracks[i];
+            std::ostringstream name;
+            name << album.stem().string() << " - " << std::setw(2) << std::setfill('0') << int(tracks[i].number)
+                 << (raw ? ".pcm" : ".wav");
+            result.output = output_dir / name.str();
+
+            auto start = std::chrono::steady_clock::now();
+            try
+            {
+                split_track(album, result.output, tracks[i], raw);
+                result.success = true;
+            }
+            catch (const std::exception &e)
+            {
+                result.error = e.what();
+            }
+            result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < std::clamp<size_t>(thread_count, 1, tracks.size()); i++)
+    {
+        threads.emplace_back(worker);
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int failures = 0;
+    for (const auto &result : results)
+    {
+        std::cout << "Track " << std::setw(2) << int(result.track.number) << "  samples "
+                  << result.track.start_sample << "-" << result.track.end_sample << "  ";
+        if (result.success)
+        {
+            std::cout << result.output.filename().string() << " (" << std::fixed << std::setprecision(2) << result.seconds << " s)\n";
+        }
+        else
+        {
+            std::cout << "failed: " << result.error << "\n";
+            failures++;
+        }
+    }
+    std::cout << "Split " << tracks.size() << " tracks in " << std::fixed << std::setprecision(2) << elapsed << " s" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
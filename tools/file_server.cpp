@@ -0,0 +1,65 @@
+#include "File_server.hpp"
+#include <csignal>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+
+// Serves a directory with the same protocols as the real file server:
+//   file_server <directory> [port] [--announce]
+
+volatile std::sig_atomic_t stop_requested = 0;
+
+void handle_signal(int)
+{
+    stop_requested = 1;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <directory> [port] [--announce]" << std::endl;
+        return 1;
+    }
+
+    std::string root = argv[1];
+    int port = 0;
+    bool announce = false;
+    for (int i = 2; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--announce")
+        {
+            announce = true;
+        }
+        else
+        {
+            port = std::stoi(arg);
+        }
+    }
+
+    std::signal(SIGINT, handle_signal);
+    std::signal(SIGTERM, handle_signal);
+
+    File_server server(root, port, announce);
+    try
+    {
+        server.start();
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    std::cout << "Serving " << root << " on port " << server.get_port()
+              << (announce ? " (announcing)" : "") << std::endl;
+
+    while (!stop_requested)
+    {
+        pause();
+    }
+
+    server.stop();
+    return 0;
+}
@@ -0,0 +1,141 @@
+#include "Flac.hpp"
+#include "Flac_encoder.hpp"
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+// Encodes a WAV file to FLAC on all cores:
+//   flac_encode [--level N] [--threads N] [--verify] IN.wav OUT.flac
+//
+// --level picks one of the presets of Encoder_settings::for_level, 0 fastest to 8
+// smallest. --verify decodes the result again and compares it with the WAV.
+// Prints the compression ratio and the encoding speed.
+
+// Decodes flac_path and compares every sample with the WAV; true if they match
+bool verify(const std::string &wav_path, const std::string &flac_path)
+{
+    Wav_reader wav(wav_path);
+    std::ifstream file(flac_path, std::ios::binary);
+    Flac flac(file);
+    flac.initialize();
+
+    // the decoder left-justifies its samples to 32 bits
+    uint32_t shift = 32 - flac.get_stream_info().bits_per_sample;
+    std::vector<int32_t> expected;
+    uint64_t samples = 0;
+    while (!flac.get_reader().eos())
+    {
+        flac.decode_frame();
+        const std::vector<buffer_sample_type> &decoded = flac.get_audio_buffer();
+        size_t frames = decoded.size() / flac.get_stream_info().channels;
+        if (wav.read(expected, frames) != frames)
+        {
+            std::cerr << "Decoded more samples than the WAV has" << std::endl;
+            return false;
+        }
+        for (size_t i = 0; i < decoded.size(); i++)
+        {
+            if (static_cast<int32_t>(decoded[i] >> shift) != expected[i])
+            {
+                std::cerr << "Mismatch at sample " << samples + i / flac.get_stream_info().channels << std::endl;
+                return false;
+            }
+        }
+        samples += frames;
+    }
+    if (wav.read(expected, 1) != 0)
+    {
+        std::cerr << "Decoded fewer samples than the WAV has" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    int level = Encoder_settings::DEFAULT_LEVEL;
+    size_t threads = 0;
+    bool check = false;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--level" && i + 1 < argc)
+        {
+            level = std::stoi(argv[++i]);
+        }
+        else if (arg == "--threads" && i + 1 < argc)
+        {
+            threads = std::stoul(argv[++i]);
+        }
+        else if (arg == "--verify")
+        {
+            check = true;
+        }
+        else if (!arg.starts_with("--"))
+        {
+            paths.push_back(arg);
+        }
+        else
+        {
+            paths.clear();
+            break;
+        }
+    }
+    if (paths.size() != 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " [--level N] [--threads N] [--verify] IN.wav OUT.flac" << std::endl;
+        return 1;
+    }
+
+    try
+    {
+        Wav_reader input(paths[0]);
+        std::ofstream out(paths[1], std::ios::binary);
+        if (!out)
+        {
+            std::cerr << "Cannot create " << paths[1] << std::endl;
+            return 1;
+        }
+
+        Flac_encoder encoder(Encoder_settings::for_level(level), threads);
+        Encode_report report = encoder.encode(input, [&](const uint8_t *data, size_t size)
+                                              { return static_cast<bool>(out.write(reinterpret_cast<const char *>(data), size)); });
+        // the header written up front didn't know the frame sizes yet
+        std::vector<uint8_t> header = Flac_encoder::stream_header(report.stream_info);
+        out.seekp(0);
+        out.write(reinterpret_cast<const char *>(header.data()), header.size());
+        out.close();
+
+        double audio_seconds = static_cast<double>(report.stream_info.total_samples) / report.stream_info.sample_rate;
+        std::cout << "Encoded " << report.frames << " frames at level " << level << ": " << std::fixed << std::setprecision(2)
+                  << report.ratio() * 100 << "% of " << report.input_bytes << " bytes in " << report.seconds << " s, "
+                  << std::setprecision(0) << audio_seconds / report.seconds << "x realtime, " << std::setprecision(1)
+                  << report.input_bytes / report.seconds / (1024 * 1024) << " MiB/s" << std::endl;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    if (check)
+    {
+        try
+        {
+            if (!verify(paths[0], paths[1]))
+            {
+                return 1;
+            }
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Verification failed: " << e.what() << std::endl;
+            return 1;
+        }
+        std::cout << "Verified" << std::endl;
+    }
+    return 0;
+}
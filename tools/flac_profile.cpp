@@ -0,0 +1,152 @@
+#include "Flac_profile.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Flac.hpp"
+
+// Decodes FLAC files and reports where the decoder spent its time:
+//   flac_profile [--table] FILE...
+//
+// Prints {"files":[{"path":...,"profile":...}],"total":...} with the Flac_profile
+// of every file. --table prints the files ranked by decode cost per sample instead,
+// with the encoder choices that dominate them.
+// Only built with -DFLAC_PROFILE=ON.
+
+struct File_profile
+{
+    std::string path;
+    std::unique_ptr<Flac_profile> profile;
+};
+
+bool profile_file(const std::string &path, Flac_profile &profile)
+{
+    std::ifstream stream(path, std::ios::binary);
+    if (!stream)
+    {
+        std::cerr << "Cannot open " << path << std::endl;
+        return false;
+    }
+    try
+    {
+        Flac flac(stream);
+        flac.initialize();
+        while (!flac.get_reader().eos())
+        {
+            flac.decode_frame();
+        }
+        profile.merge(flac.get_profile());
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << path << ": " << e.what() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// index of the largest count, "-" when all are zero
+template <size_t N>
+std::string most_common(const std::array<uint64_t, N> &counts)
+{
+    auto largest = std::max_element(counts.begin(), counts.end());
+    return *largest == 0 ? "-" : std::to_string(largest - counts.begin());
+}
+
+void print_table(std::vector<File_profile> &files)
+{
+    auto cost = [](const Flac_profile &profile)
+    {
+        return profile.samples == 0 ? 0 : static_cast<double>(profile.frame_ns) / profile.samples;
+    };
+    std::sort(files.begin(), files.end(), [&](const File_profile &a, const File_profile &b)
+              { return cost(*a.profile) > cost(*b.profile); });
+
+    std::cout << std::setw(10) << "ns/sample" << std::setw(10) << "residual" << std::setw(8) << "pred"
+              << std::setw(8) << "decor" << std::setw(8) << "lpc" << std::setw(8) << "order"
+              << std::setw(8) << "rice" << std::setw(10) << "partition" << "  file" << std::endl;
+    for (const File_profile &file : files)
+    {
+        const Flac_profile &profile = *file.profile;
+        double frame_ns = std::max<double>(profile.frame_ns, 1);
+        uint64_t subframes = 0;
+        for (const auto &stats : profile.subframes)
+        {
+            subframes += stats.count;
+        }
+        double lpc_share = subframes == 0 ? 0 : static_cast<double>(profile.subframes[Flac_profile::LPC].count) / subframes;
+
+        std::cout << std::fixed << std::setprecision(2) << std::setw(10) << cost(profile) << std::setprecision(0)
+                  << std::setw(9) << 100 * profile.residual_ns / frame_ns << "%"
+                  << std::setw(7) << 100 * profile.prediction_ns / frame_ns << "%"
+                  << std::setw(7) << 100 * profile.decorrelation_ns / frame_ns << "%"
+                  << std::setw(7) << 100 * lpc_share << "%"
+                  << std::setw(8) << most_common(profile.lpc_orders)
+                  << std::setw(8) << most_common(profile.rice_parameters)
+                  << std::setw(10) << most_common(profile.partition_orders) << "  " << file.path << std::endl;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    bool table = false;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--table")
+        {
+            table = true;
+        }
+        else if (!arg.starts_with("--"))
+        {
+            paths.push_back(arg);
+        }
+        else
+        {
+            paths.clear();
+            break;
+        }
+    }
+    if (paths.empty())
+    {
+        std::cerr << "Usage: " << argv[0] << " [--table] FILE..." << std::endl;
+        return 1;
+    }
+
+    std::vector<File_profile> files;
+    Flac_profile total;
+    bool ok = true;
+    for (const std::string &path : paths)
+    {
+        auto profile = std::make_unique<Flac_profile>();
+        if (!profile_file(path, *profile))
+        {
+            ok = false;
+            continue;
+        }
+        total.merge(*profile);
+        files.push_back({path, std::move(profile)});
+    }
+
+    if (table)
+    {
+        print_table(files);
+    }
+    else
+    {
+        std::cout << "{\"files\":[";
+        for (size_t i = 0; i < files.size(); i++)
+        {
+            std::cout << (i == 0 ? "" : ",") << "{\"path\":" << std::quoted(files[i].path)
+                      << ",\"profile\":" << files[i].profile->to_json() << "}";
+        }
+        std::cout << "],\"total\":" << total.to_json() << "}" << std::endl;
+    }
+    return ok ? 0 : 1;
+}
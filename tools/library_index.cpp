@@ -0,0 +1,139 @@
+#include "Library_scanner.hpp"
+#include "Tag_index.hpp"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+// Builds and queries a tag index of a local FLAC library:
+//   library_index scan <library dir> <index file> [threads]
+//   library_index info <index file>
+//   library_index query <index file> NAME=value
+
+namespace fs = std::filesystem;
+
+void print_usage(const char *program)
+{
+    std::cerr << "Usage: " << program << " scan <library dir> <index file> [threads]\n"
+              << "       " << program << " info <index file>\n"
+              << "       " << program << " query <index file> NAME=value" << std::endl;
+}
+
+void open_timed(Tag_index &index, const fs::path &path)
+{
+    auto start = std::chrono::steady_clock::now();
+    index.open(path);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Loaded " << index.size() << " tracks in " << std::fixed << std::setprecision(2) << ms << " ms" << std::endl;
+}
+
+int scan(const fs::path &library, const fs::path &index_path, size_t threads)
+{
+    // unchanged files are taken from the existing index
+    Tag_index previous;
+    if (fs::exists(index_path))
+    {
+        try
+        {
+            previous.open(index_path);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << e.what() << ", rebuilding it" << std::endl;
+        }
+    }
+
+    Library_scanner scanner(library, threads);
+    Scan_report report;
+    std::vector<Indexed_track> tracks = scanner.scan(report, previous.is_open() ? &previous : nullptr);
+    Tag_index::write(index_path, std::move(tracks));
+
+    for (const auto &[path, error] : report.errors)
+    {
+        std::cerr << path << ": " << error << std::endl;
+    }
+    std::cout << "Scanned " << report.files << " files in " << std::fixed << std::setprecision(2) << report.seconds << " s: "
+              << report.parsed << " read, " << report.reused << " unchanged, " << report.failed << " failed, "
+              << report.bytes_read / 1024 << " KiB read" << std::endl;
+    return 0;
+}
+
+int info(const fs::path &index_path)
+{
+    Tag_index index;
+    open_timed(index, index_path);
+
+    double total_duration = 0;
+    uint64_t total_size = 0;
+    for (size_t i = 0; i < index.size(); i++)
+    {
+        Tag_index::Track track = index.track(i);
+        total_duration += track.duration();
+        total_size += track.file_size;
+    }
+    uint64_t minutes = static_cast<uint64_t>(total_duration) / 60;
+    std::cout << "Total duration: " << minutes / 60 << " h " << minutes % 60 << " min, "
+              << total_size / (1024 * 1024) << " MiB of audio" << std::endl;
+    return 0;
+}
+
+int query(const fs::path &index_path, const std::string &filter)
+{
+    size_t delimiter_pos = filter.find('=');
+    if (delimiter_pos == std::string::npos)
+    {
+        std::cerr << "Expected NAME=value, got " << filter << std::endl;
+        return 1;
+    }
+
+    Tag_index index;
+    open_timed(index, index_path);
+
+    for (size_t i : index.find(filter.substr(0, delimiter_pos), filter.substr(delimiter_pos + 1)))
+    {
+        Tag_index::Track track = index.track(i);
+        int seconds = static_cast<int>(track.duration());
+        std::cout << track.path << "  [" << seconds / 60 << ":" << std::setw(2) << std::setfill('0') << seconds % 60 << std::setfill(' ') << "]";
+        if (auto title = index.tag(i, "TITLE"))
+        {
+            std::cout << "  " << *title;
+        }
+        std::cout << std::endl;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    std::string command = argv[1];
+    try
+    {
+        if (command == "scan" && argc >= 4)
+        {
+            return scan(argv[2], argv[3], argc >= 5 ? std::stoul(argv[4]) : 0);
+        }
+        if (command == "info")
+        {
+            return info(argv[2]);
+        }
+        if (command == "query" && argc >= 4)
+        {
+            return query(argv[2], argv[3]);
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    print_usage(argv[0]);
+    return 1;
+}
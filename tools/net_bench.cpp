@@ -0,0 +1,336 @@
+#include "Async_file_client.hpp"
+#include "File_server.hpp"
+#include "Server_discovery.hpp"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+// Drives a file server over loopback and reports connection setup cost, per-command
+// latency and upload/download throughput for several file and buffer sizes.
+//   net_bench [--server <ip>:<port>] [--quick] [--iterations <n>]
+// Without --server an in-process File_server is started on a temporary directory.
+// Every file the benchmark touches on the server is named net_bench_*.
+
+namespace fs = std::filesystem;
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+    std::string ip = "127.0.0.1";
+    int port = 0;
+    bool quick = false;
+    int iterations = 100;
+};
+
+double elapsed_us(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+}
+
+double percentile(std::vector<double> values, double fraction)
+{
+    if (values.empty())
+    {
+        return 0.0;
+    }
+    std::sort(values.begin(), values.end());
+    size_t index = std::min(values.size() - 1, static_cast<size_t>(fraction * values.size()));
+    return values[index];
+}
+
+const char *mode_name(Protocol_mode mode)
+{
+    return mode == Protocol_mode::FRAMED ? "framed" : "legacy";
+}
+
+std::string size_name(size_t bytes)
+{
+    if (bytes >= 1024 * 1024)
+    {
+        return std::to_string(bytes / (1024 * 1024)) + "M";
+    }
+    return std::to_string(bytes / 1024) + "K";
+}
+
+void print_latency_row(const std::string &label, const std::vector<double> &samples)
+{
+    std::cout << "  " << std::left << std::setw(28) << label << std::right << std::fixed << std::setprecision(1)
+              << std::setw(10) << percentile(samples, 0.5)
+              << std::setw(10) << percentile(samples, 0.99)
+              << std::setw(10) << percentile(samples, 1.0) << std::endl;
+}
+
+void print_latency_header(const std::string &title)
+{
+    std::cout << "\n"
+              << title << " (microseconds)\n"
+              << "  " << std::left << std::setw(28) << "" << std::right
+              << std::setw(10) << "p50" << std::setw(10) << "p99" << std::setw(10) << "max" << std::endl;
+}
+
+void expect_success(Transfer_result result, const std::string &what)
+{
+    if (!result.success)
+    {
+        throw std::runtime_error(what + " failed: " + result.error);
+    }
+}
+
+fs::path make_payload(const fs::path &dir, const std::string &name, size_t size)
+{
+    std::mt19937_64 random(size);
+    std::vector<uint64_t> words((size + 7) / 8);
+    for (auto &word : words)
+    {
+        word = random();
+    }
+
+    fs::path path = dir / name;
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char *>(words.data()), size);
+    return path;
+}
+
+void bench_connect(const Options &options)
+{
+    print_latency_header("Connection setup");
+
+    std::vector<double> samples;
+    for (int i = 0; i < options.iterations; i++)
+    {
+        if (auto rtt = Server_discovery::probe({options.ip, options.port}, std::chrono::milliseconds(500)))
+        {
+            samples.push_back(std::chrono::duration<double, std::micro>(*rtt).count());
+        }
+    }
+    print_latency_row("tcp connect", samples);
+
+    // connect + protocol negotiation + one LIST on a fresh client
+    for (Protocol_mode mode : {Protocol_mode::LEGACY, Protocol_mode::FRAMED})
+    {
+        samples.clear();
+        for (int i = 0; i < std::max(1, options.iterations / 5); i++)
+        {
+            Async_file_client client(options.ip, options.port);
+            client.set_protocol_mode(mode);
+            auto start = Clock::now();
+            expect_success(client.list_files().get(), "LIST");
+            samples.push_back(elapsed_us(start));
+        }
+        print_latency_row(std::string("first LIST, ") + mode_name(mode), samples);
+    }
+}
+
+void bench_latency(const Options &options, const std::string &small_file, const fs::path &download_dir)
+{
+    print_latency_header("Per-command latency on an open connection");
+
+    for (Protocol_mode mode : {Protocol_mode::LEGACY, Protocol_mode::FRAMED})
+    {
+        Async_file_client client(options.ip, options.port);
+        client.set_protocol_mode(mode);
+        expect_success(client.list_files().get(), "LIST");
+
+        std::vector<double> list_samples;
+        std::vector<double> get_samples;
+        for (int i = 0; i < options.iterations; i++)
+        {
+            auto start = Clock::now();
+            expect_success(client.list_files().get(), "LIST");
+            list_samples.push_back(elapsed_us(start));
+
+            start = Clock::now();
+            expect_success(client.download_file(small_file, download_dir.string()).get(), "GET");
+            get_samples.push_back(elapsed_us(start));
+        }
+        print_latency_row(std::string("LIST, ") + mode_name(mode), list_samples);
+        print_latency_row(std::string("GET 1K, ") + mode_name(mode), get_samples);
+    }
+}
+
+void bench_throughput(const Options &options, const std::vector<std::pair<size_t, fs::path>> &payloads,
+                      const std::vector<size_t> &buffer_sizes, const fs::path &download_dir)
+{
+    std::cout << "\nThroughput (MiB/s)\n"
+              << "  " << std::left << std::setw(8) << "mode" << std::setw(8) << "file" << std::setw(8) << "buffer"
+              << std::right << std::setw(12) << "upload" << std::setw(12) << "download" << std::endl;
+
+    size_t volume = options.quick ? 16 * 1024 * 1024 : 128 * 1024 * 1024;
+    for (Protocol_mode mode : {Protocol_mode::LEGACY, Protocol_mode::FRAMED})
+    {
+        for (const auto &[size, path] : payloads)
+        {
+            // repeat small files so every cell moves a comparable amount of data
+            size_t repeats = std::clamp<size_t>(volume / size, 1, options.iterations);
+            std::string name = path.filename().string();
+
+            for (size_t buffer_size : buffer_sizes)
+            {
+                Async_file_client client(options.ip, options.port);
+                client.set_protocol_mode(mode);
+                client.set_buffer_size(buffer_size);
+                expect_success(client.list_files().get(), "LIST");
+
+                auto start = Clock::now();
+                for (size_t i = 0; i < repeats; i++)
+                {
+                    expect_success(client.upload_file(path.string()).get(), "PUT " + name);
+                }
+                double upload_seconds = elapsed_us(start) / 1e6;
+
+                start = Clock::now();
+                for (size_t i = 0; i < repeats; i++)
+                {
+                    expect_success(client.download_file(name, download_dir.string()).get(), "GET " + name);
+                }
+                double download_seconds = elapsed_us(start) / 1e6;
+
+                double mebibytes = static_cast<double>(size) * repeats / (1024 * 1024);
+                std::cout << "  " << std::left << std::setw(8) << mode_name(mode) << std::setw(8) << size_name(size)
+                          << std::setw(8) << size_name(buffer_size) << std::right << std::fixed << std::setprecision(1)
+                          << std::setw(12) << mebibytes / upload_seconds
+                          << std::setw(12) << mebibytes / download_seconds << std::endl;
+            }
+        }
+    }
+}
+
+void bench_batch(const Options &options, const std::vector<std::string> &names, const fs::path &download_dir)
+{
+    std::cout << "\nBatch of " << names.size() << " small downloads (milliseconds)\n"
+              << "  " << std::left << std::setw(8) << "mode" << std::right << std::setw(12) << "sequential"
+              << std::setw(12) << "pipelined" << std::endl;
+
+    for (Protocol_mode mode : {Protocol_mode::LEGACY, Protocol_mode::FRAMED})
+    {
+        Async_file_client client(options.ip, options.port);
+        client.set_protocol_mode(mode);
+        expect_success(client.list_files().get(), "LIST");
+
+        auto start = Clock::now();
+        for (const auto &name : names)
+        {
+            expect_success(client.download_file(name, download_dir.string()).get(), "GET " + name);
+        }
+        double sequential_ms = elapsed_us(start) / 1000;
+
+        start = Clock::now();
+        for (auto &result : client.download_files(names, download_dir.string()))
+        {
+            expect_success(result.get(), "batch GET");
+        }
+        double pipelined_ms = elapsed_us(start) / 1000;
+
+        std::cout << "  " << std::left << std::setw(8) << mode_name(mode) << std::right << std::fixed
+                  << std::setprecision(2) << std::setw(12) << sequential_ms << std::setw(12) << pipelined_ms << std::endl;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--server" && i + 1 < argc)
+        {
+            std::string endpoint = argv[++i];
+            size_t colon = endpoint.rfind(':');
+            if (colon == std::string::npos)
+            {
+                std::cerr << "Expected <ip>:<port>, got " << endpoint << std::endl;
+                return 1;
+            }
+            options.ip = endpoint.substr(0, colon);
+            options.port = std::stoi(endpoint.substr(colon + 1));
+        }
+        else if (arg == "--quick")
+        {
+            options.quick = true;
+            options.iterations = 20;
+        }
+        else if (arg == "--iterations" && i + 1 < argc)
+        {
+            options.iterations = std::max(1, std::stoi(argv[++i]));
+        }
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--server <ip>:<port>] [--quick] [--iterations <n>]" << std::endl;
+            return 1;
+        }
+    }
+
+    fs::path work_dir = fs::temp_directory_path() / ("net_bench_" + std::to_string(getpid()));
+    fs::path source_dir = work_dir / "source";
+    fs::path download_dir = work_dir / "download";
+    fs::create_directories(source_dir);
+    fs::create_directories(download_dir);
+
+    std::optional<File_server> server;
+    if (options.port == 0)
+    {
+        fs::create_directories(work_dir / "served");
+        server.emplace(work_dir / "served");
+        server->start();
+        options.port = server->get_port();
+    }
+    std::cout << "Benchmarking " << options.ip << ":" << options.port
+              << (server ? " (in-process server)" : "") << std::endl;
+
+    int status = 0;
+    try
+    {
+        std::vector<size_t> file_sizes = {64 * 1024, 1024 * 1024, 16 * 1024 * 1024};
+        std::vector<size_t> buffer_sizes = {4 * 1024, 8 * 1024, 64 * 1024, 256 * 1024};
+        if (options.quick)
+        {
+            file_sizes = {64 * 1024, 1024 * 1024};
+            buffer_sizes = {8 * 1024, 64 * 1024};
+        }
+
+        std::vector<std::pair<size_t, fs::path>> payloads;
+        for (size_t size : file_sizes)
+        {
+            payloads.emplace_back(size, make_payload(source_dir, "net_bench_" + size_name(size) + ".bin", size));
+        }
+
+        // small files are uploaded once up front for the latency and batch runs
+        std::vector<std::string> small_names;
+        {
+            Async_file_client client(options.ip, options.port);
+            for (int i = 0; i < 32; i++)
+            {
+                std::string name = "net_bench_small_" + std::to_string(i) + ".bin";
+                expect_success(client.upload_file(make_payload(source_dir, name, 1024).string()).get(), "PUT " + name);
+                small_names.push_back(name);
+            }
+        }
+
+        bench_connect(options);
+        bench_latency(options, small_names.front(), download_dir);
+        bench_throughput(options, payloads, buffer_sizes, download_dir);
+        bench_batch(options, small_names, download_dir);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        status = 1;
+    }
+
+    if (server)
+    {
+        server->stop();
+    }
+    std::error_code ec;
+    fs::remove_all(work_dir, ec);
+    return status;
+}
@@ -0,0 +1,171 @@
+#include "Output_stage.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Flac.hpp"
+
+// Measures the output stage on its own:
+//   output_bench [--seconds N] [--chunk FRAMES] [--flac FILE]
+//
+// Every pack kernel runs against the plain C++ reference, whose output it has to
+// match byte for byte, at unity gain, at a cut and at a boost that saturates. The
+// channel mixer folds 5.1 and 7.1 down to stereo.
+// Costs are per channel-second of 44.1 kHz input. With --flac the file is decoded
+// too, to put the conversion next to the decoder it follows.
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+    double seconds = 10;
+    size_t chunk = 4096;
+    std::string flac_path;
+};
+
+const uint32_t BENCH_RATE = 44100;
+
+std::vector<int32_t> make_input(int channels, size_t frames)
+{
+    std::mt19937 random(channels);
+    std::uniform_int_distribution<int32_t> sample;
+    std::vector<int32_t> samples(frames * channels);
+    for (auto &value : samples)
+    {
+        value = sample(random);
+    }
+    return samples;
+}
+
+template <typename Function>
+double time_chunks(size_t frames, size_t chunk, Function run)
+{
+    auto start = Clock::now();
+    for (size_t offset = 0; offset < frames; offset += chunk)
+    {
+        run(offset, std::min(chunk, frames - offset));
+    }
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// ms per channel-second to decode the file, or 0 if it can't be read
+double decode_cost(const std::string &path)
+{
+    std::ifstream stream(path, std::ios::binary);
+    if (!stream)
+    {
+        std::cerr << "Cannot open " << path << std::endl;
+        return 0;
+    }
+    Flac flac(stream);
+    flac.initialize();
+    auto start = Clock::now();
+    while (!flac.get_reader().eos())
+    {
+        flac.decode_frame();
+    }
+    double elapsed_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    const Stream_info &info = flac.get_stream_info();
+    double channel_seconds = static_cast<double>(flac.get_sample_count()) * info.channels / info.sample_rate;
+    return channel_seconds == 0 ? 0 : elapsed_ms / channel_seconds;
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--seconds" && i + 1 < argc)
+        {
+            options.seconds = std::stod(argv[++i]);
+        }
+        else if (arg == "--chunk" && i + 1 < argc)
+        {
+            options.chunk = std::stoul(argv[++i]);
+        }
+        else if (arg == "--flac" && i + 1 < argc)
+        {
+            options.flac_path = argv[++i];
+        }
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--seconds N] [--chunk FRAMES] [--flac FILE]" << std::endl;
+            return 1;
+        }
+    }
+
+    const int channels = 2;
+    size_t frames = static_cast<size_t>(options.seconds * BENCH_RATE);
+    double channel_seconds = options.seconds * channels;
+    std::vector<int32_t> input = make_input(channels, frames);
+    bool all_match = true;
+    double slowest_ms = 0;
+
+    std::cout << std::left << std::setw(12) << "format" << std::setw(8) << "gain" << std::setw(10) << "kernel" << std::right
+              << std::setw(14) << "ms/ch-sec" << std::setw(14) << "reference" << std::setw(10) << "speedup"
+              << std::setw(8) << "match" << std::endl;
+    for (Sample_format format : {Sample_format::S16, Sample_format::S24_3LE, Sample_format::S32, Sample_format::FLOAT})
+    {
+        for (double gain_db : {0.0, -6.0, 6.0})
+        {
+            Fixed_gain gain = gain_db == 0 ? UNITY_GAIN : to_fixed_gain(std::pow(10.0, gain_db / 20));
+            size_t sample_bytes = bytes_per_sample(format);
+            std::vector<char> output(input.size() * sample_bytes);
+            std::vector<char> expected(input.size() * sample_bytes);
+
+            double kernel_ms = time_chunks(frames, options.chunk, [&](size_t offset, size_t count)
+                                           { pack_samples(input.data() + offset * channels, count * channels, format,
+                                                          output.data() + offset * channels * sample_bytes, gain); });
+            double reference_ms = time_chunks(frames, options.chunk, [&](size_t offset, size_t count)
+                                              { pack_samples_reference(input.data() + offset * channels, count * channels, format,
+                                                                       expected.data() + offset * channels * sample_bytes, gain); });
+            bool match = output == expected;
+            all_match = all_match && match;
+            slowest_ms = std::max(slowest_ms, kernel_ms / channel_seconds);
+
+            // built piecewise, a chain of + on temporaries trips GCC's -Wrestrict at -O3
+            std::string gain_label = gain_db > 0 ? "+" : "";
+            gain_label += std::to_string(int(gain_db));
+            gain_label += " dB";
+            std::cout << std::left << std::setw(12) << format_name(format) << std::setw(8) << gain_label
+                      << std::setw(10) << pack_kernel_name(format, gain != UNITY_GAIN)
+                      << std::right << std::fixed << std::setprecision(4)
+                      << std::setw(14) << kernel_ms / channel_seconds << std::setw(14) << reference_ms / channel_seconds
+                      << std::setprecision(1) << std::setw(9) << reference_ms / kernel_ms << "x"
+                      << std::setw(8) << (match ? "yes" : "NO") << std::endl;
+        }
+    }
+
+    std::cout << "\n"
+              << std::left << std::setw(22) << "mix" << std::right << std::setw(14) << "ms/ch-sec" << std::endl;
+    for (uint8_t in_channels : {6, 8})
+    {
+        std::vector<int32_t> surround = make_input(in_channels, frames);
+        Channel_mixer mixer(in_channels, 2);
+        std::vector<int32_t> mixed;
+        double mix_ms = time_chunks(frames, options.chunk, [&](size_t offset, size_t count)
+                                    { mixer.process(surround.data() + offset * in_channels, count, mixed); });
+        // per channel-second of the input, which is what the decoder produced
+        std::cout << std::left << std::setw(22) << (std::to_string(in_channels) + " ch -> stereo") << std::right
+                  << std::fixed << std::setprecision(4) << std::setw(14) << mix_ms / (options.seconds * in_channels) << std::endl;
+    }
+
+    if (!options.flac_path.empty())
+    {
+        double decode_ms = decode_cost(options.flac_path);
+        if (decode_ms > 0)
+        {
+            std::cout << "\ndecode " << std::fixed << std::setprecision(4) << decode_ms << " ms/ch-sec, slowest pack "
+                      << std::setprecision(2) << 100 * slowest_ms / decode_ms << "% of it" << std::endl;
+        }
+    }
+    return all_match ? 0 : 1;
+}
@@ -0,0 +1,128 @@
+#include "Playback_engine.hpp"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Plays FLAC files back to back through the playback engine without a sound card:
+//   playback_bench [--sink SPEC] [--quality fast|balanced|best] [--json] FILE...
+//
+// SPEC is anything make_headless_sink() takes: "null", the default, runs the
+// pipeline as fast as it goes; "paced" plays in real time, so waits and xruns show;
+// "@RATE" on either makes the resampler part of the run; "file:out.wav" keeps what
+// would have been played. Prints the time every stage took and the speed against
+// real time, with --json the engine's stats. Exits with 1 when nothing could be played.
+
+using Clock = std::chrono::steady_clock;
+
+const char *stage_label(Playback_stage stage)
+{
+    switch (stage)
+    {
+    case Playback_stage::FETCH:
+        return "fetch";
+    case Playback_stage::OPEN:
+        return "open";
+    case Playback_stage::DECODE:
+        return "decode";
+    case Playback_stage::CONVERT:
+        return "convert";
+    case Playback_stage::OUTPUT:
+        return "output";
+    case Playback_stage::WAIT:
+        return "wait";
+    }
+    return "";
+}
+
+int main(int argc, char *argv[])
+{
+    std::string sink_spec = "null";
+    Resampler_quality quality = Resampler_quality::BALANCED;
+    bool json = false;
+    std::vector<std::string> paths;
+    bool usage = false;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--sink" && i + 1 < argc)
+        {
+            sink_spec = argv[++i];
+        }
+        else if (arg == "--quality" && i + 1 < argc)
+        {
+            std::string name = argv[++i];
+            quality = name == "fast" ? Resampler_quality::FAST : name == "best" ? Resampler_quality::BEST : Resampler_quality::BALANCED;
+        }
+        else if (arg == "--json")
+        {
+            json = true;
+        }
+        else if (!arg.starts_with("--"))
+        {
+            paths.push_back(arg);
+        }
+        else
+        {
+            usage = true;
+        }
+    }
+    std::unique_ptr<Audio_sink> sink = make_headless_sink(sink_spec);
+    if (usage || paths.empty() || !sink)
+    {
+        std::cerr << "Usage: " << argv[0] << " [--sink null|paced[@RATE]|file:PATH] [--quality fast|balanced|best] [--json] FILE..." << std::endl;
+        return 1;
+    }
+
+    std::string sink_name = sink->name();
+    Playback_engine engine(std::move(sink), quality);
+    Playback_controls controls;
+    size_t next = 1;
+    size_t finished = 0;
+    auto next_item = [&](const std::atomic<bool> *) -> std::optional<Playback_item>
+    {
+        if (next >= paths.size())
+        {
+            return std::nullopt;
+        }
+        std::string path = paths[next++];
+        return Playback_item{path, path};
+    };
+
+    auto start = Clock::now();
+    try
+    {
+        engine.play(Playback_item{paths[0], paths[0]}, next_item, [&](const Playback_item &)
+                    { finished++; }, controls);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << paths[0] << ": " << e.what() << std::endl;
+        return 1;
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    const Playback_stats &stats = engine.stats();
+    std::cout << "\n"
+              << finished << " files to " << sink_name << ": " << std::fixed << std::setprecision(2) << stats.played_seconds()
+              << " s of audio in " << seconds << " s, " << std::setprecision(1) << stats.played_seconds() / seconds
+              << "x realtime, " << stats.xruns() << " xruns\n\n"
+              << std::left << std::setw(10) << "stage" << std::right << std::setw(12) << "total ms" << std::setw(10) << "count"
+              << std::setw(12) << "p50 us" << std::setw(12) << "p99 us" << std::setw(12) << "max us" << "\n";
+    for (Playback_stage stage : {Playback_stage::FETCH, Playback_stage::OPEN, Playback_stage::DECODE, Playback_stage::CONVERT,
+                                 Playback_stage::OUTPUT, Playback_stage::WAIT})
+    {
+        const Histogram &histogram = stats.stage_us(stage);
+        std::cout << std::left << std::setw(10) << stage_label(stage) << std::right << std::setw(12) << std::setprecision(1)
+                  << histogram.sum() / 1000.0 << std::setw(10) << histogram.count() << std::setw(12) << histogram.percentile(0.5)
+                  << std::setw(12) << histogram.percentile(0.99) << std::setw(12) << histogram.max() << "\n";
+    }
+    if (json)
+    {
+        std::cout << stats.to_json() << "\n";
+    }
+    std::cout << std::flush;
+    return finished > 0 ? 0 : 1;
+}